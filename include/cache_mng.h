@@ -29,24 +29,94 @@ typedef void (*cache_mng_on_retrieve_file_buf_cb) (unsigned char *buf, size_t si
 void cache_mng_retrieve_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
     cache_mng_on_retrieve_file_buf_cb on_retrieve_file_buf_cb, void *ctx);
 
+// return file descriptor of the cached file if it contains the whole range, -1 otherwise
+// -1 is returned as well if stored data of the file isn't written yet, see cache_mng_get_file_fd_async ()
+// the caller must close returned descriptor
+int cache_mng_get_file_fd (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+
+// file descriptor is passed to the callback when stored data of the file is written, -1 if the range isn't cached
+// the callback must close the descriptor
+typedef void (*cache_mng_on_file_fd_cb) (int fd, void *ctx);
+void cache_mng_get_file_fd_async (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
+    cache_mng_on_file_fd_cb on_file_fd_cb, void *ctx);
+
+// disk I/O is done by worker threads ("filesystem.cache_io_threads" > 0)
+// stored data is written later then, reads from the descriptor block the event loop
+gboolean cache_mng_is_async (CacheMng *cmng);
+
+// copy [off, off + size) from the memory tier, without system calls
+// return FALSE if any part of the range isn't in memory
+gboolean cache_mng_read_mem (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf);
+
 // store file buffer into local storage
 // if success == TRUE then "buf" successfuly stored on disc
 typedef void (*cache_mng_on_store_file_buf_cb) (gboolean success, void *ctx);
 void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
         cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx);
 
+// store data written by the client, it's marked as dirty if the file is staged
+void cache_mng_write_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
+        cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx);
+
+// write-back staging: staged file is not evicted, dirty ranges are not overwritten by cache_mng_store_file_buf ()
+void cache_mng_stage_file (CacheMng *cmng, fuse_ino_t ino);
+void cache_mng_unstage_file (CacheMng *cmng, fuse_ino_t ino);
+gboolean cache_mng_is_dirty (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+// data stored before is written by the client, it's marked as dirty without writing it again
+void cache_mng_mark_dirty (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+
 // removes file from local storage
 void cache_mng_remove_file (CacheMng *cmng, fuse_ino_t ino);
 
+// cached data belongs to another version of the object: remove it,
+// only the data written by the client is kept if the file is staged
+void cache_mng_discard_clean (CacheMng *cmng, fuse_ino_t ino);
+
+// move cached data to the new inode, return FALSE if the file isn't cached or is staged
+gboolean cache_mng_rename_file (CacheMng *cmng, fuse_ino_t ino, fuse_ino_t new_ino);
+
+// persistent cache: the inode is the object with the path and ETag,
+// cached data of the object is kept between mounts, data of previous mounts is attached to the inode
+void cache_mng_attach_file (CacheMng *cmng, fuse_ino_t ino, const gchar *path, const gchar *etag);
+
 // get current size of cache
 guint64 cache_mng_size (CacheMng *cmng);
+// get maximum size of cache
+guint64 cache_mng_get_max_size (CacheMng *cmng);
+
+// data is stored, accounted and evicted by blocks of this size
+guint64 cache_mng_get_block_size (CacheMng *cmng);
+
+// call on_missing_cb for every run of consecutive blocks of [off, off + size), which data isn't cached
+// runs are aligned to blocks, so only the missing blocks of a partially cached range are fetched
+typedef void (*cache_mng_on_missing_block_cb) (guint64 off, guint64 size, void *ctx);
+void cache_mng_foreach_missing_block (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
+    cache_mng_on_missing_block_cb on_missing_cb, void *ctx);
 
 // return total size of cached file
 guint64 cache_mng_get_file_length (CacheMng *cmng, fuse_ino_t ino);
 
+// check if the whole range is stored in local cache
+gboolean cache_mng_file_contains (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off);
+
 // return and update local copy of AWS ETag for this file
 const char *cache_mng_get_etag(CacheMng *cmng, fuse_ino_t ino);
 gboolean cache_mng_update_etag(CacheMng *cmng, fuse_ino_t ino, const char *etag);
 
+// single-flight downloads: only one request per block is sent to the server, overlapping ranges share it
+// return TRUE if no block of [off, off + size) is being downloaded: caller must download it and call cache_mng_fetch_done ()
+// return FALSE if one of the blocks is being downloaded, on_fetched_cb (if set) is called when it's done
+typedef void (*cache_mng_on_fetched_cb) (gboolean success, void *ctx);
+gboolean cache_mng_fetch_start (CacheMng *cmng, fuse_ino_t ino, guint64 off, guint64 size,
+    cache_mng_on_fetched_cb on_fetched_cb, void *ctx);
+// off is the start of the range passed to cache_mng_fetch_start ()
+void cache_mng_fetch_done (CacheMng *cmng, fuse_ino_t ino, guint64 off, gboolean success);
+// a part of the range is stored, waiters are called to check if their data is available
+// waiters must call cache_mng_fetch_start () again if the data is still missing
+void cache_mng_fetch_progress (CacheMng *cmng, fuse_ino_t ino, guint64 off);
+void cache_mng_get_fetch_stats (CacheMng *cmng, guint32 *pending_num, guint64 *shared_num);
+
+// cache_hits are hits of the disk tier, hits of the memory tier are counted by cache_mng_get_mem_stats ()
 void cache_mng_get_stats (CacheMng *cmng, guint32 *entries_num, guint64 *total_size, guint64 *cache_hits, guint64 *cache_miss);
+void cache_mng_get_mem_stats (CacheMng *cmng, guint32 *blocks_num, guint64 *size, guint64 *max_size, guint64 *mem_hits);
 #endif
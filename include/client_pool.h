@@ -45,6 +45,8 @@ void client_pool_destroy (ClientPool *pool);
 typedef void (*ClientPool_on_client_ready) (gpointer client, gpointer ctx);
 gboolean client_pool_get_client (ClientPool *pool, ClientPool_on_client_ready on_client_ready, gpointer ctx);
 gint client_pool_get_client_count (ClientPool *pool);
+// return the number of clients, which are ready to execute a new request
+gint client_pool_get_idle_client_count (ClientPool *pool);
 
 typedef void (*ClientPool_on_request_done) (gpointer callback_data, gboolean success);
 void client_pool_add_request (ClientPool *pool,
@@ -31,7 +31,7 @@ DirTree *dir_tree_create (Application *app);
 void dir_tree_destroy (DirTree *dtree);
 
 DirEntry *dir_tree_update_entry (DirTree *dtree, const gchar *path, DirEntryType type,
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified);
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag);
 
 // mark that DirTree is being updated
 
@@ -65,9 +65,11 @@ void dir_tree_setattr (DirTree *dtree, fuse_ino_t ino,
 
 
 typedef void (*DirTree_file_read_cb) (fuse_req_t req, gboolean success, const char *buf, size_t buf_size);
+// optional, data stored in local cache is returned as a file descriptor, callback must close it
+typedef void (*DirTree_file_read_fd_cb) (fuse_req_t req, int fd, off_t off, size_t size);
 void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino,
     size_t size, off_t off,
-    DirTree_file_read_cb getattr_cb, fuse_req_t req,
+    DirTree_file_read_cb getattr_cb, DirTree_file_read_fd_cb file_read_fd_cb, fuse_req_t req,
     struct fuse_file_info *fi);
 
 typedef void (*DirTree_file_create_cb) (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, struct fuse_file_info *fi);
@@ -85,6 +87,10 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
 
 void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi);
 
+typedef void (*DirTree_file_fsync_cb) (fuse_req_t req, gboolean success);
+void dir_tree_file_fsync (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi,
+    DirTree_file_fsync_cb file_fsync_cb, fuse_req_t req);
+
 typedef void (*DirTree_file_remove_cb) (fuse_req_t req, gboolean success);
 void dir_tree_file_remove (DirTree *dtree, fuse_ino_t ino, DirTree_file_remove_cb file_remove_cb, fuse_req_t req);
 void dir_tree_file_unlink (DirTree *dtree, fuse_ino_t parent_ino, const char *name, DirTree_file_remove_cb file_remove_cb, fuse_req_t req);
@@ -27,20 +27,58 @@ void fileio_destroy (FileIO *fop);
 
 void fileio_release (FileIO *fop);
 
+// in write-behind mode the file is queued for upload, callback is called when it's uploaded
+// parts of multipart upload are uploaded before callback is called, the upload is completed on release
+typedef void (*FileIO_on_synced_cb) (gpointer ctx, gboolean success);
+void fileio_fsync (FileIO *fop, FileIO_on_synced_cb on_synced_cb, gpointer ctx);
+
 typedef void (*FileIO_on_buffer_written_cb) (FileIO *fop, gpointer ctx, gboolean success, size_t count);
 void fileio_write_buffer (FileIO *fop,
     const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
     FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx);
 
+// file size and ETag are known (from directory listing), no need to request them from the server
+void fileio_set_object_info (FileIO *fop, guint64 file_size, const gchar *etag);
+
+// modifications of the object are staged in local file and uploaded on release, unchanged parts are copied
+// base_etag is NULL if it's not known, then size and ETag of the object are requested before upload
+void fileio_set_write_back (FileIO *fop, guint64 base_size, const gchar *base_etag);
+
+// size of the file, as it's written by the client
+guint64 fileio_get_current_size (FileIO *fop);
+
+// open-time prefetch of the file tail and head, enabled by "s3.open_prefetch_tail_size" and "s3.open_prefetch_head_size"
+void fileio_open_prefetch (FileIO *fop);
+
+// download the whole object into local cache in background, return FALSE if it's cached or is being downloaded
+typedef void (*FileIO_on_prefetched_cb) (gpointer ctx, gboolean success);
+gboolean fileio_prefetch_file (Application *app, const gchar *fname, fuse_ino_t ino, guint64 file_size, const gchar *etag,
+    FileIO_on_prefetched_cb on_prefetched_cb, gpointer ctx);
+
 typedef void (*FileIO_on_buffer_read_cb) (gpointer ctx, gboolean success, char *buf, size_t size);
+// cached data is returned as an opened file descriptor, callback must close it
+typedef void (*FileIO_on_buffer_fd_read_cb) (gpointer ctx, int fd, off_t off, size_t size);
+// on_buffer_fd_read_cb is optional, if set it's used instead of on_buffer_read_cb when data is in local cache
 void fileio_read_buffer (FileIO *fop,
     size_t size, off_t off, fuse_ino_t ino,
-    FileIO_on_buffer_read_cb on_buffer_read_cb, gpointer ctx);
+    FileIO_on_buffer_read_cb on_buffer_read_cb, FileIO_on_buffer_fd_read_cb on_buffer_fd_read_cb, gpointer ctx);
 
 typedef void (*FileIO_simple_on_upload_cb) (gpointer ctx, gboolean success);
 void fileio_simple_upload (Application *app, const gchar *fname, const char *str, mode_t mode,
     FileIO_simple_on_upload_cb on_upload_cb, gpointer ctx);
 
+// copy the object on the server side, large objects are copied by parts in parallel
+// etag is the unquoted ETag of the new object, NULL on failure
+typedef void (*FileIO_on_copied_cb) (gpointer ctx, gboolean success, const gchar *etag);
+void fileio_copy_object (Application *app, const gchar *src_fname, const gchar *dst_fname, guint64 size,
+    FileIO_on_copied_cb on_copied_cb, gpointer ctx);
+
+// delete up to FILEIO_DELETE_MAX_KEYS objects by a single Multi-Object Delete request
+// if success is TRUE, l_failed contains the names of the objects which were not deleted
+#define FILEIO_DELETE_MAX_KEYS 1000
+typedef void (*FileIO_on_objects_deleted_cb) (gpointer ctx, gboolean success, GList *l_failed);
+void fileio_delete_objects (Application *app, GList *l_fnames, FileIO_on_objects_deleted_cb on_deleted_cb, gpointer ctx);
+
 typedef void (*FileIO_simple_on_download_cb) (gpointer ctx, gboolean success, const gchar *buf, size_t buf_len);
 void fileio_simple_download (Application *app, const gchar *fname,
     FileIO_simple_on_download_cb on_download_cb, gpointer ctx);
@@ -119,6 +119,8 @@ typedef struct _ClientPool ClientPool;
 typedef struct _ConfData ConfData;
 typedef struct _CacheMng CacheMng;
 typedef struct _StatSrv StatSrv;
+typedef struct _MemBudget MemBudget;
+typedef struct _Uploader Uploader;
 
 struct event_base *application_get_evbase (Application *app);
 struct evdns_base *application_get_dnsbase (Application *app);
@@ -130,6 +132,8 @@ ClientPool *application_get_ops_client_pool (Application *app);
 DirTree *application_get_dir_tree (Application *app);
 CacheMng *application_get_cache_mng (Application *app);
 StatSrv *application_get_stat_srv (Application *app);
+MemBudget *application_get_mem_budget (Application *app);
+Uploader *application_get_uploader (Application *app);
 RFuse *application_get_rfuse (Application *app);
 
 #ifdef SSL_ENABLED
@@ -25,6 +25,10 @@ typedef enum {
     RT_list = 0,
 } RequestType;
 
+// streaming mode: called as response body data arrives, buf contains the next part of the body
+typedef void (*HttpConnection_on_chunk_cb) (HttpConnection *con, gpointer ctx,
+        const gchar *buf, size_t buf_len, struct evkeyvalq *headers);
+
 struct _HttpConnection {
     Application *app;
 
@@ -36,6 +40,10 @@ struct _HttpConnection {
     // is taken by high level
     gboolean is_acquired;
     GList *l_output_headers;
+    HttpConnection_on_chunk_cb on_chunk_cb; // streaming mode for the next request
+    int out_fd; // body of the next request is sent from this file, -1 if not set
+    off_t out_off;
+    size_t out_len;
 
     // statistics info
     enum evhttp_cmd_type cur_cmd_type;
@@ -54,6 +62,11 @@ gpointer http_connection_create (Application *app);
 void http_connection_destroy (gpointer data);
 
 void http_connection_add_output_header (HttpConnection *con, const gchar *key, const gchar *value);
+// deliver body of the next request by parts, response_cb receives only the rest of the body
+void http_connection_set_on_chunk_cb (HttpConnection *con, HttpConnection_on_chunk_cb on_chunk_cb);
+// send [off, off + len) of the file as the body of the next request, the file is not copied to memory
+// descriptor is duplicated, caller can close it after http_connection_make_request () returns
+gboolean http_connection_set_output_file (HttpConnection *con, int fd, off_t off, size_t len);
 
 void http_connection_set_on_released_cb (gpointer client, ClientPool_on_released_cb client_on_released_cb, gpointer ctx);
 gboolean http_connection_check_rediness (gpointer client);
@@ -74,13 +87,21 @@ typedef void (*HttpConnection_directory_listing_callback) (gpointer callback_dat
 void http_connection_get_directory_listing (HttpConnection *con, const gchar *path, fuse_ino_t ino,
     HttpConnection_directory_listing_callback directory_listing_callback, gpointer callback_data);
 
+// recursive listing of all objects which keys start with the prefix (no delimiter)
+// prefix and keys are relative to "s3.bucket_prefix_path", l_objects is a list of HttpConnectionObject
+// the list is owned by the caller, it must be freed with http_connection_object_list_free ()
+typedef struct {
+    gchar *key;
+    guint64 size;
+} HttpConnectionObject;
+typedef void (*HttpConnection_object_listing_callback) (gpointer callback_data, gboolean success, GList *l_objects);
+void http_connection_get_object_listing (HttpConnection *con, const gchar *prefix,
+    HttpConnection_object_listing_callback object_listing_callback, gpointer callback_data);
+void http_connection_object_list_free (GList *l_objects);
+
 typedef void (*BucketClient_on_cb) (gpointer ctx, gboolean success, const gchar *buf, size_t buf_len);
 void bucket_client_get (HttpConnection *con, const gchar *req_str, BucketClient_on_cb on_cb, gpointer ctx);
 
-typedef void (*HttpConnection_on_entry_sent_cb) (gpointer ctx, gboolean success);
-void http_connection_file_send (HttpConnection *con, int fd, const gchar *resource_path,
-    HttpConnection_on_entry_sent_cb on_entry_sent_cb, gpointer ctx);
-
 typedef void (*HttpConnection_response_cb) (HttpConnection *con, gpointer ctx, gboolean success,
         const gchar *buf, size_t buf_len, struct evkeyvalq *headers);
 gboolean http_connection_make_request (HttpConnection *con,
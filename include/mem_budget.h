@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _MEM_BUDGET_H_
+#define _MEM_BUDGET_H_
+
+#include "global.h"
+
+// process-wide budget of memory used by data buffers: write buffers, request bodies and read replies
+MemBudget *mem_budget_create (Application *app);
+void mem_budget_destroy (MemBudget *mb);
+
+// reserve "size" bytes of the budget
+// return TRUE if the memory is reserved at once
+// return FALSE if the budget is exhausted: on_reserved_cb is called when the memory is reserved
+// reservation of 0 bytes waits until the budget isn't exceeded
+typedef void (*MemBudget_on_reserved_cb) (gpointer ctx);
+gboolean mem_budget_reserve (MemBudget *mb, guint64 size, MemBudget_on_reserved_cb on_reserved_cb, gpointer ctx);
+
+// account memory which is already allocated, the budget might be exceeded
+void mem_budget_add (MemBudget *mb, guint64 size);
+
+// return reserved (or added) memory to the budget, waiting reservations are resumed
+void mem_budget_release (MemBudget *mb, guint64 size);
+
+void mem_budget_get_stats (MemBudget *mb, guint64 *used, guint64 *max_size, guint64 *peak,
+    guint32 *waiting_nr, guint64 *deferred_nr);
+#endif
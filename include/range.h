@@ -27,8 +27,17 @@ Range *range_create ();
 void range_destroy (Range *range);
 
 void range_add (Range *range, guint64 start, guint64 end);
+// remove [start, end) from range
+void range_remove (Range *range, guint64 start, guint64 end);
 
 gboolean range_contain (Range *range, guint64 start, guint64 end);
+// return TRUE if any part of [start, end) is in range
+gboolean range_intersect (Range *range, guint64 start, guint64 end);
+// call func for every part of [start, end) which is not in range, in ascending order
+typedef void (*RangeFunc) (guint64 start, guint64 end, gpointer ctx);
+void range_foreach_gap (Range *range, guint64 start, guint64 end, RangeFunc func, gpointer ctx);
+// call func for every interval of range, in ascending order
+void range_foreach (Range *range, RangeFunc func, gpointer ctx);
 gint range_count (Range *range);
 guint64 range_length (Range *range);
 void range_print (Range *range);
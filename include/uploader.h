@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _UPLOADER_H_
+#define _UPLOADER_H_
+
+#include "global.h"
+
+// write-behind: released files are copied into the spool directory and uploaded in background,
+// pending uploads are recorded in the journal and resumed after restart
+Uploader *uploader_create (Application *app);
+void uploader_destroy (Uploader *upl);
+
+// queue upload of "size" bytes as the object "fname" (escaped path)
+// data is read from fd (starting at offset 0, fd is closed by Uploader) or from buf (it's copied), if fd is -1
+// data is stored in the spool directory by a worker thread, then on_queued_cb is called,
+// it gets FALSE if data can't be stored there
+typedef void (*Uploader_on_queued_cb) (gpointer ctx, gboolean queued);
+typedef void (*Uploader_on_uploaded_cb) (gpointer ctx, gboolean success);
+void uploader_add (Uploader *upl, const gchar *fname, fuse_ino_t ino, int fd, const gchar *buf, guint64 size,
+    Uploader_on_queued_cb on_queued_cb, Uploader_on_uploaded_cb on_uploaded_cb, gpointer ctx);
+
+// wait until all queued uploads of the inode are finished, on_uploaded_cb might be called at once
+void uploader_wait (Uploader *upl, fuse_ino_t ino, Uploader_on_uploaded_cb on_uploaded_cb, gpointer ctx);
+
+void uploader_get_stats (Uploader *upl, guint32 *queued_nr, guint64 *queued_size, guint32 *in_flight,
+    guint64 *uploaded_nr, guint64 *failed_nr);
+#endif
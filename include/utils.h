@@ -23,6 +23,7 @@
 
 gchar *get_random_string (size_t len, gboolean readable);
 gboolean get_md5_sum (const gchar *buf, size_t len, gchar **md5str, gchar **md5b);
+gboolean get_md5_final (MD5_CTX *ctx, gchar **md5str, gchar **md5b);
 gchar *get_base64 (const gchar *buf, size_t len);
 gboolean uri_is_https (const struct evhttp_uri *uri);
 gint uri_get_port (const struct evhttp_uri *uri);
@@ -15,51 +15,202 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
+// fallocate () is used to free disk space of evicted blocks
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "cache_mng.h"
 #include "range.h"
 #include "utils.h"
 #include "conf.h"
+#include <sys/file.h>
+#include <sys/resource.h>
 
 /*{{{ structs / func defs */
 
 struct _CacheMng {
     Application *app;
     GHashTable *h_entries;
-    GQueue *q_lru;
+    GQueue *q_lru; // struct _CacheBlock, the most recently used block first
     guint64 size;
     guint64 max_size;
+    guint64 block_size; // cached data is accounted and evicted by blocks of this size
     gchar *cache_dir;
     time_t check_time; // last check time of stored objects
+    GHashTable *h_fetches; // blocks which are being downloaded: struct _CacheFetchKey -> struct _CacheFetch
+    guint32 fetches_nr; // number of pending downloads
+    guint64 next_id; // cache files are named by ids, inodes are not kept between mounts
+    GQueue *q_fds; // struct _CacheEntry which cache file is open, the most recently used first
+    guint fds_max;
+
+    // persistent cache, see cache_mng_attach_file ()
+    gboolean persistent;
+    int lock_fd; // the directory is locked while it's used
+    int index_fd; // journal of persisted entries, opened for appending
+    guint index_records; // the number of records appended since the journal was rewritten
+    guint index_syncs; // data of entries being flushed by workers, the journal is rewritten when they are finished
+    GHashTable *h_records; // "path etag" -> struct _CacheRecord, data of previous mounts which isn't attached yet
+    GQueue *q_records; // struct _CacheRecord, the oldest first, records are evicted before blocks
+    struct event *ev_index_sync;
+
+    // memory tier: copies of frequently read blocks, its hits are served without system calls
+    GQueue *q_mem; // struct _CacheBlock which data is in memory, the most recently used first
+    guint64 mem_size;
+    guint64 mem_max_size;
+
+    // disk I/O is done by worker threads, see cache_mng_io_submit ()
+    GThreadPool **a_io_pools; // jobs of a cache file are done by the same single-threaded pool, in order
+    guint io_pools_nr; // 0 if disk I/O is done on the event loop
+    GAsyncQueue *q_io_done; // struct _CacheIO, finished by workers
+    int io_pipe[2]; // workers wake up the event loop
+    struct event *ev_io_done;
+    guint io_in_flight;
+    GHashTable *h_io_pending; // entry id -> the number of unfinished jobs
 
     // stats
-    guint64 cache_hits;
+    guint64 cache_hits; // hits of the disk tier
     guint64 cache_miss;
+    guint64 mem_hits; // hits of the memory tier
+    guint64 fetch_shared; // number of requests attached to a pending download
 };
 
 struct _CacheEntry {
     fuse_ino_t ino;
+    guint64 id; // data is stored in "cache_mng_<id>" file
     Range *avail_range;
+    GHashTable *h_blocks; // block number -> struct _CacheBlock, blocks which contain cached data
     time_t modification_time;
-    GList *ll_lru;
     gchar *etag;
+    Range *dirty_range; // staged (write-back) file: ranges written by the client, not uploaded yet
+    guint staged_nr; // the number of file handles which stage the file
+    gchar *path; // object path, the entry is kept between mounts if it's set
+    gboolean persisted; // the journal contains a valid record of the entry
+    gboolean persist_dirty; // data is stored since the record was written
+    guint64 persist_gen; // changed with the data or the record, a record of the older data isn't written
+    guint64 writes; // the number of stores, data read before the last store isn't copied to memory tier
+    int fd; // cache file descriptor, -1 if it's not open, see cache_mng_entry_fd ()
+    GList *ll_fds;
+};
+
+// data of the previous mount, which isn't attached to an inode yet
+struct _CacheRecord {
+    guint64 id;
+    gchar *key;
+    gchar *path;
+    gchar *etag;
+    Range *avail_range;
+    guint64 size;
+    GList *ll_records;
+};
+
+// fixed-size region of the cache file, the unit of LRU and eviction
+struct _CacheBlock {
+    struct _CacheEntry *entry;
+    guint64 nr; // the block covers [nr * block_size, (nr + 1) * block_size) of the file
+    guint64 size; // the number of cached bytes of the block
+    GList *ll_lru; // NULL if the entry is staged, staged entries are not evicted
+    guint32 hits; // the number of reads of the block, blocks are copied to memory tier by frequency
+    unsigned char *mem; // copy of the first mem_len bytes of the block, NULL if it's not in memory
+    guint64 mem_len;
+    GList *ll_mem;
+    gboolean mem_loading; // the block is being read by a worker, it's copied to memory when the job is finished
 };
 
 struct _CacheContext {
     guint64 size;
     unsigned char *buf;
     gboolean success;
+    int fd; // descriptor for cache_mng_get_file_fd_async ()
     union {
         cache_mng_on_retrieve_file_buf_cb retrieve_cb;
         cache_mng_on_store_file_buf_cb store_cb;
+        cache_mng_on_file_fd_cb file_fd_cb;
     } cb;
     void *user_ctx;
     struct event *ev;
 };
 
+typedef enum {
+    CMNG_IO_READ = 0,
+    CMNG_IO_WRITE,
+    CMNG_IO_SYNC, // flush data of the file to the disk, the record of the entry is written then
+    CMNG_IO_BARRIER, // nothing is done, jobs of the file which are submitted before it are finished
+    CMNG_IO_ADMIT, // read the block, it's copied to memory tier when the job is finished
+} CacheIOType;
+
+// disk I/O job, it's done by a worker thread
+struct _CacheIO {
+    CacheIOType type;
+    gboolean dirty; // data written by the client
+    int fd; // copy of the cache file descriptor, it's closed by the worker
+    gboolean own_fd; // FALSE if fd is the descriptor of the entry (there are no workers)
+    fuse_ino_t ino;
+    guint64 id;
+    guint64 writes; // entry->writes when the job is submitted
+    guint64 persist_gen; // entry->persist_gen when the job is submitted
+    size_t size; // requested [off, off + size) of the file
+    off_t off;
+    unsigned char *buf; // contains [buf_off, buf_off + buf_len) of the file
+    guint64 buf_off;
+    guint64 buf_len;
+    gboolean own_buf;
+    GArray *a_segments; // pairs of [start, end), only these parts of buf are written if it's set
+    gboolean success;
+    struct _CacheContext *context; // NULL for CMNG_IO_SYNC and CMNG_IO_ADMIT
+};
+
+struct _CacheFetch {
+    fuse_ino_t ino;
+    guint64 off; // start of the downloaded range, the download is referred by it
+    guint64 size;
+    GList *l_waiters; // list of struct _CacheFetchWaiter
+};
+
+// every block of the downloaded range is keyed, so overlapping requests share the download
+struct _CacheFetchKey {
+    fuse_ino_t ino;
+    guint64 nr;
+};
+
+struct _CacheFetchWaiter {
+    cache_mng_on_fetched_cb fetched_cb;
+    void *user_ctx;
+};
+
 #define CMNG_LOG "cmng"
+#define CMNG_DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define CMNG_INDEX "index"
+#define CMNG_LOCK "lock"
+#define CMNG_INDEX_SYNC_SEC 30 // records of changed entries are written with this delay
+#define CMNG_INDEX_MAX_RECORDS 10000 // the journal is rewritten when it has more records
+#define CMNG_MEM_ADMIT_HITS 2 // block is copied to memory tier when it's read from the disk this many times
+#define CMNG_FDS_MAX 1024 // maximum number of open cache files, it's limited by RLIMIT_NOFILE too
 
 static void cache_entry_destroy (gpointer data);
+static void cache_record_destroy (gpointer data);
+static void cache_block_destroy (gpointer data);
+static void cache_fetch_destroy (gpointer data);
+static void cache_fetch_destroy_first (gpointer key, gpointer value, gpointer user_data);
+static guint cache_fetch_hash (gconstpointer key);
+static gboolean cache_fetch_equal (gconstpointer a, gconstpointer b);
 static void cache_mng_rm_cache_dir (CacheMng *cmng);
+static gboolean cache_mng_open_persistent (CacheMng *cmng);
+static gboolean cache_mng_index_load (CacheMng *cmng);
+static void cache_mng_close_persistent (CacheMng *cmng);
+static void cache_mng_on_index_sync_cb (evutil_socket_t fd, short flags, void *ctx);
+static void cache_mng_entry_forget (CacheMng *cmng, struct _CacheEntry *entry);
+static void cache_mng_entry_unkey (CacheMng *cmng, struct _CacheEntry *entry);
+static void cache_mng_entry_changed (CacheMng *cmng, struct _CacheEntry *entry);
+static void cache_mng_evict_record (CacheMng *cmng, struct _CacheRecord *record);
+static gboolean cache_mng_io_start (CacheMng *cmng, guint threads);
+static void cache_mng_io_stop (CacheMng *cmng);
+static guint cache_mng_fds_max (void);
+static int cache_mng_range_fd (CacheMng *cmng, struct _CacheEntry *entry, size_t size, off_t off);
+static void cache_mng_on_entry_synced (CacheMng *cmng, struct _CacheEntry *entry, struct _CacheIO *io);
+static int cache_mng_io_fd (CacheMng *cmng, struct _CacheEntry *entry, gboolean create);
+static struct _CacheIO *cache_io_create (CacheMng *cmng, CacheIOType type, int fd, struct _CacheEntry *entry,
+    size_t size, off_t off, struct _CacheContext *context);
+static void cache_mng_io_submit (CacheMng *cmng, struct _CacheIO *io);
 /*}}}*/
 
 /*{{{ create / destroy */
@@ -72,7 +223,18 @@ CacheMng *cache_mng_create (Application *app)
     cmng->app = app;
     cmng->h_entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, cache_entry_destroy);
     cmng->q_lru = g_queue_new ();
+    cmng->h_fetches = g_hash_table_new_full (cache_fetch_hash, cache_fetch_equal, g_free, NULL);
+    cmng->h_records = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cache_record_destroy);
+    cmng->q_records = g_queue_new ();
+    cmng->q_mem = g_queue_new ();
+    cmng->q_fds = g_queue_new ();
+    cmng->fds_max = cache_mng_fds_max ();
+    cmng->mem_size = 0;
     cmng->size = 0;
+    cmng->next_id = 1;
+    cmng->lock_fd = -1;
+    cmng->index_fd = -1;
+    cmng->io_pipe[0] = cmng->io_pipe[1] = -1;
     cmng->check_time = time (NULL);
     // If "filesystem.cache_dir_max_megabyte_size" is set, use it, else use "filesystem.cache_dir_max_size"
     if (conf_node_exists (application_get_conf (cmng->app), "filesystem.cache_dir_max_megabyte_size")) {
@@ -82,42 +244,92 @@ CacheMng *cache_mng_create (Application *app)
         cmng->max_size = conf_get_uint (application_get_conf (cmng->app), "filesystem.cache_dir_max_size");
     }
     LOG_debug (CMNG_LOG, "Maximum cache size (bytes): %"PRId64, cmng->max_size);
-    // generate random folder name for storing cache
-    rnd_str = get_random_string (20, TRUE);
-    cmng->cache_dir = g_strdup_printf ("%s/%s",
-        conf_get_string (application_get_conf (cmng->app), "filesystem.cache_dir"), rnd_str);
-    g_free (rnd_str);
+    cmng->mem_max_size = conf_get_uint (application_get_conf (cmng->app), "filesystem.cache_memory_max_size");
+    cmng->block_size = conf_get_uint (application_get_conf (cmng->app), "filesystem.cache_block_size");
+    if (!cmng->block_size)
+        cmng->block_size = CMNG_DEFAULT_BLOCK_SIZE;
     cmng->cache_hits = 0;
     cmng->cache_miss = 0;
+    cmng->mem_hits = 0;
+    cmng->fetch_shared = 0;
+    cmng->fetches_nr = 0;
 
-    cache_mng_rm_cache_dir (cmng);
-    if (g_mkdir_with_parents (cmng->cache_dir, 0700) != 0) {
-        LOG_err (CMNG_LOG, "Failed to create directory: %s", cmng->cache_dir);
+    if (!cache_mng_io_start (cmng, conf_get_uint (application_get_conf (cmng->app), "filesystem.cache_io_threads"))) {
+        LOG_err (CMNG_LOG, "Failed to start cache I/O threads !");
         cache_mng_destroy (cmng);
         return NULL;
     }
 
+    if (conf_get_boolean (application_get_conf (cmng->app), "filesystem.cache_persistent"))
+        cmng->persistent = cache_mng_open_persistent (cmng);
+
+    if (!cmng->persistent) {
+        // generate random folder name for storing cache
+        rnd_str = get_random_string (20, TRUE);
+        cmng->cache_dir = g_strdup_printf ("%s/%s",
+            conf_get_string (application_get_conf (cmng->app), "filesystem.cache_dir"), rnd_str);
+        g_free (rnd_str);
+
+        cache_mng_rm_cache_dir (cmng);
+        if (g_mkdir_with_parents (cmng->cache_dir, 0700) != 0) {
+            LOG_err (CMNG_LOG, "Failed to create directory: %s", cmng->cache_dir);
+            cache_mng_destroy (cmng);
+            return NULL;
+        }
+    } else {
+        cmng->ev_index_sync = evtimer_new (application_get_evbase (cmng->app), cache_mng_on_index_sync_cb, cmng);
+        if (!cache_mng_index_load (cmng)) {
+            LOG_err (CMNG_LOG, "Failed to load cache index: %s", cmng->cache_dir);
+            cache_mng_destroy (cmng);
+            return NULL;
+        }
+    }
+
     return cmng;
 }
 
 void cache_mng_destroy (CacheMng *cmng)
 {
-    cache_mng_rm_cache_dir (cmng);
+    // jobs are finished before the files are removed
+    cache_mng_io_stop (cmng);
+    if (cmng->persistent)
+        cache_mng_close_persistent (cmng);
+    else
+        cache_mng_rm_cache_dir (cmng);
+    if (cmng->ev_index_sync)
+        event_free (cmng->ev_index_sync);
     g_free (cmng->cache_dir);
     g_queue_free (cmng->q_lru);
     g_hash_table_destroy (cmng->h_entries);
+    g_hash_table_foreach (cmng->h_fetches, cache_fetch_destroy_first, cmng);
+    g_hash_table_destroy (cmng->h_fetches);
+    g_hash_table_destroy (cmng->h_records);
+    g_queue_free (cmng->q_records);
+    g_queue_free (cmng->q_mem);
+    // descriptors are closed by cache_entry_destroy ()
+    g_queue_free (cmng->q_fds);
     g_free (cmng);
 }
 
-static struct _CacheEntry* cache_entry_create (fuse_ino_t ino)
+static struct _CacheEntry* cache_entry_create (CacheMng *cmng, fuse_ino_t ino)
 {
     struct _CacheEntry* entry = g_malloc (sizeof (struct _CacheEntry));
 
     entry->ino = ino;
+    entry->id = cmng->next_id++;
     entry->avail_range = range_create ();
-    entry->ll_lru = NULL;
+    entry->h_blocks = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, cache_block_destroy);
     entry->modification_time = time (NULL);
     entry->etag = NULL;
+    entry->dirty_range = NULL;
+    entry->staged_nr = 0;
+    entry->path = NULL;
+    entry->persisted = FALSE;
+    entry->persist_dirty = FALSE;
+    entry->persist_gen = 0;
+    entry->writes = 0;
+    entry->fd = -1;
+    entry->ll_fds = NULL;
 
     return entry;
 }
@@ -126,12 +338,94 @@ static void cache_entry_destroy (gpointer data)
 {
     struct _CacheEntry * entry = (struct _CacheEntry*) data;
 
+    if (entry->fd >= 0)
+        close (entry->fd);
     range_destroy(entry->avail_range);
+    g_hash_table_destroy (entry->h_blocks);
+    if (entry->dirty_range)
+        range_destroy (entry->dirty_range);
     if (entry->etag)
         g_free (entry->etag);
+    g_free (entry->path);
     g_free(entry);
 }
 
+static void cache_block_destroy (gpointer data)
+{
+    struct _CacheBlock *block = (struct _CacheBlock *) data;
+
+    g_free (block->mem);
+    g_free (block);
+}
+
+static gchar *cache_record_key (const gchar *path, const gchar *etag)
+{
+    return g_strdup_printf ("%s %s", path, etag);
+}
+
+static struct _CacheRecord *cache_record_create (guint64 id, const gchar *path, const gchar *etag)
+{
+    struct _CacheRecord *record = g_new0 (struct _CacheRecord, 1);
+
+    record->id = id;
+    record->path = g_strdup (path);
+    record->etag = g_strdup (etag);
+    record->key = cache_record_key (path, etag);
+    record->avail_range = range_create ();
+    record->size = 0;
+    record->ll_records = NULL;
+
+    return record;
+}
+
+static void cache_record_destroy (gpointer data)
+{
+    struct _CacheRecord *record = (struct _CacheRecord *) data;
+
+    range_destroy (record->avail_range);
+    g_free (record->key);
+    g_free (record->path);
+    g_free (record->etag);
+    g_free (record);
+}
+
+static void cache_fetch_destroy (gpointer data)
+{
+    struct _CacheFetch *fetch = (struct _CacheFetch *) data;
+    GList *l;
+
+    for (l = g_list_first (fetch->l_waiters); l; l = g_list_next (l))
+        g_free (l->data);
+    g_list_free (fetch->l_waiters);
+    g_free (fetch);
+}
+
+// a download is keyed by all its blocks, it's freed once: by the key of the first block
+static void cache_fetch_destroy_first (gpointer key, gpointer value, gpointer user_data)
+{
+    CacheMng *cmng = (CacheMng *) user_data;
+    struct _CacheFetchKey *fkey = (struct _CacheFetchKey *) key;
+    struct _CacheFetch *fetch = (struct _CacheFetch *) value;
+
+    if (fkey->nr == fetch->off / cmng->block_size)
+        cache_fetch_destroy (fetch);
+}
+
+static guint cache_fetch_hash (gconstpointer key)
+{
+    const struct _CacheFetchKey *fkey = (const struct _CacheFetchKey *) key;
+
+    return g_direct_hash (GUINT_TO_POINTER (fkey->ino)) ^ (guint) (fkey->nr ^ (fkey->nr >> 32));
+}
+
+static gboolean cache_fetch_equal (gconstpointer a, gconstpointer b)
+{
+    const struct _CacheFetchKey *fa = (const struct _CacheFetchKey *) a;
+    const struct _CacheFetchKey *fb = (const struct _CacheFetchKey *) b;
+
+    return fa->ino == fb->ino && fa->nr == fb->nr;
+}
+
 static struct _CacheContext* cache_context_create (guint64 size, void *user_ctx)
 {
     struct _CacheContext *context = g_malloc (sizeof (struct _CacheContext));
@@ -141,12 +435,17 @@ static struct _CacheContext* cache_context_create (guint64 size, void *user_ctx)
     context->size = size;
     context->buf = NULL;
     context->ev = NULL;
+    context->fd = -1;
 
     return context;
 }
 
 static void cache_context_destroy (struct _CacheContext* context)
 {
+    if (!context)
+        return;
+    if (context->fd >= 0)
+        close (context->fd);
     if (context->ev)
         event_free (context->ev);
     if (context->buf)
@@ -156,9 +455,72 @@ static void cache_context_destroy (struct _CacheContext* context)
 /*}}}*/
 
 /*{{{ utils */
-static int cache_mng_file_name (CacheMng *cmng, char *buf, int buflen, fuse_ino_t ino)
+static int cache_mng_file_name (CacheMng *cmng, char *buf, int buflen, guint64 id)
+{
+    return snprintf (buf, buflen, "%s/cache_mng_%"G_GUINT64_FORMAT, cmng->cache_dir, id);
+}
+
+// cache files are kept open, RLIMIT_NOFILE is shared with connections, FUSE
+// and copies of the descriptors, which are passed to the workers and callers
+static guint cache_mng_fds_max (void)
+{
+    struct rlimit rl;
+
+    if (getrlimit (RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+        return CMNG_FDS_MAX;
+
+    return MIN (CMNG_FDS_MAX, rl.rlim_cur / 2);
+}
+
+static void cache_mng_entry_close_fd (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    if (entry->fd < 0)
+        return;
+
+    close (entry->fd);
+    entry->fd = -1;
+    g_queue_delete_link (cmng->q_fds, entry->ll_fds);
+    entry->ll_fds = NULL;
+}
+
+// return descriptor of the cache file, the file is created if "create" is TRUE
+// descriptor is kept open (the least recently used is closed first), caller must not close it
+static int cache_mng_entry_fd (CacheMng *cmng, struct _CacheEntry *entry, gboolean create)
 {
-    return snprintf (buf, buflen, "%s/cache_mng_%"INO_FMT"", cmng->cache_dir, INO ino);
+    char path[PATH_MAX];
+    int flags = create ? O_RDWR | O_CREAT : O_RDWR;
+    int fd;
+
+    if (entry->fd >= 0) {
+        g_queue_unlink (cmng->q_fds, entry->ll_fds);
+        g_queue_push_head_link (cmng->q_fds, entry->ll_fds);
+        return entry->fd;
+    }
+
+    while (g_queue_get_length (cmng->q_fds) >= cmng->fds_max && g_queue_peek_tail (cmng->q_fds))
+        cache_mng_entry_close_fd (cmng, (struct _CacheEntry *) g_queue_peek_tail (cmng->q_fds));
+
+    cache_mng_file_name (cmng, path, sizeof (path), entry->id);
+    fd = open (path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    // descriptors are exhausted, release the cached ones
+    if (fd < 0 && errno == EMFILE && g_queue_peek_tail (cmng->q_fds)) {
+        LOG_debug (CMNG_LOG, "Too many open files, closing %u cache files", g_queue_get_length (cmng->q_fds));
+        while (g_queue_peek_tail (cmng->q_fds))
+            cache_mng_entry_close_fd (cmng, (struct _CacheEntry *) g_queue_peek_tail (cmng->q_fds));
+        fd = open (path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
+
+    if (fd < 0) {
+        LOG_err (CMNG_LOG, INO_H"Failed to open file! Path: %s, error: %s", INO_T (entry->ino), path, strerror (errno));
+        return -1;
+    }
+
+    entry->fd = fd;
+    g_queue_push_head (cmng->q_fds, entry);
+    entry->ll_fds = g_queue_peek_head_link (cmng->q_fds);
+
+    return fd;
 }
 
 guint64 cache_mng_size (CacheMng *cmng)
@@ -166,6 +528,16 @@ guint64 cache_mng_size (CacheMng *cmng)
     return cmng->size;
 }
 
+guint64 cache_mng_get_block_size (CacheMng *cmng)
+{
+    return cmng->block_size;
+}
+
+guint64 cache_mng_get_max_size (CacheMng *cmng)
+{
+    return cmng->max_size;
+}
+
 guint64 cache_mng_get_file_length (CacheMng *cmng, fuse_ino_t ino)
 {
     struct _CacheEntry *entry;
@@ -177,6 +549,18 @@ guint64 cache_mng_get_file_length (CacheMng *cmng, fuse_ino_t ino)
     return range_length (entry->avail_range);
 }
 
+// check if the whole range is stored in local cache
+gboolean cache_mng_file_contains (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry)
+        return FALSE;
+
+    return range_contain (entry->avail_range, off, off + size);
+}
+
 static void cache_mng_rm_cache_dir (CacheMng *cmng)
 {
     if (cmng->cache_dir)
@@ -208,6 +592,8 @@ gboolean cache_mng_update_etag (CacheMng *cmng, fuse_ino_t ino, const gchar *eta
 
     if (entry->etag) {
         if (strcmp (entry->etag, etag)) {
+            // cached data belongs to the previous version of the object
+            cache_mng_entry_unkey (cmng, entry);
             g_free (entry->etag);
             entry->etag = g_strdup (etag);
         }
@@ -218,213 +604,1849 @@ gboolean cache_mng_update_etag (CacheMng *cmng, fuse_ino_t ino, const gchar *eta
 }
 /*}}}*/
 
-/*{{{ retrieve_file_buf */
-static void cache_read_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+/*{{{ blocks */
+static void cache_block_count_gap_cb (guint64 start, guint64 end, gpointer ctx)
 {
-    struct _CacheContext *context = (struct _CacheContext *) ctx;
+    guint64 *gaps = (guint64 *) ctx;
 
-    if (context->cb.retrieve_cb)
-        context->cb.retrieve_cb (context->buf, context->size, context->success, context->user_ctx);
-    cache_context_destroy (context);
+    *gaps += end - start;
 }
 
-// retrieve file buffer from local storage
-// if success == TRUE then "buf" contains "size" bytes of data
-void cache_mng_retrieve_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
-    cache_mng_on_retrieve_file_buf_cb on_retrieve_file_buf_cb, void *ctx)
+// the number of cached bytes of [start, end)
+static guint64 cache_entry_cached_size (struct _CacheEntry *entry, guint64 start, guint64 end)
 {
-    struct _CacheContext *context;
-    struct _CacheEntry *entry;
+    guint64 gaps = 0;
 
-    context = cache_context_create (size, ctx);
-    context->cb.retrieve_cb = on_retrieve_file_buf_cb;
-    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    range_foreach_gap (entry->avail_range, start, end, cache_block_count_gap_cb, &gaps);
 
-    if (entry && range_contain (entry->avail_range, off, off + size)) {
-        int fd;
-        ssize_t res;
-        char path[PATH_MAX];
+    return end - start - gaps;
+}
 
-        if (ino != entry->ino) {
-            LOG_err (CMNG_LOG, INO_H"Requested inode doesn't match hashed key!", INO_T (ino));
-            if (context->cb.retrieve_cb)
-                context->cb.retrieve_cb (NULL, 0, FALSE, context->user_ctx);
-            cache_context_destroy (context);
-            cmng->cache_miss++;
+// move the block to the front of q_lru, blocks of staged entries are not in q_lru
+static void cache_mng_touch_block (CacheMng *cmng, struct _CacheBlock *block)
+{
+    if (block->entry->staged_nr)
+        return;
+
+    if (block->ll_lru) {
+        g_queue_unlink (cmng->q_lru, block->ll_lru);
+        g_queue_push_head_link (cmng->q_lru, block->ll_lru);
+    } else {
+        g_queue_push_head (cmng->q_lru, block);
+        block->ll_lru = g_queue_peek_head_link (cmng->q_lru);
+    }
+}
+
+// remove the memory copy of the block
+static void cache_mng_mem_drop (CacheMng *cmng, struct _CacheBlock *block)
+{
+    if (!block->mem)
+        return;
+
+    cmng->mem_size -= block->mem_len;
+    g_queue_delete_link (cmng->q_mem, block->ll_mem);
+    block->ll_mem = NULL;
+    g_free (block->mem);
+    block->mem = NULL;
+    block->mem_len = 0;
+}
+
+// block is read from the disk tier, copy it to memory if it's read often enough
+// blocks in memory are replaced only by blocks which are read at least as often, replaced blocks are aged
+// data is taken from buf (which contains [buf_off, buf_off + buf_len) of the file) or read from fd,
+// with workers the block is read by CMNG_IO_ADMIT job instead, this function is called again when it's finished
+static void cache_mng_mem_admit (CacheMng *cmng, struct _CacheBlock *block, int fd,
+    const unsigned char *buf, guint64 buf_off, guint64 buf_len)
+{
+    struct _CacheEntry *entry = block->entry;
+    guint64 start = block->nr * cmng->block_size;
+    unsigned char *mem;
+
+    // data of the staged file is being changed
+    if (block->mem || block->mem_loading || block->hits < CMNG_MEM_ADMIT_HITS || entry->staged_nr ||
+        !block->size || block->size > cmng->mem_max_size)
+        return;
+
+    // only the data from the beginning of the block is kept
+    if (!range_contain (entry->avail_range, start, start + block->size))
+        return;
+
+    // the event loop doesn't wait for the disk
+    if (fd >= 0 && cmng->io_pools_nr && !(buf && start >= buf_off && start + block->size <= buf_off + buf_len)) {
+        struct _CacheIO *io;
+
+        fd = cache_mng_io_fd (cmng, entry, FALSE);
+        if (fd < 0)
+            return;
+
+        io = cache_io_create (cmng, CMNG_IO_ADMIT, fd, entry, block->size, start, NULL);
+        io->buf = g_malloc (io->buf_len);
+        io->own_buf = TRUE;
+        block->mem_loading = TRUE;
+        cache_mng_io_submit (cmng, io);
+        return;
+    }
+
+    while (cmng->mem_size + block->size > cmng->mem_max_size) {
+        struct _CacheBlock *victim = (struct _CacheBlock *) g_queue_peek_tail (cmng->q_mem);
+
+        if (victim->hits > block->hits) {
+            victim->hits /= 2;
             return;
         }
+        cache_mng_mem_drop (cmng, victim);
+    }
 
-        cache_mng_file_name (cmng, path, sizeof (path), ino);
-        fd = open (path, O_RDONLY);
-        if (fd < 0) {
-            LOG_err (CMNG_LOG, INO_H"Failed to open file for reading! Path: %s", INO_T (ino), path);
-            if (context->cb.retrieve_cb)
-                context->cb.retrieve_cb (NULL, 0, FALSE, context->user_ctx);
-            cache_context_destroy (context);
-            cmng->cache_miss++;
+    if (buf && start >= buf_off && start + block->size <= buf_off + buf_len) {
+        mem = g_malloc (block->size);
+        memcpy (mem, buf + (start - buf_off), block->size);
+    } else if (fd >= 0) {
+        mem = g_malloc (block->size);
+        if (pread (fd, mem, block->size, start) != (ssize_t) block->size) {
+            g_free (mem);
             return;
         }
+    } else
+        return;
 
-        context->buf = g_malloc (size);
-        res = pread (fd, context->buf, size, off);
-        close (fd);
-        context->success = (res == (ssize_t) size);
+    block->mem = mem;
+    block->mem_len = block->size;
+    cmng->mem_size += block->mem_len;
+    g_queue_push_head (cmng->q_mem, block);
+    block->ll_mem = g_queue_peek_head_link (cmng->q_mem);
 
-        LOG_debug (CMNG_LOG, INO_H"Read [%"OFF_FMT":%zu] bytes, result: %s",
-            INO_T (ino), off, size, context->success ? "OK" : "Failed");
+    LOG_debug (CMNG_LOG, INO_H"Block [%"G_GUINT64_FORMAT"] is copied to memory, hits: %u",
+        INO_T (entry->ino), block->nr, block->hits);
+}
 
-        if (!context->success) {
-            g_free (context->buf);
-            context->buf = NULL;
+// blocks of [start, end) are read, fd is the cache file if they are read from the disk tier, -1 otherwise
+// buf (if not NULL) contains the data of [start, end)
+static void cache_mng_touch_blocks (CacheMng *cmng, struct _CacheEntry *entry, guint64 start, guint64 end, int fd,
+    const unsigned char *buf)
+{
+    guint64 nr;
 
-            cmng->cache_miss++;
-        } else
-            cmng->cache_hits++;
+    for (nr = start / cmng->block_size; nr * cmng->block_size < end; nr++) {
+        struct _CacheBlock *block = g_hash_table_lookup (entry->h_blocks, &nr);
 
-        // move entry to the front of q_lru
-        g_queue_unlink (cmng->q_lru, entry->ll_lru);
-        g_queue_push_head_link (cmng->q_lru, entry->ll_lru);
-    } else {
-        LOG_debug (CMNG_LOG, INO_H"Entry isn't found or doesn't contain requested range: [%"OFF_FMT": %"OFF_FMT"]",
-            INO_T (ino), off, off + size);
+        if (!block)
+            continue;
 
-        cmng->cache_miss++;
+        cache_mng_touch_block (cmng, block);
+        if (block->hits < G_MAXUINT32)
+            block->hits++;
+
+        if (block->mem) {
+            g_queue_unlink (cmng->q_mem, block->ll_mem);
+            g_queue_push_head_link (cmng->q_mem, block->ll_mem);
+        } else if (fd >= 0 || buf)
+            cache_mng_mem_admit (cmng, block, fd, buf, start, end - start);
     }
+}
 
-    context->ev = event_new (application_get_evbase (cmng->app), -1,  0,
-                    cache_read_cb, context);
-    // fire this event at once
-    event_active (context->ev, 0, 0);
-    event_add (context->ev, NULL);
+// copy [off, off + size) from the memory tier, return FALSE if any part of it isn't in memory
+static gboolean cache_mng_mem_read (CacheMng *cmng, struct _CacheEntry *entry, unsigned char *buf, size_t size, off_t off)
+{
+    guint64 end = (guint64) off + size;
+    guint64 nr;
+
+    if (!cmng->mem_size || !size)
+        return FALSE;
+
+    for (nr = (guint64) off / cmng->block_size; nr * cmng->block_size < end; nr++) {
+        struct _CacheBlock *block = g_hash_table_lookup (entry->h_blocks, &nr);
+        guint64 block_start = nr * cmng->block_size;
+
+        if (!block || !block->mem || MIN (end, block_start + cmng->block_size) > block_start + block->mem_len)
+            return FALSE;
+    }
+
+    for (nr = (guint64) off / cmng->block_size; nr * cmng->block_size < end; nr++) {
+        struct _CacheBlock *block = g_hash_table_lookup (entry->h_blocks, &nr);
+        guint64 block_start = nr * cmng->block_size;
+        guint64 from = MAX ((guint64) off, block_start);
+        guint64 to = MIN (end, block_start + cmng->block_size);
+
+        memcpy (buf + (from - off), block->mem + (from - block_start), to - from);
+    }
+
+    cache_mng_touch_blocks (cmng, entry, off, end, -1, NULL);
+    cmng->mem_hits++;
+
+    return TRUE;
 }
-/*}}}*/
 
-/*{{{ store_file_buf */
-static void cache_write_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+// the block is going to be copied to memory tier when it's read next time
+static gboolean cache_mng_mem_candidate (CacheMng *cmng, struct _CacheBlock *block)
 {
-    struct _CacheContext *context = (struct _CacheContext *) ctx;
+    return block && !block->mem && !block->entry->staged_nr && block->size &&
+        block->size <= cmng->mem_max_size && block->hits + 1 >= CMNG_MEM_ADMIT_HITS;
+}
 
-    if (context->cb.store_cb)
-        context->cb.store_cb (context->success, context->user_ctx);
+// workers don't read blocks for memory tier, [start, end) is extended to the cached data of its first and last blocks,
+// if they are going to be copied to memory tier
+static void cache_mng_mem_extend (CacheMng *cmng, struct _CacheEntry *entry, guint64 *start, guint64 *end)
+{
+    struct _CacheBlock *block;
+    guint64 nr;
 
-    cache_context_destroy (context);
+    if (!cmng->mem_max_size || *start >= *end)
+        return;
+
+    nr = *start / cmng->block_size;
+    block = g_hash_table_lookup (entry->h_blocks, &nr);
+    if (cache_mng_mem_candidate (cmng, block) && range_contain (entry->avail_range, nr * cmng->block_size, *start))
+        *start = nr * cmng->block_size;
+
+    nr = (*end - 1) / cmng->block_size;
+    block = g_hash_table_lookup (entry->h_blocks, &nr);
+    if (cache_mng_mem_candidate (cmng, block) && nr * cmng->block_size + block->size > *end &&
+        range_contain (entry->avail_range, *end, nr * cmng->block_size + block->size))
+        *end = nr * cmng->block_size + block->size;
 }
 
-// store file buffer into local storage
-// if success == TRUE then "buf" successfuly stored on disc
-void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
-    cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx)
+// data of [start, end) is stored, update the block index and the cache size
+static void cache_mng_update_blocks (CacheMng *cmng, struct _CacheEntry *entry, guint64 start, guint64 end)
 {
-    struct _CacheContext *context;
-    struct _CacheEntry *entry;
-    ssize_t res;
-    int fd;
-    char path[PATH_MAX];
-    guint64 old_length, new_length;
-    guint64 range_size;
-    time_t now;
+    guint64 nr;
 
-    range_size = (guint64)(off + size);
+    for (nr = start / cmng->block_size; nr * cmng->block_size < end; nr++) {
+        struct _CacheBlock *block = g_hash_table_lookup (entry->h_blocks, &nr);
+        guint64 size;
 
-    // limit the number of cache checks
-    now = time (NULL);
-    if (cmng->check_time < now && now - cmng->check_time >= 10) {
-        // remove data until we have at least size bytes of max_size left
-        while (cmng->max_size < cmng->size + size && g_queue_peek_tail (cmng->q_lru)) {
-            entry = (struct _CacheEntry *) g_queue_peek_tail (cmng->q_lru);
+        size = cache_entry_cached_size (entry, nr * cmng->block_size, (nr + 1) * cmng->block_size);
 
-            cache_mng_remove_file (cmng, entry->ino);
+        if (!block) {
+            block = g_new0 (struct _CacheBlock, 1);
+            block->entry = entry;
+            block->nr = nr;
+            block->size = 0;
+            block->ll_lru = NULL;
+            g_hash_table_insert (entry->h_blocks, &block->nr, block);
         }
-        cmng->check_time = now;
-    }
-
-    context = cache_context_create (size, ctx);
-    context->cb.store_cb = on_store_file_buf_cb;
 
-    cache_mng_file_name (cmng, path, sizeof (path), ino);
-    fd = open (path, O_WRONLY|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0) {
-        LOG_err (CMNG_LOG, INO_H"Failed to create / open file for writing! Path: %s", INO_T (ino), path);
-        if (context->cb.store_cb)
-            context->cb.store_cb (FALSE, context->user_ctx);
-        cache_context_destroy (context);
-        return;
-    }
-    res = pwrite(fd, buf, size, off);
-    close (fd);
+        // the memory copy is outdated
+        cache_mng_mem_drop (cmng, block);
 
-    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+        cmng->size += size - block->size;
+        block->size = size;
 
-    if (!entry) {
-        entry = cache_entry_create (ino);
-        g_queue_push_head (cmng->q_lru, entry);
-        entry->ll_lru = g_queue_peek_head_link (cmng->q_lru);
-        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
+        cache_mng_touch_block (cmng, block);
     }
+}
 
-    old_length = range_length (entry->avail_range);
-    range_add (entry->avail_range, off, range_size);
-    new_length = range_length (entry->avail_range);
-    if (new_length >= old_length)
-        cmng->size += new_length - old_length;
-    else {
-        LOG_err (CMNG_LOG, INO_H"New length is less than the old length !: %"G_GUINT64_FORMAT" <= %"G_GUINT64_FORMAT,
-            INO_T (ino), new_length, old_length);
+// remove the least recently used block, the entry is removed with its last block
+static void cache_mng_evict_block (CacheMng *cmng, struct _CacheBlock *block)
+{
+    struct _CacheEntry *entry = block->entry;
+    guint64 start = block->nr * cmng->block_size;
+
+    if (g_hash_table_size (entry->h_blocks) == 1) {
+        cache_mng_remove_file (cmng, entry->ino);
+        return;
     }
 
-    // update modification time
-    entry->modification_time = time (NULL);
+    LOG_debug (CMNG_LOG, INO_H"Evicting block [%"G_GUINT64_FORMAT"], cached bytes: %"G_GUINT64_FORMAT,
+        INO_T (entry->ino), block->nr, block->size);
 
-    context->success = (res == (ssize_t) size);
+    // the record must not refer to the removed data
+    cache_mng_entry_forget (cmng, entry);
+    cache_mng_entry_changed (cmng, entry);
 
-    LOG_debug (CMNG_LOG, INO_H"Written [%"OFF_FMT":%zu] bytes, result: %s",
-        INO_T (ino), off, size, context->success ? "OK" : "Failed");
+#ifdef FALLOC_FL_PUNCH_HOLE
+    {
+        int fd;
 
-    context->ev = event_new (application_get_evbase (cmng->app), -1,  0,
-                    cache_write_cb, context);
-    // fire this event at once
-    event_active (context->ev, 0, 0);
-    event_add (context->ev, NULL);
+        // free disk space of the block
+        fd = cache_mng_entry_fd (cmng, entry, FALSE);
+        if (fd >= 0 && fallocate (fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, cmng->block_size) != 0)
+            LOG_debug (CMNG_LOG, INO_H"Failed to punch a hole: %s", INO_T (entry->ino), strerror (errno));
+    }
+#endif
+
+    range_remove (entry->avail_range, start, start + cmng->block_size);
+    cache_mng_mem_drop (cmng, block);
+    cmng->size -= block->size;
+    if (block->ll_lru)
+        g_queue_delete_link (cmng->q_lru, block->ll_lru);
+    g_hash_table_remove (entry->h_blocks, &block->nr);
 }
-/*}}}*/
 
-/*{{{ remove_file*/
-// removes file from local storage
-void cache_mng_remove_file (CacheMng *cmng, fuse_ino_t ino)
+// call on_missing_cb for every run of consecutive blocks of [off, off + size), which data isn't cached
+// runs are aligned to blocks, a block is missing if its part which is inside the range isn't cached
+void cache_mng_foreach_missing_block (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
+    cache_mng_on_missing_block_cb on_missing_cb, void *ctx)
 {
     struct _CacheEntry *entry;
-    char path[PATH_MAX];
+    guint64 end = (guint64) off + size;
+    guint64 nr;
+    guint64 run_start = 0, run_end = 0;
 
     entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
-    if (entry) {
-        cmng->size -= range_length (entry->avail_range);
-        g_queue_delete_link (cmng->q_lru, entry->ll_lru);
-        g_hash_table_remove (cmng->h_entries, GUINT_TO_POINTER (ino));
-        cache_mng_file_name (cmng, path, sizeof (path), ino);
-        unlink (path);
+
+    for (nr = (guint64) off / cmng->block_size; nr * cmng->block_size < end; nr++) {
+        guint64 block_start = nr * cmng->block_size;
+        guint64 block_end = block_start + cmng->block_size;
+
+        if (entry && range_contain (entry->avail_range, MAX (block_start, (guint64) off), MIN (block_end, end)))
+            continue;
+
+        // extend the current run
+        if (run_end && run_end == block_start) {
+            run_end = block_end;
+            continue;
+        }
+
+        if (run_end)
+            on_missing_cb (run_start, run_end - run_start, ctx);
+        run_start = block_start;
+        run_end = block_end;
+    }
+
+    if (run_end)
+        on_missing_cb (run_start, run_end - run_start, ctx);
+}
+/*}}}*/
+
+/*{{{ cache I/O */
+// disk I/O of the cache is done by "filesystem.cache_io_threads" worker threads, so a slow disk doesn't stall the event loop
+// jobs of a cache file are done in order by the same worker, finished jobs are passed back to the event loop by io_pipe
+// ranges and blocks are updated when a job is submitted, a read of stored data is queued after the write
+
+// return descriptor for a job, workers get a copy of it, so the cached one can be closed while the job is queued
+static int cache_mng_io_fd (CacheMng *cmng, struct _CacheEntry *entry, gboolean create)
+{
+    int fd;
+
+    fd = cache_mng_entry_fd (cmng, entry, create);
+    if (fd < 0 || !cmng->io_pools_nr)
+        return fd;
+
+    return dup (fd);
+}
+
+static struct _CacheIO *cache_io_create (CacheMng *cmng, CacheIOType type, int fd, struct _CacheEntry *entry,
+    size_t size, off_t off, struct _CacheContext *context)
+{
+    struct _CacheIO *io = g_new0 (struct _CacheIO, 1);
+
+    io->type = type;
+    io->fd = fd;
+    io->own_fd = (cmng->io_pools_nr > 0);
+    io->ino = entry->ino;
+    io->id = entry->id;
+    io->writes = entry->writes;
+    io->persist_gen = entry->persist_gen;
+    io->size = size;
+    io->off = off;
+    io->buf_off = off;
+    io->buf_len = size;
+    io->context = context;
+
+    return io;
+}
+
+static void cache_io_destroy (struct _CacheIO *io)
+{
+    if (io->own_fd && io->fd >= 0)
+        close (io->fd);
+    if (io->a_segments)
+        g_array_free (io->a_segments, TRUE);
+    if (io->own_buf)
+        g_free (io->buf);
+    g_free (io);
+}
+
+// do the job, it's called by a worker thread (or on the event loop if there are no workers)
+static void cache_io_run (struct _CacheIO *io)
+{
+    ssize_t res;
+
+    if (io->type == CMNG_IO_BARRIER) {
+        io->success = TRUE;
+    } else if (io->type == CMNG_IO_SYNC) {
+        io->success = (fdatasync (io->fd) == 0);
+    } else if (io->type == CMNG_IO_READ || io->type == CMNG_IO_ADMIT) {
+        res = pread (io->fd, io->buf, io->buf_len, io->buf_off);
+        io->success = (res == (ssize_t) io->buf_len);
+    } else if (io->a_segments) {
+        guint i;
+
+        io->success = TRUE;
+        for (i = 0; i + 1 < io->a_segments->len; i += 2) {
+            guint64 start = g_array_index (io->a_segments, guint64, i);
+            guint64 end = g_array_index (io->a_segments, guint64, i + 1);
+
+            res = pwrite (io->fd, io->buf + (start - io->off), end - start, start);
+            if (res != (ssize_t) (end - start))
+                io->success = FALSE;
+        }
+    } else {
+        res = pwrite (io->fd, io->buf, io->size, io->off);
+        io->success = (res == (ssize_t) io->size);
+    }
+}
+
+static void cache_io_worker (gpointer data, gpointer user_data)
+{
+    struct _CacheIO *io = (struct _CacheIO *) data;
+    CacheMng *cmng = (CacheMng *) user_data;
+    char c = 0;
+
+    cache_io_run (io);
+    if (io->fd >= 0)
+        close (io->fd);
+    io->fd = -1;
+
+    g_async_queue_push (cmng->q_io_done, io);
+    if (write (cmng->io_pipe[1], &c, 1) != 1) {
+        // the pipe is full, the event loop is woken up anyway
+    }
+}
+
+static guint cache_mng_io_pending (CacheMng *cmng, guint64 id)
+{
+    if (!cmng->h_io_pending)
+        return 0;
+
+    return GPOINTER_TO_UINT (g_hash_table_lookup (cmng->h_io_pending, &id));
+}
+
+static void cache_mng_io_pending_add (CacheMng *cmng, guint64 id, gint n)
+{
+    guint pending = cache_mng_io_pending (cmng, id) + n;
+    guint64 *key;
+
+    if (pending) {
+        key = g_new (guint64, 1);
+        *key = id;
+        g_hash_table_replace (cmng->h_io_pending, key, GUINT_TO_POINTER (pending));
+    } else
+        g_hash_table_remove (cmng->h_io_pending, &id);
+}
+
+// write to the staged file failed, its ranges don't claim the data any more
+static void cache_mng_io_rollback (CacheMng *cmng, struct _CacheEntry *entry, struct _CacheIO *io)
+{
+    guint i;
+
+    if (io->a_segments) {
+        for (i = 0; i + 1 < io->a_segments->len; i += 2)
+            range_remove (entry->avail_range, g_array_index (io->a_segments, guint64, i),
+                g_array_index (io->a_segments, guint64, i + 1));
+    } else {
+        range_remove (entry->avail_range, io->off, io->off + io->size);
+        if (io->dirty)
+            range_remove (entry->dirty_range, io->off, io->off + io->size);
+    }
+
+    cache_mng_update_blocks (cmng, entry, io->off, io->off + io->size);
+    entry->writes++;
+}
+
+// job is finished, update the entry and notify the caller
+static void cache_mng_io_done (CacheMng *cmng, struct _CacheIO *io)
+{
+    struct _CacheContext *context = io->context;
+    struct _CacheEntry *entry;
+
+    if (cmng->io_pools_nr && !--cmng->io_in_flight)
+        event_del (cmng->ev_io_done);
+
+    // the entry could be removed or replaced while the job was running
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (io->ino));
+    if (entry && entry->id != io->id)
+        entry = NULL;
+
+    if (io->type == CMNG_IO_SYNC) {
+        cache_mng_on_entry_synced (cmng, entry, io);
+        cache_io_destroy (io);
+        return;
+    }
+
+    if (io->type == CMNG_IO_ADMIT) {
+        guint64 nr = io->off / cmng->block_size;
+        struct _CacheBlock *block = entry ? g_hash_table_lookup (entry->h_blocks, &nr) : NULL;
+
+        // data read before the last store isn't copied to memory tier
+        if (block) {
+            block->mem_loading = FALSE;
+            if (io->success && entry->writes == io->writes)
+                cache_mng_mem_admit (cmng, block, -1, io->buf, io->buf_off, io->buf_len);
+        }
+        cache_io_destroy (io);
+        return;
+    }
+
+    if (io->type == CMNG_IO_BARRIER) {
+        // the range could be removed if one of the previous writes failed
+        if (entry && range_contain (entry->avail_range, io->off, io->off + io->size))
+            context->fd = cache_mng_range_fd (cmng, entry, io->size, io->off);
+    } else if (io->type == CMNG_IO_WRITE) {
+        LOG_debug (CMNG_LOG, INO_H"Written [%"OFF_FMT":%zu] bytes, result: %s",
+            INO_T (io->ino), io->off, io->size, io->success ? "OK" : "Failed");
+
+        // ranges are already updated, they don't match the file any more
+        if (!io->success && entry) {
+            if (entry->staged_nr)
+                cache_mng_io_rollback (cmng, entry, io);
+            else
+                cache_mng_remove_file (cmng, io->ino);
+        }
+    } else {
+        LOG_debug (CMNG_LOG, INO_H"Read [%"OFF_FMT":%zu] bytes, result: %s",
+            INO_T (io->ino), io->off, io->size, io->success ? "OK" : "Failed");
+
+        if (io->success) {
+            cmng->cache_hits++;
+            // data read before the last store isn't copied to memory tier
+            if (entry)
+                cache_mng_touch_blocks (cmng, entry, io->buf_off, io->buf_off + io->buf_len, io->fd,
+                    entry->writes == io->writes ? io->buf : NULL);
+
+            if (io->buf_off == (guint64) io->off && io->buf_len == io->size) {
+                context->buf = io->buf;
+                io->own_buf = FALSE;
+            } else {
+                context->buf = g_malloc (io->size);
+                memcpy (context->buf, io->buf + (io->off - io->buf_off), io->size);
+            }
+        } else
+            cmng->cache_miss++;
+    }
+
+    context->success = io->success;
+    cache_io_destroy (io);
+
+    // fire this event at once
+    event_active (context->ev, 0, 0);
+    event_add (context->ev, NULL);
+}
+
+static void cache_mng_on_io_done_cb (evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    CacheMng *cmng = (CacheMng *) ctx;
+    struct _CacheIO *io;
+    char buf[64];
+
+    // pipe is drained first, jobs which are finished after it wake up the event loop again
+    while (read (fd, buf, sizeof (buf)) > 0);
+
+    while ((io = (struct _CacheIO *) g_async_queue_try_pop (cmng->q_io_done))) {
+        cache_mng_io_pending_add (cmng, io->id, -1);
+        cache_mng_io_done (cmng, io);
+    }
+}
+
+// submit the job, context->ev is fired when it's finished
+static void cache_mng_io_submit (CacheMng *cmng, struct _CacheIO *io)
+{
+    if (!cmng->io_pools_nr) {
+        cache_io_run (io);
+        cache_mng_io_done (cmng, io);
+        return;
+    }
+
+    if (!cmng->io_in_flight++)
+        event_add (cmng->ev_io_done, NULL);
+    cache_mng_io_pending_add (cmng, io->id, 1);
+
+    g_thread_pool_push (cmng->a_io_pools[io->id % cmng->io_pools_nr], io, NULL);
+}
+
+static gboolean cache_mng_io_start (CacheMng *cmng, guint threads)
+{
+    guint i;
+
+    // disk I/O is done on the event loop
+    if (!threads)
+        return TRUE;
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+#endif
+
+    if (pipe (cmng->io_pipe) != 0) {
+        LOG_err (CMNG_LOG, "Failed to create pipe: %s", strerror (errno));
+        cmng->io_pipe[0] = cmng->io_pipe[1] = -1;
+        return FALSE;
+    }
+    evutil_make_socket_nonblocking (cmng->io_pipe[0]);
+    evutil_make_socket_nonblocking (cmng->io_pipe[1]);
+
+    cmng->q_io_done = g_async_queue_new ();
+    cmng->h_io_pending = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+    cmng->ev_io_done = event_new (application_get_evbase (cmng->app), cmng->io_pipe[0], EV_READ | EV_PERSIST,
+        cache_mng_on_io_done_cb, cmng);
+
+    cmng->a_io_pools = g_new0 (GThreadPool *, threads);
+    for (i = 0; i < threads; i++) {
+        GError *err = NULL;
+
+        // a single thread per pool keeps jobs of a file in order
+        cmng->a_io_pools[i] = g_thread_pool_new (cache_io_worker, cmng, 1, TRUE, &err);
+        if (!cmng->a_io_pools[i]) {
+            LOG_err (CMNG_LOG, "Failed to create thread pool: %s", err ? err->message : "");
+            if (err)
+                g_error_free (err);
+            return FALSE;
+        }
+        cmng->io_pools_nr++;
+    }
+
+    LOG_debug (CMNG_LOG, "Cache I/O threads: %u", threads);
+
+    return TRUE;
+}
+
+// wait for the jobs, callers of unfinished jobs are not notified
+static void cache_mng_io_stop (CacheMng *cmng)
+{
+    struct _CacheIO *io;
+    guint i;
+
+    for (i = 0; i < cmng->io_pools_nr; i++)
+        g_thread_pool_free (cmng->a_io_pools[i], FALSE, TRUE);
+    g_free (cmng->a_io_pools);
+    cmng->a_io_pools = NULL;
+    cmng->io_pools_nr = 0;
+
+    if (cmng->q_io_done) {
+        while ((io = (struct _CacheIO *) g_async_queue_try_pop (cmng->q_io_done))) {
+            cache_context_destroy (io->context);
+            cache_io_destroy (io);
+        }
+        g_async_queue_unref (cmng->q_io_done);
+        cmng->q_io_done = NULL;
+    }
+
+    if (cmng->h_io_pending) {
+        g_hash_table_destroy (cmng->h_io_pending);
+        cmng->h_io_pending = NULL;
+    }
+
+    if (cmng->ev_io_done) {
+        event_free (cmng->ev_io_done);
+        cmng->ev_io_done = NULL;
+    }
+    cmng->io_in_flight = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (cmng->io_pipe[i] >= 0)
+            close (cmng->io_pipe[i]);
+        cmng->io_pipe[i] = -1;
+    }
+}
+
+// disk I/O is done by worker threads
+gboolean cache_mng_is_async (CacheMng *cmng)
+{
+    return cmng->io_pools_nr > 0;
+}
+/*}}}*/
+
+/*{{{ retrieve_file_buf */
+static void cache_read_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    struct _CacheContext *context = (struct _CacheContext *) ctx;
+
+    if (context->cb.retrieve_cb)
+        context->cb.retrieve_cb (context->buf, context->size, context->success, context->user_ctx);
+    cache_context_destroy (context);
+}
+
+// retrieve file buffer from local storage
+// if success == TRUE then "buf" contains "size" bytes of data
+void cache_mng_retrieve_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
+    cache_mng_on_retrieve_file_buf_cb on_retrieve_file_buf_cb, void *ctx)
+{
+    struct _CacheContext *context;
+    struct _CacheEntry *entry;
+
+    context = cache_context_create (size, ctx);
+    context->cb.retrieve_cb = on_retrieve_file_buf_cb;
+    context->ev = event_new (application_get_evbase (cmng->app), -1,  0,
+                    cache_read_cb, context);
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+
+    if (entry && range_contain (entry->avail_range, off, off + size)) {
+        struct _CacheIO *io;
+        guint64 start = off, end = off + size;
+        int fd;
+
+        if (ino != entry->ino) {
+            LOG_err (CMNG_LOG, INO_H"Requested inode doesn't match hashed key!", INO_T (ino));
+            if (context->cb.retrieve_cb)
+                context->cb.retrieve_cb (NULL, 0, FALSE, context->user_ctx);
+            cache_context_destroy (context);
+            cmng->cache_miss++;
+            return;
+        }
+
+        context->buf = g_malloc (size);
+
+        // hot data is copied from memory tier
+        if (cache_mng_mem_read (cmng, entry, context->buf, size, off)) {
+            LOG_debug (CMNG_LOG, INO_H"Read [%"OFF_FMT":%zu] bytes from memory", INO_T (ino), off, size);
+            context->success = TRUE;
+        } else {
+            g_free (context->buf);
+            context->buf = NULL;
+
+            fd = cache_mng_io_fd (cmng, entry, FALSE);
+            if (fd < 0) {
+                LOG_err (CMNG_LOG, INO_H"Failed to open file for reading!", INO_T (ino));
+                if (context->cb.retrieve_cb)
+                    context->cb.retrieve_cb (NULL, 0, FALSE, context->user_ctx);
+                cache_context_destroy (context);
+                cmng->cache_miss++;
+                return;
+            }
+
+            // without workers the blocks are read from fd when they are copied to memory tier
+            if (cmng->io_pools_nr)
+                cache_mng_mem_extend (cmng, entry, &start, &end);
+
+            io = cache_io_create (cmng, CMNG_IO_READ, fd, entry, size, off, context);
+            io->buf_off = start;
+            io->buf_len = end - start;
+            io->buf = g_malloc (io->buf_len);
+            io->own_buf = TRUE;
+            cache_mng_io_submit (cmng, io);
+            return;
+        }
+    } else {
+        LOG_debug (CMNG_LOG, INO_H"Entry isn't found or doesn't contain requested range: [%"OFF_FMT": %"OFF_FMT"]",
+            INO_T (ino), off, off + size);
+
+        cmng->cache_miss++;
+    }
+
+    // fire this event at once
+    event_active (context->ev, 0, 0);
+    event_add (context->ev, NULL);
+}
+
+// caller gets a copy of the cached descriptor, [off, off + size) of the entry is on the disk
+static int cache_mng_range_fd (CacheMng *cmng, struct _CacheEntry *entry, size_t size, off_t off)
+{
+    int fd;
+
+    fd = cache_mng_entry_fd (cmng, entry, FALSE);
+    if (fd >= 0)
+        fd = dup (fd);
+    if (fd < 0) {
+        LOG_err (CMNG_LOG, INO_H"Failed to open file for reading!", INO_T (entry->ino));
+        return -1;
+    }
+
+    LOG_debug (CMNG_LOG, INO_H"Opened [%"OFF_FMT":%zu] bytes for reading", INO_T (entry->ino), off, size);
+
+    cmng->cache_hits++;
+
+    cache_mng_touch_blocks (cmng, entry, off, off + size, fd, NULL);
+
+    return fd;
+}
+
+// open cached file, so the data can be sent to FUSE without copying it to user space
+// cache miss isn't counted here, caller falls back to cache_mng_retrieve_file_buf ()
+int cache_mng_get_file_fd (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || !range_contain (entry->avail_range, off, off + size))
+        return -1;
+
+    // stored data isn't on the disk yet, see cache_mng_get_file_fd_async ()
+    if (cache_mng_io_pending (cmng, entry->id)) {
+        LOG_debug (CMNG_LOG, INO_H"File has unfinished jobs", INO_T (ino));
+        return -1;
+    }
+
+    return cache_mng_range_fd (cmng, entry, size, off);
+}
+
+static void cache_file_fd_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    struct _CacheContext *context = (struct _CacheContext *) ctx;
+    int file_fd = context->fd;
+
+    // the callback owns the descriptor
+    context->fd = -1;
+    if (context->cb.file_fd_cb)
+        context->cb.file_fd_cb (file_fd, context->user_ctx);
+    else if (file_fd >= 0)
+        close (file_fd);
+
+    cache_context_destroy (context);
+}
+
+// the descriptor is returned when the jobs of the file, which are submitted before, are finished
+void cache_mng_get_file_fd_async (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off,
+    cache_mng_on_file_fd_cb on_file_fd_cb, void *ctx)
+{
+    struct _CacheContext *context;
+    struct _CacheEntry *entry;
+
+    context = cache_context_create (size, ctx);
+    context->cb.file_fd_cb = on_file_fd_cb;
+    context->ev = event_new (application_get_evbase (cmng->app), -1,  0,
+                    cache_file_fd_cb, context);
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (entry && range_contain (entry->avail_range, off, off + size)) {
+        if (cache_mng_io_pending (cmng, entry->id)) {
+            cache_mng_io_submit (cmng, cache_io_create (cmng, CMNG_IO_BARRIER, -1, entry, size, off, context));
+            return;
+        }
+        context->fd = cache_mng_range_fd (cmng, entry, size, off);
+    }
+
+    // fire this event at once
+    event_active (context->ev, 0, 0);
+    event_add (context->ev, NULL);
+}
+
+// copy [off, off + size) from the memory tier, return FALSE if any part of it isn't in memory
+gboolean cache_mng_read_mem (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry)
+        return FALSE;
+
+    return cache_mng_mem_read (cmng, entry, buf, size, off);
+}
+/*}}}*/
+
+/*{{{ store_file_buf */
+static void cache_write_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    struct _CacheContext *context = (struct _CacheContext *) ctx;
+
+    if (context->cb.store_cb)
+        context->cb.store_cb (context->success, context->user_ctx);
+
+    cache_context_destroy (context);
+}
+
+// only the parts of the buffer, which don't overwrite dirty data, are written
+static void cache_mng_store_gap_cb (guint64 start, guint64 end, gpointer ctx)
+{
+    GArray *a_segments = (GArray *) ctx;
+
+    g_array_append_val (a_segments, start);
+    g_array_append_val (a_segments, end);
+}
+
+// downloaded data must not overwrite ranges of staged file, which are written by the client
+static void cache_mng_store_file_buf_full (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
+    gboolean dirty, cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx)
+{
+    struct _CacheContext *context;
+    struct _CacheEntry *entry;
+    struct _CacheIO *io;
+    int fd;
+    guint64 range_size;
+    time_t now;
+
+    range_size = (guint64)(off + size);
+
+    // limit the number of cache checks
+    now = time (NULL);
+    if (cmng->check_time < now && now - cmng->check_time >= 10) {
+        // data of previous mounts which isn't used yet is removed first
+        while (cmng->max_size < cmng->size + size && g_queue_peek_head (cmng->q_records))
+            cache_mng_evict_record (cmng, (struct _CacheRecord *) g_queue_peek_head (cmng->q_records));
+        // remove the least recently used blocks until we have at least size bytes of max_size left
+        while (cmng->max_size < cmng->size + size && g_queue_peek_tail (cmng->q_lru))
+            cache_mng_evict_block (cmng, (struct _CacheBlock *) g_queue_peek_tail (cmng->q_lru));
+        cmng->check_time = now;
+    }
+
+    context = cache_context_create (size, ctx);
+    context->cb.store_cb = on_store_file_buf_cb;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry) {
+        entry = cache_entry_create (cmng, ino);
+        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
+    }
+
+    // data written by the client doesn't match the object any more
+    if (dirty)
+        cache_mng_entry_unkey (cmng, entry);
+
+    fd = cache_mng_io_fd (cmng, entry, TRUE);
+    if (fd < 0) {
+        LOG_err (CMNG_LOG, INO_H"Failed to create / open file for writing!", INO_T (ino));
+        if (context->cb.store_cb)
+            context->cb.store_cb (FALSE, context->user_ctx);
+        cache_context_destroy (context);
+        return;
+    }
+
+    io = cache_io_create (cmng, CMNG_IO_WRITE, fd, entry, size, off, context);
+    io->dirty = dirty;
+    if (!dirty && entry->dirty_range && range_intersect (entry->dirty_range, off, off + size)) {
+        io->a_segments = g_array_new (FALSE, FALSE, sizeof (guint64));
+        range_foreach_gap (entry->dirty_range, off, off + size, cache_mng_store_gap_cb, io->a_segments);
+    }
+    // workers write a copy, the caller's buffer can be released as soon as this function returns
+    if (cmng->io_pools_nr) {
+        io->buf = g_malloc (size);
+        memcpy (io->buf, buf, size);
+        io->own_buf = TRUE;
+    } else
+        io->buf = buf;
+
+    if (dirty && entry->dirty_range)
+        range_add (entry->dirty_range, off, range_size);
+
+    range_add (entry->avail_range, off, range_size);
+    cache_mng_update_blocks (cmng, entry, off, range_size);
+    cache_mng_entry_changed (cmng, entry);
+    entry->writes++;
+
+    // update modification time
+    entry->modification_time = time (NULL);
+
+    context->ev = event_new (application_get_evbase (cmng->app), -1,  0,
+                    cache_write_cb, context);
+    cache_mng_io_submit (cmng, io);
+}
+
+// store file buffer into local storage
+// if success == TRUE then "buf" successfuly stored on disc
+void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
+    cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx)
+{
+    cache_mng_store_file_buf_full (cmng, ino, size, off, buf, FALSE, on_store_file_buf_cb, ctx);
+}
+
+// store data written by the client, it's marked as dirty if the file is staged
+void cache_mng_write_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
+    cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx)
+{
+    cache_mng_store_file_buf_full (cmng, ino, size, off, buf, TRUE, on_store_file_buf_cb, ctx);
+}
+/*}}}*/
+
+/*{{{ staging */
+// file is used as write-back staging file: it's not evicted and dirty ranges are tracked
+void cache_mng_stage_file (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry) {
+        entry = cache_entry_create (cmng, ino);
+        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
+    } else if (!entry->staged_nr) {
+        GHashTableIter iter;
+        gpointer value;
+
+        // staged file is going to be modified
+        cache_mng_entry_unkey (cmng, entry);
+
+        // blocks of the staged file are not evicted
+        g_hash_table_iter_init (&iter, entry->h_blocks);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+            struct _CacheBlock *block = (struct _CacheBlock *) value;
+
+            if (block->ll_lru)
+                g_queue_delete_link (cmng->q_lru, block->ll_lru);
+            block->ll_lru = NULL;
+        }
+    }
+
+    if (!entry->dirty_range)
+        entry->dirty_range = range_create ();
+    entry->staged_nr++;
+
+    LOG_debug (CMNG_LOG, INO_H"Entry is staged", INO_T (ino));
+}
+
+// staged file is uploaded (or discarded), it can be evicted again
+void cache_mng_unstage_file (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+    GHashTableIter iter;
+    gpointer value;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || !entry->staged_nr)
+        return;
+
+    entry->staged_nr--;
+    if (entry->staged_nr)
+        return;
+
+    range_destroy (entry->dirty_range);
+    entry->dirty_range = NULL;
+
+    g_hash_table_iter_init (&iter, entry->h_blocks);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        cache_mng_touch_block (cmng, (struct _CacheBlock *) value);
+
+    LOG_debug (CMNG_LOG, INO_H"Entry is unstaged", INO_T (ino));
+}
+
+// check if any part of the range was written by the client
+gboolean cache_mng_is_dirty (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || !entry->dirty_range)
+        return FALSE;
+
+    return range_intersect (entry->dirty_range, off, off + size);
+}
+
+// data stored by cache_mng_store_file_buf () is written by the client, the file must be staged
+void cache_mng_mark_dirty (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || !entry->dirty_range)
+        return;
+
+    // data written by the client doesn't match the object any more
+    cache_mng_entry_unkey (cmng, entry);
+    range_add (entry->dirty_range, off, off + size);
+}
+/*}}}*/
+
+/*{{{ remove_file*/
+// removes file from local storage
+void cache_mng_remove_file (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+    char path[PATH_MAX];
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (entry) {
+        GHashTableIter iter;
+        gpointer value;
+
+        cache_mng_entry_forget (cmng, entry);
+        // unfinished jobs use their own copies of the descriptor
+        cache_mng_entry_close_fd (cmng, entry);
+        cache_mng_file_name (cmng, path, sizeof (path), entry->id);
+
+        g_hash_table_iter_init (&iter, entry->h_blocks);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+            struct _CacheBlock *block = (struct _CacheBlock *) value;
+
+            cache_mng_mem_drop (cmng, block);
+            cmng->size -= block->size;
+            if (block->ll_lru)
+                g_queue_delete_link (cmng->q_lru, block->ll_lru);
+        }
+        g_hash_table_remove (cmng->h_entries, GUINT_TO_POINTER (ino));
+        unlink (path);
         LOG_debug (CMNG_LOG, INO_H"Entry is removed", INO_T (ino));
     } else {
-        LOG_debug (CMNG_LOG, INO_H"Entry not found", INO_T (ino));
+        LOG_debug (CMNG_LOG, INO_H"Entry not found", INO_T (ino));
+    }
+}
+
+static void cache_mng_discard_gap_cb (guint64 start, guint64 end, gpointer ctx)
+{
+    range_remove ((Range *) ctx, start, end);
+}
+
+// cached data belongs to another version of the object, the data written by the client is kept
+void cache_mng_discard_clean (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+    GHashTableIter iter;
+    gpointer value;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry)
+        return;
+
+    // nothing is written to the file which isn't staged
+    if (!entry->staged_nr) {
+        cache_mng_remove_file (cmng, ino);
+        return;
+    }
+
+    cache_mng_entry_unkey (cmng, entry);
+    g_free (entry->etag);
+    entry->etag = NULL;
+
+    range_foreach_gap (entry->dirty_range, 0, G_MAXUINT64, cache_mng_discard_gap_cb, entry->avail_range);
+    // data read before isn't copied to memory tier
+    entry->writes++;
+
+    g_hash_table_iter_init (&iter, entry->h_blocks);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct _CacheBlock *block = (struct _CacheBlock *) value;
+        guint64 size;
+
+        size = cache_entry_cached_size (entry, block->nr * cmng->block_size, (block->nr + 1) * cmng->block_size);
+        cache_mng_mem_drop (cmng, block);
+        cmng->size -= block->size - size;
+        block->size = size;
+
+        if (!size) {
+            if (block->ll_lru)
+                g_queue_delete_link (cmng->q_lru, block->ll_lru);
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+    LOG_debug (CMNG_LOG, INO_H"Clean data is discarded, dirty bytes: %"G_GUINT64_FORMAT,
+        INO_T (ino), range_length (entry->avail_range));
+}
+
+// cached data of the file is moved to the new inode (file is renamed)
+// staged files are not moved, they are uploaded under the old name
+gboolean cache_mng_rename_file (CacheMng *cmng, fuse_ino_t ino, fuse_ino_t new_ino)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || entry->staged_nr || ino == new_ino)
+        return FALSE;
+
+    // data of the target is outdated
+    cache_mng_remove_file (cmng, new_ino);
+
+    // the object path is changed, the entry is attached again when the new object is read
+    cache_mng_entry_unkey (cmng, entry);
+
+    // the cache file is named by the entry id, it's kept as is
+    g_hash_table_steal (cmng->h_entries, GUINT_TO_POINTER (ino));
+    entry->ino = new_ino;
+    g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (new_ino), entry);
+
+    LOG_debug (CMNG_LOG, INO_H"Entry is moved to ino: %"INO_FMT, INO_T (ino), INO new_ino);
+
+    return TRUE;
+}
+/*}}}*/
+
+/*{{{ persistent cache */
+// cached objects are kept in "<cache_dir>/persistent-<bucket name>" between mounts
+// entries are identified by object path and ETag, inodes are attached to them by cache_mng_attach_file ()
+// journal contains "A <id> <etag> <ranges> <path>" when data of the entry is stored and flushed to the disk,
+// "D <id>" is appended and flushed before the data is changed or removed
+static gboolean cache_mng_open_persistent (CacheMng *cmng)
+{
+    gchar *lock_path;
+
+    cmng->cache_dir = g_strdup_printf ("%s/persistent-%s",
+        conf_get_string (application_get_conf (cmng->app), "filesystem.cache_dir"),
+        conf_get_string (application_get_conf (cmng->app), "s3.bucket_name"));
+
+    if (g_mkdir_with_parents (cmng->cache_dir, 0700) != 0) {
+        LOG_err (CMNG_LOG, "Failed to create directory: %s", cmng->cache_dir);
+        g_free (cmng->cache_dir);
+        cmng->cache_dir = NULL;
+        return FALSE;
+    }
+
+    // the directory can't be shared with another mount of the same bucket
+    lock_path = g_build_filename (cmng->cache_dir, CMNG_LOCK, NULL);
+    cmng->lock_fd = open (lock_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (cmng->lock_fd < 0 || flock (cmng->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        LOG_err (CMNG_LOG, "Failed to lock persistent cache directory %s, using temporary cache: %s",
+            cmng->cache_dir, strerror (errno));
+        if (cmng->lock_fd >= 0)
+            close (cmng->lock_fd);
+        cmng->lock_fd = -1;
+        g_free (lock_path);
+        g_free (cmng->cache_dir);
+        cmng->cache_dir = NULL;
+        return FALSE;
+    }
+    g_free (lock_path);
+
+    LOG_debug (CMNG_LOG, "Using persistent cache directory: %s", cmng->cache_dir);
+
+    return TRUE;
+}
+
+// append the line to the journal, lines are written by a single write () call
+static gboolean cache_mng_index_write (CacheMng *cmng, const gchar *line, gboolean sync)
+{
+    size_t len = strlen (line);
+
+    if (cmng->index_fd < 0 || write (cmng->index_fd, line, len) != (ssize_t) len) {
+        LOG_err (CMNG_LOG, "Failed to write cache index: %s", strerror (errno));
+        return FALSE;
+    }
+
+    if (sync && fdatasync (cmng->index_fd) != 0) {
+        LOG_err (CMNG_LOG, "Failed to flush cache index: %s", strerror (errno));
+        return FALSE;
+    }
+
+    cmng->index_records++;
+
+    return TRUE;
+}
+
+// removal can't be recorded: all records are dropped, rather than referring to changed data
+static void cache_mng_index_drop (CacheMng *cmng)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    LOG_err (CMNG_LOG, "Dropping cache index !");
+
+    if (cmng->index_fd < 0 || ftruncate (cmng->index_fd, 0) != 0 || fdatasync (cmng->index_fd) != 0)
+        LOG_err (CMNG_LOG, "Failed to truncate cache index: %s", strerror (errno));
+
+    // they are written again by the next sync
+    g_hash_table_iter_init (&iter, cmng->h_entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct _CacheEntry *entry = (struct _CacheEntry *) value;
+
+        entry->persisted = FALSE;
+        if (entry->path)
+            entry->persist_dirty = TRUE;
+    }
+}
+
+static void cache_mng_index_write_remove (CacheMng *cmng, guint64 id)
+{
+    gchar *line;
+
+    line = g_strdup_printf ("D %"G_GUINT64_FORMAT"\n", id);
+    if (!cache_mng_index_write (cmng, line, TRUE))
+        cache_mng_index_drop (cmng);
+    g_free (line);
+}
+
+static void cache_mng_range_print_cb (guint64 start, guint64 end, gpointer ctx)
+{
+    GString *str = (GString *) ctx;
+
+    g_string_append_printf (str, "%s%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, str->len ? "," : "", start, end);
+}
+
+static void cache_mng_index_print_record (GString *str, guint64 id, const gchar *etag, const gchar *path, Range *range)
+{
+    GString *ranges;
+
+    ranges = g_string_new (NULL);
+    range_foreach (range, cache_mng_range_print_cb, ranges);
+    g_string_append_printf (str, "A %"G_GUINT64_FORMAT" %s %s %s\n", id, etag, ranges->len ? ranges->str : "-", path);
+    g_string_free (ranges, TRUE);
+}
+
+// flush data of the entry to the disk, the record must not be written before it
+// it's called when there are no jobs: the cache is being opened or closed
+static gboolean cache_mng_entry_sync_data (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    int fd;
+
+    if (entry->persisted && !entry->persist_dirty)
+        return TRUE;
+
+    fd = cache_mng_entry_fd (cmng, entry, FALSE);
+    if (fd < 0)
+        return FALSE;
+
+    return (fdatasync (fd) == 0);
+}
+
+// flush data of the entry to the disk by a worker, the record is written by cache_mng_on_entry_synced ()
+static void cache_mng_entry_sync (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    int fd;
+
+    fd = cache_mng_io_fd (cmng, entry, FALSE);
+    if (fd < 0)
+        return;
+
+    cmng->index_syncs++;
+    cache_mng_io_submit (cmng, cache_io_create (cmng, CMNG_IO_SYNC, fd, entry, 0, 0, NULL));
+}
+
+// the record of the entry is removed before its data is changed or removed
+static void cache_mng_entry_forget (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    // the record of data which is flushed now is outdated
+    entry->persist_gen++;
+
+    if (!entry->persisted)
+        return;
+
+    cache_mng_index_write_remove (cmng, entry->id);
+    entry->persisted = FALSE;
+}
+
+// cached data doesn't match the object any more, the entry isn't kept between mounts
+static void cache_mng_entry_unkey (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    if (!entry->path)
+        return;
+
+    cache_mng_entry_forget (cmng, entry);
+    g_free (entry->path);
+    entry->path = NULL;
+    entry->persist_dirty = FALSE;
+
+    LOG_debug (CMNG_LOG, INO_H"Entry is not persisted", INO_T (entry->ino));
+}
+
+// data of the persisted entry is changed, its record is written later
+static void cache_mng_entry_changed (CacheMng *cmng, struct _CacheEntry *entry)
+{
+    struct timeval tv;
+
+    entry->persist_gen++;
+
+    if (!entry->path)
+        return;
+
+    entry->persist_dirty = TRUE;
+
+    if (evtimer_pending (cmng->ev_index_sync, NULL))
+        return;
+
+    tv.tv_sec = CMNG_INDEX_SYNC_SEC;
+    tv.tv_usec = 0;
+    evtimer_add (cmng->ev_index_sync, &tv);
+}
+
+// data of the previous mount is removed to free space
+static void cache_mng_evict_record (CacheMng *cmng, struct _CacheRecord *record)
+{
+    char path[PATH_MAX];
+
+    LOG_debug (CMNG_LOG, "Evicting %s of the previous mount, cached bytes: %"G_GUINT64_FORMAT,
+        record->path, record->size);
+
+    // the journal is rewritten anyway while it's being loaded
+    if (cmng->index_fd >= 0)
+        cache_mng_index_write_remove (cmng, record->id);
+
+    cache_mng_file_name (cmng, path, sizeof (path), record->id);
+    unlink (path);
+
+    cmng->size -= record->size;
+    g_queue_delete_link (cmng->q_records, record->ll_records);
+    g_hash_table_remove (cmng->h_records, record->key);
+}
+
+// rewrite the journal, it contains records of all persisted data only
+// if sync_data is FALSE, records of changed entries are dropped, they are written by the next sync
+static gboolean cache_mng_index_compact (CacheMng *cmng, gboolean sync_data)
+{
+    GString *str;
+    GHashTableIter iter;
+    gpointer value;
+    GList *l;
+    gchar *path;
+    gchar *tmp_path;
+    int fd;
+    gboolean res;
+
+    str = g_string_new (NULL);
+
+    g_hash_table_iter_init (&iter, cmng->h_entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct _CacheEntry *entry = (struct _CacheEntry *) value;
+
+        if (!entry->path)
+            continue;
+
+        if ((!entry->persisted || entry->persist_dirty) && (!sync_data || !cache_mng_entry_sync_data (cmng, entry))) {
+            entry->persisted = FALSE;
+            continue;
+        }
+
+        cache_mng_index_print_record (str, entry->id, entry->etag, entry->path, entry->avail_range);
+        entry->persisted = TRUE;
+        entry->persist_dirty = FALSE;
+    }
+
+    for (l = g_queue_peek_head_link (cmng->q_records); l; l = g_list_next (l)) {
+        struct _CacheRecord *record = (struct _CacheRecord *) l->data;
+
+        cache_mng_index_print_record (str, record->id, record->etag, record->path, record->avail_range);
+    }
+
+    path = g_build_filename (cmng->cache_dir, CMNG_INDEX, NULL);
+    tmp_path = g_strdup_printf ("%s.tmp", path);
+
+    // the new journal replaces the old one only when it's on the disk
+    fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    res = (fd >= 0 && write (fd, str->str, str->len) == (ssize_t) str->len && fsync (fd) == 0);
+    if (fd >= 0)
+        close (fd);
+    if (res && rename (tmp_path, path) == 0) {
+        fd = open (cmng->cache_dir, O_RDONLY);
+        if (fd >= 0) {
+            fsync (fd);
+            close (fd);
+        }
+    } else {
+        LOG_err (CMNG_LOG, "Failed to rewrite cache index: %s", path);
+        unlink (tmp_path);
+        res = FALSE;
+    }
+
+    if (cmng->index_fd >= 0)
+        close (cmng->index_fd);
+    cmng->index_fd = open (path, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
+    if (cmng->index_fd < 0) {
+        LOG_err (CMNG_LOG, "Failed to open cache index: %s", path);
+        res = FALSE;
     }
+    cmng->index_records = 0;
+
+    g_free (tmp_path);
+    g_free (path);
+    g_string_free (str, TRUE);
+
+    return res;
 }
-/*}}}*/
 
-/*{{{ get_stats*/
-void cache_mng_get_stats (CacheMng *cmng, guint32 *entries_num, guint64 *total_size, guint64 *cache_hits, guint64 *cache_miss)
+// data of the entry is on the disk, the record is written if the entry isn't changed since the job was submitted
+static void cache_mng_on_entry_synced (CacheMng *cmng, struct _CacheEntry *entry, struct _CacheIO *io)
 {
+    GString *str;
+
+    cmng->index_syncs--;
+
+    if (!io->success) {
+        LOG_err (CMNG_LOG, INO_H"Failed to flush cache file: %"G_GUINT64_FORMAT, INO_T (io->ino), io->id);
+    } else if (entry && entry->path && entry->persist_gen == io->persist_gen) {
+        str = g_string_new (NULL);
+        cache_mng_index_print_record (str, entry->id, entry->etag, entry->path, entry->avail_range);
+        if (cache_mng_index_write (cmng, str->str, FALSE)) {
+            entry->persisted = TRUE;
+            entry->persist_dirty = FALSE;
+        }
+        g_string_free (str, TRUE);
+    }
+
+    if (!cmng->index_syncs && cmng->index_records > CMNG_INDEX_MAX_RECORDS)
+        cache_mng_index_compact (cmng, FALSE);
+}
+
+// records of changed entries are written after their data is flushed to the disk by workers
+static void cache_mng_on_index_sync_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    CacheMng *cmng = (CacheMng *) ctx;
     GHashTableIter iter;
-    struct _CacheEntry *entry;
     gpointer value;
 
-    *entries_num = g_hash_table_size (cmng->h_entries);
-    *cache_hits = cmng->cache_hits;
-    *cache_miss = cmng->cache_miss;
-    *total_size = 0;
+    g_hash_table_iter_init (&iter, cmng->h_entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct _CacheEntry *entry = (struct _CacheEntry *) value;
+
+        if (!entry->path || !entry->persist_dirty)
+            continue;
+
+        cache_mng_entry_sync (cmng, entry);
+    }
+
+    if (!cmng->index_syncs && cmng->index_records > CMNG_INDEX_MAX_RECORDS)
+        cache_mng_index_compact (cmng, FALSE);
+}
+
+static gint cache_record_cmp (const struct _CacheRecord *a, const struct _CacheRecord *b)
+{
+    return a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
+}
+
+static void cache_mng_index_parse_ranges (Range *range, const gchar *str)
+{
+    gchar **intervals;
+    gchar **interval;
+
+    intervals = g_strsplit (str, ",", -1);
+    for (interval = intervals; *interval; interval++) {
+        guint64 start, end;
+
+        if (sscanf (*interval, "%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, &start, &end) == 2 && start < end)
+            range_add (range, start, end);
+    }
+    g_strfreev (intervals);
+}
+
+// replay the journal, records are checked against the stored files, files without records are removed
+static gboolean cache_mng_index_load (CacheMng *cmng)
+{
+    gchar *path;
+    gchar *contents = NULL;
+    gchar **lines;
+    gchar **line;
+    GHashTable *h_ids;
+    GHashTableIter iter;
+    gpointer value;
+    GList *l_records, *l;
+    GDir *dir;
+    const gchar *name;
+
+    h_ids = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, cache_record_destroy);
+
+    path = g_build_filename (cmng->cache_dir, CMNG_INDEX, NULL);
+    if (g_file_get_contents (path, &contents, NULL, NULL)) {
+        lines = g_strsplit (contents, "\n", -1);
+        // the last line is incomplete if the write was interrupted
+        for (line = lines; *line && *(line + 1); line++) {
+            gchar **fields = g_strsplit (*line, " ", 5);
+            guint64 id;
+
+            if (g_strv_length (fields) == 5 && !strcmp (fields[0], "A")) {
+                struct _CacheRecord *record;
+
+                id = g_ascii_strtoull (fields[1], NULL, 10);
+                record = cache_record_create (id, fields[4], fields[2]);
+                if (strcmp (fields[3], "-"))
+                    cache_mng_index_parse_ranges (record->avail_range, fields[3]);
+                g_hash_table_replace (h_ids, &record->id, record);
+            } else if (g_strv_length (fields) == 2 && !strcmp (fields[0], "D")) {
+                id = g_ascii_strtoull (fields[1], NULL, 10);
+                g_hash_table_remove (h_ids, &id);
+            } else
+                id = 0;
+
+            if (id >= cmng->next_id)
+                cmng->next_id = id + 1;
+            g_strfreev (fields);
+        }
+        g_strfreev (lines);
+        g_free (contents);
+    }
+    g_free (path);
+
+    // drop records which data is lost, data beyond the end of file is lost
+    g_hash_table_iter_init (&iter, h_ids);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        struct _CacheRecord *record = (struct _CacheRecord *) value;
+        char fpath[PATH_MAX];
+        struct stat st;
+
+        cache_mng_file_name (cmng, fpath, sizeof (fpath), record->id);
+        if (stat (fpath, &st) != 0) {
+            g_hash_table_iter_remove (&iter);
+            continue;
+        }
+
+        range_remove (record->avail_range, st.st_size, G_MAXUINT64);
+        record->size = range_length (record->avail_range);
+        if (!record->size)
+            g_hash_table_iter_remove (&iter);
+    }
+
+    // remove files which are not recorded
+    dir = g_dir_open (cmng->cache_dir, 0, NULL);
+    if (dir) {
+        while ((name = g_dir_read_name (dir))) {
+            guint64 id;
+            gchar *fpath;
+
+            if (!strcmp (name, CMNG_INDEX) || !strcmp (name, CMNG_LOCK))
+                continue;
+            if (sscanf (name, "cache_mng_%"G_GUINT64_FORMAT, &id) == 1 && g_hash_table_lookup (h_ids, &id))
+                continue;
+
+            fpath = g_build_filename (cmng->cache_dir, name, NULL);
+            unlink (fpath);
+            g_free (fpath);
+        }
+        g_dir_close (dir);
+    }
+
+    // the oldest records are evicted first, the newest copy of the object is kept
+    l_records = g_list_sort (g_hash_table_get_values (h_ids), (GCompareFunc) cache_record_cmp);
+    g_hash_table_steal_all (h_ids);
+    g_hash_table_destroy (h_ids);
+    for (l = g_list_first (l_records); l; l = g_list_next (l)) {
+        struct _CacheRecord *record = (struct _CacheRecord *) l->data;
+        struct _CacheRecord *old_record;
+
+        old_record = g_hash_table_lookup (cmng->h_records, record->key);
+        if (old_record)
+            cache_mng_evict_record (cmng, old_record);
+
+        g_queue_push_tail (cmng->q_records, record);
+        record->ll_records = g_queue_peek_tail_link (cmng->q_records);
+        g_hash_table_insert (cmng->h_records, record->key, record);
+        cmng->size += record->size;
+    }
+    g_list_free (l_records);
+
+    while (cmng->size > cmng->max_size && g_queue_peek_head (cmng->q_records))
+        cache_mng_evict_record (cmng, (struct _CacheRecord *) g_queue_peek_head (cmng->q_records));
+
+    LOG_msg (CMNG_LOG, "Loaded %u cached objects, cached bytes: %"G_GUINT64_FORMAT,
+        g_hash_table_size (cmng->h_records), cmng->size);
+
+    return cache_mng_index_compact (cmng, TRUE);
+}
+
+// data of persisted entries is recorded and kept, files of other entries are removed
+static void cache_mng_close_persistent (CacheMng *cmng)
+{
+    GHashTableIter iter;
+    gpointer value;
+    char path[PATH_MAX];
+
+    if (evtimer_pending (cmng->ev_index_sync, NULL))
+        evtimer_del (cmng->ev_index_sync);
 
     g_hash_table_iter_init (&iter, cmng->h_entries);
     while (g_hash_table_iter_next (&iter, NULL, &value)) {
-        entry = (struct _CacheEntry *) value;
-        *total_size = *total_size + range_length (entry->avail_range);
+        struct _CacheEntry *entry = (struct _CacheEntry *) value;
+
+        if (entry->path)
+            continue;
+        cache_mng_file_name (cmng, path, sizeof (path), entry->id);
+        unlink (path);
+    }
+
+    cache_mng_index_compact (cmng, TRUE);
+
+    if (cmng->index_fd >= 0)
+        close (cmng->index_fd);
+    cmng->index_fd = -1;
+    if (cmng->lock_fd >= 0)
+        close (cmng->lock_fd);
+    cmng->lock_fd = -1;
+}
+
+static void cache_mng_attach_blocks_cb (guint64 start, guint64 end, gpointer ctx)
+{
+    gpointer *data = (gpointer *) ctx;
+
+    cache_mng_update_blocks ((CacheMng *) data[0], (struct _CacheEntry *) data[1], start, end);
+}
+
+// the inode is the object with the path and ETag: data of the previous mounts is attached to it,
+// or its cached data is kept between mounts
+void cache_mng_attach_file (CacheMng *cmng, fuse_ino_t ino, const gchar *path, const gchar *etag)
+{
+    struct _CacheEntry *entry;
+    struct _CacheRecord *record;
+    gchar *key;
+
+    if (!cmng->persistent)
+        return;
+
+    key = cache_record_key (path, etag);
+    record = g_hash_table_lookup (cmng->h_records, key);
+    g_free (key);
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry) {
+        entry = cache_entry_create (cmng, ino);
+        entry->etag = g_strdup (etag);
+        entry->path = g_strdup (path);
+        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
+
+        if (record) {
+            Range *range = entry->avail_range;
+            gpointer data[2];
+
+            // the entry takes over the file and the data of the record
+            entry->id = record->id;
+            entry->avail_range = record->avail_range;
+            record->avail_range = range;
+            entry->persisted = TRUE;
+
+            cmng->size -= record->size;
+            g_queue_delete_link (cmng->q_records, record->ll_records);
+            g_hash_table_remove (cmng->h_records, record->key);
+
+            data[0] = cmng;
+            data[1] = entry;
+            range_foreach (entry->avail_range, cache_mng_attach_blocks_cb, data);
+
+            LOG_debug (CMNG_LOG, INO_H"Entry is attached to %s, cached bytes: %"G_GUINT64_FORMAT,
+                INO_T (ino), path, range_length (entry->avail_range));
+        }
+        return;
+    }
+
+    // written data and data of other versions of the object are not persisted
+    if (entry->staged_nr || !entry->etag || strcmp (entry->etag, etag))
+        return;
+
+    if (entry->path) {
+        if (!strcmp (entry->path, path))
+            return;
+        cache_mng_entry_unkey (cmng, entry);
+    }
+
+    // the object is cached twice, the copy of the previous mount is removed
+    if (record)
+        cache_mng_evict_record (cmng, record);
+
+    entry->path = g_strdup (path);
+    cache_mng_entry_changed (cmng, entry);
+
+    LOG_debug (CMNG_LOG, INO_H"Entry is persisted as %s", INO_T (ino), path);
+}
+/*}}}*/
+
+/*{{{ fetch */
+// last block of the [off, off + size) range, empty ranges take one block
+static guint64 cache_mng_fetch_last_nr (CacheMng *cmng, guint64 off, guint64 size)
+{
+    return (size ? off + size - 1 : off) / cmng->block_size;
+}
+
+// return download which [off, ...) range was started by cache_mng_fetch_start ()
+static struct _CacheFetch *cache_mng_fetch_lookup (CacheMng *cmng, fuse_ino_t ino, guint64 off)
+{
+    struct _CacheFetchKey key;
+    struct _CacheFetch *fetch;
+
+    key.ino = ino;
+    key.nr = off / cmng->block_size;
+    fetch = g_hash_table_lookup (cmng->h_fetches, &key);
+    if (!fetch || fetch->off != off)
+        return NULL;
+
+    return fetch;
+}
+
+// single-flight downloads: in-flight requests are keyed by cache blocks,
+// so a block is requested once, whatever the offsets of the overlapping reads are
+// return TRUE if none of the blocks of [off, off + size) is being downloaded:
+// caller must download the range and call cache_mng_fetch_done () with the same offset
+// return FALSE if one of the blocks is being downloaded, on_fetched_cb (if set) is called when it's done
+gboolean cache_mng_fetch_start (CacheMng *cmng, fuse_ino_t ino, guint64 off, guint64 size,
+    cache_mng_on_fetched_cb on_fetched_cb, void *ctx)
+{
+    struct _CacheFetchKey key;
+    struct _CacheFetch *fetch = NULL;
+    struct _CacheFetchWaiter *waiter;
+    guint64 last_nr;
+
+    last_nr = cache_mng_fetch_last_nr (cmng, off, size);
+
+    key.ino = ino;
+    for (key.nr = off / cmng->block_size; key.nr <= last_nr && !fetch; key.nr++)
+        fetch = g_hash_table_lookup (cmng->h_fetches, &key);
+
+    if (!fetch) {
+        fetch = g_new0 (struct _CacheFetch, 1);
+        fetch->ino = ino;
+        fetch->off = off;
+        fetch->size = size;
+        fetch->l_waiters = NULL;
+
+        for (key.nr = off / cmng->block_size; key.nr <= last_nr; key.nr++) {
+            struct _CacheFetchKey *fkey = g_new (struct _CacheFetchKey, 1);
+
+            *fkey = key;
+            g_hash_table_insert (cmng->h_fetches, fkey, fetch);
+        }
+        cmng->fetches_nr++;
+
+        return TRUE;
+    }
+
+    if (on_fetched_cb) {
+        LOG_debug (CMNG_LOG, INO_H"Block [%"G_GUINT64_FORMAT"] is being downloaded by [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"], waiting for it",
+            INO_T (ino), (key.nr - 1) * cmng->block_size, fetch->off, fetch->size);
+
+        waiter = g_new0 (struct _CacheFetchWaiter, 1);
+        waiter->fetched_cb = on_fetched_cb;
+        waiter->user_ctx = ctx;
+        fetch->l_waiters = g_list_append (fetch->l_waiters, waiter);
+        cmng->fetch_shared++;
+    }
+
+    return FALSE;
+}
+
+// range download is finished, notify all waiters
+void cache_mng_fetch_done (CacheMng *cmng, fuse_ino_t ino, guint64 off, gboolean success)
+{
+    struct _CacheFetchKey key;
+    struct _CacheFetch *fetch;
+    GList *l_waiters, *l;
+    guint64 last_nr;
+
+    fetch = cache_mng_fetch_lookup (cmng, ino, off);
+    if (!fetch) {
+        LOG_err (CMNG_LOG, INO_H"Block [%"G_GUINT64_FORMAT"] is not being downloaded !", INO_T (ino), off);
+        return;
+    }
+
+    // waiters might start a new download of the same blocks
+    l_waiters = fetch->l_waiters;
+    fetch->l_waiters = NULL;
+
+    last_nr = cache_mng_fetch_last_nr (cmng, fetch->off, fetch->size);
+    key.ino = ino;
+    for (key.nr = off / cmng->block_size; key.nr <= last_nr; key.nr++)
+        g_hash_table_remove (cmng->h_fetches, &key);
+    cache_fetch_destroy (fetch);
+    cmng->fetches_nr--;
+
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        struct _CacheFetchWaiter *waiter = (struct _CacheFetchWaiter *) l->data;
+
+        waiter->fetched_cb (success, waiter->user_ctx);
+        g_free (waiter);
+    }
+    g_list_free (l_waiters);
+}
+
+// a part of the range is stored, let waiters check if it contains their data
+void cache_mng_fetch_progress (CacheMng *cmng, fuse_ino_t ino, guint64 off)
+{
+    struct _CacheFetch *fetch;
+    GList *l_waiters, *l;
+
+    fetch = cache_mng_fetch_lookup (cmng, ino, off);
+    if (!fetch || !fetch->l_waiters)
+        return;
+
+    // waiters attach themselves again if the data isn't stored yet
+    l_waiters = fetch->l_waiters;
+    fetch->l_waiters = NULL;
+
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        struct _CacheFetchWaiter *waiter = (struct _CacheFetchWaiter *) l->data;
+
+        waiter->fetched_cb (TRUE, waiter->user_ctx);
+        g_free (waiter);
     }
+    g_list_free (l_waiters);
+}
+
+void cache_mng_get_fetch_stats (CacheMng *cmng, guint32 *pending_num, guint64 *shared_num)
+{
+    *pending_num = cmng->fetches_nr;
+    *shared_num = cmng->fetch_shared;
+}
+/*}}}*/
 
+/*{{{ get_stats*/
+void cache_mng_get_stats (CacheMng *cmng, guint32 *entries_num, guint64 *total_size, guint64 *cache_hits, guint64 *cache_miss)
+{
+    *entries_num = g_hash_table_size (cmng->h_entries) + g_hash_table_size (cmng->h_records);
+    *cache_hits = cmng->cache_hits;
+    *cache_miss = cmng->cache_miss;
+    // cached data of all entries and data of previous mounts which isn't attached yet
+    *total_size = cmng->size;
+}
+
+void cache_mng_get_mem_stats (CacheMng *cmng, guint32 *blocks_num, guint64 *size, guint64 *max_size, guint64 *mem_hits)
+{
+    *blocks_num = g_queue_get_length (cmng->q_mem);
+    *size = cmng->mem_size;
+    *max_size = cmng->mem_max_size;
+    *mem_hits = cmng->mem_hits;
 }/*}}}*/
@@ -160,6 +160,26 @@ gint client_pool_get_client_count (ClientPool *pool)
     return g_list_length (pool->l_clients);
 }
 
+// return the number of clients, which are ready to execute a new request
+gint client_pool_get_idle_client_count (ClientPool *pool)
+{
+    GList *l;
+    PoolClient *pc;
+    gint count = 0;
+
+    // clients are taken by awaiting requests first
+    if (!g_queue_is_empty (pool->q_requests))
+        return 0;
+
+    for (l = g_list_first (pool->l_clients); l; l = g_list_next (l)) {
+        pc = (PoolClient *) l->data;
+        if (pc->client_check_rediness (pc->client))
+            count++;
+    }
+
+    return count;
+}
+
 // collects statistics information from clients
 void client_pool_get_client_stats_info (ClientPool *pool, GString *str, struct PrintFormat *print_format)
 {
@@ -80,6 +80,11 @@ struct _DirEntry {
     // for directory only, content of the directory
     GHashTable *h_dir_tree; // name -> DirEntry
 
+    // for directory only, detection of sequential reads of files in name order
+    gchar *prefetch_last_name; // name of the last file which was read from the beginning
+    guint prefetch_seq; // number of files read in name order
+    GPtrArray *a_files_sorted; // files of the directory in name order, NULL if the content is changed
+
     gboolean is_updating; // TRUE if getting attributes
     time_t updated_time; // time when entry was updated
     time_t access_time; // time when entry was accessed
@@ -88,6 +93,7 @@ struct _DirEntry {
     gchar *version_id;
     gchar *content_type;
     time_t xattr_time; // time when XAttrs were updated
+    time_t etag_time; // time when size and ETag were received from the server
 };
 
 struct _DirTree {
@@ -99,6 +105,12 @@ struct _DirTree {
 
     gint64 current_write_ops; // the number of current write operations
 
+    guint64 prefetch_size; // the number of bytes being prefetched by sibling prefetch
+
+    // removed files waiting for the next Multi-Object Delete request
+    GQueue *q_delete_pending;
+    struct event *ev_delete_batch;
+
     // files and directories mode, -1 to use the default value
     gint fmode;
     gint dmode;
@@ -107,6 +119,8 @@ struct _DirTree {
 #define DIR_TREE_LOG "dir_tree"
 #define DIR_DEFAULT_MODE S_IFDIR | 0755
 #define FILE_DEFAULT_MODE S_IFREG | 0644
+// the number of files read in name order to start sibling prefetch
+#define DIR_TREE_PREFETCH_SEQ 2
 /*}}}*/
 
 /*{{{ func declarations */
@@ -115,6 +129,8 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
 static void dir_tree_entry_modified (DirTree *dtree, DirEntry *en);
 static void dir_entry_destroy (gpointer data);
 static void dir_tree_entry_update_xattrs (DirEntry *en, struct evkeyvalq *headers);
+static void dir_tree_on_delete_batch_cb (evutil_socket_t fd, short flags, void *ctx);
+static void dir_tree_delete_pending_free (gpointer data);
 /*}}}*/
 
 /*{{{ create / destroy */
@@ -129,6 +145,9 @@ DirTree *dir_tree_create (Application *app)
     dtree->h_inodes = g_hash_table_new (g_direct_hash, g_direct_equal);
     dtree->max_ino = FUSE_ROOT_ID;
     dtree->current_write_ops = 0;
+    dtree->prefetch_size = 0;
+    dtree->q_delete_pending = g_queue_new ();
+    dtree->ev_delete_batch = evtimer_new (application_get_evbase (app), dir_tree_on_delete_batch_cb, dtree);
 
     dtree->fmode = conf_get_int (application_get_conf (app), "filesystem.file_mode");
     if (dtree->fmode < 0)
@@ -151,6 +170,9 @@ DirTree *dir_tree_create (Application *app)
 
 void dir_tree_destroy (DirTree *dtree)
 {
+    // the event loop is stopped, pending removals are not replied
+    event_free (dtree->ev_delete_batch);
+    g_queue_free_full (dtree->q_delete_pending, dir_tree_delete_pending_free);
     g_hash_table_destroy (dtree->h_inodes);
     dir_entry_destroy (dtree->root);
     g_free (dtree);
@@ -177,12 +199,25 @@ static void dir_entry_destroy (gpointer data)
         g_free (en->version_id);
     if (en->content_type)
         g_free (en->content_type);
+    if (en->prefetch_last_name)
+        g_free (en->prefetch_last_name);
+    if (en->a_files_sorted)
+        g_ptr_array_free (en->a_files_sorted, TRUE);
 
     g_free (en->basename);
     g_free (en->fullpath);
     g_free (en);
 }
 
+// entries are added to (or removed from) the directory, the sorted list of its files is built again when it's needed
+static void dir_entry_files_changed (DirEntry *parent_en)
+{
+    if (parent_en->a_files_sorted) {
+        g_ptr_array_free (parent_en->a_files_sorted, TRUE);
+        parent_en->a_files_sorted = NULL;
+    }
+}
+
 // create and add a new entry (file or dir) to DirTree
 static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode_t mode,
     DirEntryType type, fuse_ino_t parent_ino, off_t size, time_t ctime)
@@ -242,6 +277,10 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     en->updated_time = 0;
     en->access_time = time (NULL);
     en->xattr_time = 0;
+    en->etag_time = 0;
+    en->prefetch_last_name = NULL;
+    en->prefetch_seq = 0;
+    en->a_files_sorted = NULL;
 
     // cache is empty
     en->dir_cache = NULL;
@@ -263,8 +302,10 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     g_hash_table_insert (dtree->h_inodes, GUINT_TO_POINTER (en->ino), en);
 
     // add to the parent's hash
-    if (parent_ino)
+    if (parent_ino) {
         g_hash_table_insert (parent_en->h_dir_tree, g_strdup (en->basename), en);
+        dir_entry_files_changed (parent_en);
+    }
 
     // inform parent that the directory cache has changed
     if (parent_ino)
@@ -369,12 +410,14 @@ void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino)
     }
 
     res = g_hash_table_foreach_remove (parent_en->h_dir_tree, dir_tree_stop_update_on_remove_child_cb, dtree);
-    if (res)
+    if (res) {
+        dir_entry_files_changed (parent_en);
         LOG_debug (DIR_TREE_LOG, INO_H"Removed: %u entries !", INO_T (parent_ino), res);
+    }
 }
 
 DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path, DirEntryType type,
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified)
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag)
 {
     DirEntry *parent_en;
     DirEntry *en;
@@ -406,6 +449,18 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
             type, parent_ino, size, last_modified);
     }
 
+    // directory listing contains object's ETag, file size and ETag can be used without sending HEAD request
+    if (etag && !en->is_modified) {
+        gchar *tmp;
+
+        tmp = g_strdup (etag);
+        str_remove_quotes (tmp);
+        if (en->etag)
+            g_free (en->etag);
+        en->etag = tmp;
+        en->etag_time = time (NULL);
+    }
+
     LOG_debug (DIR_TREE_LOG, INO_H"Updating %s, size: %lld", INO_T (en->ino), entry_name, size);
 
     return en;
@@ -783,6 +838,8 @@ static void dir_tree_on_lookup_cb (HttpConnection *con, void *ctx, gboolean succ
     }
 
     dir_tree_entry_update_xattrs (en, headers);
+    if (en->etag)
+        en->etag_time = en->xattr_time;
 
     // check if this is a directory
     content_type = http_find_header (headers, "Content-Type");
@@ -934,7 +991,7 @@ static void dir_tree_on_lookup_not_found_cb (HttpConnection *con, void *ctx, gbo
     }
 
     en = dir_tree_update_entry (op_data->dtree, parent_en->fullpath, DET_file,
-        op_data->parent_ino, op_data->name, size, last_modified);
+        op_data->parent_ino, op_data->name, size, last_modified, NULL);
 
     if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Failed to create FileEntry parent ino: %"INO_FMT" !",
@@ -947,6 +1004,8 @@ static void dir_tree_on_lookup_not_found_cb (HttpConnection *con, void *ctx, gbo
     }
 
     dir_tree_entry_update_xattrs (en, headers);
+    if (en->etag)
+        en->etag_time = en->xattr_time;
 
     op_data->lookup_cb (op_data->req, TRUE, en->ino, en->mode, en->size, en->ctime);
     g_free (op_data->name);
@@ -1343,6 +1402,13 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
 /*}}}*/
 
 /*{{{ dir_tree_file_open */
+// return TRUE if size and ETag of the file were received from the server recently
+static gboolean dir_tree_entry_object_info_is_fresh (DirTree *dtree, DirEntry *en)
+{
+    return en->etag && en->etag_time && !en->is_modified &&
+        time (NULL) - en->etag_time < (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time");
+}
+
 // existing file is opened, create context data
 void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi,
     DirTree_file_open_cb file_open_cb, fuse_req_t req)
@@ -1360,9 +1426,23 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
         return;
     }
 
-    fop = fileio_create (dtree->app, en->fullpath, en->ino, FALSE);
+    // truncated object is written from scratch, it's uploaded on release even if it stays empty
+    fop = fileio_create (dtree->app, en->fullpath, en->ino, (fi->flags & O_TRUNC) != 0);
     fi->fh = convert_ptr_to_fh (fop);
 
+    // size and ETag are recently received from the server, skip requesting them on the first read
+    if (dir_tree_entry_object_info_is_fresh (dtree, en))
+        fileio_set_object_info (fop, en->size, en->etag);
+
+    // existing object is modified in place (or appended), writes are staged in local file
+    if ((fi->flags & O_ACCMODE) != O_RDONLY && !(fi->flags & O_TRUNC) &&
+        (conf_get_boolean (application_get_conf (dtree->app), "s3.write_back") || (fi->flags & O_APPEND)))
+        fileio_set_write_back (fop, en->size, dir_tree_entry_object_info_is_fresh (dtree, en) ? en->etag : NULL);
+
+    // file is opened for reading, prefetch the data which is read first
+    if ((fi->flags & O_ACCMODE) != O_WRONLY && !(fi->flags & O_TRUNC))
+        fileio_open_prefetch (fop);
+
     LOG_debug (DIR_TREE_LOG, INO_FOP_H"dir_tree_open", INO_T (en->ino), (void *)fop);
 
     file_open_cb (req, TRUE, fi);
@@ -1394,10 +1474,190 @@ void dir_tree_file_release (DirTree *dtree, fuse_ino_t ino, G_GNUC_UNUSED struct
 }
 /*}}}*/
 
+/*{{{ dir_tree_file_fsync */
+
+typedef struct {
+    DirTree_file_fsync_cb file_fsync_cb;
+    fuse_req_t req;
+    fuse_ino_t ino;
+} FileFsyncOpData;
+
+static void dir_tree_file_on_synced_cb (gpointer ctx, gboolean success)
+{
+    FileFsyncOpData *op_data = (FileFsyncOpData *) ctx;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"File synced, success: %s", INO_T (op_data->ino), success ? "TRUE" : "FALSE");
+
+    op_data->file_fsync_cb (op_data->req, success);
+    g_free (op_data);
+}
+
+// wait until the file is uploaded
+void dir_tree_file_fsync (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi,
+    DirTree_file_fsync_cb file_fsync_cb, fuse_req_t req)
+{
+    DirEntry *en;
+    FileIO *fop;
+    FileFsyncOpData *op_data;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en) {
+        LOG_msg (DIR_TREE_LOG, INO_H"Entry not found !", INO_T (ino));
+        file_fsync_cb (req, FALSE);
+        return;
+    }
+
+    fop = convert_fh_to_ptr (fi->fh);
+
+    LOG_debug (DIR_TREE_LOG, INO_FOP_H"dir_tree_file_fsync", INO_T (ino), (void *)fop);
+
+    op_data = g_new0 (FileFsyncOpData, 1);
+    op_data->file_fsync_cb = file_fsync_cb;
+    op_data->req = req;
+    op_data->ino = ino;
+
+    fileio_fsync (fop, dir_tree_file_on_synced_cb, op_data);
+}
+/*}}}*/
+
+/*{{{ sibling prefetch */
+
+typedef struct {
+    DirTree *dtree;
+    fuse_ino_t ino;
+    guint64 size;
+} SiblingPrefetchData;
+
+static void dir_tree_on_sibling_prefetched_cb (gpointer ctx, gboolean success)
+{
+    SiblingPrefetchData *pdata = (SiblingPrefetchData *) ctx;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Sibling prefetch finished, success: %s", INO_T (pdata->ino), success ? "TRUE" : "FALSE");
+
+    pdata->dtree->prefetch_size -= pdata->size;
+    g_free (pdata);
+}
+
+static gint dir_tree_entry_name_cmp (gconstpointer a, gconstpointer b)
+{
+    return strcmp ((*(DirEntry * const *) a)->basename, (*(DirEntry * const *) b)->basename);
+}
+
+// files of the directory in name order, the list is kept until the content of the directory is changed
+static GPtrArray *dir_tree_files_sorted (DirEntry *parent_en)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (parent_en->a_files_sorted)
+        return parent_en->a_files_sorted;
+
+    parent_en->a_files_sorted = g_ptr_array_new ();
+    g_hash_table_iter_init (&iter, parent_en->h_dir_tree);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        if (((DirEntry *) value)->type == DET_file)
+            g_ptr_array_add (parent_en->a_files_sorted, value);
+    }
+    g_ptr_array_sort (parent_en->a_files_sorted, dir_tree_entry_name_cmp);
+
+    return parent_en->a_files_sorted;
+}
+
+// files of the directory are read one after another in name order,
+// download the next "s3.sibling_prefetch_files" files into local cache
+static void dir_tree_prefetch_siblings (DirTree *dtree, DirEntry *en)
+{
+    DirEntry *parent_en;
+    GPtrArray *a_files;
+    guint lo, hi, i;
+    guint files_nr;
+    guint64 max_size;
+    guint64 cache_max_size;
+    CacheMng *cmng;
+
+    files_nr = conf_get_uint (application_get_conf (dtree->app), "s3.sibling_prefetch_files");
+    if (!files_nr)
+        return;
+
+    parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (en->parent_ino));
+    if (!parent_en || !parent_en->h_dir_tree)
+        return;
+
+    // the same file is read again
+    if (parent_en->prefetch_last_name && !strcmp (parent_en->prefetch_last_name, en->basename))
+        return;
+
+    if (parent_en->prefetch_last_name && strcmp (parent_en->prefetch_last_name, en->basename) < 0)
+        parent_en->prefetch_seq++;
+    else
+        parent_en->prefetch_seq = 1;
+
+    g_free (parent_en->prefetch_last_name);
+    parent_en->prefetch_last_name = g_strdup (en->basename);
+
+    if (parent_en->prefetch_seq < DIR_TREE_PREFETCH_SEQ)
+        return;
+
+    a_files = dir_tree_files_sorted (parent_en);
+
+    // the first file after the current one
+    lo = 0;
+    hi = a_files->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (strcmp (((DirEntry *) g_ptr_array_index (a_files, mid))->basename, en->basename) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    cmng = application_get_cache_mng (dtree->app);
+    max_size = conf_get_uint (application_get_conf (dtree->app), "s3.sibling_prefetch_max_size");
+    cache_max_size = cache_mng_get_max_size (cmng);
+
+    // the next files_nr files in name order
+    for (i = lo; i < a_files->len && files_nr; i++) {
+        DirEntry *sibling_en = (DirEntry *) g_ptr_array_index (a_files, i);
+        SiblingPrefetchData *pdata;
+
+        if (sibling_en->removed || !sibling_en->size)
+            continue;
+
+        // size and ETag are required to make sure that the prefetched data is valid
+        if (!dir_tree_entry_object_info_is_fresh (dtree, sibling_en))
+            continue;
+        files_nr--;
+
+        // bandwidth budget: do not exceed the number of bytes being prefetched
+        if (dtree->prefetch_size + sibling_en->size > max_size)
+            break;
+
+        // cache budget: prefetched files must not evict each other or the data which is being read
+        if (cache_mng_size (cmng) + dtree->prefetch_size + sibling_en->size > cache_max_size)
+            break;
+
+        pdata = g_new0 (SiblingPrefetchData, 1);
+        pdata->dtree = dtree;
+        pdata->ino = sibling_en->ino;
+        pdata->size = sibling_en->size;
+
+        // the callback might be called before fileio_prefetch_file () returns
+        dtree->prefetch_size += sibling_en->size;
+        if (!fileio_prefetch_file (dtree->app, sibling_en->fullpath, sibling_en->ino, sibling_en->size, sibling_en->etag,
+            dir_tree_on_sibling_prefetched_cb, pdata)) {
+            dtree->prefetch_size -= sibling_en->size;
+            g_free (pdata);
+        }
+    }
+}
+/*}}}*/
+
 /*{{{ dir_tree_file_read */
 
 typedef struct {
     DirTree_file_read_cb file_read_cb;
+    DirTree_file_read_fd_cb file_read_fd_cb;
     fuse_req_t req;
     size_t size;
     fuse_ino_t ino;
@@ -1420,10 +1680,20 @@ static void dir_tree_on_buffer_read_cb (gpointer ctx, gboolean success, char *bu
     g_free (op_data);
 }
 
+static void dir_tree_on_buffer_fd_read_cb (gpointer ctx, int fd, off_t off, size_t size)
+{
+    FileReadOpData *op_data = (FileReadOpData *)ctx;
+
+    LOG_debug (DIR_TREE_LOG, INO_FROP_H"file READ_fd_cb !", INO_T (op_data->ino), (void *)op_data);
+
+    op_data->file_read_fd_cb (op_data->req, fd, off, size);
+    g_free (op_data);
+}
+
 // read file starting at off position, size length
 void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino,
     size_t size, off_t off,
-    DirTree_file_read_cb file_read_cb, fuse_req_t req,
+    DirTree_file_read_cb file_read_cb, DirTree_file_read_fd_cb file_read_fd_cb, fuse_req_t req,
     G_GNUC_UNUSED struct fuse_file_info *fi)
 {
     DirEntry *en;
@@ -1446,11 +1716,17 @@ void dir_tree_file_read (DirTree *dtree, fuse_ino_t ino,
 
     op_data = g_new0 (FileReadOpData, 1);
     op_data->file_read_cb = file_read_cb;
+    op_data->file_read_fd_cb = file_read_fd_cb;
     op_data->req = req;
     op_data->size = size;
     op_data->ino = ino;
 
-    fileio_read_buffer (fop, size, off, ino, dir_tree_on_buffer_read_cb, op_data);
+    fileio_read_buffer (fop, size, off, ino, dir_tree_on_buffer_read_cb,
+        file_read_fd_cb ? dir_tree_on_buffer_fd_read_cb : NULL, op_data);
+
+    // file is read from the beginning, check if files of the directory are scanned
+    if (off == 0)
+        dir_tree_prefetch_siblings (dtree, en);
 }
 /*}}}*/
 
@@ -1485,16 +1761,12 @@ static void dir_tree_on_buffer_written_cb (FileIO *fop, gpointer ctx, gboolean s
             return;
         }
 
-        // try to get file size from CacheMng
-        len = cache_mng_get_file_length (application_get_cache_mng (op_data->dtree->app), op_data->ino);
-
-        // calculate current size in case of CacheMng is disabled or the file is not stored in CacheMng
-        if (len == 0) {
-            len = op_data->off + count;
-            LOG_debug (DIR_TREE_LOG, INO_H"Recalculating file size !", INO_T (op_data->ino));
-        }
+        // FileIO knows the size, including unchanged data of the object which is not in CacheMng
+        len = fileio_get_current_size (fop);
 
         en->size = len;
+        // local size differs from the object's one
+        en->etag_time = 0;
         //en->ctime = time (NULL);
     }
 
@@ -1544,26 +1816,33 @@ void dir_tree_file_write (DirTree *dtree, fuse_ino_t ino,
 typedef struct {
     DirTree *dtree;
     fuse_ino_t ino;
+    gchar *fname; // object name, the entry can be renamed before the request is sent
     DirTree_file_remove_cb file_remove_cb;
     fuse_req_t req;
 } FileRemoveData;
 
-// file is removed
-static void dir_tree_file_remove_on_con_data_cb (HttpConnection *con, gpointer ctx, gboolean success,
-    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+static void file_remove_data_destroy (FileRemoveData *data)
 {
-    FileRemoveData *data = (FileRemoveData *) ctx;
-    DirEntry *en;
+    g_free (data->fname);
+    g_free (data);
+}
 
-    http_connection_release (con);
+static void dir_tree_delete_pending_free (gpointer data)
+{
+    file_remove_data_destroy ((FileRemoveData *) data);
+}
+
+// object is removed (or failed to be removed), reply and free FileRemoveData
+static void dir_tree_file_remove_done (FileRemoveData *data, gboolean success)
+{
+    DirEntry *en;
 
     en = g_hash_table_lookup (data->dtree->h_inodes, GUINT_TO_POINTER (data->ino));
     if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Entry not found !", INO_T (data->ino));
         if (data->file_remove_cb)
             data->file_remove_cb (data->req, FALSE);
-                g_free (data);
+        file_remove_data_destroy (data);
         return;
     }
 
@@ -1577,7 +1856,19 @@ static void dir_tree_file_remove_on_con_data_cb (HttpConnection *con, gpointer c
     if (data->file_remove_cb)
         data->file_remove_cb (data->req, success);
 
-    g_free (data);
+    file_remove_data_destroy (data);
+}
+
+// file is removed
+static void dir_tree_file_remove_on_con_data_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileRemoveData *data = (FileRemoveData *) ctx;
+
+    http_connection_release (con);
+
+    dir_tree_file_remove_done (data, success);
 }
 
 // http client is ready for a new request
@@ -1587,20 +1878,10 @@ static void dir_tree_file_remove_on_con_cb (gpointer client, gpointer ctx)
     FileRemoveData *data = (FileRemoveData *) ctx;
     gchar *req_path;
     gboolean res;
-    DirEntry *en;
-
-    en = g_hash_table_lookup (data->dtree->h_inodes, GUINT_TO_POINTER (data->ino));
-    if (!en) {
-        LOG_err (DIR_TREE_LOG, INO_H"Entry not found !", INO_T (data->ino));
-        if (data->file_remove_cb)
-            data->file_remove_cb (data->req, FALSE);
-        g_free (data);
-        return;
-    }
 
     http_connection_acquire (con);
 
-    req_path = filepath_for_url (con,en->fullpath);
+    req_path = filepath_for_url (con, data->fname);
     res = http_connection_make_request (con,
         req_path, "DELETE",
         NULL, TRUE, NULL,
@@ -1609,20 +1890,97 @@ static void dir_tree_file_remove_on_con_cb (gpointer client, gpointer ctx)
     );
     g_free (req_path);
 
-    if (!res) {
+    // dir_tree_file_remove_on_con_data_cb () is already called with failure status
+    if (!res)
         LOG_err (DIR_TREE_LOG, "Failed to create http request !");
-        data->file_remove_cb (data->req, FALSE);
+}
 
-        http_connection_release (con);
-        g_free (data);
+/*{{{ delete batch */
+typedef struct {
+    DirTree *dtree;
+    GList *l_data; // FileRemoveData
+} DeleteBatch;
+
+// every FUSE request is replied with the result of its own key
+static void dir_tree_on_delete_batch_done_cb (gpointer ctx, gboolean success, GList *l_failed)
+{
+    DeleteBatch *batch = (DeleteBatch *) ctx;
+    GHashTable *h_failed;
+    GList *l;
+
+    h_failed = g_hash_table_new (g_str_hash, g_str_equal);
+    for (l = g_list_first (l_failed); l; l = g_list_next (l))
+        g_hash_table_insert (h_failed, l->data, l->data);
+
+    for (l = g_list_first (batch->l_data); l; l = g_list_next (l)) {
+        FileRemoveData *data = (FileRemoveData *) l->data;
+
+        dir_tree_file_remove_done (data, success && !g_hash_table_lookup (h_failed, data->fname));
     }
+
+    g_hash_table_destroy (h_failed);
+    g_list_free (batch->l_data);
+    g_free (batch);
 }
 
+// send up to FILEIO_DELETE_MAX_KEYS pending removals by a single request
+static void dir_tree_delete_batch_send (DirTree *dtree)
+{
+    DeleteBatch *batch;
+    GList *l_fnames = NULL;
+    FileRemoveData *data;
+    guint count = 0;
+
+    if (g_queue_is_empty (dtree->q_delete_pending))
+        return;
+
+    batch = g_new0 (DeleteBatch, 1);
+    batch->dtree = dtree;
+
+    while (count < FILEIO_DELETE_MAX_KEYS && (data = g_queue_pop_head (dtree->q_delete_pending))) {
+        batch->l_data = g_list_prepend (batch->l_data, data);
+        l_fnames = g_list_prepend (l_fnames, data->fname);
+        count++;
+    }
+
+    LOG_debug (DIR_TREE_LOG, "Sending delete batch of %u objects", count);
+
+    fileio_delete_objects (dtree->app, l_fnames, dir_tree_on_delete_batch_done_cb, batch);
+    g_list_free (l_fnames);
+}
+
+static void dir_tree_on_delete_batch_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    DirTree *dtree = (DirTree *) ctx;
+
+    while (!g_queue_is_empty (dtree->q_delete_pending))
+        dir_tree_delete_batch_send (dtree);
+}
+
+// removals are collected for "s3.delete_batch_window_ms" milliseconds
+static void dir_tree_delete_batch_add (DirTree *dtree, FileRemoveData *data, guint window_ms)
+{
+    g_queue_push_tail (dtree->q_delete_pending, data);
+
+    if (g_queue_get_length (dtree->q_delete_pending) >= FILEIO_DELETE_MAX_KEYS) {
+        evtimer_del (dtree->ev_delete_batch);
+        dir_tree_delete_batch_send (dtree);
+        return;
+    }
+
+    if (!evtimer_pending (dtree->ev_delete_batch, NULL)) {
+        struct timeval tv = { window_ms / 1000, (window_ms % 1000) * 1000 };
+        evtimer_add (dtree->ev_delete_batch, &tv);
+    }
+}
+/*}}}*/
+
 // remove file
 void dir_tree_file_remove (DirTree *dtree, fuse_ino_t ino, DirTree_file_remove_cb file_remove_cb, fuse_req_t req)
 {
     DirEntry *en;
     FileRemoveData *data;
+    guint window_ms;
 
     LOG_debug (DIR_TREE_LOG, INO_H"Removing  inode", INO_T (ino));
 
@@ -1648,14 +2006,22 @@ void dir_tree_file_remove (DirTree *dtree, fuse_ino_t ino, DirTree_file_remove_c
     data = g_new0 (FileRemoveData, 1);
     data->dtree = dtree;
     data->ino = ino;
+    data->fname = g_strdup (en->fullpath);
     data->file_remove_cb = file_remove_cb;
     data->req = req;
 
+    // batch removals, "rm -rf" sends one request per 1000 files
+    window_ms = conf_get_uint (application_get_conf (dtree->app), "s3.delete_batch_window_ms");
+    if (window_ms) {
+        dir_tree_delete_batch_add (dtree, data, window_ms);
+        return;
+    }
+
     if (!client_pool_get_client (application_get_ops_client_pool (dtree->app),
         dir_tree_file_remove_on_con_cb, data)) {
         LOG_err (DIR_TREE_LOG, INO_H"Failed to get PoolClient !", INO_T (ino));
         file_remove_cb (req, FALSE);
-        g_free (data);
+        file_remove_data_destroy (data);
         return;
     }
 }
@@ -1808,6 +2174,8 @@ typedef struct {
     char *newname;
     DirTree_rename_cb rename_cb;
     fuse_req_t req;
+    fuse_ino_t ino; // source file
+    guint64 size;
 } RenameData;
 
 static void rename_data_destroy (RenameData *rdata)
@@ -1927,16 +2295,12 @@ static void dir_tree_on_rename_delete_con_cb (gpointer client, gpointer ctx)
 /*}}}*/
 
 /*{{{ copy object */
-static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gboolean success,
-    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+static void dir_tree_on_rename_copied_cb (gpointer ctx, gboolean success, const gchar *etag)
 {
     RenameData *rdata = (RenameData *) ctx;
     DirEntry *newparent_en;
     DirEntry *en;
 
-    http_connection_release (con);
-
     if (!success) {
         LOG_err (DIR_TREE_LOG, "Failed to rename !");
         if (rdata->rename_cb)
@@ -1945,8 +2309,6 @@ static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gbool
         return;
     }
 
-    //XXX: a 200 OK response can contain either a success or an error
-
     // Update new entry
     newparent_en = g_hash_table_lookup (rdata->dtree->h_inodes, GUINT_TO_POINTER (rdata->newparent_ino));
     if (!newparent_en || newparent_en->type != DET_dir) {
@@ -1968,6 +2330,17 @@ static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gbool
 
     en->removed = FALSE;
     en->access_time = time (NULL);
+    en->size = rdata->size;
+
+    // cached data of the source is the content of the copy, the file is not downloaded again
+    if (cache_mng_rename_file (application_get_cache_mng (rdata->dtree->app), rdata->ino, en->ino)) {
+        gchar *aws_etag;
+
+        // S3 returns quoted ETag in headers
+        aws_etag = g_strdup_printf ("\"%s\"", etag);
+        cache_mng_update_etag (application_get_cache_mng (rdata->dtree->app), en->ino, aws_etag);
+        g_free (aws_etag);
+    }
 
     // inform the parent that his dir cache is no longer up-to-dated
     dir_tree_entry_modified (rdata->dtree, newparent_en);
@@ -1982,82 +2355,386 @@ static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gbool
         return;
     }
 }
+/*}}}*/
 
-static void dir_tree_on_rename_copy_con_cb (gpointer client, gpointer ctx)
+/*{{{ rename directory */
+
+typedef struct {
+    DirTree *dtree;
+    fuse_ino_t parent_ino;
+    char *name;
+    fuse_ino_t newparent_ino;
+    char *newname;
+    DirTree_rename_cb rename_cb;
+    fuse_req_t req;
+
+    gchar *src_prefix; // "dir/", relative to the bucket prefix
+    gchar *dst_prefix;
+    GList *l_objects; // HttpConnectionObject, objects found under src_prefix
+    GList *l_next_copy; // next object to copy
+    guint copies_in_flight;
+    GList *l_copied; // destination keys of objects which were copied
+    GHashTable *h_etags; // destination key -> ETag of the copy
+
+    GList *l_delete; // keys to delete once all copies are done
+    GList *l_next_delete; // first key of the next Multi-Object Delete batch
+    guint delete_failed; // the number of objects which failed to be deleted
+
+    gboolean failed;
+    gboolean pumping;
+    gboolean pump_again;
+} DirRenameData;
+
+typedef struct {
+    DirRenameData *drdata;
+    gchar *dst_key;
+} DirRenameCopy;
+
+static void dir_rename_pump (DirRenameData *drdata);
+static void dir_rename_delete_next (DirRenameData *drdata);
+
+static void dir_rename_data_destroy (DirRenameData *drdata)
 {
-    HttpConnection *con = (HttpConnection *) client;
-    RenameData *rdata = (RenameData *) ctx;
-    gchar *dst_path = NULL;
-    gchar *src_path = NULL;
-    gboolean res;
-    DirEntry *en;
+    http_connection_object_list_free (drdata->l_objects);
+    g_list_free_full (drdata->l_copied, g_free);
+    g_list_free (drdata->l_delete);
+    g_hash_table_destroy (drdata->h_etags);
+    g_free (drdata->src_prefix);
+    g_free (drdata->dst_prefix);
+    g_free (drdata->name);
+    g_free (drdata->newname);
+    g_free (drdata);
+}
+
+static void dir_rename_done (DirRenameData *drdata, gboolean success)
+{
+    if (drdata->rename_cb)
+        drdata->rename_cb (drdata->req, success);
+    dir_rename_data_destroy (drdata);
+}
+
+// remove the entry and all its children from the inode table, before the entry is destroyed
+static void dir_tree_forget_entry (DirTree *dtree, DirEntry *en)
+{
+    if (en->type == DET_dir && en->h_dir_tree) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init (&iter, en->h_dir_tree);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            dir_tree_forget_entry (dtree, (DirEntry *) value);
+    }
+
+    g_hash_table_remove (dtree->h_inodes, GUINT_TO_POINTER (en->ino));
+}
+
+// set the new full path of the entry and its children
+// inodes are kept, so cached data stays valid, only ETags of the copies are updated
+static void dir_tree_entry_set_fullpath (DirRenameData *drdata, DirEntry *en, DirEntry *parent_en)
+{
+    g_free (en->fullpath);
+    if (parent_en->ino == FUSE_ROOT_ID)
+        en->fullpath = g_strdup (en->basename);
+    else
+        en->fullpath = g_strdup_printf ("%s/%s", parent_en->fullpath, en->basename);
+
+    if (en->type == DET_dir && en->h_dir_tree) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init (&iter, en->h_dir_tree);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            dir_tree_entry_set_fullpath (drdata, (DirEntry *) value, en);
+    } else {
+        const gchar *etag = g_hash_table_lookup (drdata->h_etags, en->fullpath);
+
+        g_free (en->etag);
+        en->etag = NULL;
+        en->etag_time = 0;
+
+        if (etag) {
+            // S3 returns quoted ETag in headers
+            en->etag = g_strdup_printf ("\"%s\"", etag);
+            en->etag_time = time (NULL);
+            cache_mng_update_etag (application_get_cache_mng (drdata->dtree->app), en->ino, en->etag);
+        }
+    }
+}
+
+// move DirEntry subtree to the new parent, without re-listing the directory
+static gboolean dir_rename_reparent (DirRenameData *drdata)
+{
+    DirTree *dtree = drdata->dtree;
     DirEntry *parent_en;
     DirEntry *newparent_en;
+    DirEntry *en;
+    DirEntry *target_en;
+    gpointer orig_key;
 
-    parent_en = g_hash_table_lookup (rdata->dtree->h_inodes, GUINT_TO_POINTER (rdata->parent_ino));
-    if (!parent_en || parent_en->type != DET_dir) {
-        LOG_err (DIR_TREE_LOG, INO_H"Entry not found !", INO_T (rdata->parent_ino));
-        if (rdata->rename_cb)
-            rdata->rename_cb (rdata->req, FALSE);
-        rename_data_destroy (rdata);
+    parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (drdata->parent_ino));
+    newparent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (drdata->newparent_ino));
+    if (!parent_en || parent_en->type != DET_dir || !newparent_en || newparent_en->type != DET_dir) {
+        LOG_err (DIR_TREE_LOG, "Parent directory not found !");
+        return FALSE;
+    }
+
+    if (!g_hash_table_lookup_extended (parent_en->h_dir_tree, drdata->name, &orig_key, (gpointer *) &en)) {
+        LOG_err (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, drdata->name, INO drdata->parent_ino);
+        return FALSE;
+    }
+
+    // lookup creates "removed" entries for missing names, replace it
+    target_en = g_hash_table_lookup (newparent_en->h_dir_tree, drdata->newname);
+    if (target_en) {
+        if (!target_en->removed) {
+            LOG_err (DIR_TREE_LOG, INO_H"Destination '%s' already exists !", INO_T (target_en->ino), drdata->newname);
+            return FALSE;
+        }
+        dir_tree_forget_entry (dtree, target_en);
+        g_hash_table_remove (newparent_en->h_dir_tree, drdata->newname);
+    }
+
+    g_hash_table_steal (parent_en->h_dir_tree, drdata->name);
+    g_free (orig_key);
+
+    g_free (en->basename);
+    en->basename = g_strdup (drdata->newname);
+    en->parent_ino = newparent_en->ino;
+    en->access_time = time (NULL);
+    g_hash_table_insert (newparent_en->h_dir_tree, g_strdup (en->basename), en);
+    dir_entry_files_changed (parent_en);
+    dir_entry_files_changed (newparent_en);
+
+    dir_tree_entry_set_fullpath (drdata, en, newparent_en);
+
+    dir_tree_entry_modified (dtree, parent_en);
+    dir_tree_entry_modified (dtree, newparent_en);
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Directory is moved to %s", INO_T (en->ino), en->fullpath);
+
+    return TRUE;
+}
+
+/*{{{ delete objects */
+static void dir_rename_on_deleted_cb (gpointer ctx, gboolean success, GList *l_failed)
+{
+    DirRenameData *drdata = (DirRenameData *) ctx;
+    guint batch = 0;
+
+    while (drdata->l_next_delete && batch < FILEIO_DELETE_MAX_KEYS) {
+        drdata->l_next_delete = g_list_next (drdata->l_next_delete);
+        batch++;
+    }
+
+    if (!success)
+        drdata->delete_failed += batch;
+    else
+        drdata->delete_failed += g_list_length (l_failed);
+
+    dir_rename_delete_next (drdata);
+}
+
+// delete objects in sequential batches of up to FILEIO_DELETE_MAX_KEYS keys
+static void dir_rename_delete_next (DirRenameData *drdata)
+{
+    GList *l_batch = NULL;
+    GList *l;
+    guint batch = 0;
+
+    for (l = drdata->l_next_delete; l && batch < FILEIO_DELETE_MAX_KEYS; l = g_list_next (l), batch++)
+        l_batch = g_list_prepend (l_batch, l->data);
+
+    if (l_batch) {
+        l_batch = g_list_reverse (l_batch);
+        fileio_delete_objects (drdata->dtree->app, l_batch, dir_rename_on_deleted_cb, drdata);
+        g_list_free (l_batch);
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, rdata->name);
-    if (!en) {
-        LOG_debug (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, rdata->name, INO rdata->parent_ino);
-        if (rdata->rename_cb)
-            rdata->rename_cb (rdata->req, FALSE);
-        rename_data_destroy (rdata);
+    // rename failed, the copies are removed, source objects are intact
+    if (drdata->failed) {
+        if (drdata->delete_failed)
+            LOG_err (DIR_TREE_LOG, "Failed to remove %u copies of %s objects !", drdata->delete_failed, drdata->src_prefix);
+        dir_rename_done (drdata, FALSE);
         return;
     }
 
-    newparent_en = g_hash_table_lookup (rdata->dtree->h_inodes, GUINT_TO_POINTER (rdata->newparent_ino));
-    if (!newparent_en || newparent_en->type != DET_dir) {
-        LOG_err (DIR_TREE_LOG, INO_H"Entry not found !", INO_T (rdata->newparent_ino));
-        if (rdata->rename_cb)
-            rdata->rename_cb (rdata->req, FALSE);
-        rename_data_destroy (rdata);
+    // the destination is complete, leftovers of the source re-appear after the directory is re-listed
+    if (drdata->delete_failed)
+        LOG_err (DIR_TREE_LOG, "Failed to remove %u objects of %s !", drdata->delete_failed, drdata->src_prefix);
+
+    dir_rename_done (drdata, TRUE);
+}
+
+static void dir_rename_delete_start (DirRenameData *drdata)
+{
+    GList *l;
+
+    g_list_free (drdata->l_delete);
+    drdata->l_delete = NULL;
+
+    // the tree is moved before any source object is removed,
+    // if the destination appeared meanwhile, the rename fails and the copies are removed instead
+    if (!drdata->failed && !dir_rename_reparent (drdata))
+        drdata->failed = TRUE;
+
+    if (drdata->failed) {
+        for (l = g_list_first (drdata->l_copied); l; l = g_list_next (l))
+            drdata->l_delete = g_list_prepend (drdata->l_delete, l->data);
+    } else {
+        for (l = g_list_first (drdata->l_objects); l; l = g_list_next (l))
+            drdata->l_delete = g_list_prepend (drdata->l_delete, ((HttpConnectionObject *) l->data)->key);
+    }
+    drdata->l_delete = g_list_reverse (drdata->l_delete);
+    drdata->l_next_delete = drdata->l_delete;
+
+    dir_rename_delete_next (drdata);
+}
+/*}}}*/
+
+/*{{{ copy objects */
+static void dir_rename_on_copied_cb (gpointer ctx, gboolean success, const gchar *etag)
+{
+    DirRenameCopy *dcopy = (DirRenameCopy *) ctx;
+    DirRenameData *drdata = dcopy->drdata;
+
+    drdata->copies_in_flight--;
+
+    if (success) {
+        if (etag)
+            g_hash_table_insert (drdata->h_etags, g_strdup (dcopy->dst_key), g_strdup (etag));
+        drdata->l_copied = g_list_prepend (drdata->l_copied, dcopy->dst_key);
+    } else {
+        LOG_err (DIR_TREE_LOG, "Failed to copy %s !", dcopy->dst_key);
+        drdata->failed = TRUE;
+        g_free (dcopy->dst_key);
+    }
+    g_free (dcopy);
+
+    dir_rename_pump (drdata);
+}
+
+// copy objects in parallel, up to "s3.copy_max_objects_in_flight" at once
+static void dir_rename_pump (DirRenameData *drdata)
+{
+    guint max_copies = MAX (conf_get_uint (application_get_conf (drdata->dtree->app), "s3.copy_max_objects_in_flight"), 1);
+    size_t src_prefix_len = strlen (drdata->src_prefix);
+
+    // fileio_copy_object () might call dir_rename_on_copied_cb () right away
+    if (drdata->pumping) {
+        drdata->pump_again = TRUE;
         return;
     }
+    drdata->pumping = TRUE;
 
-    http_connection_acquire (con);
+    do {
+        drdata->pump_again = FALSE;
 
-    // source
-    char * temp = g_strdup_printf ("%s/%s%s", conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_name"),
-                                    conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_prefix_path"), en->fullpath);
-    src_path = url_escape(temp);
-    g_free (temp);
-    http_connection_add_output_header (con, "x-amz-copy-source", src_path);
-    g_free (src_path);
+        while (!drdata->failed && drdata->l_next_copy && drdata->copies_in_flight < max_copies) {
+            HttpConnectionObject *obj = (HttpConnectionObject *) drdata->l_next_copy->data;
+            DirRenameCopy *dcopy;
 
-    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (rdata->dtree->app), "s3.storage_type"));
+            drdata->l_next_copy = g_list_next (drdata->l_next_copy);
 
-    if (rdata->newparent_ino == FUSE_ROOT_ID)
-        temp = g_strdup_printf ("%s%s/%s", conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_prefix_path"),
-                    newparent_en->fullpath, rdata->newname);
-    else
-        temp = g_strdup_printf ("/%s%s/%s", conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_prefix_path"),
-                    newparent_en->fullpath, rdata->newname);
-    dst_path = url_escape(temp);
-    g_free(temp);
+            dcopy = g_new0 (DirRenameCopy, 1);
+            dcopy->drdata = drdata;
+            dcopy->dst_key = g_strdup_printf ("%s%s", drdata->dst_prefix, obj->key + src_prefix_len);
+            drdata->copies_in_flight++;
 
-    LOG_debug (DIR_TREE_LOG, INO_CON_H"Rename: coping %s to %s", INO_T (en->ino), (void *)con, en->fullpath, dst_path);
+            LOG_debug (DIR_TREE_LOG, "Rename: copying %s to %s", obj->key, dcopy->dst_key);
+            fileio_copy_object (drdata->dtree->app, obj->key, dcopy->dst_key, obj->size, dir_rename_on_copied_cb, dcopy);
+        }
+    } while (drdata->pump_again);
 
-    res = http_connection_make_request (con,
-        dst_path, "PUT",
-        NULL, TRUE, NULL,
-        dir_tree_on_rename_copy_cb,
-        rdata
-    );
-    g_free (dst_path);
+    drdata->pumping = FALSE;
 
-    if (!res) {
-        LOG_err (DIR_TREE_LOG, "Failed to create http request !");
-        if (rdata->rename_cb)
-            rdata->rename_cb (rdata->req, FALSE);
-        http_connection_release (con);
-        rename_data_destroy (rdata);
+    if (drdata->copies_in_flight)
+        return;
+
+    if (!drdata->failed && drdata->l_next_copy)
+        return;
+
+    // all copies are done, remove the sources (or the copies on failure)
+    dir_rename_delete_start (drdata);
+}
+/*}}}*/
+
+/*{{{ list objects */
+static void dir_rename_on_listed_cb (gpointer ctx, gboolean success, GList *l_objects)
+{
+    DirRenameData *drdata = (DirRenameData *) ctx;
+
+    if (!success) {
+        LOG_err (DIR_TREE_LOG, "Failed to list objects of %s !", drdata->src_prefix);
+        dir_rename_done (drdata, FALSE);
+        return;
+    }
+
+    LOG_debug (DIR_TREE_LOG, "Rename: %u objects found under %s", g_list_length (l_objects), drdata->src_prefix);
+
+    drdata->l_objects = l_objects;
+    drdata->l_next_copy = l_objects;
+
+    dir_rename_pump (drdata);
+}
+
+static void dir_rename_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    DirRenameData *drdata = (DirRenameData *) ctx;
+
+    // the listing has no delimiter, it contains all objects of the subtree
+    http_connection_get_object_listing (con, drdata->src_prefix, dir_rename_on_listed_cb, drdata);
+}
+/*}}}*/
+
+static void dir_tree_rename_dir (DirTree *dtree, DirEntry *en, DirEntry *newparent_en,
+    fuse_ino_t parent_ino, const char *name, const char *newname,
+    DirTree_rename_cb rename_cb, fuse_req_t req)
+{
+    DirRenameData *drdata;
+    DirEntry *tmp_en;
+
+    // a directory can't be moved into itself
+    for (tmp_en = newparent_en; tmp_en; tmp_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (tmp_en->parent_ino))) {
+        if (tmp_en->ino == en->ino) {
+            LOG_err (DIR_TREE_LOG, INO_H"Can't move directory into itself !", INO_T (en->ino));
+            if (rename_cb)
+                rename_cb (req, FALSE);
+            return;
+        }
+        if (tmp_en->ino == FUSE_ROOT_ID)
+            break;
+    }
+
+    tmp_en = g_hash_table_lookup (newparent_en->h_dir_tree, newname);
+    if (tmp_en && !tmp_en->removed) {
+        LOG_err (DIR_TREE_LOG, INO_H"Destination '%s' already exists !", INO_T (tmp_en->ino), newname);
+        if (rename_cb)
+            rename_cb (req, FALSE);
+        return;
+    }
+
+    drdata = g_new0 (DirRenameData, 1);
+    drdata->dtree = dtree;
+    drdata->parent_ino = parent_ino;
+    drdata->name = g_strdup (name);
+    drdata->newparent_ino = newparent_en->ino;
+    drdata->newname = g_strdup (newname);
+    drdata->rename_cb = rename_cb;
+    drdata->req = req;
+    drdata->h_etags = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    drdata->src_prefix = g_strdup_printf ("%s/", en->fullpath);
+    if (newparent_en->ino == FUSE_ROOT_ID)
+        drdata->dst_prefix = g_strdup_printf ("%s/", newname);
+    else
+        drdata->dst_prefix = g_strdup_printf ("%s/%s/", newparent_en->fullpath, newname);
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Rename: moving directory %s to %s", INO_T (en->ino), drdata->src_prefix, drdata->dst_prefix);
+
+    if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_rename_on_con_cb, drdata)) {
+        LOG_err (DIR_TREE_LOG, "Failed to get HTTP client !");
+        dir_rename_done (drdata, FALSE);
         return;
     }
 }
@@ -2071,6 +2748,7 @@ void dir_tree_rename (DirTree *dtree,
     DirEntry *parent_en;
     DirEntry *newparent_en;
     DirEntry *en;
+    gchar *dst_fname;
 
     LOG_debug (DIR_TREE_LOG, "Renaming: %s parent: %"INO_FMT" to %s parent: %"INO_FMT,
         name, INO parent_ino, newname, INO newparent_ino);
@@ -2099,21 +2777,10 @@ void dir_tree_rename (DirTree *dtree,
         return;
     }
 
-    // we need to rename each object, which contains this directory in the path
+    // each object, which contains this directory in the path, is copied and removed
     // could take a quite amount of time
     if (en->type == DET_dir) {
-        LOG_err (DIR_TREE_LOG, "Removing directories is not supported !");
-        if (rename_cb)
-            rename_cb (req, FALSE);
-        return;
-    }
-
-    // You create a copy of your object up to 5 GB in size in a single atomic operation using this API.
-    // However, for copying an object greater than 5 GB, you must use the multipart upload API
-    if (en->size >= FIVEG) {
-        LOG_err (DIR_TREE_LOG, "Removing files larger than 5Gb is not currently supported !");
-        if (rename_cb)
-            rename_cb (req, FALSE);
+        dir_tree_rename_dir (dtree, en, newparent_en, parent_ino, name, newname, rename_cb, req);
         return;
     }
 
@@ -2125,15 +2792,19 @@ void dir_tree_rename (DirTree *dtree,
     rdata->newname = g_strdup (newname);
     rdata->rename_cb = rename_cb;
     rdata->req = req;
+    rdata->ino = en->ino;
+    rdata->size = en->size;
 
-    if (!client_pool_get_client (application_get_ops_client_pool (dtree->app),
-        dir_tree_on_rename_copy_con_cb, rdata)) {
-        LOG_debug (DIR_TREE_LOG, "Failed to get HTTPPool !");
-        if (rename_cb)
-           rename_cb (req, FALSE);
-        rename_data_destroy (rdata);
-        return;
-    }
+    if (newparent_ino == FUSE_ROOT_ID)
+        dst_fname = g_strdup (newname);
+    else
+        dst_fname = g_strdup_printf ("%s/%s", newparent_en->fullpath, newname);
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Rename: copying %s to %s", INO_T (en->ino), en->fullpath, dst_fname);
+
+    // objects larger than 5 GB (and large objects in general) are copied by parts
+    fileio_copy_object (dtree->app, en->fullpath, dst_fname, en->size, dir_tree_on_rename_copied_cb, rdata);
+    g_free (dst_fname);
 }
 /*}}}*/
 
@@ -18,10 +18,22 @@
 #include "file_io_ops.h"
 #include "http_connection.h"
 #include "cache_mng.h"
+#include "mem_budget.h"
+#include "uploader.h"
 #include "utils.h"
 #include "dir_tree.h"
 
 /*{{{ struct */
+// read access pattern of the file handle
+typedef enum {
+    FIO_ACCESS_SEQUENTIAL = 0, // streaming reader, whole parts are downloaded
+    FIO_ACCESS_STRIDED = 1, // reads with the same distance between them
+    FIO_ACCESS_RANDOM = 2,
+    FIO_ACCESS_TAIL = 3, // file footer is read first (columnar formats, archives)
+} FileIOAccessPattern;
+
+typedef struct _FileOpenPrefetch FileOpenPrefetch;
+
 struct _FileIO {
     Application *app;
     gchar *fname;
@@ -31,48 +43,178 @@ struct _FileIO {
 
     // write
     guint64 current_size;
-    struct evbuffer *write_buf;
+    struct evbuffer *write_buf; // data which isn't queued for upload, only if it can't be kept in the cache file
+    guint64 part_off; // offset of the data which isn't queued for upload yet
+    gboolean staged; // cache entry is staged by this file handle, it isn't evicted
     gboolean multipart_initiated;
     gchar *uploadid;
     guint part_number;
+    guint64 upload_part_size; // size of the new parts, it grows if parts are uploaded fast
     GList *l_parts; // list of FileIOPart
     MD5_CTX md5;
+    GQueue *q_parts_pending; // parts waiting for UploadId or for a free connection, FileIOPart
+    guint parts_in_flight; // the number of parts being uploaded
+    GList *l_write_waiters; // writes waiting for room in the upload window, FileWriteData
+    gboolean multipart_init_pending; // Initiate Multipart Upload request is in progress
+    gboolean upload_failed; // one of the parts failed to upload, the file can't be completed
+    guint stores_pending; // written data being stored in the cache file, parts are read from it
+    guint parts_loading; // parts waiting for the descriptor of the cache file
+    int release_fd; // the file is sent from the cache file by a single request, -1 if it's sent from write_buf
+    gboolean released; // fileio_release () is called, upload is finished in background
+    gboolean write_pumping; // fileio_write_pump () is running
+    gboolean write_pump_again; // state was changed while fileio_write_pump () was running
+    gboolean wbh_queued; // current content is queued for write-behind upload (by fsync)
+    GList *l_sync_waiters; // fsync calls waiting for queued parts or for unchanged data of the staged file, FileSyncData
+
+    // write-back
+    gboolean write_back; // writes are staged in local cache file, the object is uploaded on release
+    gboolean wb_modified; // staged file was written
+    gboolean wb_base_known; // size and ETag of the base object are known
+    guint64 base_size; // size of the remote object which is modified, 0 for a new object
+    gchar *base_etag; // ETag of the remote object, unchanged parts are copied from it
+    guint64 wb_end; // the end of written data
+    guint64 wb_next_off; // offset of the next part to build
+    gboolean wb_request_pending; // HEAD request or download of unchanged data is in progress
 
     // read
     gboolean head_req_sent;
+    gboolean head_req_pending; // request for the file size and ETag is in progress
+    GList *l_head_waiters; // reads waiting for the file size and ETag, FileReadData
     guint64 file_size;
+    gchar *aws_etag; // ETag of the object, as returned by the server
+
+    // read-ahead
+    guint64 ra_next_off; // expected offset of the next sequential read
+    guint64 ra_window; // current read-ahead window size, 0 if disabled
+    guint64 ra_end; // read-ahead requests are sent up to this offset
+
+    // access pattern
+    FileIOAccessPattern access_pattern;
+    guint64 reads_nr; // the number of read requests
+    off_t last_read_off; // offset of the previous read request
+    size_t last_read_size; // size of the previous read request
+    gint64 last_stride; // distance between the two previous read requests
+
+    FileOpenPrefetch *open_prefetch; // open-time prefetch request, if it's in progress
+};
+
+// open-time prefetch of the file tail, outlives FileIO
+struct _FileOpenPrefetch {
+    Application *app;
+    FileIO *fop; // NULL if the file is released
+    gchar *fname;
+    fuse_ino_t ino;
 };
 
 typedef struct {
     guint part_number;
     gchar *md5str;
     gchar *md5b;
+    struct evbuffer *buf; // part data, until it's passed to HTTP request
+    int fd; // part data is sent from [off, off + size) of the cache file, -1 if it's in buf
+    guint64 off;
+    guint64 size;
+    gboolean copy; // UploadPartCopy of the unchanged range of the base object
+    gboolean loading; // the descriptor of the cache file isn't received yet, the part isn't sent
+    guint64 copy_off;
+    guint64 copy_size;
 } FileIOPart;
+
+typedef struct {
+    FileIO_on_synced_cb on_synced_cb;
+    gpointer ctx;
+} FileSyncData;
 /*}}}*/
 
 #define FIO_LOG "fio"
 
+// reads within this distance from the expected offset are sequential (async reads might be reordered)
+#define FIO_SEQUENTIAL_GAP (1024 * 1024)
+// the number of the first reads, which are checked for tail-first access
+#define FIO_TAIL_READS 3
+// the number of the following reads of a long stride, which are downloaded in advance
+#define FIO_STRIDE_PREFETCH 4
+// holes of the staged file are filled with zeros by blocks of this size
+#define FIO_HOLE_BLOCK (1024 * 1024)
+// MD5 of the part stored in the cache file is calculated by blocks of this size
+#define FIO_MD5_BLOCK (256 * 1024)
+// S3 limits: minimal size of a part (except the last one) and maximal number of parts
+#define FIO_MIN_PART_SIZE (5 * 1024 * 1024)
+#define FIO_MAX_PARTS 10000
+// the part size is doubled every FIO_PARTS_PER_STEP parts, 10000 parts of 5 MB and larger cover 5 TB object
+#define FIO_PARTS_PER_STEP 1000
+// part uploaded faster than this time (in milliseconds) is too small, the request overhead dominates
+#define FIO_PART_MIN_TIME 2000
+// the part size isn't grown by the measured throughput beyond this size
+#define FIO_MAX_ADAPTIVE_PART_SIZE (512 * 1024 * 1024)
+
 /*{{{ create / destroy */
 
+// escaped object path, used in requests
+static gchar *fileio_get_object_path (Application *app, const gchar *fname)
+{
+    gchar *tmp;
+    gchar *path;
+
+    tmp = g_strdup_printf ("/%s%s", conf_get_string (application_get_conf (app), "s3.bucket_prefix_path"),
+                     fname);
+    path = url_escape(tmp);
+    g_free(tmp);
+
+    return path;
+}
+
 FileIO *fileio_create (Application *app, const gchar *fname, fuse_ino_t ino, gboolean assume_new)
 {
     FileIO *fop;
-    char* tmp;
 
     fop = g_new0 (FileIO, 1);
     fop->app = app;
     fop->current_size = 0;
     fop->write_buf = evbuffer_new ();
-    tmp = g_strdup_printf ("/%s%s", conf_get_string (application_get_conf (app), "s3.bucket_prefix_path"),
-                     fname);
-    fop->fname = url_escape(tmp);
-    g_free(tmp);
+    fop->part_off = 0;
+    fop->staged = FALSE;
+    fop->fname = fileio_get_object_path (app, fname);
     fop->content_type = NULL;
     fop->file_size = 0;
     fop->head_req_sent = FALSE;
+    fop->head_req_pending = FALSE;
+    fop->l_head_waiters = NULL;
+    fop->aws_etag = NULL;
+    fop->ra_next_off = 0;
+    fop->ra_window = 0;
+    fop->ra_end = 0;
+    fop->access_pattern = FIO_ACCESS_SEQUENTIAL;
+    fop->reads_nr = 0;
+    fop->last_read_off = 0;
+    fop->last_stride = 0;
+    fop->last_read_size = 0;
+    fop->open_prefetch = NULL;
     fop->multipart_initiated = FALSE;
     fop->uploadid = NULL;
+    fop->part_number = 1;
+    fop->upload_part_size = conf_get_uint (application_get_conf (app), "s3.part_size");
     fop->l_parts = NULL;
+    fop->q_parts_pending = g_queue_new ();
+    fop->parts_in_flight = 0;
+    fop->l_write_waiters = NULL;
+    fop->multipart_init_pending = FALSE;
+    fop->upload_failed = FALSE;
+    fop->stores_pending = 0;
+    fop->parts_loading = 0;
+    fop->release_fd = -1;
+    fop->released = FALSE;
+    fop->write_pumping = FALSE;
+    fop->write_pump_again = FALSE;
+    fop->l_sync_waiters = NULL;
+    fop->write_back = FALSE;
+    fop->wb_modified = FALSE;
+    fop->wb_base_known = FALSE;
+    fop->base_size = 0;
+    fop->base_etag = NULL;
+    fop->wb_end = 0;
+    fop->wb_next_off = 0;
+    fop->wb_request_pending = FALSE;
     fop->ino = ino;
     fop->assume_new = assume_new;
     MD5_Init (&fop->md5);
@@ -83,26 +225,69 @@ FileIO *fileio_create (Application *app, const gchar *fname, fuse_ino_t ino, gbo
 void fileio_destroy (FileIO *fop)
 {
     GList *l;
+    MemBudget *mb = application_get_mem_budget (fop->app);
 
     for (l = g_list_first (fop->l_parts); l; l = g_list_next (l)) {
         FileIOPart *part = (FileIOPart *) l->data;
         g_free (part->md5str);
         g_free (part->md5b);
+        if (part->buf) {
+            mem_budget_release (mb, evbuffer_get_length (part->buf));
+            evbuffer_free (part->buf);
+        }
+        if (part->fd >= 0)
+            close (part->fd);
         g_free (part);
     }
     g_list_free(fop->l_parts);
+    // parts are owned by l_parts
+    g_queue_free (fop->q_parts_pending);
+    mem_budget_release (mb, evbuffer_get_length (fop->write_buf));
     evbuffer_free (fop->write_buf);
+    if (fop->release_fd >= 0)
+        close (fop->release_fd);
     g_free (fop->fname);
     if (fop->content_type)
         g_free (fop->content_type);
     if (fop->uploadid)
         g_free (fop->uploadid);
+    if (fop->aws_etag)
+        g_free (fop->aws_etag);
+    if (fop->base_etag)
+        g_free (fop->base_etag);
+    // staged file can be evicted now
+    if (fop->staged)
+        cache_mng_unstage_file (application_get_cache_mng (fop->app), fop->ino);
+    // open-time prefetch is finished without FileIO
+    if (fop->open_prefetch)
+        fop->open_prefetch->fop = NULL;
+    // FUSE doesn't release file while read requests are in progress
+    if (fop->l_head_waiters) {
+        LOG_err (FIO_LOG, INO_H"Destroying FileIO with pending read requests !", INO_T (fop->ino));
+        g_list_free (fop->l_head_waiters);
+    }
+    // FUSE doesn't release file while fsync is in progress
+    if (fop->l_sync_waiters) {
+        LOG_err (FIO_LOG, INO_H"Destroying FileIO with pending fsync requests !", INO_T (fop->ino));
+        for (l = g_list_first (fop->l_sync_waiters); l; l = g_list_next (l)) {
+            FileSyncData *sdata = (FileSyncData *) l->data;
+            sdata->on_synced_cb (sdata->ctx, FALSE);
+            g_free (sdata);
+        }
+        g_list_free (fop->l_sync_waiters);
+    }
     g_free (fop);
 }
 /*}}}*/
 
 /*{{{ fileio_release*/
 
+static void fileio_write_queue_written (FileIO *fop);
+static void fileio_write_pump (FileIO *fop);
+static void fileio_write_back_request_base (FileIO *fop);
+static gboolean fileio_write_back_fetch (FileIO *fop, guint64 off, guint64 size);
+static gboolean fileio_write_md5_file (FileIO *fop, int fd, guint64 off, guint64 size, gchar **md5str, gchar **md5b);
+
 static void fileio_release_update_headers (FileIO *fop)
 {
         LOG_debug (FIO_LOG, INO_H"File uploaded !", INO_T (fop->ino));
@@ -110,6 +295,46 @@ static void fileio_release_update_headers (FileIO *fop)
 }
 /*}}}*/
 
+/*{{{ Abort Multipart Upload */
+static void fileio_on_multipart_aborted_cb (HttpConnection *con, G_GNUC_UNUSED void *ctx, G_GNUC_UNUSED gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    http_connection_release (con);
+}
+
+// uploaded parts are removed by the server, result is ignored
+static void fileio_abort_multipart_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    gchar *path = (gchar *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    res = http_connection_make_request (con,
+        path, "DELETE", NULL, TRUE, NULL,
+        fileio_on_multipart_aborted_cb,
+        NULL
+    );
+    g_free (path);
+
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// multipart upload can't be completed, its parts aren't kept (and billed) by the server
+static void fileio_abort_multipart (Application *app, const gchar *fname, const gchar *uploadid)
+{
+    gchar *path = g_strdup_printf ("%s?uploadId=%s", fname, uploadid);
+
+    if (!client_pool_get_client (application_get_ops_client_pool (app), fileio_abort_multipart_on_con_cb, path)) {
+        LOG_err (FIO_LOG, "Failed to abort multipart upload of %s !", fname);
+        g_free (path);
+    }
+}
+/*}}}*/
+
 /*{{{ Complete Multipart Upload */
 // multipart is sent
 static void fileio_release_on_complete_cb (HttpConnection *con, void *ctx, gboolean success,
@@ -208,15 +433,8 @@ static void fileio_release_on_part_sent_cb (HttpConnection *con, void *ctx, gboo
         return;
     }
 
-    // if it's a multi part upload - Complete Multipart Upload
-    if (fop->multipart_initiated) {
-        fileio_release_complete_multipart (fop);
-
-    // or we are done
-    } else {
-        fileio_release_update_headers (fop);
-        //fileio_destroy (fop);
-    }
+    // we are done
+    fileio_release_update_headers (fop);
 }
 
 // got HttpConnection object
@@ -228,51 +446,74 @@ static void fileio_release_on_part_con_cb (gpointer client, gpointer ctx)
     gboolean res;
     FileIOPart *part;
     size_t buf_len;
-    const gchar *buf;
+    const gchar *buf = NULL;
+    int fd = -1;
 
-    LOG_debug (FIO_LOG, INO_CON_H"Releasing fop. Size: %zu", INO_T (fop->ino), (void *)con, evbuffer_get_length (fop->write_buf));
+    LOG_debug (FIO_LOG, INO_CON_H"Releasing fop. Size: %"G_GUINT64_FORMAT, INO_T (fop->ino), (void *)con, fop->current_size);
 
     // add part information to the list
     part = g_new0 (FileIOPart, 1);
-    part->part_number = fop->part_number;
-    buf_len = evbuffer_get_length (fop->write_buf);
-    buf = (const gchar *)evbuffer_pullup (fop->write_buf, buf_len);
-
-    // XXX: move to separate thread
-    // 1. calculate MD5 of a part.
-    get_md5_sum (buf, buf_len, &part->md5str, &part->md5b);
-    // 2. calculate MD5 of multiple message blocks
-    MD5_Update (&fop->md5, buf, buf_len);
-
+    part->part_number = 1;
+    part->fd = -1;
     fop->l_parts = g_list_append (fop->l_parts, part);
 
-    // if this is a multipart
-    if (fop->multipart_initiated) {
-
-        if (!fop->uploadid) {
-            LOG_err (FIO_LOG, INO_CON_H"UploadID is not set, aborting operation !", INO_T (fop->ino), (void *)con);
+    // the file is sent from local cache, unless it's kept in memory
+    if (fop->release_fd >= 0) {
+        buf_len = fop->current_size;
+        fd = fop->release_fd;
+        fop->release_fd = -1;
+        if (!fileio_write_md5_file (fop, fd, 0, buf_len, &part->md5str, &part->md5b)) {
+            LOG_err (FIO_LOG, INO_CON_H"Failed to read file from local cache !", INO_T (fop->ino), (void *)con);
+            close (fd);
+            http_connection_release (con);
             fileio_destroy (fop);
             return;
         }
-
-        path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s",
-        fop->fname, fop->part_number, fop->uploadid);
-        fop->part_number++;
     } else {
-        path = fop->fname;
+        buf_len = evbuffer_get_length (fop->write_buf);
+        buf = (const gchar *)evbuffer_pullup (fop->write_buf, buf_len);
+
+        // XXX: move to separate thread
+        // 1. calculate MD5 of a part.
+        get_md5_sum (buf, buf_len, &part->md5str, &part->md5b);
+        // 2. calculate MD5 of multiple message blocks
+        MD5_Update (&fop->md5, buf, buf_len);
     }
 
+    path = fop->fname;
+
 #ifdef MAGIC_ENABLED
     // guess MIME type
-    const gchar *mime_type = magic_buffer (application_get_magic_ctx (fop->app), buf, buf_len);
-    if (mime_type) {
-        LOG_debug (FIO_LOG, "Guessed MIME type of %s as %s", path, mime_type);
-        fop->content_type = g_strdup (mime_type);
-    } else {
-        LOG_err (FIO_LOG, "Failed to guess MIME type of %s !", path);
+    {
+        gchar head[4096];
+        ssize_t head_len = buf_len;
+        const gchar *mime_type;
+
+        if (fd >= 0) {
+            head_len = pread (fd, head, MIN (buf_len, sizeof (head)), 0);
+            buf = head;
+        }
+        mime_type = head_len >= 0 ? magic_buffer (application_get_magic_ctx (fop->app), buf, head_len) : NULL;
+        if (mime_type) {
+            LOG_debug (FIO_LOG, "Guessed MIME type of %s as %s", path, mime_type);
+            fop->content_type = g_strdup (mime_type);
+        } else {
+            LOG_err (FIO_LOG, "Failed to guess MIME type of %s !", path);
+        }
     }
 #endif
 
+    // the file is sent without copying it to memory
+    if (fd >= 0) {
+        res = http_connection_set_output_file (con, fd, 0, buf_len);
+        close (fd);
+        if (!res) {
+            http_connection_release (con);
+            fileio_destroy (fop);
+            return;
+        }
+    }
+
     http_connection_acquire (con);
 
     // add output headers
@@ -281,8 +522,8 @@ static void fileio_release_on_part_con_cb (gpointer client, gpointer ctx)
         http_connection_add_output_header (con, "Content-Type", fop->content_type);
 
 
-    // if this is the full file
-    if (!fop->multipart_initiated) {
+    // this is the full file
+    {
         time_t t;
         gchar time_str[50];
 
@@ -296,731 +537,3501 @@ static void fileio_release_on_part_con_cb (gpointer client, gpointer ctx)
     }
 
     res = http_connection_make_request (con,
-        path, "PUT", fop->write_buf, TRUE, NULL,
+        path, "PUT", fd >= 0 ? NULL : fop->write_buf, TRUE, NULL,
         fileio_release_on_part_sent_cb,
         fop
     );
 
-    if (!res) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (fop->ino), (void *)con);
-        http_connection_release (con);
-        fileio_destroy (fop);
-        return;
-    }
-}
-/*}}}*/
-
-// file is released, finish all operations
-void fileio_release (FileIO *fop)
-{
-    // if write buffer has some data left - send it to the server
-    // or an empty file was created
-    if (evbuffer_get_length (fop->write_buf) || fop->assume_new) {
-        if (!client_pool_get_client (application_get_write_client_pool (fop->app),
-            fileio_release_on_part_con_cb, fop)) {
-            LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
-            fileio_destroy (fop);
-            return;
-        }
-    } else {
-        // if it's a multi part upload - Complete Multipart Upload
-        if (fop->multipart_initiated) {
-            fileio_release_complete_multipart (fop);
-
-        // just a "small" file
-        } else
-            fileio_destroy (fop);
-    }
+    // fileio_release_on_part_sent_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
 }
 /*}}}*/
 
-/*{{{ fileio_write_buffer */
+typedef void (*FileIO_on_queued_cb) (FileIO *fop, gboolean queued, gpointer ctx);
 
 typedef struct {
     FileIO *fop;
-    size_t buf_size;
-    off_t off;
-    fuse_ino_t ino;
-    FileIO_on_buffer_written_cb on_buffer_written_cb;
+    FileIO_on_queued_cb on_queued_cb;
     gpointer ctx;
-} FileWriteData;
-
-/*{{{ send part */
+} FileWriteBehindData;
 
-// buffer is sent
-static void fileio_write_on_send_cb (HttpConnection *con, void *ctx, gboolean success,
-    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+// the file is copied into the upload directory
+static void fileio_write_behind_on_added_cb (gpointer ctx, gboolean queued)
 {
-    FileWriteData *wdata = (FileWriteData *) ctx;
-
-    http_connection_release (con);
-
-    if (!success) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to send buffer to server !", INO_T (wdata->ino), (void *)con);
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
-        return;
-    }
+    FileWriteBehindData *wbdata = (FileWriteBehindData *) ctx;
+    FileIO *fop = wbdata->fop;
 
-    // empty part buffer
-    evbuffer_drain (wdata->fop->write_buf, -1);
+    // the file could be modified while it was copied, then the flag is reset already
+    if (!queued)
+        fop->wbh_queued = FALSE;
 
-    // done sending part
-    wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, TRUE, wdata->buf_size);
-    g_free (wdata);
+    wbdata->on_queued_cb (fop, queued, wbdata->ctx);
+    g_free (wbdata);
 }
 
-// got HttpConnection object
-static void fileio_write_on_send_con_cb (gpointer client, gpointer ctx)
+// fd is closed by Uploader
+static void fileio_write_behind_add (FileWriteBehindData *wbdata, int fd, const gchar *buf)
 {
-    HttpConnection *con = (HttpConnection *) client;
-    FileWriteData *wdata = (FileWriteData *) ctx;
-    gchar *path;
-    gboolean res;
-    FileIOPart *part;
-    size_t buf_len;
-    const gchar *buf;
-
-    http_connection_acquire (con);
-
-    // add part information to the list
-    part = g_new0 (FileIOPart, 1);
-    part->part_number = wdata->fop->part_number;
-    buf_len = evbuffer_get_length (wdata->fop->write_buf);
-    buf = (const gchar *) evbuffer_pullup (wdata->fop->write_buf, buf_len);
+    FileIO *fop = wbdata->fop;
 
-    // XXX: move to separate thread
-    // 1. calculate MD5 of a part.
-    get_md5_sum (buf, buf_len, &part->md5str, &part->md5b);
-    // 2. calculate MD5 of multiple message blocks
-    MD5_Update (&wdata->fop->md5, buf, buf_len);
+    uploader_add (application_get_uploader (fop->app), fop->fname, fop->ino, fd, buf, fop->current_size,
+        fileio_write_behind_on_added_cb, NULL, wbdata);
+}
 
-    wdata->fop->l_parts = g_list_append (wdata->fop->l_parts, part);
+// stored data of the file is written to the cache file
+static void fileio_write_behind_on_fd_cb (int fd, void *ctx)
+{
+    FileWriteBehindData *wbdata = (FileWriteBehindData *) ctx;
 
-    path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s",
-        wdata->fop->fname, wdata->fop->part_number, wdata->fop->uploadid);
+    if (fd < 0) {
+        LOG_err (FIO_LOG, INO_H"File data is not found in local cache !", INO_T (wbdata->fop->ino));
+        wbdata->fop->wbh_queued = FALSE;
+        wbdata->on_queued_cb (wbdata->fop, FALSE, wbdata->ctx);
+        g_free (wbdata);
+        return;
+    }
 
-    // increase part number
-    wdata->fop->part_number++;
-    // XXX: check that part_number does not exceeds 10000
+    fileio_write_behind_add (wbdata, fd, NULL);
+}
 
-    // add output headers
-    http_connection_add_output_header (con, "Content-MD5", part->md5b);
+// write-behind: copy the whole file to the upload directory, it's uploaded in background
+// on_queued_cb gets FALSE if write-behind is disabled or the file can't be queued
+static void fileio_write_behind (FileIO *fop, FileIO_on_queued_cb on_queued_cb, gpointer ctx)
+{
+    FileWriteBehindData *wbdata;
 
-    res = http_connection_make_request (con,
-        path, "PUT", wdata->fop->write_buf, TRUE, NULL,
-        fileio_write_on_send_cb,
-        wdata
-    );
-    g_free (path);
+    if (!application_get_uploader (fop->app)) {
+        on_queued_cb (fop, FALSE, ctx);
+        return;
+    }
 
-    if (!res) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (wdata->ino), (void *)con);
-        http_connection_release (con);
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+    // not modified since the previous fsync
+    if (fop->wbh_queued) {
+        on_queued_cb (fop, TRUE, ctx);
         return;
     }
+
+    wbdata = g_new0 (FileWriteBehindData, 1);
+    wbdata->fop = fop;
+    wbdata->on_queued_cb = on_queued_cb;
+    wbdata->ctx = ctx;
+
+    // it's reset by writes
+    fop->wbh_queued = TRUE;
+
+    if (evbuffer_get_length (fop->write_buf))
+        fileio_write_behind_add (wbdata, -1, (const gchar *) evbuffer_pullup (fop->write_buf, -1));
+    else if (fop->current_size)
+        cache_mng_get_file_fd_async (application_get_cache_mng (fop->app), fop->ino, fop->current_size, 0,
+            fileio_write_behind_on_fd_cb, wbdata);
+    else
+        fileio_write_behind_add (wbdata, -1, NULL);
 }
 
-static void fileio_write_send_part (FileWriteData *wdata)
+static void fileio_release_get_client (FileIO *fop)
 {
-    if (!wdata->fop->uploadid) {
-        LOG_err (FIO_LOG, INO_H"UploadID is not set, aborting operation !", INO_T (wdata->ino));
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+    if (!client_pool_get_client (application_get_write_client_pool (fop->app),
+        fileio_release_on_part_con_cb, fop)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        fileio_destroy (fop);
         return;
     }
+}
 
-    if (!client_pool_get_client (application_get_write_client_pool (wdata->fop->app),
-        fileio_write_on_send_con_cb, wdata)) {
-        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (wdata->ino));
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+// stored data of the file is written to the cache file
+static void fileio_release_on_file_fd_cb (int fd, void *ctx)
+{
+    FileIO *fop = (FileIO *) ctx;
+
+    if (fd < 0) {
+        LOG_err (FIO_LOG, INO_H"Failed to read file from local cache !", INO_T (fop->ino));
+        fileio_destroy (fop);
         return;
     }
-}
-/*}}}*/
 
-/*{{{ Multipart Init */
+    fop->release_fd = fd;
+    fileio_release_get_client (fop);
+}
 
-static gchar *get_uploadid (const char *xml, size_t xml_len) {
-    xmlDocPtr doc;
-    xmlXPathContextPtr ctx;
-    xmlXPathObjectPtr uploadid_xp;
-    xmlNodeSetPtr nodes;
-    gchar *uploadid = NULL;
+// send the whole write buffer by a single request
+static void fileio_release_send_file (FileIO *fop)
+{
+    // the file is sent from local cache, unless it's kept in memory
+    if (!evbuffer_get_length (fop->write_buf) && fop->current_size) {
+        cache_mng_get_file_fd_async (application_get_cache_mng (fop->app), fop->ino, fop->current_size, 0,
+            fileio_release_on_file_fd_cb, fop);
+        return;
+    }
 
-    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
-    ctx = xmlXPathNewContext (doc);
-    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+    fileio_release_get_client (fop);
+}
 
-    uploadid_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:UploadId", ctx);
-    if (!uploadid_xp) {
-        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return NULL;
+// all parts of the released file are uploaded (or the upload failed), finish multipart upload
+static void fileio_release_finish (FileIO *fop)
+{
+    if (fop->upload_failed) {
+        LOG_err (FIO_LOG, INO_H"Failed to upload file parts, file is not saved !", INO_T (fop->ino));
+        // parts aren't sent any more
+        if (fop->uploadid)
+            fileio_abort_multipart (fop->app, fop->fname, fop->uploadid);
+        fileio_destroy (fop);
+        return;
     }
 
-    nodes = uploadid_xp->nodesetval;
-    if (!nodes) {
-        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeObject (uploadid_xp);
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return NULL;
+    // staged file fits into a single part, it's loaded into write buffer
+    if (!fop->multipart_initiated) {
+        fileio_release_send_file (fop);
+        return;
     }
 
-    if (!nodes || nodes->nodeNr < 1) {
-        uploadid = NULL;
-    } else {
-        uploadid = (char *) xmlNodeListGetString (doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
-    }
+    fileio_release_complete_multipart (fop);
+}
 
-    xmlXPathFreeObject (uploadid_xp);
-    xmlXPathFreeContext (ctx);
-    xmlFreeDoc (doc);
+// the file is uploaded by Uploader, sent directly if it can't be queued
+static void fileio_release_on_queued_cb (FileIO *fop, gboolean queued, G_GNUC_UNUSED gpointer ctx)
+{
+    if (queued) {
+        fileio_destroy (fop);
+        return;
+    }
 
-    return uploadid;
+    fileio_release_send_file (fop);
 }
 
-static void fileio_write_on_multipart_init_cb (HttpConnection *con, void *ctx, gboolean success,
-    const gchar *buf, size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+// all written data is stored in the cache file, send the file
+static void fileio_release_written (FileIO *fop)
 {
-    FileWriteData *wdata = (FileWriteData *) ctx;
-    gchar *uploadid;
+    if (fop->upload_failed) {
+        LOG_err (FIO_LOG, INO_H"Failed to store written data, file is not saved !", INO_T (fop->ino));
+        fileio_destroy (fop);
+        return;
+    }
 
-    http_connection_release (con);
+    // if write buffer has some data left - send it to the server
+    // or an empty file was created
+    if (fop->current_size || fop->assume_new) {
+        fileio_write_behind (fop, fileio_release_on_queued_cb, NULL);
 
-    wdata->fop->multipart_initiated = TRUE;
+    // just a "small" file
+    } else
+        fileio_destroy (fop);
+}
 
-    if (!success || !buf_len) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to get multipart init data from the server !", INO_T (wdata->ino), (void *)con);
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+// file is released, finish all operations
+void fileio_release (FileIO *fop)
+{
+    // staged file is uploaded in background, by parts if it's large
+    if (fop->write_back) {
+        // the current content is queued for upload by fsync
+        if (!fop->wb_modified || fop->wbh_queued) {
+            fileio_destroy (fop);
+            return;
+        }
+        fop->released = TRUE;
+        fileio_write_pump (fop);
         return;
     }
 
-    uploadid = get_uploadid (buf, buf_len);
-    if (!uploadid) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to parse multipart init data!", INO_T (wdata->ino), (void *)con);
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+    // parts are uploaded in background, the rest of write buffer is the last part
+    if (fop->multipart_initiated) {
+        fop->released = TRUE;
+        if (!fop->upload_failed && fop->current_size > fop->part_off)
+            fileio_write_queue_written (fop);
+        // Complete Multipart Upload is sent when all parts are uploaded
+        fileio_write_pump (fop);
         return;
     }
-    wdata->fop->uploadid = g_strdup (uploadid);
-    xmlFree (uploadid);
 
-    // done, resume uploading part
-    wdata->fop->part_number = 1;
-    fileio_write_send_part (wdata);
+    // the file is sent when the last store is finished
+    fop->released = TRUE;
+    if (!fop->stores_pending)
+        fileio_release_written (fop);
 }
 
-// got HttpConnection object
-static void fileio_write_on_multipart_init_con_cb (gpointer client, gpointer ctx)
+// the file is queued by fsync, wait for the upload
+static void fileio_fsync_on_queued_cb (FileIO *fop, gboolean queued, gpointer ctx)
 {
-    HttpConnection *con = (HttpConnection *) client;
-    FileWriteData *wdata = (FileWriteData *) ctx;
-    gboolean res;
-    gchar *path;
+    FileSyncData *sdata = (FileSyncData *) ctx;
 
-    http_connection_acquire (con);
-
-    path = g_strdup_printf ("%s?uploads", wdata->fop->fname);
+    if (queued)
+        uploader_wait (application_get_uploader (fop->app), fop->ino, sdata->on_synced_cb, sdata->ctx);
+    else
+        sdata->on_synced_cb (sdata->ctx, FALSE);
+    g_free (sdata);
+}
 
-    // send storage class with the init request
-    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (con->app), "s3.storage_type"));
-
-    res = http_connection_make_request (con,
-        path, "POST", NULL, TRUE, NULL,
-        fileio_write_on_multipart_init_cb,
-        wdata
-    );
-    g_free (path);
-
-    if (!res) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (wdata->ino), (void *)con);
-        http_connection_release (con);
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
-        return;
+// return TRUE if fsync waiters can be resumed
+static gboolean fileio_fsync_ready (FileIO *fop)
+{
+    if (fop->upload_failed)
+        return TRUE;
+
+    // staged file is queued for upload, when unchanged data of the base object is in local file
+    if (fop->write_back) {
+        if (fop->wb_request_pending)
+            return FALSE;
+        // size and ETag of the object are needed to download unchanged data
+        if (!fop->wb_base_known) {
+            fileio_write_back_request_base (fop);
+            return fop->upload_failed;
+        }
+        return fileio_write_back_fetch (fop, 0, MIN (fop->base_size, fop->current_size)) || fop->upload_failed;
     }
+
+    // parts queued so far are uploaded
+    return !fop->parts_in_flight && !fop->multipart_init_pending && !fop->stores_pending && !fop->parts_loading &&
+        g_queue_is_empty (fop->q_parts_pending);
 }
 
-static void fileio_write_init_multipart (FileWriteData *wdata)
+// resume fsync calls, called by fileio_write_pump ()
+static void fileio_fsync_pump (FileIO *fop)
 {
-    if (!client_pool_get_client (application_get_write_client_pool (wdata->fop->app),
-        fileio_write_on_multipart_init_con_cb, wdata)) {
-        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (wdata->ino));
-        wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
-        g_free (wdata);
+    GList *l_waiters, *l;
+
+    if (!fop->l_sync_waiters || !fileio_fsync_ready (fop))
         return;
+
+    l_waiters = fop->l_sync_waiters;
+    fop->l_sync_waiters = NULL;
+
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        FileSyncData *sdata = (FileSyncData *) l->data;
+
+        if (!fop->upload_failed && fop->write_back) {
+            fileio_write_behind (fop, fileio_fsync_on_queued_cb, sdata);
+            continue;
+        }
+
+        sdata->on_synced_cb (sdata->ctx, !fop->upload_failed);
+        g_free (sdata);
     }
+    g_list_free (l_waiters);
 }
-/*}}}*/
 
-void fileio_write_buffer (FileIO *fop,
-    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
-    FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
+// wait until the file data is uploaded:
+// write-behind file and modified staged file are queued to Uploader, fsync waits for the upload,
+// multipart upload can't be completed before release, fsync waits for the parts queued so far
+void fileio_fsync (FileIO *fop, FileIO_on_synced_cb on_synced_cb, gpointer ctx)
 {
-    FileWriteData *wdata;
+    Uploader *upl = application_get_uploader (fop->app);
+    FileSyncData *sdata;
 
-    // XXX: allow only sequentially write
-    // current written bytes should be always match offset
-    if (off >= 0 && fop->current_size != (guint64)off) {
-        LOG_err (FIO_LOG, INO_H"Write call with offset %"OFF_FMT" is not allowed !", INO_T (ino), off);
-        on_buffer_written_cb (fop, ctx, FALSE, 0);
+    sdata = g_new0 (FileSyncData, 1);
+    sdata->on_synced_cb = on_synced_cb;
+    sdata->ctx = ctx;
+
+    if ((fop->multipart_initiated && !fop->write_back) || (upl && fop->write_back && fop->wb_modified)) {
+        fop->l_sync_waiters = g_list_append (fop->l_sync_waiters, sdata);
+        fileio_write_pump (fop);
         return;
     }
 
-    // add data to output buffer
-    evbuffer_add (fop->write_buf, buf, buf_size);
-    fop->current_size += buf_size;
-
-    LOG_debug (FIO_LOG, INO_H"Write buf size: %zd", INO_T (ino), evbuffer_get_length (fop->write_buf));
-
-    // CacheMng
-    cache_mng_store_file_buf (application_get_cache_mng (fop->app),
-        ino, buf_size, off, (unsigned char *) buf,
-        NULL, NULL);
-
-    // if current write buffer exceeds "part_size" - this is a multipart upload
-    if (evbuffer_get_length (fop->write_buf) >= conf_get_uint (application_get_conf (fop->app), "s3.part_size")) {
-        // init helper struct
-        wdata = g_new0 (FileWriteData, 1);
-        wdata->fop = fop;
-        wdata->buf_size = buf_size;
-        wdata->off = off;
-        wdata->ino = ino;
-        wdata->on_buffer_written_cb = on_buffer_written_cb;
-        wdata->ctx = ctx;
-
-        // init multipart upload
-        if (!fop->multipart_initiated) {
-            fileio_write_init_multipart (wdata);
-
-        // else send the current part
-        } else {
-            fileio_write_send_part (wdata);
-        }
+    if (!upl) {
+        g_free (sdata);
+        on_synced_cb (ctx, TRUE);
+        return;
+    }
 
-    // or just notify client that we are ready for more data
-    } else {
-        on_buffer_written_cb (fop, ctx, TRUE, buf_size);
+    if (!fop->write_back && (fop->current_size || fop->assume_new)) {
+        fileio_write_behind (fop, fileio_fsync_on_queued_cb, sdata);
+        return;
     }
+
+    g_free (sdata);
+    uploader_wait (upl, fop->ino, on_synced_cb, ctx);
 }
 /*}}}*/
 
-/*{{{ fileio_read_buffer*/
+/*{{{ fileio_write_buffer */
 
 typedef struct {
     FileIO *fop;
-    guint64 size;
+    size_t buf_size;
     off_t off;
     fuse_ino_t ino;
-    off_t request_offset;
-    FileIO_on_buffer_read_cb on_buffer_read_cb;
+    FileIO_on_buffer_written_cb on_buffer_written_cb;
     gpointer ctx;
-    char *aws_etag;
-    gboolean cache_etag_is_set;
-} FileReadData;
+} FileWriteData;
 
-void fileread_destroy (FileReadData *rdata)
+typedef struct {
+    FileIO *fop;
+    FileIOPart *part;
+    guint64 size; // the number of bytes sent, 0 for a copied part
+    struct timeval start_tv; // time when the request is sent
+} FileWritePartData;
+
+static gchar *get_xml_value (const char *xml, size_t xml_len, const char *xpath);
+static void fileio_write_back_build_parts (FileIO *fop);
+static gboolean fileio_read_ahead_send_range (Application *app, const gchar *fname, fuse_ino_t ino,
+    guint64 off, guint64 size, const gchar *aws_etag, FileIO_on_prefetched_cb on_prefetched_cb, gpointer ctx);
+
+/*{{{ send part */
+
+// the number of parts which are not uploaded yet
+static guint fileio_write_parts_pending (FileIO *fop)
 {
-    if (rdata->aws_etag)
-        g_free (rdata->aws_etag);
-    g_free (rdata);
+    return g_queue_get_length (fop->q_parts_pending) + fop->parts_in_flight;
 }
 
-static void fileio_read_get_buf (FileReadData *rdata);
+static void fileio_write_fail (FileIO *fop);
 
-static gboolean insure_cache_etag_consistent_or_invalidate_cache(struct evkeyvalq *headers, FileReadData *rdata)
+// the size of the next part of a multipart upload
+// the part grows with the object to stay under the limit of 10000 parts,
+// and with the measured throughput if "s3.part_size_adaptive" is set
+static guint64 fileio_write_part_size (FileIO *fop)
 {
-    const char *aws_etag, *cached_etag;
+    guint64 part_size;
+    guint64 min_size;
 
-    // consistency checking:
-    //    If AWS and cached ETag's aren't equal, invalidate local cache
+    min_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    min_size = min_size << MIN ((fop->part_number - 1) / FIO_PARTS_PER_STEP, FIO_MAX_PARTS / FIO_PARTS_PER_STEP);
+    part_size = MAX (fop->upload_part_size, min_size);
 
-    aws_etag = http_find_header (headers, "ETag");
+    return MIN (part_size, FIVEG);
+}
 
-    if (!aws_etag) {
-        LOG_err (FIO_LOG, INO_H"Header fails to contain ETag!", INO_T (rdata->ino));
-        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-        fileread_destroy (rdata);
-        return FALSE;
-    }
+// part of size bytes was uploaded in msec milliseconds
+static void fileio_write_adapt_part_size (FileIO *fop, guint64 size, guint64 msec)
+{
+    if (!conf_get_boolean (application_get_conf (fop->app), "s3.part_size_adaptive"))
+        return;
 
-    if (!rdata->aws_etag)
-        rdata->aws_etag = strdup (aws_etag);
-    else if (strcmp (rdata->aws_etag, aws_etag)) {
-        g_free (rdata->aws_etag);
-        rdata->aws_etag = strdup (aws_etag);
+    // only full-size parts are measured, the last part is shorter
+    if (size < fop->upload_part_size || msec >= FIO_PART_MIN_TIME ||
+        fop->upload_part_size * 2 > FIO_MAX_ADAPTIVE_PART_SIZE)
+        return;
+
+    fop->upload_part_size *= 2;
+
+    LOG_debug (FIO_LOG, INO_H"Part of %"G_GUINT64_FORMAT" bytes is uploaded in %"G_GUINT64_FORMAT" ms, part size: %"G_GUINT64_FORMAT,
+        INO_T (fop->ino), size, msec, fop->upload_part_size);
+}
+
+// add a new part to the upload queue
+static FileIOPart *fileio_write_new_part (FileIO *fop)
+{
+    FileIOPart *part;
+
+    part = g_new0 (FileIOPart, 1);
+    part->part_number = fop->part_number;
+    part->fd = -1;
+
+    // parts are created in order, CompleteMultipartUpload lists them by part number
+    fop->l_parts = g_list_append (fop->l_parts, part);
+    g_queue_push_tail (fop->q_parts_pending, part);
+
+    // increase part number
+    fop->part_number++;
+
+    // the part is kept in the list, but it's never sent
+    if (part->part_number > FIO_MAX_PARTS) {
+        LOG_err (FIO_LOG, INO_H"Object exceeds the maximal number of parts (%d) !", INO_T (fop->ino), FIO_MAX_PARTS);
+        fileio_write_fail (fop);
     }
 
-    cached_etag = cache_mng_get_etag (application_get_cache_mng (rdata->fop->app), rdata->ino);
+    return part;
+}
 
-    if (cached_etag) {
-        if (!strcmp(rdata->aws_etag, cached_etag)) {
-            LOG_debug (FIO_LOG, INO_H"ETags same %.8s..., using local cached file",
-                INO_T (rdata->ino), rdata->aws_etag+1);
-        } else {
-            LOG_debug (FIO_LOG, INO_H"ETags differ, invalidating local cached file!: AWS %.8s..., cache %.8s...",
-                INO_T (rdata->ino), rdata->aws_etag+1, cached_etag+1);
-            cache_mng_remove_file (application_get_cache_mng (rdata->fop->app), rdata->ino);
-        }
-    } else {
-        if (cache_mng_update_etag (application_get_cache_mng (rdata->fop->app), rdata->ino, rdata->aws_etag)) {
-            LOG_debug (FIO_LOG, INO_H"Set cache etag: %.8s...", INO_T (rdata->ino), rdata->aws_etag+1);
-            rdata->cache_etag_is_set = TRUE;
+// move the content of buffer into a new part, which is queued for upload
+static void fileio_write_queue_part (FileIO *fop, struct evbuffer *buf)
+{
+    FileIOPart *part;
+    size_t buf_len;
+    const gchar *data;
+
+    part = fileio_write_new_part (fop);
+    part->buf = evbuffer_new ();
+    evbuffer_add_buffer (part->buf, buf);
+
+    buf_len = evbuffer_get_length (part->buf);
+    data = (const gchar *) evbuffer_pullup (part->buf, buf_len);
+
+    // XXX: move to separate thread
+    // 1. calculate MD5 of a part.
+    get_md5_sum (data, buf_len, &part->md5str, &part->md5b);
+    // 2. calculate MD5 of multiple message blocks
+    MD5_Update (&fop->md5, data, buf_len);
+
+    LOG_debug (FIO_LOG, INO_H"Part %u is queued, size: %zu", INO_T (fop->ino), part->part_number, buf_len);
+}
+
+// calculate MD5 of [off, off + size) of the file, whole file MD5 is updated too
+static gboolean fileio_write_md5_file (FileIO *fop, int fd, guint64 off, guint64 size, gchar **md5str, gchar **md5b)
+{
+    MD5_CTX md5;
+    gchar *tmp;
+    ssize_t res;
+    guint64 end = off + size;
+
+    MD5_Init (&md5);
+    tmp = g_malloc (MIN (size, FIO_MD5_BLOCK));
+    while (off < end) {
+        res = pread (fd, tmp, MIN (end - off, FIO_MD5_BLOCK), off);
+        if (res <= 0) {
+            g_free (tmp);
+            return FALSE;
         }
+        MD5_Update (&md5, tmp, res);
+        MD5_Update (&fop->md5, tmp, res);
+        off += res;
     }
+    g_free (tmp);
 
-    return TRUE;
+    return get_md5_final (&md5, md5str, md5b);
 }
 
-/*{{{ GET request */
-static void fileio_read_on_get_cb (HttpConnection *con, void *ctx, gboolean success,
-    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+// stored data of the part is written to the cache file, descriptor keeps the data, even if the cache entry is removed
+static void fileio_write_on_part_fd_cb (int fd, void *ctx)
 {
-    FileReadData *rdata = (FileReadData *) ctx;
-    const char *cached_etag;
+    FileWritePartData *pdata = (FileWritePartData *) ctx;
+    FileIO *fop = pdata->fop;
+    FileIOPart *part = pdata->part;
+
+    g_free (pdata);
+    fop->parts_loading--;
+    part->loading = FALSE;
+
+    if (fd < 0) {
+        LOG_err (FIO_LOG, INO_H"Part data is not found in local cache !", INO_T (fop->ino));
+        g_queue_remove (fop->q_parts_pending, part);
+        fileio_write_fail (fop);
+        fileio_write_pump (fop);
+        return;
+    }
 
-    // release HttpConnection
-    http_connection_release (con);
+    part->fd = fd;
+    if (!fileio_write_md5_file (fop, fd, part->off, part->size, &part->md5str, &part->md5b)) {
+        LOG_err (FIO_LOG, INO_H"Failed to read part data from local cache !", INO_T (fop->ino));
+        g_queue_remove (fop->q_parts_pending, part);
+        fileio_write_fail (fop);
+        fileio_write_pump (fop);
+        return;
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Part %u is queued from local cache, size: %"G_GUINT64_FORMAT,
+        INO_T (fop->ino), part->part_number, part->size);
+
+    fileio_write_pump (fop);
+}
+
+// queue [off, off + size) of the cache file for upload, data is sent directly from the file
+// the part is sent when the data is written to the cache file
+static void fileio_write_queue_file_part (FileIO *fop, guint64 off, guint64 size)
+{
+    FileWritePartData *pdata;
+    FileIOPart *part;
+
+    part = fileio_write_new_part (fop);
+    part->off = off;
+    part->size = size;
+    part->loading = TRUE;
+    fop->parts_loading++;
+
+    pdata = g_new0 (FileWritePartData, 1);
+    pdata->fop = fop;
+    pdata->part = part;
+    cache_mng_get_file_fd_async (application_get_cache_mng (fop->app), fop->ino, size, off,
+        fileio_write_on_part_fd_cb, pdata);
+}
+
+// queue data written since the previous part, it's in memory or in the cache file
+static void fileio_write_queue_written (FileIO *fop)
+{
+    if (evbuffer_get_length (fop->write_buf))
+        fileio_write_queue_part (fop, fop->write_buf);
+    else
+        fileio_write_queue_file_part (fop, fop->part_off, fop->current_size - fop->part_off);
+
+    fop->part_off = fop->current_size;
+}
+
+// read [off, off + size) of the cache file into buffer, it fails if stored data isn't written to the file yet
+// it's used only if written data can't be stored, the upload is failed by fileio_write_on_stored_cb () then
+static gboolean fileio_write_read_cache (FileIO *fop, struct evbuffer *buf, guint64 off, guint64 size)
+{
+    int fd;
+    gchar *tmp;
+    ssize_t res;
+
+    if (!size)
+        return TRUE;
+
+    fd = cache_mng_get_file_fd (application_get_cache_mng (fop->app), fop->ino, size, off);
+    if (fd < 0)
+        return FALSE;
+
+    tmp = g_malloc (size);
+    res = pread (fd, tmp, size, off);
+    close (fd);
+
+    if (res == (ssize_t) size)
+        evbuffer_add (buf, tmp, size);
+    g_free (tmp);
+
+    return res == (ssize_t) size;
+}
+
+// upload can't be completed, fail all waiting writes
+static void fileio_write_fail (FileIO *fop)
+{
+    GList *l_waiters, *l;
+
+    fop->upload_failed = TRUE;
+
+    l_waiters = fop->l_write_waiters;
+    fop->l_write_waiters = NULL;
+
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        FileWriteData *wdata = (FileWriteData *) l->data;
+
+        wdata->on_buffer_written_cb (fop, wdata->ctx, FALSE, 0);
+        g_free (wdata);
+    }
+    g_list_free (l_waiters);
+}
+
+// written data is stored in the cache file, the file can't be uploaded if it failed
+static void fileio_write_on_stored_cb (gboolean success, void *ctx)
+{
+    FileIO *fop = (FileIO *) ctx;
 
+    fop->stores_pending--;
     if (!success) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to get file from server !", INO_T (rdata->ino), (void *)con);
-        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-        fileread_destroy (rdata);
+        LOG_err (FIO_LOG, INO_H"Failed to store written data in local file !", INO_T (fop->ino));
+        fileio_write_fail (fop);
+    }
+
+    if (fop->released && !fop->write_back && !fop->multipart_initiated) {
+        if (!fop->stores_pending)
+            fileio_release_written (fop);
         return;
     }
 
-    if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata))
+    fileio_write_pump (fop);
+}
+
+// store data of the file in the cache file, written (dirty) data can't be fetched from the server again
+static void fileio_write_store (FileIO *fop, guint64 size, guint64 off, const unsigned char *buf, gboolean dirty)
+{
+    CacheMng *cmng = application_get_cache_mng (fop->app);
+
+    fop->stores_pending++;
+    if (dirty)
+        cache_mng_write_file_buf (cmng, fop->ino, size, off, (unsigned char *) buf, fileio_write_on_stored_cb, fop);
+    else
+        cache_mng_store_file_buf (cmng, fop->ino, size, off, (unsigned char *) buf, fileio_write_on_stored_cb, fop);
+}
+
+// part is uploaded
+static void fileio_write_on_part_sent_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileWritePartData *pdata = (FileWritePartData *) ctx;
+    FileIO *fop = pdata->fop;
+
+    http_connection_release (con);
+
+    fop->parts_in_flight--;
+
+    // ETag of the copied part is returned in CopyPartResult
+    if (success && pdata->part->copy) {
+        gchar *etag;
+
+        etag = buf_len ? get_xml_value (buf, buf_len, "//s3:ETag") : NULL;
+        if (etag) {
+            pdata->part->md5str = g_strdup (etag[0] == '"' ? etag + 1 : etag);
+            if (strlen (pdata->part->md5str) && pdata->part->md5str[strlen (pdata->part->md5str) - 1] == '"')
+                pdata->part->md5str[strlen (pdata->part->md5str) - 1] = '\0';
+            xmlFree (etag);
+        } else
+            success = FALSE;
+    }
+
+    if (!success) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to upload part %u !", INO_T (fop->ino), (void *)con, pdata->part->part_number);
+        fileio_write_fail (fop);
+    } else {
+        struct timeval end_tv;
+
+        LOG_debug (FIO_LOG, INO_CON_H"Part %u is uploaded", INO_T (fop->ino), (void *)con, pdata->part->part_number);
+
+        gettimeofday (&end_tv, NULL);
+        if (pdata->size)
+            fileio_write_adapt_part_size (fop, pdata->size, timeval_diff (&pdata->start_tv, &end_tv));
+    }
+
+    g_free (pdata);
+
+    // send more parts, resume writers
+    fileio_write_pump (fop);
+}
+
+// got HttpConnection object
+static void fileio_write_on_part_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileWritePartData *pdata = (FileWritePartData *) ctx;
+    FileIO *fop = pdata->fop;
+    struct evbuffer *part_buf;
+    gchar *path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    // part stored in the cache file is sent without copying it to memory
+    if (pdata->part->fd >= 0) {
+        res = http_connection_set_output_file (con, pdata->part->fd, pdata->part->off, pdata->part->size);
+        close (pdata->part->fd);
+        pdata->part->fd = -1;
+        if (!res) {
+            fileio_write_on_part_sent_cb (con, pdata, FALSE, NULL, 0, NULL);
+            return;
+        }
+    }
+
+    path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s",
+        fop->fname, pdata->part->part_number, fop->uploadid);
+
+    // unchanged range is copied from the base object on the server side
+    if (pdata->part->copy) {
+        gchar *hdr;
+
+        hdr = g_strdup_printf ("%s%s", conf_get_string (application_get_conf (fop->app), "s3.bucket_name"), fop->fname);
+        http_connection_add_output_header (con, "x-amz-copy-source", hdr);
+        g_free (hdr);
+
+        hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
+            pdata->part->copy_off, pdata->part->copy_off + pdata->part->copy_size - 1);
+        http_connection_add_output_header (con, "x-amz-copy-source-range", hdr);
+        g_free (hdr);
+
+        // fail if the object was changed since it was opened
+        http_connection_add_output_header (con, "x-amz-copy-source-if-match", fop->base_etag);
+
+    // add output headers
+    } else
+        http_connection_add_output_header (con, "Content-MD5", pdata->part->md5b);
+
+    // request keeps its own copy of the data, FileIO might be destroyed before this function returns
+    part_buf = pdata->part->buf;
+    pdata->part->buf = NULL;
+
+    if (!pdata->part->copy)
+        pdata->size = part_buf ? evbuffer_get_length (part_buf) : pdata->part->size;
+    gettimeofday (&pdata->start_tv, NULL);
+
+    res = http_connection_make_request (con,
+        path, "PUT", part_buf, TRUE, NULL,
+        fileio_write_on_part_sent_cb,
+        pdata
+    );
+    g_free (path);
+    // the copy of the request is accounted by HttpConnection
+    if (part_buf) {
+        mem_budget_release (application_get_mem_budget (con->app), evbuffer_get_length (part_buf));
+        evbuffer_free (part_buf);
+    }
+
+    // fileio_write_on_part_sent_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// send queued parts, pool queues requests when all "writers" connections are busy
+static void fileio_write_send_parts (FileIO *fop)
+{
+    FileIOPart *part;
+    FileWritePartData *pdata;
+
+    if (fop->upload_failed || !fop->uploadid)
         return;
 
-    // store it in the local cache
-    cache_mng_store_file_buf (application_get_cache_mng (rdata->fop->app),
-        rdata->ino, buf_len, rdata->request_offset, (unsigned char *) buf,
-        NULL, NULL);
+    // parts are sent in order
+    while ((part = g_queue_peek_head (fop->q_parts_pending)) && !part->loading) {
+        g_queue_pop_head (fop->q_parts_pending);
+        pdata = g_new0 (FileWritePartData, 1);
+        pdata->fop = fop;
+        pdata->part = part;
 
-    cached_etag = cache_mng_get_etag (application_get_cache_mng (rdata->fop->app), rdata->ino);
-    LOG_debug (FIO_LOG, INO_H"Read from server done, AWS etag %.8s..., cache etag %.8s...",
-        INO_T (rdata->ino), rdata->aws_etag+1, cached_etag ? cached_etag+1 : "not set");
+        fop->parts_in_flight++;
+        if (!client_pool_get_client (application_get_write_client_pool (fop->app),
+            fileio_write_on_part_con_cb, pdata)) {
+            fop->parts_in_flight--;
+            g_free (pdata);
+            g_queue_push_head (fop->q_parts_pending, part);
+
+            // nothing is being uploaded, the queue will not move
+            if (!fop->parts_in_flight) {
+                LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+                fileio_write_fail (fop);
+            }
+            return;
+        }
+    }
+}
 
-    if (rdata->aws_etag && !cached_etag) {
-        LOG_debug (FIO_LOG, INO_H"Setting cache etag: %.8s...", INO_T (rdata->ino), rdata->aws_etag+1);
-        cache_mng_update_etag (application_get_cache_mng (rdata->fop->app), rdata->ino, rdata->aws_etag);
+// acknowledge waiting writes while the upload window has room
+static void fileio_write_ack_waiters (FileIO *fop)
+{
+    guint max_parts;
+    FileWriteData *wdata;
+
+    max_parts = conf_get_uint (application_get_conf (fop->app), "s3.upload_max_parts_in_flight");
+
+    while (fop->l_write_waiters && fileio_write_parts_pending (fop) <= max_parts) {
+        wdata = (FileWriteData *) fop->l_write_waiters->data;
+        fop->l_write_waiters = g_list_delete_link (fop->l_write_waiters, fop->l_write_waiters);
+
+        wdata->on_buffer_written_cb (fop, wdata->ctx, TRUE, wdata->buf_size);
+        g_free (wdata);
+    }
+}
+
+// move multipart upload forward: send queued parts, resume writers, complete the upload of released file
+static void fileio_write_pump (FileIO *fop)
+{
+    // called from a callback of a request sent by the outer call
+    if (fop->write_pumping) {
+        fop->write_pump_again = TRUE;
+        return;
     }
 
-    LOG_debug (FIO_LOG, INO_H"Storing [%"G_GUINT64_FORMAT" %zu]", INO_T(rdata->ino), rdata->request_offset, buf_len);
+    fop->write_pumping = TRUE;
+    do {
+        fop->write_pump_again = FALSE;
+        if (fop->write_back && fop->released)
+            fileio_write_back_build_parts (fop);
+        fileio_write_send_parts (fop);
+        if (!fop->upload_failed)
+            fileio_write_ack_waiters (fop);
+    } while (fop->write_pump_again);
+    fop->write_pumping = FALSE;
+
+    fileio_fsync_pump (fop);
+
+    if (fop->released && !fop->parts_in_flight && !fop->multipart_init_pending && !fop->wb_request_pending &&
+        !fop->stores_pending && !fop->parts_loading &&
+        (fop->upload_failed || (g_queue_is_empty (fop->q_parts_pending) &&
+            (!fop->write_back || (fop->wb_base_known && fop->wb_next_off >= fop->current_size)))))
+        fileio_release_finish (fop);
+}
+/*}}}*/
 
-    // and read it
-    fileio_read_get_buf (rdata);
+/*{{{ Multipart Init */
+
+// return the value of the first node matching XPath expression, must be freed by xmlFree ()
+static gchar *get_xml_value (const char *xml, size_t xml_len, const char *xpath) {
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr uploadid_xp;
+    xmlNodeSetPtr nodes;
+    gchar *uploadid = NULL;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+
+    uploadid_xp = xmlXPathEvalExpression ((xmlChar *) xpath, ctx);
+    if (!uploadid_xp) {
+        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
+        xmlXPathFreeContext (ctx);
+        xmlFreeDoc (doc);
+        return NULL;
+    }
+
+    nodes = uploadid_xp->nodesetval;
+    if (!nodes) {
+        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
+        xmlXPathFreeObject (uploadid_xp);
+        xmlXPathFreeContext (ctx);
+        xmlFreeDoc (doc);
+        return NULL;
+    }
+
+    if (!nodes || nodes->nodeNr < 1) {
+        uploadid = NULL;
+    } else {
+        uploadid = (char *) xmlNodeListGetString (doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
+    }
+
+    xmlXPathFreeObject (uploadid_xp);
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    return uploadid;
+}
+
+static void fileio_write_on_multipart_init_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIO *fop = (FileIO *) ctx;
+    gchar *uploadid;
+
+    http_connection_release (con);
+
+    fop->multipart_init_pending = FALSE;
+
+    if (!success || !buf_len) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get multipart init data from the server !", INO_T (fop->ino), (void *)con);
+        fileio_write_fail (fop);
+        fileio_write_pump (fop);
+        return;
+    }
+
+    uploadid = get_xml_value (buf, buf_len, "//s3:UploadId");
+    if (!uploadid) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to parse multipart init data!", INO_T (fop->ino), (void *)con);
+        fileio_write_fail (fop);
+        fileio_write_pump (fop);
+        return;
+    }
+    fop->uploadid = g_strdup (uploadid);
+    xmlFree (uploadid);
+
+    // done, start uploading parts
+    fileio_write_pump (fop);
+}
+
+// got HttpConnection object
+static void fileio_write_on_multipart_init_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIO *fop = (FileIO *) ctx;
+    gboolean res;
+    gchar *path;
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploads", fop->fname);
+
+    // send storage class with the init request
+    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (con->app), "s3.storage_type"));
+
+    res = http_connection_make_request (con,
+        path, "POST", NULL, TRUE, NULL,
+        fileio_write_on_multipart_init_cb,
+        fop
+    );
+    g_free (path);
+
+    // fileio_write_on_multipart_init_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+static void fileio_write_init_multipart (FileIO *fop)
+{
+    fop->multipart_initiated = TRUE;
+    fop->multipart_init_pending = TRUE;
+
+    if (!client_pool_get_client (application_get_write_client_pool (fop->app),
+        fileio_write_on_multipart_init_con_cb, fop)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        fop->multipart_init_pending = FALSE;
+        fileio_write_fail (fop);
+        return;
+    }
+}
+/*}}}*/
+
+/*{{{ write-back */
+
+// unchanged ranges of the staged file must be a copy of the base object,
+// cached data of another version is discarded, the data written by clients is kept
+static void fileio_write_back_check_etag (FileIO *fop)
+{
+    CacheMng *cmng;
+    const char *cached_etag;
+
+    cmng = application_get_cache_mng (fop->app);
+    cached_etag = cache_mng_get_etag (cmng, fop->ino);
+    if (!cached_etag || strcmp (cached_etag, fop->base_etag))
+        cache_mng_discard_clean (cmng, fop->ino);
+}
+
+// modifications of the object are staged in local cache file and uploaded on release
+// base_etag is NULL if it's not known, then size and ETag of the object are requested before upload
+void fileio_set_write_back (FileIO *fop, guint64 base_size, const gchar *base_etag)
+{
+    CacheMng *cmng;
+
+    cmng = application_get_cache_mng (fop->app);
+
+    fop->write_back = TRUE;
+    fop->base_size = base_size;
+    fop->current_size = base_size;
+    if (base_etag) {
+        // S3 returns quoted ETag in headers
+        fop->base_etag = g_strdup_printf ("\"%s\"", base_etag);
+        fop->wb_base_known = TRUE;
+        fileio_write_back_check_etag (fop);
+    }
+    // otherwise ETag is checked when it's received
+
+    if (!fop->staged) {
+        cache_mng_stage_file (cmng, fop->ino);
+        fop->staged = TRUE;
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Write-back mode, base size: %"G_GUINT64_FORMAT, INO_T (fop->ino), base_size);
+}
+
+// out-of-order write to a new (or truncated) file before any part is uploaded:
+// data written so far becomes the staged file
+static void fileio_write_back_from_write_buf (FileIO *fop)
+{
+    size_t buf_len;
+    guint64 written;
+
+    buf_len = evbuffer_get_length (fop->write_buf);
+    written = fop->current_size;
+
+    fileio_set_write_back (fop, 0, NULL);
+    fop->wb_base_known = TRUE;
+
+    if (!written)
+        return;
+
+    // written data is in the cache file already, unless it's kept in memory
+    if (buf_len) {
+        fileio_write_store (fop, buf_len, 0, evbuffer_pullup (fop->write_buf, buf_len), TRUE);
+        evbuffer_drain (fop->write_buf, buf_len);
+        mem_budget_release (application_get_mem_budget (fop->app), buf_len);
+    } else
+        cache_mng_mark_dirty (application_get_cache_mng (fop->app), fop->ino, written, 0);
+
+    fop->current_size = written;
+    fop->wb_end = written;
+    fop->wb_modified = TRUE;
+}
+
+// fill [start, end) of the staged file with zeros
+// if dirty is FALSE, ranges written by the client are not overwritten
+static void fileio_write_back_fill_zeros (FileIO *fop, guint64 start, guint64 end, gboolean dirty)
+{
+    unsigned char *zeros;
+    guint64 len;
+
+    zeros = g_malloc0 (FIO_HOLE_BLOCK);
+    while (start < end) {
+        len = MIN (end - start, FIO_HOLE_BLOCK);
+        fileio_write_store (fop, len, start, zeros, dirty);
+        start += len;
+    }
+    g_free (zeros);
+}
+
+// write is stored in the staged file
+static void fileio_write_back_on_stored_cb (gboolean success, void *ctx)
+{
+    FileWriteData *wdata = (FileWriteData *) ctx;
+
+    if (!success)
+        LOG_err (FIO_LOG, INO_H"Failed to store written data in local file !", INO_T (wdata->ino));
+
+    wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, success, success ? wdata->buf_size : 0);
+    g_free (wdata);
+}
+
+static void fileio_write_back_buffer (FileIO *fop,
+    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
+    FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
+{
+    FileWriteData *wdata;
+
+    if (off < 0)
+        off = fop->current_size;
+
+    // the gap between the end of file and the write offset reads as zeros
+    if ((guint64) off > fop->current_size)
+        fileio_write_back_fill_zeros (fop, fop->current_size, off, TRUE);
+
+    if ((guint64) off + buf_size > fop->current_size)
+        fop->current_size = off + buf_size;
+    if ((guint64) off + buf_size > fop->wb_end)
+        fop->wb_end = off + buf_size;
+    fop->wb_modified = TRUE;
+
+    wdata = g_new0 (FileWriteData, 1);
+    wdata->fop = fop;
+    wdata->buf_size = buf_size;
+    wdata->off = off;
+    wdata->ino = ino;
+    wdata->on_buffer_written_cb = on_buffer_written_cb;
+    wdata->ctx = ctx;
+
+    cache_mng_write_file_buf (application_get_cache_mng (fop->app), ino, buf_size, off, (unsigned char *) buf,
+        fileio_write_back_on_stored_cb, wdata);
+}
+
+// size and ETag of the base object are received
+static void fileio_write_back_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    FileIO *fop = (FileIO *) ctx;
+    const char *content_len_header = NULL;
+    const char *aws_etag = NULL;
+    gint64 size;
+
+    http_connection_release (con);
+
+    fop->wb_request_pending = FALSE;
+
+    if (success) {
+        content_len_header = http_find_header (headers, "Content-Length");
+        aws_etag = http_find_header (headers, "ETag");
+    }
+
+    if (!content_len_header || !aws_etag) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get size and ETag of the object !", INO_T (fop->ino), (void *)con);
+        fileio_write_fail (fop);
+        fileio_write_pump (fop);
+        return;
+    }
+
+    size = strtoll ((char *)content_len_header, NULL, 10);
+    if (size < 0)
+        size = 0;
+
+    fop->base_etag = g_strdup (aws_etag);
+    fileio_write_back_check_etag (fop);
+
+    // the object is smaller than it was expected, the rest of the staged file reads as zeros
+    if ((guint64) size < fop->current_size)
+        fileio_write_back_fill_zeros (fop, size, fop->current_size, FALSE);
+
+    fop->base_size = size;
+    fop->current_size = MAX (fop->base_size, fop->wb_end);
+    fop->wb_base_known = TRUE;
+
+    LOG_debug (FIO_LOG, INO_CON_H"Base object size: %"G_GUINT64_FORMAT, INO_T (fop->ino), (void *)con, fop->base_size);
+
+    fileio_write_pump (fop);
+}
+
+// got HttpConnection object
+static void fileio_write_back_on_head_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIO *fop = (FileIO *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    res = http_connection_make_request (con,
+        fop->fname, "HEAD", NULL, TRUE, NULL,
+        fileio_write_back_on_head_cb,
+        fop
+    );
+
+    // fileio_write_back_on_head_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// request size and ETag of the base object, fileio_write_pump () is called when they are received
+static void fileio_write_back_request_base (FileIO *fop)
+{
+    fop->wb_request_pending = TRUE;
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app),
+        fileio_write_back_on_head_con_cb, fop)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        fop->wb_request_pending = FALSE;
+        fileio_write_fail (fop);
+    }
+}
+
+static void fileio_write_back_fetched (FileIO *fop, gboolean success)
+{
+    fop->wb_request_pending = FALSE;
+
+    if (!success) {
+        LOG_err (FIO_LOG, INO_H"Failed to download unchanged data of the object !", INO_T (fop->ino));
+        fileio_write_fail (fop);
+    }
+
+    fileio_write_pump (fop);
+}
+
+// download sent by the file handle is finished
+static void fileio_write_back_on_prefetched_cb (gpointer ctx, gboolean success)
+{
+    fileio_write_back_fetched ((FileIO *) ctx, success);
+}
+
+// download sent by a reader is finished, or a part of it is received
+static void fileio_write_back_on_fetched_cb (gboolean success, void *ctx)
+{
+    fileio_write_back_fetched ((FileIO *) ctx, success);
+}
+
+// unchanged ranges of [off, off + size) are downloaded from the base object into the staged file
+// return TRUE if the whole range is in local file, otherwise fileio_write_pump () is called when it's downloaded
+static gboolean fileio_write_back_fetch (FileIO *fop, guint64 off, guint64 size)
+{
+    CacheMng *cmng;
+
+    cmng = application_get_cache_mng (fop->app);
+
+    if (!size || cache_mng_file_contains (cmng, fop->ino, size, off))
+        return TRUE;
+
+    fop->wb_request_pending = TRUE;
+
+    // the block is being downloaded by a reader
+    if (!cache_mng_fetch_start (cmng, fop->ino, off, size, fileio_write_back_on_fetched_cb, fop))
+        return FALSE;
+
+    LOG_debug (FIO_LOG, INO_H"Downloading unchanged data [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]",
+        INO_T (fop->ino), off, off + size);
+
+    if (!fileio_read_ahead_send_range (fop->app, fop->fname, fop->ino, off, size, fop->base_etag,
+        fileio_write_back_on_prefetched_cb, fop)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        fop->wb_request_pending = FALSE;
+        fileio_write_fail (fop);
+    }
+
+    return FALSE;
+}
+
+// build parts of the released staged file: unchanged parts of the base object are copied on the server side,
+// the rest is uploaded from local file when unchanged ranges of the part are downloaded
+static void fileio_write_back_build_parts (FileIO *fop)
+{
+    guint64 part_size;
+    guint64 copy_size;
+    guint max_parts;
+    guint64 part_start, part_end;
+    CacheMng *cmng;
+
+    if (fop->upload_failed || fop->wb_request_pending)
+        return;
+
+    // size and ETag of the object are needed to keep unchanged data
+    if (!fop->wb_base_known) {
+        fileio_write_back_request_base (fop);
+        return;
+    }
+
+    cmng = application_get_cache_mng (fop->app);
+    part_size = fileio_write_part_size (fop);
+    max_parts = conf_get_uint (application_get_conf (fop->app), "s3.upload_max_parts_in_flight");
+    copy_size = MIN (MAX (conf_get_uint (application_get_conf (fop->app), "s3.copy_part_size"), FIO_MIN_PART_SIZE), FIVEG);
+
+    if (fop->current_size > part_size && !fop->multipart_initiated) {
+        fileio_write_init_multipart (fop);
+        if (fop->upload_failed)
+            return;
+    }
+
+    // small file is uploaded from write buffer by a single request
+    if (!fop->multipart_initiated) {
+        if (fop->wb_next_off >= fop->current_size)
+            return;
+        if (!fileio_write_back_fetch (fop, 0, MIN (fop->base_size, fop->current_size)))
+            return;
+        fop->wb_next_off = fop->current_size;
+        return;
+    }
+
+    while (!fop->upload_failed && !fop->wb_request_pending && fop->wb_next_off < fop->current_size &&
+        fileio_write_parts_pending (fop) < max_parts) {
+
+        gboolean copy = FALSE;
+
+        part_start = fop->wb_next_off;
+        part_size = fileio_write_part_size (fop);
+        part_end = MIN (part_start + part_size, fop->current_size);
+
+        // unchanged data of the base object is copied by parts of "s3.copy_part_size",
+        // the part is halved down to the write part size until it doesn't contain dirty data
+        if (part_start < fop->base_size) {
+            guint64 copy_end = MIN (part_start + copy_size, fop->base_size);
+
+            // the rest of the base object is too small for a separate part, it's copied with this one
+            if (fop->base_size - copy_end < FIO_MIN_PART_SIZE && fop->base_size - part_start <= FIVEG)
+                copy_end = fop->base_size;
+
+            while (copy_end - part_start > part_size &&
+                cache_mng_is_dirty (cmng, fop->ino, copy_end - part_start, part_start))
+                copy_end = part_start + (copy_end - part_start) / 2;
+
+            // only the last part may be shorter than the minimal part size
+            if ((copy_end - part_start >= FIO_MIN_PART_SIZE || copy_end >= fop->current_size) &&
+                !cache_mng_is_dirty (cmng, fop->ino, copy_end - part_start, part_start)) {
+                part_end = copy_end;
+                copy = TRUE;
+            }
+        }
+
+        // parts with dirty or appended data use the write part size
+        if (!copy) {
+            // unchanged tail of the base object is copied by a shorter part, so appended data isn't mixed with it
+            if (part_start < fop->base_size && part_end > fop->base_size &&
+                fop->base_size - part_start >= FIO_MIN_PART_SIZE &&
+                !cache_mng_is_dirty (cmng, fop->ino, fop->base_size - part_start, part_start))
+                part_end = fop->base_size;
+            // the rest of the base object is too small for a separate part, it's copied with this one
+            else if (part_end < fop->base_size && fop->base_size - part_end < FIO_MIN_PART_SIZE &&
+                fop->base_size - part_start <= FIVEG &&
+                !cache_mng_is_dirty (cmng, fop->ino, fop->base_size - part_start, part_start))
+                part_end = fop->base_size;
+        }
+
+        if (copy || (part_end <= fop->base_size && !cache_mng_is_dirty (cmng, fop->ino, part_end - part_start, part_start))) {
+            FileIOPart *part;
+
+            part = fileio_write_new_part (fop);
+            part->copy = TRUE;
+            part->copy_off = part_start;
+            part->copy_size = part_end - part_start;
+
+            LOG_debug (FIO_LOG, INO_H"Part %u is copied from [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]",
+                INO_T (fop->ino), part->part_number, part_start, part_end);
+        } else {
+            if (part_start < fop->base_size &&
+                !fileio_write_back_fetch (fop, part_start, MIN (part_end, fop->base_size) - part_start))
+                return;
+
+            fileio_write_queue_file_part (fop, part_start, part_end - part_start);
+            if (fop->upload_failed)
+                return;
+        }
+
+        fop->wb_next_off = part_end;
+    }
+}
+/*}}}*/
+
+void fileio_write_buffer (FileIO *fop,
+    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
+    FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
+{
+    FileWriteData *wdata;
+    CacheMng *cmng;
+    size_t in_memory;
+
+    // one of the previous parts failed to upload
+    if (fop->upload_failed) {
+        LOG_err (FIO_LOG, INO_H"Multipart upload failed, rejecting write !", INO_T (ino));
+        on_buffer_written_cb (fop, ctx, FALSE, 0);
+        return;
+    }
+
+    // content is changed after fsync, it's queued again
+    fop->wbh_queued = FALSE;
+
+    if (fop->write_back) {
+        fileio_write_back_buffer (fop, buf, buf_size, off, ino, on_buffer_written_cb, ctx);
+        return;
+    }
+
+    // out-of-order write, continue in write-back mode if no part is uploaded yet
+    if (off >= 0 && fop->current_size != (guint64)off && !fop->multipart_initiated &&
+        conf_get_boolean (application_get_conf (fop->app), "s3.write_back")) {
+        LOG_debug (FIO_LOG, INO_H"Write call with offset %"OFF_FMT", switching to write-back mode", INO_T (ino), off);
+        fileio_write_back_from_write_buf (fop);
+        fileio_write_back_buffer (fop, buf, buf_size, off, ino, on_buffer_written_cb, ctx);
+        return;
+    }
+
+    // existing object is appended (or written past the beginning) by the first write,
+    // the object is staged and its unchanged data is copied on the server side
+    if (off > 0 && !fop->current_size && !fop->assume_new && !fop->multipart_initiated &&
+        conf_get_boolean (application_get_conf (fop->app), "s3.append_write_back")) {
+        LOG_debug (FIO_LOG, INO_H"Write call with offset %"OFF_FMT" to existing object, switching to append mode", INO_T (ino), off);
+        // object size and ETag are requested before upload
+        fileio_set_write_back (fop, off, NULL);
+        fileio_write_back_buffer (fop, buf, buf_size, off, ino, on_buffer_written_cb, ctx);
+        return;
+    }
+
+    // sequential fast path: the offset matches the written size,
+    // out-of-order writes are staged above, unless write-back is disabled or parts are uploaded already
+    if (off >= 0 && fop->current_size != (guint64)off) {
+        LOG_err (FIO_LOG, INO_H"Out-of-order write with offset %"OFF_FMT" can't be staged, it's not allowed !", INO_T (ino), off);
+        on_buffer_written_cb (fop, ctx, FALSE, 0);
+        return;
+    }
+
+    cmng = application_get_cache_mng (fop->app);
+
+    // written data is kept in the cache file until it's uploaded
+    if (!fop->staged) {
+        cache_mng_stage_file (cmng, ino);
+        fop->staged = TRUE;
+    }
+
+    // CacheMng
+    fileio_write_store (fop, buf_size, off, (const unsigned char *) buf, FALSE);
+
+    // data is kept in memory if the cache file can't hold it, until the part is queued
+    in_memory = evbuffer_get_length (fop->write_buf);
+    if (!in_memory &&
+        !cache_mng_file_contains (cmng, ino, fop->current_size + buf_size - fop->part_off, fop->part_off)) {
+        if (!fileio_write_read_cache (fop, fop->write_buf, fop->part_off, fop->current_size - fop->part_off)) {
+            LOG_err (FIO_LOG, INO_H"Failed to read written data from local cache !", INO_T (ino));
+            on_buffer_written_cb (fop, ctx, FALSE, 0);
+            return;
+        }
+        evbuffer_add (fop->write_buf, buf, buf_size);
+    } else if (in_memory)
+        evbuffer_add (fop->write_buf, buf, buf_size);
+    mem_budget_add (application_get_mem_budget (fop->app), evbuffer_get_length (fop->write_buf) - in_memory);
+
+    fop->current_size += buf_size;
+
+    LOG_debug (FIO_LOG, INO_H"Write buf size: %"G_GUINT64_FORMAT", in memory: %zd", INO_T (ino),
+        fop->current_size - fop->part_off, evbuffer_get_length (fop->write_buf));
+
+    // if current write buffer exceeds the part size - this is a multipart upload
+    if (fop->current_size - fop->part_off >= fileio_write_part_size (fop)) {
+        fileio_write_queue_written (fop);
+
+        // init multipart upload, queued parts are sent when UploadId is received
+        if (!fop->multipart_initiated && !fop->upload_failed)
+            fileio_write_init_multipart (fop);
+
+        fileio_write_pump (fop);
+
+        if (fop->upload_failed) {
+            on_buffer_written_cb (fop, ctx, FALSE, 0);
+            return;
+        }
+
+        // upload window is full, the writer waits until one of the parts is uploaded
+        if (fileio_write_parts_pending (fop) > conf_get_uint (application_get_conf (fop->app), "s3.upload_max_parts_in_flight")) {
+            wdata = g_new0 (FileWriteData, 1);
+            wdata->fop = fop;
+            wdata->buf_size = buf_size;
+            wdata->off = off;
+            wdata->ino = ino;
+            wdata->on_buffer_written_cb = on_buffer_written_cb;
+            wdata->ctx = ctx;
+
+            fop->l_write_waiters = g_list_append (fop->l_write_waiters, wdata);
+            return;
+        }
+    }
+
+    // data kept in memory is less than one part now, it's released only when the next writes fill the part,
+    // so the writer isn't deferred by the memory budget, the upload window limits the memory of the file
+
+    // notify client that we are ready for more data
+    on_buffer_written_cb (fop, ctx, TRUE, buf_size);
+}
+/*}}}*/
+
+/*{{{ fileio_read_buffer*/
+
+typedef struct {
+    FileIO *fop;
+    Application *app; // FileIO might be released before the block download is finished
+    guint64 size;
+    off_t off;
+    fuse_ino_t ino;
+    off_t request_offset; // offset of the block, which is being downloaded
+    guint64 request_size;
+    guint64 received; // bytes of the block received so far
+    gboolean replied; // read is answered before the block download is finished
+    char *reply_buf; // requested range, collected from received parts of the block
+    FileIO_on_buffer_read_cb on_buffer_read_cb;
+    FileIO_on_buffer_fd_read_cb on_buffer_fd_read_cb;
+    gpointer ctx;
+    char *aws_etag;
+    gboolean cache_etag_is_set;
+    guint64 mem_size; // memory budget reserved for the reply
+} FileReadData;
+
+void fileread_destroy (FileReadData *rdata)
+{
+    mem_budget_release (application_get_mem_budget (rdata->app), rdata->mem_size);
+    if (rdata->aws_etag)
+        g_free (rdata->aws_etag);
+    g_free (rdata->reply_buf);
+    g_free (rdata);
+}
+
+static void fileio_read_get_buf (FileReadData *rdata);
+static void fileio_read_ahead_submit (FileIO *fop);
+static void fileio_read_parallel_submit (FileIO *fop);
+static void fileio_read_get_request_range (FileIO *fop, size_t size, off_t off, guint64 *start, guint64 *end);
+
+// compare object's ETag with the ETag of the cached file, invalidate local cache if they differ
+// return TRUE if the cache ETag was set
+static gboolean fileio_update_cache_etag (FileIO *fop, const char *aws_etag)
+{
+    const char *cached_etag;
+    CacheMng *cmng;
+    gboolean res = FALSE;
+
+    // remember object's ETag, read-ahead requests are checked against it
+    if (!fop->aws_etag || strcmp (fop->aws_etag, aws_etag)) {
+        g_free (fop->aws_etag);
+        fop->aws_etag = g_strdup (aws_etag);
+    }
+
+    cmng = application_get_cache_mng (fop->app);
+    cached_etag = cache_mng_get_etag (cmng, fop->ino);
+
+    if (cached_etag) {
+        if (!strcmp(aws_etag, cached_etag)) {
+            LOG_debug (FIO_LOG, INO_H"ETags same %.8s..., using local cached file",
+                INO_T (fop->ino), aws_etag+1);
+        // written data would be lost, the upload fails if the object was changed
+        } else if (fop->write_back) {
+            LOG_err (FIO_LOG, INO_H"ETags differ, staged file is not invalidated !: AWS %.8s..., cache %.8s...",
+                INO_T (fop->ino), aws_etag+1, cached_etag+1);
+        } else {
+            LOG_debug (FIO_LOG, INO_H"ETags differ, invalidating local cached file!: AWS %.8s..., cache %.8s...",
+                INO_T (fop->ino), aws_etag+1, cached_etag+1);
+            // the file could be staged by another handle, its written data is kept
+            cache_mng_discard_clean (cmng, fop->ino);
+        }
+    } else {
+        if (cache_mng_update_etag (cmng, fop->ino, aws_etag)) {
+            LOG_debug (FIO_LOG, INO_H"Set cache etag: %.8s...", INO_T (fop->ino), aws_etag+1);
+            res = TRUE;
+        }
+    }
+
+    // cached data of the object is kept between mounts (or taken from the previous mount)
+    cache_mng_attach_file (cmng, fop->ino, fop->fname, aws_etag);
+
+    return res;
+}
+
+static gboolean insure_cache_etag_consistent_or_invalidate_cache(struct evkeyvalq *headers, FileReadData *rdata)
+{
+    const char *aws_etag;
+
+    // consistency checking:
+    //    If AWS and cached ETag's aren't equal, invalidate local cache
+
+    aws_etag = http_find_header (headers, "ETag");
+
+    if (!aws_etag) {
+        LOG_err (FIO_LOG, INO_H"Header fails to contain ETag!", INO_T (rdata->ino));
+        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+        fileread_destroy (rdata);
+        return FALSE;
+    }
+
+    if (!rdata->aws_etag)
+        rdata->aws_etag = strdup (aws_etag);
+    else if (strcmp (rdata->aws_etag, aws_etag)) {
+        g_free (rdata->aws_etag);
+        rdata->aws_etag = strdup (aws_etag);
+    }
+
+    if (fileio_update_cache_etag (rdata->fop, rdata->aws_etag))
+        rdata->cache_etag_is_set = TRUE;
+
+    return TRUE;
+}
+
+// answer read request with data from the memory tier of the local cache
+// return FALSE if the data isn't in memory
+static gboolean fileio_read_reply_from_mem (FileReadData *rdata)
+{
+    unsigned char *buf;
+
+    buf = g_malloc (rdata->size);
+    if (!cache_mng_read_mem (application_get_cache_mng (rdata->fop->app), rdata->ino, rdata->size, rdata->off, buf)) {
+        g_free (buf);
+        return FALSE;
+    }
+
+    rdata->on_buffer_read_cb (rdata->ctx, TRUE, (char *) buf, rdata->size);
+    g_free (buf);
+
+    return TRUE;
+}
+
+// copy the requested part of the received data, answer the read when the whole range is received
+// received parts are stored by cache I/O jobs, so the reply doesn't wait for them
+// return TRUE if the read is answered
+static gboolean fileio_read_reply_from_chunk (FileReadData *rdata, const gchar *buf, size_t buf_len, guint64 buf_off)
+{
+    guint64 start, end;
+
+    start = MAX (buf_off, (guint64) rdata->off);
+    end = MIN (buf_off + buf_len, rdata->off + rdata->size);
+    if (start < end) {
+        if (!rdata->reply_buf)
+            rdata->reply_buf = g_malloc (rdata->size);
+        memcpy (rdata->reply_buf + (start - rdata->off), buf + (start - buf_off), end - start);
+    }
+
+    if (buf_off + buf_len < rdata->off + rdata->size)
+        return FALSE;
+
+    rdata->on_buffer_read_cb (rdata->ctx, TRUE, rdata->reply_buf, rdata->size);
+    g_free (rdata->reply_buf);
+    rdata->reply_buf = NULL;
+
+    // the reply isn't kept in memory, but rdata waits for the download to finish
+    mem_budget_release (application_get_mem_budget (rdata->app), rdata->mem_size);
+    rdata->mem_size = 0;
+
+    return TRUE;
+}
+
+/*{{{ GET request */
+
+// a part of the block is received, store it and answer reads which are covered by stored data
+static void fileio_read_on_get_chunk_cb (G_GNUC_UNUSED HttpConnection *con, void *ctx,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+    CacheMng *cmng;
+
+    cmng = application_get_cache_mng (rdata->app);
+
+    // check ETag before storing the first part
+    if (!rdata->received) {
+        const char *aws_etag;
+
+        aws_etag = http_find_header (headers, "ETag");
+        // fileio_read_on_get_cb () fails the request
+        if (!aws_etag)
+            return;
+
+        g_free (rdata->aws_etag);
+        rdata->aws_etag = g_strdup (aws_etag);
+        if (fileio_update_cache_etag (rdata->fop, rdata->aws_etag))
+            rdata->cache_etag_is_set = TRUE;
+    } else if (!rdata->aws_etag)
+        return;
+
+    cache_mng_store_file_buf (cmng, rdata->ino, buf_len, rdata->request_offset + rdata->received,
+        (unsigned char *) buf, NULL, NULL);
+
+    // the requested range is received, don't wait for the rest of the block
+    if (!rdata->replied && rdata->size > 0 && (guint64)rdata->off >= (guint64)rdata->request_offset &&
+        fileio_read_reply_from_chunk (rdata, buf, buf_len, rdata->request_offset + rdata->received)) {
+        LOG_debug (FIO_LOG, INO_H"Replied before the block download is finished [%"OFF_FMT": %"G_GUINT64_FORMAT"]",
+            INO_T (rdata->ino), rdata->off, rdata->size);
+        rdata->replied = TRUE;
+    }
+
+    rdata->received += buf_len;
+
+    if (!cache_mng_get_etag (cmng, rdata->ino))
+        cache_mng_update_etag (cmng, rdata->ino, rdata->aws_etag);
+
+    // requests waiting for this block
+    cache_mng_fetch_progress (cmng, rdata->ino, rdata->request_offset);
+}
+
+static void fileio_read_on_get_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+    const char *cached_etag;
+    CacheMng *cmng;
+    fuse_ino_t ino;
+    off_t request_offset;
+
+    // release HttpConnection
+    http_connection_release (con);
+
+    cmng = application_get_cache_mng (rdata->app);
+    ino = rdata->ino;
+    request_offset = rdata->request_offset;
+
+    if (!success) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get file from server !", INO_T (rdata->ino), (void *)con);
+        cache_mng_fetch_done (cmng, ino, request_offset, FALSE);
+        if (!rdata->replied)
+            rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+        fileread_destroy (rdata);
+        return;
+    }
+
+    // the request is answered already, just finish the block download
+    if (rdata->replied) {
+        cache_mng_fetch_done (cmng, ino, request_offset, TRUE);
+        fileread_destroy (rdata);
+        return;
+    }
+
+    if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata)) {
+        cache_mng_fetch_done (cmng, ino, request_offset, FALSE);
+        return;
+    }
+
+    // store it in the local cache, the body is already stored by parts in streaming mode
+    if (buf_len)
+        cache_mng_store_file_buf (cmng,
+            rdata->ino, buf_len, rdata->request_offset + rdata->received, (unsigned char *) buf,
+            NULL, NULL);
+
+    cached_etag = cache_mng_get_etag (cmng, rdata->ino);
+    LOG_debug (FIO_LOG, INO_H"Read from server done, AWS etag %.8s..., cache etag %.8s...",
+        INO_T (rdata->ino), rdata->aws_etag+1, cached_etag ? cached_etag+1 : "not set");
+
+    if (rdata->aws_etag && !cached_etag) {
+        LOG_debug (FIO_LOG, INO_H"Setting cache etag: %.8s...", INO_T (rdata->ino), rdata->aws_etag+1);
+        cache_mng_update_etag (cmng, rdata->ino, rdata->aws_etag);
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Storing [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]", INO_T(rdata->ino),
+        rdata->request_offset, rdata->received + buf_len);
+
+    // notify other requests, waiting for this block
+    cache_mng_fetch_done (cmng, ino, request_offset, TRUE);
+
+    // and read it
+    fileio_read_get_buf (rdata);
+}
+
+// got HttpConnection object
+static void fileio_read_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileReadData *rdata = (FileReadData *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    // small file - get the whole file at once
+    if (rdata->request_offset == 0 && rdata->request_size >= rdata->fop->file_size) {
+
+    // get the block
+    } else {
+        gchar *range_hdr;
+
+        range_hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
+            (gint64)rdata->request_offset, (gint64)(rdata->request_offset + rdata->request_size - 1));
+        http_connection_add_output_header (con, "Range", range_hdr);
+        g_free (range_hdr);
+    }
+
+    // store data and answer reads as soon as it arrives
+    rdata->received = 0;
+    http_connection_set_on_chunk_cb (con, fileio_read_on_get_chunk_cb);
+
+    res = http_connection_make_request (con,
+        rdata->fop->fname, "GET", NULL, TRUE, NULL,
+        fileio_read_on_get_cb,
+        rdata
+    );
+    // fileio_read_on_get_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (rdata->ino), (void *)con);
+}
+
+// block download, started by another request, is finished
+static void fileio_read_on_fetched_cb (gboolean success, void *ctx)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+
+    // if the download failed, the block is requested once again
+    LOG_debug (FIO_LOG, INO_H"Pending block download is done, success: %s", INO_T (rdata->ino), success ? "TRUE" : "FALSE");
+    fileio_read_get_buf (rdata);
+}
+
+typedef struct {
+    guint64 off;
+    guint64 size;
+} FileReadMissing;
+
+// remember the first run of missing blocks
+static void fileio_read_on_missing_block_cb (guint64 off, guint64 size, void *ctx)
+{
+    FileReadMissing *missing = (FileReadMissing *) ctx;
+
+    if (missing->size)
+        return;
+
+    missing->off = off;
+    missing->size = size;
+}
+
+static void fileio_read_on_cache_cb (unsigned char *buf, size_t size, gboolean success, void *ctx)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+    CacheMng *cmng;
+    guint64 part_size;
+    guint64 block_off;
+
+    if (success) {
+        // read directly from cache
+        LOG_debug (FIO_LOG, INO_H"Reading from cache", INO_T (rdata->ino));
+        rdata->on_buffer_read_cb (rdata->ctx, TRUE, (char *)buf, size);
+        fileread_destroy (rdata);
+        return;
+    }
+
+    cmng = application_get_cache_mng (rdata->fop->app);
+    part_size = conf_get_uint (application_get_conf (rdata->fop->app), "s3.part_size");
+
+    if (rdata->fop->access_pattern == FIO_ACCESS_SEQUENTIAL) {
+        // find the first part-aligned block of the requested range, which is not cached yet
+        block_off = rdata->off - rdata->off % part_size;
+        while (block_off + part_size < (guint64)rdata->off + rdata->size &&
+            cache_mng_file_contains (cmng, rdata->ino,
+                block_off + part_size - MAX (block_off, (guint64)rdata->off), MAX (block_off, (guint64)rdata->off)))
+            block_off += part_size;
+
+        rdata->request_size = MIN (part_size, rdata->fop->file_size - block_off);
+    } else {
+        FileReadMissing missing = { 0, 0 };
+        guint64 end;
+
+        fileio_read_get_request_range (rdata->fop, rdata->size, rdata->off, &block_off, &end);
+
+        // partial hit: only the first run of missing blocks is fetched, the rest is read from the cache
+        cache_mng_foreach_missing_block (cmng, rdata->ino, end - block_off, block_off,
+            fileio_read_on_missing_block_cb, &missing);
+        if (missing.size) {
+            end = MIN (end, missing.off + missing.size);
+            block_off = MAX (block_off, missing.off);
+        }
+
+        rdata->request_size = end - block_off;
+    }
+
+    rdata->request_offset = block_off;
+
+    // a block of the range is being downloaded by another request (of any access pattern or read-ahead), wait for it
+    if (!cache_mng_fetch_start (cmng, rdata->ino, block_off, rdata->request_size, fileio_read_on_fetched_cb, rdata))
+        return;
+
+    // try reading from server, using fileio_read_on_con_cb() callback
+    LOG_debug (FIO_LOG, INO_H"Reading from server [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"]",
+        INO_T (rdata->ino), block_off, rdata->request_size);
+    if (client_pool_get_client (application_get_read_client_pool (rdata->fop->app), fileio_read_on_con_cb, rdata)) {
+        // fileio_read_on_con_cb() callback will resume handling this request
+        // meanwhile, use the rest of idle connections to download the following parts
+        fileio_read_parallel_submit (rdata->fop);
+    } else {
+        // couldn't get HTTP client to try accessing server; fail directly
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (rdata->ino));
+        cache_mng_fetch_done (cmng, rdata->ino, block_off, FALSE);
+        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+        fileread_destroy (rdata);
+        return;
+    }
+}
+
+// cache file descriptor of the requested range is received
+static void fileio_read_on_file_fd_cb (int fd, void *ctx)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+
+    // the range is evicted or one of the stores failed, data is read (or downloaded) as usual
+    if (fd < 0) {
+        cache_mng_retrieve_file_buf (application_get_cache_mng (rdata->fop->app),
+            rdata->ino, rdata->size, rdata->off,
+            fileio_read_on_cache_cb, rdata);
+        return;
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Reading from cache file descriptor", INO_T (rdata->ino));
+    rdata->on_buffer_fd_read_cb (rdata->ctx, fd, rdata->off, rdata->size);
+    fileread_destroy (rdata);
+}
+
+static void fileio_read_get_buf (FileReadData *rdata)
+{
+    if ((guint64)rdata->off >= rdata->fop->file_size) {
+        // requested range is outsize the file size
+        LOG_debug (FIO_LOG, INO_H"requested size is beyond the file size!", INO_T (rdata->ino));
+        fileio_read_on_cache_cb (NULL, 0, TRUE, rdata);
+        return;
+    }
+
+    // set new request size:
+    // 1. file must have some size
+    // 2. offset must be less than the file size
+    // 3. offset + size is greater than the file size
+    if (rdata->fop->file_size > 0 &&
+        rdata->off >= 0 &&
+        rdata->fop->file_size > (guint64)rdata->off &&
+        (guint64) (rdata->off + rdata->size) > rdata->fop->file_size)
+    {
+        rdata->size = rdata->fop->file_size - rdata->off;
+    // special case, when zero-size file is requested
+    } else if (rdata->fop->file_size == 0) {
+        rdata->size = 0;
+    } else {
+        // request size and offset are ok
+    }
+
+    LOG_debug (FIO_LOG, INO_H"requesting [%"OFF_FMT": %"G_GUINT64_FORMAT"], file size: %"G_GUINT64_FORMAT,
+        INO_T (rdata->ino), rdata->off, rdata->size, rdata->fop->file_size);
+
+    // hot data is copied from memory, without system calls
+    if (rdata->size > 0 && fileio_read_reply_from_mem (rdata)) {
+        LOG_debug (FIO_LOG, INO_H"Reading from cache memory", INO_T (rdata->ino));
+        fileread_destroy (rdata);
+        return;
+    }
+
+    // pass cached file descriptor to the caller, avoids copying data to a temporary buffer
+    // the descriptor is received when pending cache I/O jobs of the file are finished
+    if (rdata->on_buffer_fd_read_cb && rdata->size > 0 &&
+        cache_mng_file_contains (application_get_cache_mng (rdata->fop->app), rdata->ino, rdata->size, rdata->off)) {
+        cache_mng_get_file_fd_async (application_get_cache_mng (rdata->fop->app),
+            rdata->ino, rdata->size, rdata->off,
+            fileio_read_on_file_fd_cb, rdata);
+        return;
+    }
+
+    cache_mng_retrieve_file_buf (application_get_cache_mng (rdata->fop->app),
+        rdata->ino, rdata->size, rdata->off,
+        fileio_read_on_cache_cb, rdata);
+}
+/*}}}*/
+
+// file size and ETag request is finished, resume reads which were waiting for it
+static void fileio_read_head_done (FileIO *fop)
+{
+    GList *l, *l_waiters;
+
+    fop->head_req_pending = FALSE;
+
+    l_waiters = fop->l_head_waiters;
+    fop->l_head_waiters = NULL;
+
+    for (l = g_list_first (l_waiters); l; l = g_list_next (l)) {
+        FileReadData *rdata = (FileReadData *) l->data;
+
+        if (!fop->head_req_sent) {
+            LOG_err (FIO_LOG, INO_H"Failed to get file size !", INO_T (rdata->ino));
+            rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+            fileread_destroy (rdata);
+            continue;
+        }
+
+        rdata->cache_etag_is_set = cache_mng_get_etag (application_get_cache_mng (fop->app), rdata->ino) != NULL;
+        fileio_read_get_buf (rdata);
+    }
+
+    g_list_free (l_waiters);
+}
+
+/*{{{ HEAD request*/
+
+static void fileio_read_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+    FileIO *fop = rdata->fop;
+    const char *content_len_header;
+    DirTree *dtree;
+
+    // release HttpConnection
+    http_connection_release (con);
+
+    if (!success) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get HEAD from server !", INO_T (rdata->ino), (void *)con);
+        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+        fileread_destroy (rdata);
+        fileio_read_head_done (fop);
+        return;
+    }
+
+    rdata->fop->head_req_sent = TRUE;
+
+    // update DirTree
+    dtree = application_get_dir_tree (rdata->fop->app);
+    dir_tree_set_entry_exist (dtree, rdata->ino);
+
+    // Set file size from header Content-Length
+    content_len_header = http_find_header (headers, "Content-Length");
+    if (content_len_header) {
+        gint64 size = 0;
+
+        size = strtoll ((char *)content_len_header, NULL, 10);
+        if (size < 0) {
+            LOG_err (FIO_LOG, INO_CON_H"Header contains incorrect file size!", INO_T (rdata->ino), (void *)con);
+            size = 0;
+        }
+
+        rdata->fop->file_size = size;
+        LOG_debug (FIO_LOG, INO_H"Remote file size: %"G_GUINT64_FORMAT, INO_T (rdata->ino), rdata->fop->file_size);
+    }
+
+    // Check that the etag we're caching matches the AWS ETag
+    if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata)) {
+        fileio_read_head_done (fop);
+        return;
+    }
+
+    // file size is known now, start reading ahead
+    fileio_read_ahead_submit (fop);
+
+    // resume downloading file
+    fileio_read_get_buf (rdata);
+    fileio_read_head_done (fop);
+}
+
+// got HttpConnection object
+static void fileio_read_on_head_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileReadData *rdata = (FileReadData *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    res = http_connection_make_request (con,
+        rdata->fop->fname, "HEAD", NULL, FALSE, NULL,
+        fileio_read_on_head_cb,
+        rdata
+    );
+
+    // fileio_read_on_head_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (rdata->ino), (void *)con);
+}
+/*}}}*/
+
+/*{{{ read-ahead */
+
+typedef struct {
+    Application *app;
+    gchar *fname;
+    fuse_ino_t ino;
+    guint64 off;
+    guint64 size;
+    gchar *aws_etag;
+    guint64 received; // bytes stored so far
+    gboolean dropped; // object was modified, received data is ignored
+    FileIO_on_prefetched_cb on_prefetched_cb; // whole file prefetch only
+    gpointer ctx;
+} FileReadAheadData;
+
+static void fileio_read_ahead_destroy (FileReadAheadData *radata)
+{
+    g_free (radata->fname);
+    g_free (radata->aws_etag);
+    g_free (radata);
+}
+
+// download is finished, notify waiting requests
+static void fileio_read_ahead_done (FileReadAheadData *radata, gboolean success)
+{
+    cache_mng_fetch_done (application_get_cache_mng (radata->app), radata->ino, radata->off, success);
+    if (radata->on_prefetched_cb)
+        radata->on_prefetched_cb (radata->ctx, success);
+    fileio_read_ahead_destroy (radata);
+}
+
+// a part of the block is received, store it, so waiting reads can use it
+static void fileio_read_ahead_on_get_chunk_cb (G_GNUC_UNUSED HttpConnection *con, void *ctx,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileReadAheadData *radata = (FileReadAheadData *) ctx;
+    CacheMng *cmng;
+    const char *aws_etag, *cached_etag;
+
+    if (radata->dropped)
+        return;
+
+    cmng = application_get_cache_mng (radata->app);
+
+    // object was modified since the read-ahead request was sent
+    aws_etag = http_find_header (headers, "ETag");
+    cached_etag = cache_mng_get_etag (cmng, radata->ino);
+    if (!aws_etag || strcmp (aws_etag, radata->aws_etag) ||
+        (cached_etag && strcmp (cached_etag, radata->aws_etag))) {
+        radata->dropped = TRUE;
+        return;
+    }
+
+    cache_mng_store_file_buf (cmng, radata->ino, buf_len, radata->off + radata->received, (unsigned char *) buf, NULL, NULL);
+    radata->received += buf_len;
+    if (!cached_etag)
+        cache_mng_update_etag (cmng, radata->ino, radata->aws_etag);
+
+    cache_mng_fetch_progress (cmng, radata->ino, radata->off);
+}
+
+static void fileio_read_ahead_on_get_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileReadAheadData *radata = (FileReadAheadData *) ctx;
+    CacheMng *cmng;
+    const char *aws_etag, *cached_etag;
+
+    http_connection_release (con);
+
+    cmng = application_get_cache_mng (radata->app);
+
+    if (!success) {
+        LOG_debug (FIO_LOG, INO_CON_H"Failed to read ahead [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"]",
+            INO_T (radata->ino), (void *)con, radata->off, radata->size);
+        fileio_read_ahead_done (radata, FALSE);
+        return;
+    }
+
+    // object was modified since the read-ahead request was sent, drop data
+    aws_etag = http_find_header (headers, "ETag");
+    if (radata->dropped || !aws_etag || strcmp (aws_etag, radata->aws_etag)) {
+        LOG_debug (FIO_LOG, INO_CON_H"ETag changed, dropping read-ahead data", INO_T (radata->ino), (void *)con);
+        fileio_read_ahead_done (radata, FALSE);
+        return;
+    }
+
+    cached_etag = cache_mng_get_etag (cmng, radata->ino);
+    if (cached_etag && strcmp (cached_etag, radata->aws_etag)) {
+        LOG_debug (FIO_LOG, INO_CON_H"Cached ETag differs, dropping read-ahead data", INO_T (radata->ino), (void *)con);
+        fileio_read_ahead_done (radata, FALSE);
+        return;
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Read ahead [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]", INO_T (radata->ino),
+        radata->off, radata->received + buf_len);
+
+    // in streaming mode the body is already stored by parts
+    if (buf_len)
+        cache_mng_store_file_buf (cmng, radata->ino, buf_len, radata->off + radata->received, (unsigned char *) buf, NULL, NULL);
+    if (!cached_etag)
+        cache_mng_update_etag (cmng, radata->ino, radata->aws_etag);
+
+    fileio_read_ahead_done (radata, TRUE);
+}
+
+// got HttpConnection object
+static void fileio_read_ahead_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileReadAheadData *radata = (FileReadAheadData *) ctx;
+    gchar *range_hdr;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    range_hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
+        radata->off, radata->off + radata->size - 1);
+    http_connection_add_output_header (con, "Range", range_hdr);
+    g_free (range_hdr);
+
+    // reads waiting for this block can use data as soon as it arrives
+    http_connection_set_on_chunk_cb (con, fileio_read_ahead_on_get_chunk_cb);
+
+    res = http_connection_make_request (con,
+        radata->fname, "GET", NULL, TRUE, NULL,
+        fileio_read_ahead_on_get_cb,
+        radata
+    );
+    // fileio_read_ahead_on_get_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// classify access pattern of the file handle by the sequence of read requests
+static void fileio_read_classify (FileIO *fop, size_t size, off_t off)
+{
+    guint64 part_size;
+    gint64 stride;
+    FileIOAccessPattern pattern;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    stride = (gint64)off - (gint64)fop->last_read_off;
+
+    // the footer is read first: one of the first reads is within the last part of the file
+    if (fop->head_req_sent && fop->reads_nr < FIO_TAIL_READS &&
+        fop->file_size > part_size && (guint64)off + part_size >= fop->file_size &&
+        (!fop->reads_nr || fop->access_pattern == FIO_ACCESS_TAIL)) {
+        pattern = FIO_ACCESS_TAIL;
+
+    // the next expected offset
+    } else if ((guint64)off + FIO_SEQUENTIAL_GAP >= fop->ra_next_off && (guint64)off <= fop->ra_next_off + FIO_SEQUENTIAL_GAP) {
+        pattern = FIO_ACCESS_SEQUENTIAL;
+
+    // the same distance between non-adjacent reads
+    } else if (fop->reads_nr > 1 && stride == fop->last_stride && (guint64)ABS (stride) > size) {
+        pattern = FIO_ACCESS_STRIDED;
+
+    } else {
+        pattern = FIO_ACCESS_RANDOM;
+    }
+
+    if (pattern != fop->access_pattern)
+        LOG_debug (FIO_LOG, INO_H"Access pattern changed: %d -> %d", INO_T (fop->ino), fop->access_pattern, pattern);
+
+    fop->access_pattern = pattern;
+    fop->last_stride = stride;
+    fop->last_read_off = off;
+    fop->last_read_size = size;
+    fop->reads_nr++;
+}
+
+// range to download for a non-sequential read: from one page up to the end of file for tail-first reads
+// strides up to a part are downloaded whole, from the read up to the reads of the following strides within a part
+static void fileio_read_get_request_range (FileIO *fop, size_t size, off_t off, guint64 *start, guint64 *end)
+{
+    guint64 min_size;
+    guint64 part_size;
+
+    min_size = conf_get_uint (application_get_conf (fop->app), "s3.min_read_size");
+    if (!min_size)
+        min_size = 1;
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+
+    *start = off - off % min_size;
+
+    if (fop->access_pattern == FIO_ACCESS_TAIL) {
+        *end = fop->file_size;
+    } else if (fop->access_pattern == FIO_ACCESS_STRIDED && (guint64) ABS (fop->last_stride) <= part_size) {
+        guint64 stride = ABS (fop->last_stride);
+        guint64 span = (part_size / stride - 1) * stride + size;
+
+        // backward strides: the following reads are before the current one
+        if (fop->last_stride < 0) {
+            *start = (guint64)off + size > span ? (guint64)off + size - span : 0;
+            *start -= *start % min_size;
+            *end = (guint64)off + size;
+        } else
+            *end = (guint64)off + span;
+        if (*end % min_size)
+            *end += min_size - *end % min_size;
+    } else {
+        *end = (guint64)off + size;
+        if (*end % min_size)
+            *end += min_size - *end % min_size;
+    }
+
+    *end = MIN (*end, fop->file_size);
+}
+
+// update read-ahead window according to the access pattern:
+// sequential reads grow the window up to "s3.read_ahead_max_parts" parts, random reads shrink it
+static void fileio_read_ahead_update (FileIO *fop, size_t size, off_t off)
+{
+    guint64 part_size;
+    guint64 max_window;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    max_window = part_size * conf_get_uint (application_get_conf (fop->app), "s3.read_ahead_max_parts");
+
+    // sequential read
+    if (fop->access_pattern == FIO_ACCESS_SEQUENTIAL) {
+        if (!fop->ra_window) {
+            fop->ra_window = part_size;
+            // the current request downloads the rest of the part at least
+            fop->ra_end = MAX (fop->ra_end, MAX ((guint64)off - off % part_size + part_size, (guint64)off + size));
+        // reader has consumed half of the window, double it
+        } else if ((guint64)off + size + fop->ra_window / 2 >= fop->ra_end) {
+            fop->ra_window = MIN (fop->ra_window * 2, max_window);
+        }
+
+    // random read
+    } else {
+        fop->ra_window = fop->ra_window / 2;
+        if (fop->ra_window < part_size)
+            fop->ra_window = 0;
+        fop->ra_end = MAX ((guint64)off - off % part_size + part_size, (guint64)off + size);
+    }
+
+    if (fop->ra_window > max_window)
+        fop->ra_window = max_window;
+
+    // don't move backward because of reordered requests
+    if (fop->ra_window)
+        fop->ra_next_off = MAX (fop->ra_next_off, (guint64)off + size);
+    else
+        fop->ra_next_off = off + size;
+}
+
+// send request to download [off, off + size) range of the object into local cache
+// caller must own the fetch of the block (cache_mng_fetch_start () returned TRUE)
+// return FALSE if read pool queue is full, the fetch is finished with failure status
+static gboolean fileio_read_ahead_send_range (Application *app, const gchar *fname, fuse_ino_t ino,
+    guint64 off, guint64 size, const gchar *aws_etag, FileIO_on_prefetched_cb on_prefetched_cb, gpointer ctx)
+{
+    FileReadAheadData *radata;
+
+    radata = g_new0 (FileReadAheadData, 1);
+    radata->app = app;
+    radata->fname = g_strdup (fname);
+    radata->ino = ino;
+    radata->off = off;
+    radata->size = size;
+    radata->aws_etag = g_strdup (aws_etag);
+    radata->on_prefetched_cb = on_prefetched_cb;
+    radata->ctx = ctx;
+
+    if (!client_pool_get_client (application_get_read_client_pool (app), fileio_read_ahead_on_con_cb, radata)) {
+        LOG_debug (FIO_LOG, INO_H"Failed to get HTTP client for read-ahead !", INO_T (ino));
+        cache_mng_fetch_done (application_get_cache_mng (app), ino, off, FALSE);
+        fileio_read_ahead_destroy (radata);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// send request to download [off, off + size) range into local cache
+// return FALSE if read pool queue is full
+static gboolean fileio_read_ahead_send (FileIO *fop, guint64 off, guint64 size)
+{
+    // the block is being downloaded already
+    if (!cache_mng_fetch_start (application_get_cache_mng (fop->app), fop->ino, off, size, NULL, NULL))
+        return TRUE;
+
+    return fileio_read_ahead_send_range (fop->app, fop->fname, fop->ino, off, size, fop->aws_etag, NULL, NULL);
+}
+
+// download the whole object into local cache, used by DirTree to prefetch files which are likely to be read next
+// return FALSE if the request is not sent, on_prefetched_cb is called only if TRUE is returned
+gboolean fileio_prefetch_file (Application *app, const gchar *fname, fuse_ino_t ino, guint64 file_size, const gchar *etag,
+    FileIO_on_prefetched_cb on_prefetched_cb, gpointer ctx)
+{
+    CacheMng *cmng;
+    const char *cached_etag;
+    gchar *aws_etag;
+    gchar *path;
+    gboolean res;
+
+    cmng = application_get_cache_mng (app);
+
+    // S3 returns quoted ETag in headers
+    aws_etag = g_strdup_printf ("\"%s\"", etag);
+
+    cached_etag = cache_mng_get_etag (cmng, ino);
+    if (cached_etag && strcmp (cached_etag, aws_etag)) {
+        LOG_debug (FIO_LOG, INO_H"ETags differ, invalidating local cached file before prefetch", INO_T (ino));
+        // data written by an open handle isn't discarded
+        cache_mng_discard_clean (cmng, ino);
+    }
+
+    // file is already in local cache or is being downloaded
+    if (cache_mng_file_contains (cmng, ino, file_size, 0) || !cache_mng_fetch_start (cmng, ino, 0, file_size, NULL, NULL)) {
+        g_free (aws_etag);
+        return FALSE;
+    }
+
+    path = fileio_get_object_path (app, fname);
+    res = fileio_read_ahead_send_range (app, path, ino, 0, file_size, aws_etag, on_prefetched_cb, ctx);
+    g_free (path);
+    g_free (aws_etag);
+
+    if (res)
+        LOG_debug (FIO_LOG, INO_H"Prefetching %s (%"G_GUINT64_FORMAT" bytes)", INO_T (ino), fname, file_size);
+
+    return res;
+}
+
+// long strides: the following reads are predicted by the stride and downloaded in advance, without the gaps between them
+static void fileio_read_stride_submit (FileIO *fop)
+{
+    guint64 part_size;
+    CacheMng *cmng;
+    guint i;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+
+    // short strides are downloaded whole by fileio_read_get_request_range ()
+    if (!fop->head_req_sent || !fop->aws_etag || (guint64) ABS (fop->last_stride) <= part_size)
+        return;
+
+    cmng = application_get_cache_mng (fop->app);
+
+    for (i = 1; i <= FIO_STRIDE_PREFETCH; i++) {
+        gint64 off = (gint64) fop->last_read_off + (gint64) i * fop->last_stride;
+        guint64 start, end;
+
+        if (off < 0 || (guint64) off >= fop->file_size)
+            break;
+
+        fileio_read_get_request_range (fop, fop->last_read_size, off, &start, &end);
+        if (cache_mng_file_contains (cmng, fop->ino, end - start, start))
+            continue;
+
+        // pool queue is full, try again on the next read
+        if (!fileio_read_ahead_send (fop, start, end - start))
+            return;
+
+        LOG_debug (FIO_LOG, INO_H"Reading stride ahead [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"], stride: %"G_GINT64_FORMAT,
+            INO_T (fop->ino), start, end - start, fop->last_stride);
+    }
+}
+
+// send read-ahead requests for the parts within the current window, which are not cached yet
+static void fileio_read_ahead_submit (FileIO *fop)
+{
+    guint64 part_size;
+    guint64 win_end;
+    CacheMng *cmng;
+
+    if (fop->access_pattern == FIO_ACCESS_STRIDED) {
+        fileio_read_stride_submit (fop);
+        return;
+    }
+
+    if (!fop->ra_window || !fop->head_req_sent || !fop->aws_etag)
+        return;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    cmng = application_get_cache_mng (fop->app);
+
+    // keep requests aligned to part boundaries
+    if (fop->ra_end < fop->ra_next_off)
+        fop->ra_end = fop->ra_next_off - fop->ra_next_off % part_size;
+    win_end = MIN (fop->ra_next_off + fop->ra_window, fop->file_size);
+
+    while (fop->ra_end < win_end) {
+        guint64 size;
+
+        size = MIN (part_size - fop->ra_end % part_size, fop->file_size - fop->ra_end);
+
+        if (!cache_mng_file_contains (cmng, fop->ino, size, fop->ra_end)) {
+            // pool queue is full, try again on the next read
+            if (!fileio_read_ahead_send (fop, fop->ra_end, size))
+                return;
+
+            LOG_debug (FIO_LOG, INO_H"Reading ahead [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"], window: %"G_GUINT64_FORMAT,
+                INO_T (fop->ino), fop->ra_end, size, fop->ra_window);
+        }
+
+        fop->ra_end += size;
+    }
+}
+
+// cache miss during a sequential read of a large file:
+// download the following parts in parallel, using all idle read connections
+static void fileio_read_parallel_submit (FileIO *fop)
+{
+    guint64 part_size;
+    gint idle;
+    CacheMng *cmng;
+
+    if (!conf_get_boolean (application_get_conf (fop->app), "s3.parallel_download"))
+        return;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    if (!fop->ra_window || !fop->head_req_sent || !fop->aws_etag || fop->file_size < part_size * 2)
+        return;
+
+    cmng = application_get_cache_mng (fop->app);
+    idle = client_pool_get_idle_client_count (application_get_read_client_pool (fop->app));
+
+    if (fop->ra_end < fop->ra_next_off)
+        fop->ra_end = fop->ra_next_off - fop->ra_next_off % part_size;
+
+    while (idle > 0 && fop->ra_end < fop->file_size) {
+        guint64 size;
+
+        size = MIN (part_size - fop->ra_end % part_size, fop->file_size - fop->ra_end);
+
+        if (!cache_mng_file_contains (cmng, fop->ino, size, fop->ra_end)) {
+            if (!fileio_read_ahead_send (fop, fop->ra_end, size))
+                return;
+
+            LOG_debug (FIO_LOG, INO_H"Downloading in parallel [%"G_GUINT64_FORMAT": %"G_GUINT64_FORMAT"]",
+                INO_T (fop->ino), fop->ra_end, size);
+            idle--;
+        }
+
+        fop->ra_end += size;
+    }
+}
+/*}}}*/
+
+// get the offset of the returned data and the total object size from GET response headers
+// return FALSE if the object size is unknown
+static gboolean fileio_get_content_range (struct evkeyvalq *headers, guint64 *start, guint64 *total)
+{
+    const char *range_header;
+    const char *content_len_header;
+    gint64 size = -1;
+
+    *start = 0;
+
+    // Content-Range: bytes 0-5242879/10485760
+    range_header = http_find_header (headers, "Content-Range");
+    content_len_header = http_find_header (headers, "Content-Length");
+    if (range_header) {
+        const char *total_str = strrchr (range_header, '/');
+        const char *start_str = strchr (range_header, ' ');
+
+        if (total_str && *(total_str + 1) != '*')
+            size = strtoll (total_str + 1, NULL, 10);
+        if (start_str)
+            *start = strtoull (start_str + 1, NULL, 10);
+    // the whole file is returned
+    } else if (content_len_header) {
+        size = strtoll ((char *)content_len_header, NULL, 10);
+    }
+
+    if (size < 0)
+        return FALSE;
+
+    *total = size;
+    return TRUE;
+}
+
+/*{{{ first GET request*/
+
+// the first block of the file is received
+// the file size is taken from Content-Range header, ETag from the same response
+static void fileio_read_on_first_get_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileReadData *rdata = (FileReadData *) ctx;
+    FileIO *fop = rdata->fop;
+    const char *cached_etag;
+    CacheMng *cmng;
+    guint64 start;
+    guint64 size;
+
+    // release HttpConnection
+    http_connection_release (con);
+
+    // the range might be not satisfiable (empty file, offset is beyond the file size), send HEAD request
+    if (!success || !fileio_get_content_range (headers, &start, &size)) {
+        LOG_debug (FIO_LOG, INO_CON_H"Failed to get file size from GET request, sending HEAD request", INO_T (rdata->ino), (void *)con);
+        if (!client_pool_get_client (application_get_read_client_pool (rdata->fop->app), fileio_read_on_head_con_cb, rdata)) {
+            LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (rdata->ino));
+            rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+            fileread_destroy (rdata);
+            fileio_read_head_done (fop);
+        }
+        return;
+    }
+
+    rdata->fop->head_req_sent = TRUE;
+    rdata->fop->file_size = size;
+    LOG_debug (FIO_LOG, INO_H"Remote file size: %"G_GUINT64_FORMAT, INO_T (rdata->ino), rdata->fop->file_size);
+
+    // update DirTree
+    dir_tree_set_entry_exist (application_get_dir_tree (rdata->fop->app), rdata->ino);
+
+    // Check that the etag we're caching matches the AWS ETag
+    if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata)) {
+        fileio_read_head_done (fop);
+        return;
+    }
+
+    // store it in the local cache
+    cmng = application_get_cache_mng (rdata->fop->app);
+    cache_mng_store_file_buf (cmng, rdata->ino, buf_len, rdata->request_offset, (unsigned char *) buf, NULL, NULL);
+
+    cached_etag = cache_mng_get_etag (cmng, rdata->ino);
+    if (rdata->aws_etag && !cached_etag)
+        cache_mng_update_etag (cmng, rdata->ino, rdata->aws_etag);
+
+    // file size is known now, start reading ahead
+    fileio_read_ahead_submit (fop);
+
+    // read it
+    fileio_read_get_buf (rdata);
+    fileio_read_head_done (fop);
+}
+
+// got HttpConnection object
+static void fileio_read_on_first_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileReadData *rdata = (FileReadData *) ctx;
+    gchar *range_hdr;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    range_hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
+        (gint64)rdata->request_offset, (gint64)(rdata->request_offset + rdata->request_size - 1));
+    http_connection_add_output_header (con, "Range", range_hdr);
+    g_free (range_hdr);
+
+    // do not retry, HEAD request is sent if GET fails
+    res = http_connection_make_request (con,
+        rdata->fop->fname, "GET", NULL, FALSE, NULL,
+        fileio_read_on_first_get_cb,
+        rdata
+    );
+
+    // fileio_read_on_first_get_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (rdata->ino), (void *)con);
+}
+/*}}}*/
+
+// file size is unknown, request the block containing the offset
+// the response contains the file size and ETag
+static void fileio_read_send_first_get (FileReadData *rdata)
+{
+    FileIO *fop = rdata->fop;
+    guint64 part_size;
+
+    part_size = conf_get_uint (application_get_conf (fop->app), "s3.part_size");
+    rdata->request_offset = rdata->off - rdata->off % part_size;
+    rdata->request_size = part_size;
+    rdata->cache_etag_is_set = FALSE;
+    fop->head_req_pending = TRUE;
+     // get HTTP connection to download a part or a full file
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app), fileio_read_on_first_con_cb, rdata)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (rdata->ino));
+        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
+        fileread_destroy (rdata);
+        fileio_read_head_done (fop);
+    }
+}
+
+/*{{{ open prefetch */
+
+static void fileio_open_prefetch_destroy (FileOpenPrefetch *pdata)
+{
+    g_free (pdata->fname);
+    g_free (pdata);
+}
+
+// size and ETag are known, download tail and head of the file in background
+static void fileio_open_prefetch_ranges (FileIO *fop)
+{
+    CacheMng *cmng;
+    guint64 tail_size, head_size;
+    guint64 min_size;
+    guint64 off;
+
+    if (!fop->aws_etag || !fop->file_size)
+        return;
+
+    cmng = application_get_cache_mng (fop->app);
+    tail_size = conf_get_uint (application_get_conf (fop->app), "s3.open_prefetch_tail_size");
+    head_size = conf_get_uint (application_get_conf (fop->app), "s3.open_prefetch_head_size");
+    min_size = MAX (conf_get_uint (application_get_conf (fop->app), "s3.min_read_size"), 1);
+
+    if (tail_size) {
+        off = fop->file_size > tail_size ? fop->file_size - tail_size : 0;
+        off -= off % min_size;
+        if (!cache_mng_file_contains (cmng, fop->ino, fop->file_size - off, off))
+            fileio_read_ahead_send (fop, off, fop->file_size - off);
+    }
+
+    if (head_size) {
+        head_size = MIN (head_size, fop->file_size);
+        if (!cache_mng_file_contains (cmng, fop->ino, head_size, 0))
+            fileio_read_ahead_send (fop, 0, head_size);
+    }
+}
+
+static void fileio_open_prefetch_on_get_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len, struct evkeyvalq *headers)
+{
+    FileOpenPrefetch *pdata = (FileOpenPrefetch *) ctx;
+    FileIO *fop = pdata->fop;
+    const char *aws_etag = NULL;
+    CacheMng *cmng;
+    guint64 start = 0;
+    guint64 size = 0;
+
+    http_connection_release (con);
+
+    // file is released already
+    if (!fop) {
+        fileio_open_prefetch_destroy (pdata);
+        return;
+    }
+    fop->open_prefetch = NULL;
+
+    if (success)
+        aws_etag = http_find_header (headers, "ETag");
+
+    // let the first waiting read get file size by itself
+    if (!aws_etag || !fileio_get_content_range (headers, &start, &size) || start + buf_len > size) {
+        LOG_debug (FIO_LOG, INO_CON_H"Open prefetch failed", INO_T (pdata->ino), (void *)con);
+        fop->head_req_pending = FALSE;
+        if (!fop->head_req_sent && fop->l_head_waiters) {
+            FileReadData *rdata = (FileReadData *) fop->l_head_waiters->data;
+
+            fop->l_head_waiters = g_list_delete_link (fop->l_head_waiters, fop->l_head_waiters);
+            fileio_read_send_first_get (rdata);
+        }
+        fileio_open_prefetch_destroy (pdata);
+        return;
+    }
+
+    fop->file_size = size;
+    fop->head_req_sent = TRUE;
+    LOG_debug (FIO_LOG, INO_H"Remote file size: %"G_GUINT64_FORMAT", prefetched [%"G_GUINT64_FORMAT": %zu]",
+        INO_T (fop->ino), size, start, buf_len);
+
+    dir_tree_set_entry_exist (application_get_dir_tree (fop->app), fop->ino);
+    fileio_update_cache_etag (fop, aws_etag);
+
+    cmng = application_get_cache_mng (fop->app);
+    if (buf_len) {
+        cache_mng_store_file_buf (cmng, fop->ino, buf_len, start, (unsigned char *) buf, NULL, NULL);
+        if (!cache_mng_get_etag (cmng, fop->ino))
+            cache_mng_update_etag (cmng, fop->ino, aws_etag);
+    }
+
+    // head of the file
+    fileio_open_prefetch_ranges (fop);
+
+    // resume reads
+    fileio_read_head_done (fop);
+    fileio_open_prefetch_destroy (pdata);
+}
+
+static void fileio_open_prefetch_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileOpenPrefetch *pdata = (FileOpenPrefetch *) ctx;
+    guint64 tail_size, head_size;
+    gchar *range_hdr;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    // file is released before the request is sent
+    if (!pdata->fop) {
+        http_connection_release (con);
+        fileio_open_prefetch_destroy (pdata);
+        return;
+    }
+
+    tail_size = conf_get_uint (application_get_conf (pdata->app), "s3.open_prefetch_tail_size");
+    head_size = conf_get_uint (application_get_conf (pdata->app), "s3.open_prefetch_head_size");
+
+    // suffix range, the response contains the object size
+    if (tail_size)
+        range_hdr = g_strdup_printf ("bytes=-%"G_GUINT64_FORMAT, tail_size);
+    else
+        range_hdr = g_strdup_printf ("bytes=0-%"G_GUINT64_FORMAT, head_size - 1);
+    http_connection_add_output_header (con, "Range", range_hdr);
+    g_free (range_hdr);
+
+    res = http_connection_make_request (con,
+        pdata->fname, "GET", NULL, FALSE, NULL,
+        fileio_open_prefetch_on_get_cb,
+        pdata
+    );
+
+    // fileio_open_prefetch_on_get_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// prefetch tail (and head) of the file, which columnar formats read first
+// if the file size is unknown, the tail request gets size and ETag as well
+void fileio_open_prefetch (FileIO *fop)
+{
+    FileOpenPrefetch *pdata;
+
+    if (!conf_get_uint (application_get_conf (fop->app), "s3.open_prefetch_tail_size") &&
+        !conf_get_uint (application_get_conf (fop->app), "s3.open_prefetch_head_size"))
+        return;
+
+    if (fop->head_req_sent) {
+        fileio_open_prefetch_ranges (fop);
+        return;
+    }
+
+    if (fop->head_req_pending)
+        return;
+
+    pdata = g_new0 (FileOpenPrefetch, 1);
+    pdata->app = fop->app;
+    pdata->fop = fop;
+    pdata->fname = g_strdup (fop->fname);
+    pdata->ino = fop->ino;
+
+    // reads wait for the prefetch request
+    fop->open_prefetch = pdata;
+    fop->head_req_pending = TRUE;
+
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app), fileio_open_prefetch_on_con_cb, pdata)) {
+        LOG_debug (FIO_LOG, INO_H"Failed to get HTTP client for open prefetch", INO_T (fop->ino));
+        fop->open_prefetch = NULL;
+        fop->head_req_pending = FALSE;
+        fileio_open_prefetch_destroy (pdata);
+        return;
+    }
+}
+
+// size of the file, as it's written by the client
+guint64 fileio_get_current_size (FileIO *fop)
+{
+    return fop->current_size;
+}
+
+// file size and ETag are known (from directory listing), no need to request them from the server
+void fileio_set_object_info (FileIO *fop, guint64 file_size, const gchar *etag)
+{
+    gchar *aws_etag;
+
+    // S3 returns quoted ETag in headers
+    aws_etag = g_strdup_printf ("\"%s\"", etag);
+    fileio_update_cache_etag (fop, aws_etag);
+    g_free (aws_etag);
+
+    fop->file_size = file_size;
+    fop->head_req_sent = TRUE;
+
+    LOG_debug (FIO_LOG, INO_H"Using file size %"G_GUINT64_FORMAT" and ETag from DirTree", INO_T (fop->ino), file_size);
+}
+
+// if it's the first fuse read() request - get the file size and ETag with the first block of data
+// else try to get data from local cache, otherwise download from the server
+static void fileio_read_start (FileReadData *rdata);
+
+static void fileio_read_on_mem_reserved_cb (gpointer ctx)
+{
+    fileio_read_start ((FileReadData *) ctx);
+}
+
+void fileio_read_buffer (FileIO *fop,
+    size_t size, off_t off, fuse_ino_t ino,
+    FileIO_on_buffer_read_cb on_buffer_read_cb, FileIO_on_buffer_fd_read_cb on_buffer_fd_read_cb, gpointer ctx)
+{
+    FileReadData *rdata;
+
+    rdata = g_new0 (FileReadData, 1);
+    rdata->fop = fop;
+    rdata->app = fop->app;
+    rdata->size = size;
+    rdata->off = off;
+    rdata->ino = ino;
+    rdata->on_buffer_read_cb = on_buffer_read_cb;
+    rdata->on_buffer_fd_read_cb = on_buffer_fd_read_cb;
+    rdata->ctx = ctx;
+    rdata->request_offset = off;
+    rdata->aws_etag = NULL;
+    rdata->mem_size = size;
+
+    fileio_read_classify (fop, size, off);
+    fileio_read_ahead_update (fop, size, off);
+
+    // reply is deferred until the memory budget has room for it
+    if (!mem_budget_reserve (application_get_mem_budget (fop->app), rdata->mem_size, fileio_read_on_mem_reserved_cb, rdata)) {
+        LOG_debug (FIO_LOG, INO_H"Memory budget is exhausted, read is deferred [%"OFF_FMT": %zu]", INO_T (ino), off, size);
+        return;
+    }
+
+    fileio_read_start (rdata);
+}
+
+// start the read, memory budget is reserved
+static void fileio_read_start (FileReadData *rdata)
+{
+    FileIO *fop = rdata->fop;
+
+    // file size is being requested by another read, wait for it
+    if (!fop->head_req_sent && fop->head_req_pending) {
+        LOG_debug (FIO_LOG, INO_H"Waiting for the file size [%"OFF_FMT": %"G_GUINT64_FORMAT"]", INO_T (rdata->ino), rdata->off, rdata->size);
+        fop->l_head_waiters = g_list_append (fop->l_head_waiters, rdata);
+
+    // file size is unknown, request the block containing the offset
+    } else if (!fop->head_req_sent) {
+        fileio_read_send_first_get (rdata);
+
+    // file size is known, try to get data from cache
+    } else {
+        if (cache_mng_get_etag (application_get_cache_mng (rdata->fop->app), rdata->ino))
+            rdata->cache_etag_is_set = TRUE;
+        else
+            rdata->cache_etag_is_set = FALSE;
+        fileio_read_ahead_submit (fop);
+        fileio_read_get_buf (rdata);
+    }
+}
+/*}}}*/
+
+/*{{{ fileio_simple_upload*/
+typedef struct {
+    gchar *fname;
+    struct evbuffer *write_buf;
+    FileIO_simple_on_upload_cb on_upload_cb;
+    gpointer ctx;
+    mode_t mode;
+} FileIOSimpleUpload;
+
+static void fileio_simple_upload_destroy (FileIOSimpleUpload *fsim)
+{
+    evbuffer_free (fsim->write_buf);
+    g_free (fsim->fname);
+    g_free (fsim);
+}
+
+static void fileio_simple_upload_on_sent_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIOSimpleUpload *fsim = (FileIOSimpleUpload *) ctx;
+
+    http_connection_release (con);
+
+    fsim->on_upload_cb (fsim->ctx, success);
+
+    fileio_simple_upload_destroy (fsim);
+}
+
+static void fileio_simple_upload_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIOSimpleUpload *fsim = (FileIOSimpleUpload *) ctx;
+    time_t t;
+    gchar str[10];
+    char time_str[50];
+    gboolean res;
+
+    LOG_debug (FIO_LOG, CON_H"Uploading data. Size: %zu", (void *)con, evbuffer_get_length (fsim->write_buf));
+
+    http_connection_acquire (con);
+
+    snprintf (str, sizeof (str), "%d", fsim->mode);
+
+    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (con->app), "s3.storage_type"));
+    http_connection_add_output_header (con, "x-amz-meta-mode", str);
+
+    t = time (NULL);
+    if (strftime (time_str, sizeof (time_str), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t))) {
+        http_connection_add_output_header (con, "x-amz-meta-date", time_str);
+    }
+
+    res = http_connection_make_request (con,
+        fsim->fname, "PUT", fsim->write_buf, TRUE, NULL,
+        fileio_simple_upload_on_sent_cb,
+        fsim
+    );
+
+    if (!res) {
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        fsim->on_upload_cb (fsim->ctx, FALSE);
+        fileio_simple_upload_destroy (fsim);
+        return;
+    }
+}
+
+void fileio_simple_upload (Application *app, const gchar *fname, const char *str, mode_t mode, FileIO_simple_on_upload_cb on_upload_cb, gpointer ctx)
+{
+    FileIOSimpleUpload *fsim;
+
+    fsim = g_new0 (FileIOSimpleUpload, 1);
+    fsim->write_buf = evbuffer_new ();
+    evbuffer_add (fsim->write_buf, str, strlen (str));
+    fsim->fname = g_strdup_printf ("/%s", fname);
+    fsim->on_upload_cb = on_upload_cb;
+    fsim->ctx = ctx;
+    fsim->mode = mode;
+
+    if (!client_pool_get_client (application_get_write_client_pool (app),
+        fileio_simple_upload_on_con_cb, fsim)) {
+        LOG_err (FIO_LOG, "Failed to get HTTP client !");
+        fsim->on_upload_cb (ctx, FALSE);
+        fileio_simple_upload_destroy (fsim);
+    }
+}
+/*}}}*/
+
+/*{{{ fileio_copy_object */
+typedef struct {
+    Application *app;
+    gchar *src_path; // x-amz-copy-source value
+    gchar *dst_path; // escaped object path
+    guint64 size;
+    guint64 part_size;
+    FileIO_on_copied_cb on_copied_cb;
+    gpointer ctx;
+
+    // multipart copy
+    gchar *src_etag; // parts are copied only if the source isn't changed
+    GList *l_headers; // Content-Type and metadata of the source object, FileIOCopyHeader
+    gchar *uploadid;
+    guint parts_nr;
+    gchar **part_etags; // index is part number - 1
+    guint next_part; // index of the next part to copy
+    guint parts_in_flight;
+    guint parts_done;
+    gboolean failed;
+    gboolean pumping; // fileio_copy_pump () is running
+    gboolean pump_again; // a part was finished while fileio_copy_pump () was running
+} FileIOCopy;
+
+typedef struct {
+    gchar *key;
+    gchar *value;
+} FileIOCopyHeader;
+
+typedef struct {
+    FileIOCopy *cop;
+    guint part;
+} FileIOCopyPart;
+
+static void fileio_copy_destroy (FileIOCopy *cop)
+{
+    GList *l;
+    guint i;
+
+    for (l = g_list_first (cop->l_headers); l; l = g_list_next (l)) {
+        FileIOCopyHeader *hdr = (FileIOCopyHeader *) l->data;
+        g_free (hdr->key);
+        g_free (hdr->value);
+        g_free (hdr);
+    }
+    g_list_free (cop->l_headers);
+    for (i = 0; cop->part_etags && i < cop->parts_nr; i++)
+        g_free (cop->part_etags[i]);
+    g_free (cop->part_etags);
+    g_free (cop->uploadid);
+    g_free (cop->src_etag);
+    g_free (cop->src_path);
+    g_free (cop->dst_path);
+    g_free (cop);
+}
+
+// the copy is finished, etag is the unquoted ETag of the new object
+static void fileio_copy_done (FileIOCopy *cop, gboolean success, const gchar *etag)
+{
+    cop->on_copied_cb (cop->ctx, success, etag);
+    fileio_copy_destroy (cop);
+}
+
+// return unquoted ETag from CopyObjectResult, CopyPartResult or CompleteMultipartUploadResult, NULL on error
+static gchar *fileio_copy_get_etag (const gchar *buf, size_t buf_len)
+{
+    gchar *etag;
+    gchar *out;
+
+    etag = buf_len ? get_xml_value (buf, buf_len, "//s3:ETag") : NULL;
+    if (!etag)
+        return NULL;
+
+    out = g_strdup (etag);
+    xmlFree (etag);
+
+    return str_remove_quotes (out);
+}
+
+/*{{{ single request */
+static void fileio_copy_on_copied_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gchar *etag = NULL;
+
+    http_connection_release (con);
+
+    // a 200 OK response can contain either a success or an error
+    if (success)
+        etag = fileio_copy_get_etag (buf, buf_len);
+
+    if (!etag) {
+        LOG_err (FIO_LOG, CON_H"Failed to copy object %s !", (void *)con, cop->src_path);
+        fileio_copy_done (cop, FALSE, NULL);
+        return;
+    }
+
+    fileio_copy_done (cop, TRUE, etag);
+    g_free (etag);
+}
+
+static void fileio_copy_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    http_connection_add_output_header (con, "x-amz-copy-source", cop->src_path);
+    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (cop->app), "s3.storage_type"));
+
+    LOG_debug (FIO_LOG, CON_H"Copying %s to %s", (void *)con, cop->src_path, cop->dst_path);
+
+    res = http_connection_make_request (con,
+        cop->dst_path, "PUT", NULL, TRUE, NULL,
+        fileio_copy_on_copied_cb,
+        cop
+    );
+
+    // fileio_copy_on_copied_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+/*}}}*/
+
+/*{{{ multipart copy */
+static void fileio_copy_pump (FileIOCopy *cop);
+
+static void fileio_copy_fail (FileIOCopy *cop)
+{
+    LOG_err (FIO_LOG, "Failed to copy object %s !", cop->src_path);
+
+    if (cop->uploadid)
+        fileio_abort_multipart (cop->app, cop->dst_path, cop->uploadid);
+
+    fileio_copy_done (cop, FALSE, NULL);
+}
+
+static void fileio_copy_on_complete_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gchar *etag = NULL;
+
+    http_connection_release (con);
+
+    if (success)
+        etag = fileio_copy_get_etag (buf, buf_len);
+
+    if (!etag) {
+        fileio_copy_fail (cop);
+        return;
+    }
+
+    LOG_debug (FIO_LOG, CON_H"Object %s is copied by %u parts", (void *)con, cop->dst_path, cop->parts_nr);
+
+    fileio_copy_done (cop, TRUE, etag);
+    g_free (etag);
+}
+
+static void fileio_copy_on_complete_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    struct evbuffer *xml_buf;
+    gchar *path;
+    gboolean res;
+    guint i;
+
+    xml_buf = evbuffer_new ();
+    evbuffer_add_printf (xml_buf, "%s", "<CompleteMultipartUpload>");
+    for (i = 0; i < cop->parts_nr; i++)
+        evbuffer_add_printf (xml_buf, "<Part><PartNumber>%u</PartNumber><ETag>\"%s\"</ETag></Part>",
+            i + 1, cop->part_etags[i]);
+    evbuffer_add_printf (xml_buf, "%s", "</CompleteMultipartUpload>");
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploadId=%s", cop->dst_path, cop->uploadid);
+    res = http_connection_make_request (con,
+        path, "POST", xml_buf, TRUE, NULL,
+        fileio_copy_on_complete_cb,
+        cop
+    );
+    g_free (path);
+    evbuffer_free (xml_buf);
+
+    // fileio_copy_on_complete_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+static void fileio_copy_on_part_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIOCopyPart *pdata = (FileIOCopyPart *) ctx;
+    FileIOCopy *cop = pdata->cop;
+    gchar *etag = NULL;
+
+    http_connection_release (con);
+
+    cop->parts_in_flight--;
+
+    if (success)
+        etag = fileio_copy_get_etag (buf, buf_len);
+
+    if (!etag) {
+        LOG_err (FIO_LOG, CON_H"Failed to copy part %u of %s !", (void *)con, pdata->part + 1, cop->src_path);
+        cop->failed = TRUE;
+    } else {
+        cop->part_etags[pdata->part] = etag;
+        cop->parts_done++;
+    }
+
+    g_free (pdata);
+
+    fileio_copy_pump (cop);
+}
+
+static void fileio_copy_on_part_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIOCopyPart *pdata = (FileIOCopyPart *) ctx;
+    FileIOCopy *cop = pdata->cop;
+    guint64 off;
+    gchar *hdr;
+    gchar *path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    off = pdata->part * cop->part_size;
+
+    http_connection_add_output_header (con, "x-amz-copy-source", cop->src_path);
+    hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
+        off, MIN (off + cop->part_size, cop->size) - 1);
+    http_connection_add_output_header (con, "x-amz-copy-source-range", hdr);
+    g_free (hdr);
+    if (cop->src_etag)
+        http_connection_add_output_header (con, "x-amz-copy-source-if-match", cop->src_etag);
+
+    path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s", cop->dst_path, pdata->part + 1, cop->uploadid);
+    res = http_connection_make_request (con,
+        path, "PUT", NULL, TRUE, NULL,
+        fileio_copy_on_part_cb,
+        pdata
+    );
+    g_free (path);
+
+    // fileio_copy_on_part_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
 }
 
-// got HttpConnection object
-static void fileio_read_on_con_cb (gpointer client, gpointer ctx)
+// copy parts in parallel, up to "s3.copy_max_parts_in_flight" at once
+static void fileio_copy_pump (FileIOCopy *cop)
 {
-    HttpConnection *con = (HttpConnection *) client;
-    FileReadData *rdata = (FileReadData *) ctx;
-    gboolean res;
-    guint64 part_size;
+    guint max_parts = MAX (conf_get_uint (application_get_conf (cop->app), "s3.copy_max_parts_in_flight"), 1);
 
-    http_connection_acquire (con);
+    // request callbacks might be called before client_pool_get_client () returns
+    if (cop->pumping) {
+        cop->pump_again = TRUE;
+        return;
+    }
+    cop->pumping = TRUE;
 
-    part_size = conf_get_uint (application_get_conf (rdata->fop->app), "s3.part_size");
+    do {
+        cop->pump_again = FALSE;
 
-    // small file - get the whole file at once
-    if (rdata->fop->file_size < part_size)
-        rdata->request_offset = 0;
+        while (!cop->failed && cop->next_part < cop->parts_nr && cop->parts_in_flight < max_parts) {
+            FileIOCopyPart *pdata;
 
-    // calculate offset
-    else {
-        gchar *range_hdr;
+            pdata = g_new0 (FileIOCopyPart, 1);
+            pdata->cop = cop;
+            pdata->part = cop->next_part++;
+            cop->parts_in_flight++;
 
-        if (part_size < rdata->size)
-            part_size = rdata->size;
+            if (!client_pool_get_client (application_get_ops_client_pool (cop->app), fileio_copy_on_part_con_cb, pdata)) {
+                LOG_err (FIO_LOG, "Failed to get HTTP client !");
+                cop->parts_in_flight--;
+                cop->failed = TRUE;
+                g_free (pdata);
+            }
+        }
+    } while (cop->pump_again);
 
-        rdata->request_offset = rdata->off;
-        range_hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT,
-            (gint64)rdata->request_offset, (gint64)(rdata->request_offset + part_size));
-        http_connection_add_output_header (con, "Range", range_hdr);
-        g_free (range_hdr);
-    }
+    cop->pumping = FALSE;
 
-    res = http_connection_make_request (con,
-        rdata->fop->fname, "GET", NULL, TRUE, NULL,
-        fileio_read_on_get_cb,
-        rdata
-    );
-    if (!res) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (rdata->ino), (void *)con);
-        http_connection_release (con);
-        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-        fileread_destroy (rdata);
+    // wait for the parts in progress
+    if (cop->parts_in_flight)
+        return;
+
+    if (cop->failed) {
+        fileio_copy_fail (cop);
         return;
     }
+
+    if (cop->parts_done == cop->parts_nr &&
+        !client_pool_get_client (application_get_ops_client_pool (cop->app), fileio_copy_on_complete_con_cb, cop)) {
+        LOG_err (FIO_LOG, "Failed to get HTTP client !");
+        fileio_copy_fail (cop);
+    }
 }
 
-static void fileio_read_on_cache_cb (unsigned char *buf, size_t size, gboolean success, void *ctx)
+static void fileio_copy_on_init_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
 {
-    FileReadData *rdata = (FileReadData *) ctx;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gchar *uploadid;
 
-    if (success) {
-        // read directly from cache
-        LOG_debug (FIO_LOG, INO_H"Reading from cache", INO_T (rdata->ino));
-        rdata->on_buffer_read_cb (rdata->ctx, TRUE, (char *)buf, size);
-        fileread_destroy (rdata);
-    } else {
-        // try reading from server, using fileio_read_on_con_cb() callback
-        LOG_debug (FIO_LOG, INO_H"Reading from server !", INO_T (rdata->ino));
-        if (client_pool_get_client (application_get_read_client_pool (rdata->fop->app), fileio_read_on_con_cb, rdata)) {
-            // fileio_read_on_con_cb() callback will resume handling this request
-        } else {
-            // couldn't get HTTP client to try accessing server; fail directly
-            LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (rdata->ino));
-            rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-            fileread_destroy (rdata);
-            return;
-        }
+    http_connection_release (con);
+
+    uploadid = success && buf_len ? get_xml_value (buf, buf_len, "//s3:UploadId") : NULL;
+    if (!uploadid) {
+        LOG_err (FIO_LOG, CON_H"Failed to get multipart init data from the server !", (void *)con);
+        fileio_copy_fail (cop);
+        return;
     }
+    cop->uploadid = g_strdup (uploadid);
+    xmlFree (uploadid);
+
+    fileio_copy_pump (cop);
 }
 
-static void fileio_read_get_buf (FileReadData *rdata)
+static void fileio_copy_on_init_con_cb (gpointer client, gpointer ctx)
 {
-    if ((guint64)rdata->off >= rdata->fop->file_size) {
-        // requested range is outsize the file size
-        LOG_debug (FIO_LOG, INO_H"requested size is beyond the file size!", INO_T (rdata->ino));
-        fileio_read_on_cache_cb (NULL, 0, TRUE, rdata);
-        return;
-    }
+    HttpConnection *con = (HttpConnection *) client;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gchar *path;
+    gboolean res;
+    GList *l;
 
-    // set new request size:
-    // 1. file must have some size
-    // 2. offset must be less than the file size
-    // 3. offset + size is greater than the file size
-    if (rdata->fop->file_size > 0 &&
-        rdata->off >= 0 &&
-        rdata->fop->file_size > (guint64)rdata->off &&
-        (guint64) (rdata->off + rdata->size) > rdata->fop->file_size)
-    {
-        rdata->size = rdata->fop->file_size - rdata->off;
-    // special case, when zero-size file is requested
-    } else if (rdata->fop->file_size == 0) {
-        rdata->size = 0;
-    } else {
-        // request size and offset are ok
+    http_connection_acquire (con);
+
+    // unlike CopyObject, multipart upload doesn't keep metadata of the source object
+    for (l = g_list_first (cop->l_headers); l; l = g_list_next (l)) {
+        FileIOCopyHeader *hdr = (FileIOCopyHeader *) l->data;
+        http_connection_add_output_header (con, hdr->key, hdr->value);
     }
+    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (cop->app), "s3.storage_type"));
 
-    LOG_debug (FIO_LOG, INO_H"requesting [%"OFF_FMT": %"G_GUINT64_FORMAT"], file size: %"G_GUINT64_FORMAT,
-        INO_T (rdata->ino), rdata->off, rdata->size, rdata->fop->file_size);
+    path = g_strdup_printf ("%s?uploads", cop->dst_path);
+    res = http_connection_make_request (con,
+        path, "POST", NULL, TRUE, NULL,
+        fileio_copy_on_init_cb,
+        cop
+    );
+    g_free (path);
 
-    cache_mng_retrieve_file_buf (application_get_cache_mng (rdata->fop->app),
-        rdata->ino, rdata->size, rdata->off,
-        fileio_read_on_cache_cb, rdata);
+    // fileio_copy_on_init_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
 }
-/*}}}*/
-
-/*{{{ HEAD request*/
 
-static void fileio_read_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
+// ETag and metadata of the source object are received
+static void fileio_copy_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
     G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
     struct evkeyvalq *headers)
 {
-    FileReadData *rdata = (FileReadData *) ctx;
-    const char *content_len_header;
-    DirTree *dtree;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    struct evkeyval *header;
+    const gchar *etag;
 
-    // release HttpConnection
     http_connection_release (con);
 
     if (!success) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to get HEAD from server !", INO_T (rdata->ino), (void *)con);
-        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-        fileread_destroy (rdata);
+        LOG_err (FIO_LOG, CON_H"Failed to get attributes of %s !", (void *)con, cop->src_path);
+        fileio_copy_fail (cop);
         return;
     }
 
-    rdata->fop->head_req_sent = TRUE;
-
-    // update DirTree
-    dtree = application_get_dir_tree (rdata->fop->app);
-    dir_tree_set_entry_exist (dtree, rdata->ino);
-
-    // Set file size from header Content-Length
-    content_len_header = http_find_header (headers, "Content-Length");
-    if (content_len_header) {
-        gint64 size = 0;
-
-        size = strtoll ((char *)content_len_header, NULL, 10);
-        if (size < 0) {
-            LOG_err (FIO_LOG, INO_CON_H"Header contains incorrect file size!", INO_T (rdata->ino), (void *)con);
-            size = 0;
+    etag = http_find_header (headers, "ETag");
+    if (etag)
+        cop->src_etag = g_strdup (etag);
+
+    TAILQ_FOREACH (header, headers, next) {
+        if (!g_ascii_strcasecmp (header->key, "Content-Type") ||
+            !g_ascii_strncasecmp (header->key, "x-amz-meta-", strlen ("x-amz-meta-"))) {
+            FileIOCopyHeader *hdr = g_new0 (FileIOCopyHeader, 1);
+            hdr->key = g_strdup (header->key);
+            hdr->value = g_strdup (header->value);
+            cop->l_headers = g_list_append (cop->l_headers, hdr);
         }
-
-        rdata->fop->file_size = size;
-        LOG_debug (FIO_LOG, INO_H"Remote file size: %"G_GUINT64_FORMAT, INO_T (rdata->ino), rdata->fop->file_size);
     }
 
-    // Check that the etag we're caching matches the AWS ETag
-    if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata))
-        return;
-
-    // resume downloading file
-    fileio_read_get_buf (rdata);
+    if (!client_pool_get_client (application_get_ops_client_pool (cop->app), fileio_copy_on_init_con_cb, cop)) {
+        LOG_err (FIO_LOG, "Failed to get HTTP client !");
+        fileio_copy_fail (cop);
+    }
 }
 
-// got HttpConnection object
-static void fileio_read_on_head_con_cb (gpointer client, gpointer ctx)
+static void fileio_copy_on_head_con_cb (gpointer client, gpointer ctx)
 {
     HttpConnection *con = (HttpConnection *) client;
-    FileReadData *rdata = (FileReadData *) ctx;
+    FileIOCopy *cop = (FileIOCopy *) ctx;
+    gchar *path;
     gboolean res;
 
     http_connection_acquire (con);
 
+    // x-amz-copy-source is "bucket/path"
+    path = g_strdup (cop->src_path + strlen (conf_get_string (application_get_conf (cop->app), "s3.bucket_name")));
     res = http_connection_make_request (con,
-        rdata->fop->fname, "HEAD", NULL, FALSE, NULL,
-        fileio_read_on_head_cb,
-        rdata
+        path, "HEAD", NULL, TRUE, NULL,
+        fileio_copy_on_head_cb,
+        cop
     );
+    g_free (path);
 
-    if (!res) {
-        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (rdata->ino), (void *)con);
-        http_connection_release (con);
-        rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-        fileread_destroy (rdata);
-        return;
-    }
+    // fileio_copy_on_head_cb () is already called with failure status
+    if (!res)
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
 }
 /*}}}*/
 
-// if it's the first fuse read() request - send HEAD request to server
-// else try to get data from local cache, otherwise download from the server
-void fileio_read_buffer (FileIO *fop,
-    size_t size, off_t off, fuse_ino_t ino,
-    FileIO_on_buffer_read_cb on_buffer_read_cb, gpointer ctx)
+void fileio_copy_object (Application *app, const gchar *src_fname, const gchar *dst_fname, guint64 size,
+    FileIO_on_copied_cb on_copied_cb, gpointer ctx)
 {
-    FileReadData *rdata;
-
-    rdata = g_new0 (FileReadData, 1);
-    rdata->fop = fop;
-    rdata->size = size;
-    rdata->off = off;
-    rdata->ino = ino;
-    rdata->on_buffer_read_cb = on_buffer_read_cb;
-    rdata->ctx = ctx;
-    rdata->request_offset = off;
-    rdata->aws_etag = NULL;
-
-    // send HEAD request first
-    if (!rdata->fop->head_req_sent) {
-        rdata->cache_etag_is_set = FALSE;
-         // get HTTP connection to download manifest or a full file
-        if (!client_pool_get_client (application_get_read_client_pool (rdata->fop->app), fileio_read_on_head_con_cb, rdata)) {
-            LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (rdata->ino));
-            rdata->on_buffer_read_cb (rdata->ctx, FALSE, NULL, 0);
-            fileread_destroy (rdata);
-        }
+    FileIOCopy *cop;
+    gchar *path;
+    ClientPool_on_client_ready on_con_cb;
 
-    // HEAD is sent, try to get data from cache
+    cop = g_new0 (FileIOCopy, 1);
+    cop->app = app;
+    path = fileio_get_object_path (app, src_fname);
+    cop->src_path = g_strdup_printf ("%s%s", conf_get_string (application_get_conf (app), "s3.bucket_name"), path);
+    g_free (path);
+    cop->dst_path = fileio_get_object_path (app, dst_fname);
+    cop->size = size;
+    cop->on_copied_cb = on_copied_cb;
+    cop->ctx = ctx;
+
+    // objects up to 5 GB can be copied by a single request, but large objects are copied faster by parts
+    cop->part_size = MAX (conf_get_uint (application_get_conf (app), "s3.copy_part_size"), FIO_MIN_PART_SIZE);
+    cop->part_size = MIN (MAX (cop->part_size, (size + FIO_MAX_PARTS - 1) / FIO_MAX_PARTS), FIVEG);
+
+    if (size > cop->part_size) {
+        cop->parts_nr = (size + cop->part_size - 1) / cop->part_size;
+        cop->part_etags = g_new0 (gchar *, cop->parts_nr);
+        on_con_cb = fileio_copy_on_head_con_cb;
     } else {
-        if (cache_mng_get_etag (application_get_cache_mng (rdata->fop->app), rdata->ino))
-            rdata->cache_etag_is_set = TRUE;
-        else
-            rdata->cache_etag_is_set = FALSE;
-        fileio_read_get_buf (rdata);
+        on_con_cb = fileio_copy_on_con_cb;
+    }
+
+    if (!client_pool_get_client (application_get_ops_client_pool (app), on_con_cb, cop)) {
+        LOG_err (FIO_LOG, "Failed to get HTTP client !");
+        fileio_copy_done (cop, FALSE, NULL);
     }
 }
 /*}}}*/
 
-/*{{{ fileio_simple_upload*/
+/*{{{ fileio_delete_objects */
 typedef struct {
-    gchar *fname;
-    struct evbuffer *write_buf;
-    FileIO_simple_on_upload_cb on_upload_cb;
+    Application *app;
+    GList *l_fnames; // object names, as they were passed
+    FileIO_on_objects_deleted_cb on_deleted_cb;
     gpointer ctx;
-    mode_t mode;
-} FileIOSimpleUpload;
+} FileIODelete;
 
-static void fileio_simple_upload_destroy (FileIOSimpleUpload *fsim)
+static void fileio_delete_destroy (FileIODelete *fdel)
 {
-    evbuffer_free (fsim->write_buf);
-    g_free (fsim->fname);
-    g_free (fsim);
+    g_list_free_full (fdel->l_fnames, g_free);
+    g_free (fdel);
 }
 
-static void fileio_simple_upload_on_sent_cb (HttpConnection *con, void *ctx, gboolean success,
-    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+// return the list of keys (relative to "s3.bucket_prefix_path") which failed to be deleted
+static GList *fileio_delete_get_errors (Application *app, const gchar *xml, size_t xml_len, gboolean *success)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr keys_xp;
+    GList *l_failed = NULL;
+    size_t prefix_len;
+    int i;
+
+    *success = FALSE;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    if (!doc)
+        return NULL;
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+
+    // the whole request failed
+    keys_xp = xmlXPathEvalExpression ((xmlChar *) "/s3:DeleteResult", ctx);
+    if (keys_xp && keys_xp->nodesetval && keys_xp->nodesetval->nodeNr > 0)
+        *success = TRUE;
+    if (keys_xp)
+        xmlXPathFreeObject (keys_xp);
+
+    prefix_len = strlen (conf_get_string (application_get_conf (app), "s3.bucket_prefix_path"));
+    keys_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:Error/s3:Key", ctx);
+    for (i = 0; *success && keys_xp && keys_xp->nodesetval && i < keys_xp->nodesetval->nodeNr; i++) {
+        gchar *key = (gchar *) xmlNodeListGetString (doc, keys_xp->nodesetval->nodeTab[i]->xmlChildrenNode, 1);
+        if (key) {
+            l_failed = g_list_prepend (l_failed, g_strdup (strlen (key) >= prefix_len ? key + prefix_len : key));
+            xmlFree (key);
+        }
+    }
+    if (keys_xp)
+        xmlXPathFreeObject (keys_xp);
+
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    return l_failed;
+}
+
+static void fileio_delete_on_sent_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
     G_GNUC_UNUSED struct evkeyvalq *headers)
 {
-    FileIOSimpleUpload *fsim = (FileIOSimpleUpload *) ctx;
+    FileIODelete *fdel = (FileIODelete *) ctx;
+    GList *l_failed = NULL;
 
     http_connection_release (con);
 
-    fsim->on_upload_cb (fsim->ctx, success);
+    // a 200 OK response contains per-key results
+    if (success && buf_len)
+        l_failed = fileio_delete_get_errors (fdel->app, buf, buf_len, &success);
+    else
+        success = FALSE;
 
-    fileio_simple_upload_destroy (fsim);
+    if (!success)
+        LOG_err (FIO_LOG, CON_H"Failed to delete %u objects !", (void *)con, g_list_length (fdel->l_fnames));
+    else if (l_failed)
+        LOG_err (FIO_LOG, CON_H"Failed to delete %u of %u objects !", (void *)con,
+            g_list_length (l_failed), g_list_length (fdel->l_fnames));
+    else
+        LOG_debug (FIO_LOG, CON_H"%u objects are deleted", (void *)con, g_list_length (fdel->l_fnames));
+
+    fdel->on_deleted_cb (fdel->ctx, success, l_failed);
+
+    g_list_free_full (l_failed, g_free);
+    fileio_delete_destroy (fdel);
 }
 
-static void fileio_simple_upload_on_con_cb (gpointer client, gpointer ctx)
+static void fileio_delete_on_con_cb (gpointer client, gpointer ctx)
 {
     HttpConnection *con = (HttpConnection *) client;
-    FileIOSimpleUpload *fsim = (FileIOSimpleUpload *) ctx;
-    time_t t;
-    gchar str[10];
-    char time_str[50];
+    FileIODelete *fdel = (FileIODelete *) ctx;
+    struct evbuffer *xml_buf;
+    const gchar *prefix;
+    gchar *md5str = NULL;
+    gchar *md5b = NULL;
+    GList *l;
     gboolean res;
 
-    LOG_debug (FIO_LOG, CON_H"Uploading data. Size: %zu", (void *)con, evbuffer_get_length (fsim->write_buf));
-
-    http_connection_acquire (con);
+    prefix = conf_get_string (application_get_conf (fdel->app), "s3.bucket_prefix_path");
 
-    snprintf (str, sizeof (str), "%d", fsim->mode);
+    // only errors are returned in quiet mode
+    xml_buf = evbuffer_new ();
+    evbuffer_add_printf (xml_buf, "%s", "<Delete><Quiet>true</Quiet>");
+    for (l = g_list_first (fdel->l_fnames); l; l = g_list_next (l)) {
+        gchar *key = g_markup_printf_escaped ("<Object><Key>%s%s</Key></Object>", prefix, (const gchar *) l->data);
+        evbuffer_add (xml_buf, key, strlen (key));
+        g_free (key);
+    }
+    evbuffer_add_printf (xml_buf, "%s", "</Delete>");
 
-    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (con->app), "s3.storage_type"));
-    http_connection_add_output_header (con, "x-amz-meta-mode", str);
+    http_connection_acquire (con);
 
-    t = time (NULL);
-    if (strftime (time_str, sizeof (time_str), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t))) {
-        http_connection_add_output_header (con, "x-amz-meta-date", time_str);
-    }
+    // Content-MD5 is required by Multi-Object Delete
+    get_md5_sum ((const gchar *) evbuffer_pullup (xml_buf, -1), evbuffer_get_length (xml_buf), &md5str, &md5b);
+    http_connection_add_output_header (con, "Content-MD5", md5b);
+    g_free (md5str);
+    g_free (md5b);
 
     res = http_connection_make_request (con,
-        fsim->fname, "PUT", fsim->write_buf, TRUE, NULL,
-        fileio_simple_upload_on_sent_cb,
-        fsim
+        "/?delete", "POST", xml_buf, TRUE, NULL,
+        fileio_delete_on_sent_cb,
+        fdel
     );
+    evbuffer_free (xml_buf);
 
-    if (!res) {
+    // fileio_delete_on_sent_cb () is already called with failure status
+    if (!res)
         LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
-        http_connection_release (con);
-        fsim->on_upload_cb (fsim->ctx, FALSE);
-        fileio_simple_upload_destroy (fsim);
-        return;
-    }
 }
 
-void fileio_simple_upload (Application *app, const gchar *fname, const char *str, mode_t mode, FileIO_simple_on_upload_cb on_upload_cb, gpointer ctx)
+void fileio_delete_objects (Application *app, GList *l_fnames, FileIO_on_objects_deleted_cb on_deleted_cb, gpointer ctx)
 {
-    FileIOSimpleUpload *fsim;
+    FileIODelete *fdel;
+    GList *l;
 
-    fsim = g_new0 (FileIOSimpleUpload, 1);
-    fsim->write_buf = evbuffer_new ();
-    evbuffer_add (fsim->write_buf, str, strlen (str));
-    fsim->fname = g_strdup_printf ("/%s", fname);
-    fsim->on_upload_cb = on_upload_cb;
-    fsim->ctx = ctx;
-    fsim->mode = mode;
+    fdel = g_new0 (FileIODelete, 1);
+    fdel->app = app;
+    for (l = g_list_first (l_fnames); l; l = g_list_next (l))
+        fdel->l_fnames = g_list_prepend (fdel->l_fnames, g_strdup ((const gchar *) l->data));
+    fdel->l_fnames = g_list_reverse (fdel->l_fnames);
+    fdel->on_deleted_cb = on_deleted_cb;
+    fdel->ctx = ctx;
 
-    if (!client_pool_get_client (application_get_write_client_pool (app),
-        fileio_simple_upload_on_con_cb, fsim)) {
+    if (!client_pool_get_client (application_get_ops_client_pool (app), fileio_delete_on_con_cb, fdel)) {
         LOG_err (FIO_LOG, "Failed to get HTTP client !");
-        fsim->on_upload_cb (ctx, FALSE);
-        fileio_simple_upload_destroy (fsim);
+        on_deleted_cb (ctx, FALSE, NULL);
+        fileio_delete_destroy (fdel);
     }
 }
 /*}}}*/
@@ -18,6 +18,7 @@
 #include "http_connection.h"
 #include "utils.h"
 #include "stat_srv.h"
+#include "mem_budget.h"
 #include "ec2_metadata.h"
 
 /*{{{ struct*/
@@ -52,6 +53,8 @@ gpointer http_connection_create (Application *app)
 
     con->app = app;
     con->l_output_headers = NULL;
+    con->on_chunk_cb = NULL;
+    con->out_fd = -1;
     con->cur_cmd_type = CMD_IDLE;
     con->cur_url = NULL;
     con->cur_time_start = 0;
@@ -148,6 +151,8 @@ void http_connection_destroy (gpointer data)
 
     if (con->cur_url)
         g_free (con->cur_url);
+    if (con->out_fd >= 0)
+        close (con->out_fd);
     if (con->evcon)
         evhttp_connection_free (con->evcon);
     g_free (con);
@@ -181,6 +186,11 @@ gboolean http_connection_acquire (HttpConnection *con)
 gboolean http_connection_release (HttpConnection *con)
 {
     con->is_acquired = FALSE;
+    con->on_chunk_cb = NULL;
+    if (con->out_fd >= 0) {
+        close (con->out_fd);
+        con->out_fd = -1;
+    }
 
     LOG_debug (CON_LOG, CON_H"Connection object is released!", (void *)con);
 
@@ -258,7 +268,8 @@ static gchar *http_connection_get_auth_string (Application *app,
     // Element are: acl, lifecycle, location, logging, notification, partNumber, policy,
     // requestPayment, torrent, uploadId, uploads, versionId, versioning, versions and website.
     if (strlen (resource) > 2 && resource[1] == '?') {
-        if (strstr (resource, "?acl") || strstr (resource, "?versioning") || strstr (resource, "?versions"))
+        if (strstr (resource, "?acl") || strstr (resource, "?versioning") || strstr (resource, "?versions") ||
+            strstr (resource, "?delete"))
             tmp = g_strdup_printf ("/%s%s", conf_get_string (application_get_conf (app), "s3.bucket_name"), resource);
         else
             tmp = g_strdup_printf ("/%s/", conf_get_string (application_get_conf (app), "s3.bucket_name"));
@@ -364,6 +375,9 @@ typedef struct {
     gchar *http_cmd;
     struct evbuffer *out_buffer;
     size_t out_size;
+    int out_fd; // body is sent from this file, -1 if the body is in out_buffer
+    off_t out_off;
+    guint64 mem_size; // size of out_buffer, accounted by MemBudget
 
     struct timeval start_tv;
 
@@ -371,17 +385,64 @@ typedef struct {
     gboolean enable_retry;
 
     GList *l_output_headers;
+
+    // streaming mode
+    HttpConnection_on_chunk_cb on_chunk_cb;
+    struct evbuffer *in_buffer; // body of error response
+    guint64 body_received; // the number of body bytes received by the current attempt
+    guint64 body_delivered; // the number of body bytes passed to on_chunk_cb
 } RequestData;
 
 static void request_data_free (RequestData *data)
 {
     http_connection_free_headers (data->l_output_headers);
+    if (data->mem_size)
+        mem_budget_release (application_get_mem_budget (data->con->app), data->mem_size);
     evbuffer_free (data->out_buffer);
+    if (data->out_fd >= 0)
+        close (data->out_fd);
+    if (data->in_buffer)
+        evbuffer_free (data->in_buffer);
     g_free (data->resource_path);
     g_free (data->http_cmd);
     g_free (data);
 }
 
+// streaming mode: a part of the response body is received
+static void http_connection_on_chunk_cb (struct evhttp_request *req, void *ctx)
+{
+    RequestData *data = (RequestData *) ctx;
+    struct evbuffer *inbuf;
+    const char *buf;
+    size_t buf_len;
+    size_t skip = 0;
+    int code;
+
+    inbuf = evhttp_request_get_input_buffer (req);
+    buf_len = evbuffer_get_length (inbuf);
+    code = evhttp_request_get_response_code (req);
+
+    // keep the body of error response, it's parsed by http_connection_on_response_cb ()
+    if (code != 200 && code != 206) {
+        evbuffer_add_buffer (data->in_buffer, inbuf);
+        return;
+    }
+
+    data->con->total_bytes_in += buf_len;
+
+    // the request is retried, skip data which was already delivered
+    if (data->body_delivered > data->body_received)
+        skip = MIN (buf_len, data->body_delivered - data->body_received);
+    data->body_received += buf_len;
+
+    if (skip < buf_len) {
+        buf = (const char *) evbuffer_pullup (inbuf, buf_len);
+        data->on_chunk_cb (data->con, data->ctx, buf + skip, buf_len - skip, evhttp_request_get_input_headers (req));
+        data->body_delivered = data->body_received;
+    }
+    // libevent drains input buffer after this callback
+}
+
 static void http_connection_on_response_cb (struct evhttp_request *req, void *ctx)
 {
     RequestData *data = (RequestData *) ctx;
@@ -420,7 +481,7 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
         struct evkeyvalq *input_headers;
         struct evkeyval *header;
 
-        inbuf = evhttp_request_get_input_buffer (req);
+        inbuf = data->on_chunk_cb ? data->in_buffer : evhttp_request_get_input_buffer (req);
         buf_len = evbuffer_get_length (inbuf);
 
         output_headers = evhttp_request_get_output_headers (req);
@@ -455,7 +516,7 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
         range_str ? range_str : "",
         con->cur_code,
         data->out_size,
-        buf_len
+        buf_len + data->body_received
     );
 
     stats_srv_add_op_history (application_get_stat_srv (data->con->app), s_history);
@@ -526,7 +587,7 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
 
         loc = http_find_header (headers, "Location");
         if (!loc) {
-            inbuf = evhttp_request_get_input_buffer (req);
+            inbuf = data->on_chunk_cb ? data->in_buffer : evhttp_request_get_input_buffer (req);
             buf_len = evbuffer_get_length (inbuf);
             buf = (const char *) evbuffer_pullup (inbuf, buf_len);
 
@@ -572,7 +633,7 @@ static void http_connection_on_response_cb (struct evhttp_request *req, void *ct
         goto done;
     }
 
-    inbuf = evhttp_request_get_input_buffer (req);
+    inbuf = data->on_chunk_cb ? data->in_buffer : evhttp_request_get_input_buffer (req);
     buf_len = evbuffer_get_length (inbuf);
     buf = (const char *) evbuffer_pullup (inbuf, buf_len);
 
@@ -705,6 +766,27 @@ void http_connection_add_output_header (HttpConnection *con, const gchar *key, c
             (GCompareFunc) hdr_compare);
 }
 
+void http_connection_set_on_chunk_cb (HttpConnection *con, HttpConnection_on_chunk_cb on_chunk_cb)
+{
+    con->on_chunk_cb = on_chunk_cb;
+}
+
+gboolean http_connection_set_output_file (HttpConnection *con, int fd, off_t off, size_t len)
+{
+    if (con->out_fd >= 0)
+        close (con->out_fd);
+
+    con->out_fd = dup (fd);
+    if (con->out_fd < 0) {
+        LOG_err (CON_LOG, CON_H"Failed to duplicate file descriptor: %s", (void *)con, strerror (errno));
+        return FALSE;
+    }
+    con->out_off = off;
+    con->out_len = len;
+
+    return TRUE;
+}
+
 static void http_connection_free_headers (GList *l_headers)
 {
     GList *l;
@@ -811,16 +893,17 @@ gboolean http_connection_make_request (HttpConnection *con,
         data->resource_path = strdup(resource_path);
         data->http_cmd = g_strdup (http_cmd);
         data->out_buffer = evbuffer_new ();
-        if (out_buffer) {
-            gchar *tmp;
-
+        data->out_fd = con->out_fd;
+        con->out_fd = -1;
+        if (data->out_fd >= 0) {
+            data->out_off = con->out_off;
+            data->out_size = con->out_len;
+        } else if (out_buffer) {
             data->out_size = evbuffer_get_length (out_buffer);
-
-            tmp = g_new0 (gchar, data->out_size);
-            evbuffer_copyout (out_buffer, tmp, data->out_size);
-            evbuffer_add (data->out_buffer, tmp, data->out_size);
-
-            g_free (tmp);
+            // the only copy of the body, it's kept for retries
+            evbuffer_add (data->out_buffer, evbuffer_pullup (out_buffer, -1), data->out_size);
+            data->mem_size = data->out_size;
+            mem_budget_add (application_get_mem_budget (con->app), data->mem_size);
         } else
             data->out_size = 0;
 
@@ -844,9 +927,20 @@ gboolean http_connection_make_request (HttpConnection *con,
             http_connection_free_headers (con->l_output_headers);
             con->l_output_headers = NULL;
         }
+
+        data->on_chunk_cb = con->on_chunk_cb;
+        con->on_chunk_cb = NULL;
+        if (data->on_chunk_cb)
+            data->in_buffer = evbuffer_new ();
+        data->body_delivered = 0;
     } else
         data = (RequestData *) parent_request_data;
 
+    // the body of the previous attempt
+    data->body_received = 0;
+    if (data->in_buffer)
+        evbuffer_drain (data->in_buffer, evbuffer_get_length (data->in_buffer));
+
     data->response_cb = response_cb;
     data->ctx = ctx;
     data->con = con;
@@ -891,6 +985,9 @@ gboolean http_connection_make_request (HttpConnection *con,
         return FALSE;
     }
 
+    if (data->on_chunk_cb)
+        evhttp_request_set_chunked_cb (req, http_connection_on_chunk_cb);
+
     evhttp_add_header (req->output_headers, "Authorization", auth_key);
     evhttp_add_header (req->output_headers, "Host", conf_get_string (application_get_conf (con->app), "s3.host"));
     evhttp_add_header (req->output_headers, "Date", time_str);
@@ -905,12 +1002,26 @@ gboolean http_connection_make_request (HttpConnection *con,
         );
     }
 
-    if (out_buffer) {
-        con->total_bytes_out += evbuffer_get_length (out_buffer);
-        // we don't want to destruct the original buffer
-        evbuffer_add (req->output_buffer, evbuffer_pullup (out_buffer, -1), evbuffer_get_length (out_buffer));
-        // a better approach, but requires "beta" libevent version
-        // evbuffer_add_buffer_reference (req->output_buffer, out_buffer);
+    if (data->out_fd >= 0) {
+        int fd;
+
+        // libevent sends the file by sendfile () or mmap (), descriptor is closed when the body is sent
+        fd = dup (data->out_fd);
+        if (fd < 0 || evbuffer_add_file (req->output_buffer, fd, data->out_off, data->out_size) < 0) {
+            LOG_err (CON_LOG, CON_H"Failed to add file to the request body !", (void *)con);
+            if (fd >= 0)
+                close (fd);
+            evhttp_request_free (req);
+            if (data->response_cb)
+                data->response_cb (data->con, data->ctx, FALSE, NULL, 0, NULL);
+            request_data_free (data);
+            return FALSE;
+        }
+        con->total_bytes_out += data->out_size;
+    } else if (data->out_size) {
+        con->total_bytes_out += data->out_size;
+        // request body refers to the saved copy, it's freed after the response is received
+        evbuffer_add_reference (req->output_buffer, evbuffer_pullup (data->out_buffer, -1), data->out_size, NULL, NULL);
     }
 
     bucket_name = conf_get_string (application_get_conf (con->app), "s3.bucket_name");
@@ -922,9 +1033,9 @@ gboolean http_connection_make_request (HttpConnection *con,
         request_str = g_strdup_printf ("/%s%s", bucket_name, data->resource_path);
     }
 
-    LOG_msg (CON_LOG, CON_H"%s %s  bucket: %s, host: %s, out_len: %zd", (void *)con,
+    LOG_msg (CON_LOG, CON_H"%s %s  bucket: %s, host: %s, out_len: %zu", (void *)con,
         http_cmd, request_str, bucket_name, host,
-        out_buffer ? evbuffer_get_length (out_buffer) : 0);
+        data->out_size);
 
     // update stats info
     con->cur_cmd_type = cmd_type;
@@ -17,6 +17,7 @@
  */
 #include "http_connection.h"
 #include "dir_tree.h"
+#include "utils.h"
 
 typedef struct {
     Application *app;
@@ -96,6 +97,7 @@ static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t
         gchar *name = NULL;
         gchar *s_size = NULL;
         gchar *s_last_modified = NULL;
+        gchar *etag = NULL;
 
         ctx->node = content_nodes->nodeTab[i];
 
@@ -133,9 +135,20 @@ static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t
         }
         xmlXPathFreeObject (key);
 
+        // ETag is optional, don't skip the entry if it's missing
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:ETag", ctx);
+        if (key) {
+            key_nodes = key->nodesetval;
+            if (key_nodes && key_nodes->nodeNr > 0)
+                etag = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
+            xmlXPathFreeObject (key);
+        }
+
         //
         if (!strncmp (name, dir_list->dir_path, strlen (name))) {
             xmlFree (name);
+            if (etag)
+                xmlFree (etag);
             continue;
         }
 
@@ -145,6 +158,8 @@ static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t
         if (strlen (bname) == 1 && bname[0] == '/')  {
             LOG_debug (CON_DIR_LOG, "Wrong file name !");
             xmlFree (name);
+            if (etag)
+                xmlFree (etag);
             continue;
         }
 
@@ -155,9 +170,11 @@ static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t
         }
 
         dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_file, dir_list->ino,
-            bname, size, last_modified);
+            bname, size, last_modified, etag);
 
         xmlFree (name);
+        if (etag)
+            xmlFree (etag);
     }
 
     xmlXPathFreeObject (contents_xp);
@@ -210,7 +227,7 @@ static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t
         // XXX: save / restore directory mtime
         last_modified = time (NULL);
 
-        dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_dir, dir_list->ino, bname, 0, last_modified);
+        dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_dir, dir_list->ino, bname, 0, last_modified, NULL);
 
         xmlFree (name);
     }
@@ -389,3 +406,216 @@ void http_connection_get_directory_listing (HttpConnection *con, const gchar *di
 
     return;
 }
+
+/*{{{ object listing */
+typedef struct {
+    HttpConnection *con;
+    gchar *prefix; // including "s3.bucket_prefix_path"
+    guint max_keys;
+    GList *l_objects; // HttpConnectionObject, in reverse order
+    HttpConnection_object_listing_callback object_listing_callback;
+    gpointer callback_data;
+} ObjectListRequest;
+
+void http_connection_object_list_free (GList *l_objects)
+{
+    GList *l;
+
+    for (l = g_list_first (l_objects); l; l = g_list_next (l)) {
+        HttpConnectionObject *obj = (HttpConnectionObject *) l->data;
+        g_free (obj->key);
+        g_free (obj);
+    }
+    g_list_free (l_objects);
+}
+
+// parses objects XML, returns the key of the last object (marker of the next request) or NULL
+static gchar *parse_objects_xml (ObjectListRequest *obj_req, const char *xml, size_t xml_len, gboolean *success)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr contents_xp;
+    xmlNodeSetPtr content_nodes;
+    xmlXPathObjectPtr key;
+    xmlNodeSetPtr key_nodes;
+    gchar *last_key = NULL;
+    size_t bucket_prefix_len;
+    int i;
+
+    *success = FALSE;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    if (doc == NULL)
+        return NULL;
+
+    ctx = xmlXPathNewContext (doc);
+    if (!ctx) {
+        xmlFreeDoc (doc);
+        return NULL;
+    }
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+
+    contents_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:Contents", ctx);
+    if (!contents_xp || !contents_xp->nodesetval) {
+        if (contents_xp)
+            xmlXPathFreeObject (contents_xp);
+        xmlXPathFreeContext (ctx);
+        xmlFreeDoc (doc);
+        // no objects
+        *success = TRUE;
+        return NULL;
+    }
+
+    bucket_prefix_len = strlen (conf_get_string (application_get_conf (obj_req->con->app), "s3.bucket_prefix_path"));
+    content_nodes = contents_xp->nodesetval;
+
+    for (i = 0; i < content_nodes->nodeNr; i++) {
+        HttpConnectionObject *obj;
+        gchar *name = NULL;
+        gchar *s_size = NULL;
+
+        ctx->node = content_nodes->nodeTab[i];
+
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:Key", ctx);
+        if (!key)
+            continue;
+        key_nodes = key->nodesetval;
+        if (key_nodes && key_nodes->nodeNr > 0)
+            name = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
+        xmlXPathFreeObject (key);
+        if (!name)
+            continue;
+
+        obj = g_new0 (HttpConnectionObject, 1);
+        obj->key = g_strdup (strlen (name) >= bucket_prefix_len ? name + bucket_prefix_len : name);
+
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:Size", ctx);
+        if (key) {
+            key_nodes = key->nodesetval;
+            if (key_nodes && key_nodes->nodeNr > 0)
+                s_size = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
+            if (s_size) {
+                gint64 size = strtoll (s_size, NULL, 10);
+                obj->size = size > 0 ? size : 0;
+                xmlFree (s_size);
+            }
+            xmlXPathFreeObject (key);
+        }
+
+        obj_req->l_objects = g_list_prepend (obj_req->l_objects, obj);
+
+        g_free (last_key);
+        last_key = g_strdup (name);
+        xmlFree (name);
+    }
+
+    xmlXPathFreeObject (contents_xp);
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    *success = TRUE;
+    return last_key;
+}
+
+static void object_listing_done (HttpConnection *con, ObjectListRequest *obj_req, gboolean success)
+{
+    GList *l_objects = g_list_reverse (obj_req->l_objects);
+
+    http_connection_release (con);
+
+    if (!success) {
+        http_connection_object_list_free (l_objects);
+        l_objects = NULL;
+    }
+
+    obj_req->object_listing_callback (obj_req->callback_data, success, l_objects);
+
+    g_free (obj_req->prefix);
+    g_free (obj_req);
+}
+
+static gboolean object_listing_send (ObjectListRequest *obj_req, const gchar *marker);
+
+static void http_connection_on_object_listing_data (HttpConnection *con, void *ctx, gboolean success,
+        const gchar *buf, size_t buf_len, G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    ObjectListRequest *obj_req = (ObjectListRequest *) ctx;
+    gchar *last_key;
+    gboolean parsed;
+
+    if (!success || !buf_len || !buf) {
+        LOG_err (CON_DIR_LOG, CON_H"Error getting object list of %s !", (void *)con, obj_req->prefix);
+        object_listing_done (con, obj_req, FALSE);
+        return;
+    }
+
+    last_key = parse_objects_xml (obj_req, buf, buf_len, &parsed);
+    if (!parsed) {
+        LOG_err (CON_DIR_LOG, CON_H"Error parsing object list XML !", (void *)con);
+        object_listing_done (con, obj_req, FALSE);
+        return;
+    }
+
+    // without delimiter NextMarker isn't returned, the listing continues after the last key
+    if (!g_strstr_len (buf, buf_len, "<IsTruncated>true</IsTruncated>") || !last_key) {
+        LOG_debug (CON_DIR_LOG, CON_H"Object listing of %s done, objects: %u", (void *)con,
+            obj_req->prefix, g_list_length (obj_req->l_objects));
+        g_free (last_key);
+        object_listing_done (con, obj_req, TRUE);
+        return;
+    }
+
+    // http_connection_on_object_listing_data () is already called with failure status
+    if (!object_listing_send (obj_req, last_key))
+        LOG_err (CON_DIR_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+    g_free (last_key);
+}
+
+static gboolean object_listing_send (ObjectListRequest *obj_req, const gchar *marker)
+{
+    gchar *req_path;
+    gchar *prefix;
+    gchar *escaped_marker = NULL;
+    gboolean res;
+
+    prefix = url_escape (obj_req->prefix);
+    if (marker) {
+        escaped_marker = url_escape (marker);
+        req_path = g_strdup_printf ("/?marker=%s&max-keys=%u&prefix=%s", escaped_marker, obj_req->max_keys, prefix);
+    } else
+        req_path = g_strdup_printf ("/?max-keys=%u&prefix=%s", obj_req->max_keys, prefix);
+    g_free (escaped_marker);
+    g_free (prefix);
+
+    res = http_connection_make_request (obj_req->con,
+        req_path, "GET",
+        NULL, TRUE, NULL,
+        http_connection_on_object_listing_data,
+        obj_req
+    );
+    g_free (req_path);
+
+    return res;
+}
+
+void http_connection_get_object_listing (HttpConnection *con, const gchar *prefix,
+    HttpConnection_object_listing_callback object_listing_callback, gpointer callback_data)
+{
+    ObjectListRequest *obj_req;
+
+    obj_req = g_new0 (ObjectListRequest, 1);
+    obj_req->con = con;
+    obj_req->prefix = g_strdup_printf ("%s%s", conf_get_string (application_get_conf (con->app), "s3.bucket_prefix_path"), prefix);
+    obj_req->max_keys = conf_get_uint (application_get_conf (con->app), "s3.keys_per_request");
+    obj_req->object_listing_callback = object_listing_callback;
+    obj_req->callback_data = callback_data;
+
+    LOG_debug (CON_DIR_LOG, CON_H"Getting object listing for: >>%s<<", (void *)con, obj_req->prefix);
+
+    http_connection_acquire (con);
+
+    // http_connection_on_object_listing_data () is already called with failure status
+    if (!object_listing_send (obj_req, NULL))
+        LOG_err (CON_DIR_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+/*}}}*/
@@ -23,6 +23,8 @@
 #include "utils.h"
 #include "client_pool.h"
 #include "cache_mng.h"
+#include "mem_budget.h"
+#include "uploader.h"
 #include "stat_srv.h"
 #include "conf_keys.h"
 #include <unistd.h>
@@ -40,6 +42,8 @@ struct _Application {
     DirTree *dir_tree;
     CacheMng *cmng;
     StatSrv *stat_srv;
+    MemBudget *mem_budget;
+    Uploader *uploader; // NULL if write-behind is disabled
 
     // initial bucket ACL request
     HttpConnection *service_con;
@@ -124,6 +128,16 @@ StatSrv *application_get_stat_srv (Application *app)
     return app->stat_srv;
 }
 
+MemBudget *application_get_mem_budget (Application *app)
+{
+    return app->mem_budget;
+}
+
+Uploader *application_get_uploader (Application *app)
+{
+    return app->uploader;
+}
+
 #ifdef SSL_ENABLED
 SSL_CTX *application_get_ssl_ctx (Application *app)
 {
@@ -373,6 +387,16 @@ static gint application_finish_initialization_and_run (Application *app)
 {
     struct sigaction sigact;
 
+/*{{{ MemBudget */
+    // used by HTTP connections, must be created before Pools
+    app->mem_budget = mem_budget_create (app);
+    if (!app->mem_budget) {
+        LOG_err (APP_LOG, "Failed to create MemBudget !");
+        application_exit (app);
+        return -1;
+    }
+/*}}}*/
+
 /*{{{ create Pools */
     // create ClientPool for reading operations
     app->read_client_pool = client_pool_create (app, conf_get_int (app->conf, "pool.readers"),
@@ -429,6 +453,17 @@ static gint application_finish_initialization_and_run (Application *app)
     }
 /*}}}*/
 
+/*{{{ Uploader */
+    if (conf_get_boolean (app->conf, "s3.write_behind")) {
+        app->uploader = uploader_create (app);
+        if (!app->uploader) {
+            LOG_err (APP_LOG, "Failed to create Uploader !");
+            application_exit (app);
+            return -1;
+        }
+    }
+/*}}}*/
+
 /*{{{ DirTree*/
     app->dir_tree = dir_tree_create (app);
     if (!app->dir_tree) {
@@ -531,9 +566,15 @@ static void application_destroy (Application *app)
     if (app->dir_tree)
         dir_tree_destroy (app->dir_tree);
 
+    if (app->uploader)
+        uploader_destroy (app->uploader);
+
     if (app->cmng)
         cache_mng_destroy (app->cmng);
 
+    if (app->mem_budget)
+        mem_budget_destroy (app->mem_budget);
+
     if (app->sigint_ev)
         event_free (app->sigint_ev);
     if (app->sigterm_ev)
@@ -970,6 +1011,72 @@ int main (int argc, char *argv[])
     if (part_size)
         conf_set_uint (app->conf, "s3.part_size", part_size);
 
+    if (!conf_node_exists (app->conf, "s3.read_ahead_max_parts"))
+        conf_set_uint (app->conf, "s3.read_ahead_max_parts", 8);
+
+    if (!conf_node_exists (app->conf, "s3.parallel_download"))
+        conf_set_boolean (app->conf, "s3.parallel_download", FALSE);
+
+    if (!conf_node_exists (app->conf, "s3.upload_max_parts_in_flight"))
+        conf_set_uint (app->conf, "s3.upload_max_parts_in_flight", 4);
+
+    if (!conf_node_exists (app->conf, "s3.write_back"))
+        conf_set_boolean (app->conf, "s3.write_back", FALSE);
+
+    if (!conf_node_exists (app->conf, "s3.append_write_back"))
+        conf_set_boolean (app->conf, "s3.append_write_back", FALSE);
+
+    if (!conf_node_exists (app->conf, "s3.min_read_size"))
+        conf_set_uint (app->conf, "s3.min_read_size", 4096);
+
+    if (!conf_node_exists (app->conf, "s3.open_prefetch_tail_size"))
+        conf_set_uint (app->conf, "s3.open_prefetch_tail_size", 0);
+
+    if (!conf_node_exists (app->conf, "s3.open_prefetch_head_size"))
+        conf_set_uint (app->conf, "s3.open_prefetch_head_size", 0);
+
+    if (!conf_node_exists (app->conf, "s3.sibling_prefetch_files"))
+        conf_set_uint (app->conf, "s3.sibling_prefetch_files", 0);
+
+    if (!conf_node_exists (app->conf, "s3.sibling_prefetch_max_size"))
+        conf_set_uint (app->conf, "s3.sibling_prefetch_max_size", 104857600);
+
+    if (!conf_node_exists (app->conf, "filesystem.cache_block_size"))
+        conf_set_uint (app->conf, "filesystem.cache_block_size", 1048576);
+
+    if (!conf_node_exists (app->conf, "filesystem.cache_memory_max_size"))
+        conf_set_uint (app->conf, "filesystem.cache_memory_max_size", 67108864);
+
+    if (!conf_node_exists (app->conf, "filesystem.cache_io_threads"))
+        conf_set_uint (app->conf, "filesystem.cache_io_threads", 4);
+
+    if (!conf_node_exists (app->conf, "filesystem.cache_persistent"))
+        conf_set_boolean (app->conf, "filesystem.cache_persistent", FALSE);
+
+    if (!conf_node_exists (app->conf, "filesystem.memory_max_size"))
+        conf_set_uint (app->conf, "filesystem.memory_max_size", 0);
+
+    if (!conf_node_exists (app->conf, "s3.part_size_adaptive"))
+        conf_set_boolean (app->conf, "s3.part_size_adaptive", FALSE);
+
+    if (!conf_node_exists (app->conf, "s3.write_behind"))
+        conf_set_boolean (app->conf, "s3.write_behind", FALSE);
+
+    if (!conf_node_exists (app->conf, "s3.write_behind_max_uploads"))
+        conf_set_uint (app->conf, "s3.write_behind_max_uploads", 4);
+
+    if (!conf_node_exists (app->conf, "s3.copy_part_size"))
+        conf_set_uint (app->conf, "s3.copy_part_size", 104857600);
+
+    if (!conf_node_exists (app->conf, "s3.copy_max_parts_in_flight"))
+        conf_set_uint (app->conf, "s3.copy_max_parts_in_flight", 8);
+
+    if (!conf_node_exists (app->conf, "s3.copy_max_objects_in_flight"))
+        conf_set_uint (app->conf, "s3.copy_max_objects_in_flight", 8);
+
+    if (!conf_node_exists (app->conf, "s3.delete_batch_window_ms"))
+        conf_set_uint (app->conf, "s3.delete_batch_window_ms", 0);
+
     if (disable_stats)
         conf_set_boolean (app->conf, "statistics.enabled", FALSE);
 
@@ -979,6 +1086,13 @@ int main (int argc, char *argv[])
         conf_set_boolean (app->conf, "s3.force_head_requests_on_lookup", FALSE);
 
     conf_set_string (app->conf, "s3.bucket_name", s_params[0]);
+
+    // pending uploads are kept between restarts, the directory is per bucket
+    if (!conf_node_exists (app->conf, "filesystem.upload_dir")) {
+        gchar *upload_dir = g_strdup_printf ("%s/upload-%s", conf_get_string (app->conf, "filesystem.cache_dir"), s_params[0]);
+        conf_set_string (app->conf, "filesystem.upload_dir", upload_dir);
+        g_free (upload_dir);
+    }
     if (!application_set_url (app, conf_get_string (app->conf, "s3.endpoint"))) {
         LOG_err(APP_LOG, "%s: could not configure s3 bucket", argv[0]);
         application_destroy (app);
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "mem_budget.h"
+
+/*{{{ structs */
+struct _MemBudget {
+    Application *app;
+    guint64 max_size; // 0 if memory is not limited
+    guint64 used;
+    GQueue *q_waiters; // reservations waiting for memory, MemBudgetWaiter
+    struct event *ev_resume; // waiters are resumed from the event loop
+    gboolean resume_pending;
+
+    // stats
+    guint64 peak;
+    guint64 deferred_nr; // the number of reservations which had to wait
+};
+
+typedef struct {
+    guint64 size;
+    MemBudget_on_reserved_cb on_reserved_cb;
+    gpointer ctx;
+} MemBudgetWaiter;
+
+#define MB_LOG "mem"
+
+static void mem_budget_on_resume_cb (evutil_socket_t fd, short flags, void *ctx);
+/*}}}*/
+
+/*{{{ create / destroy */
+MemBudget *mem_budget_create (Application *app)
+{
+    MemBudget *mb;
+
+    mb = g_new0 (MemBudget, 1);
+    mb->app = app;
+    mb->max_size = conf_get_uint (application_get_conf (app), "filesystem.memory_max_size");
+    mb->used = 0;
+    mb->q_waiters = g_queue_new ();
+    mb->ev_resume = event_new (application_get_evbase (app), -1, 0, mem_budget_on_resume_cb, mb);
+    mb->resume_pending = FALSE;
+    mb->peak = 0;
+    mb->deferred_nr = 0;
+
+    LOG_debug (MB_LOG, "Memory budget (bytes): %"G_GUINT64_FORMAT, mb->max_size);
+
+    return mb;
+}
+
+void mem_budget_destroy (MemBudget *mb)
+{
+    MemBudgetWaiter *waiter;
+
+    while ((waiter = g_queue_pop_head (mb->q_waiters)))
+        g_free (waiter);
+    g_queue_free (mb->q_waiters);
+    event_free (mb->ev_resume);
+    g_free (mb);
+}
+/*}}}*/
+
+// the first reservation is always granted, large requests can't wait forever
+static gboolean mem_budget_fits (MemBudget *mb, guint64 size)
+{
+    return !mb->max_size || !mb->used || mb->used + size <= mb->max_size;
+}
+
+static void mem_budget_charge (MemBudget *mb, guint64 size)
+{
+    mb->used += size;
+    if (mb->used > mb->peak)
+        mb->peak = mb->used;
+}
+
+gboolean mem_budget_reserve (MemBudget *mb, guint64 size, MemBudget_on_reserved_cb on_reserved_cb, gpointer ctx)
+{
+    MemBudgetWaiter *waiter;
+
+    // waiters are served in order
+    if (g_queue_is_empty (mb->q_waiters) && mem_budget_fits (mb, size)) {
+        mem_budget_charge (mb, size);
+        return TRUE;
+    }
+
+    waiter = g_new0 (MemBudgetWaiter, 1);
+    waiter->size = size;
+    waiter->on_reserved_cb = on_reserved_cb;
+    waiter->ctx = ctx;
+    g_queue_push_tail (mb->q_waiters, waiter);
+    mb->deferred_nr++;
+
+    LOG_debug (MB_LOG, "Memory budget is exhausted (used: %"G_GUINT64_FORMAT"), waiting for %"G_GUINT64_FORMAT" bytes",
+        mb->used, size);
+
+    return FALSE;
+}
+
+void mem_budget_add (MemBudget *mb, guint64 size)
+{
+    mem_budget_charge (mb, size);
+}
+
+void mem_budget_release (MemBudget *mb, guint64 size)
+{
+    if (size > mb->used) {
+        LOG_err (MB_LOG, "Released more memory than used: %"G_GUINT64_FORMAT" > %"G_GUINT64_FORMAT, size, mb->used);
+        size = mb->used;
+    }
+    mb->used -= size;
+
+    // waiters are resumed from the event loop, not from the caller of mem_budget_release ()
+    if (!g_queue_is_empty (mb->q_waiters) && !mb->resume_pending) {
+        mb->resume_pending = TRUE;
+        event_active (mb->ev_resume, 0, 0);
+    }
+}
+
+static void mem_budget_on_resume_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    MemBudget *mb = (MemBudget *) ctx;
+    MemBudgetWaiter *waiter;
+
+    mb->resume_pending = FALSE;
+
+    while ((waiter = g_queue_peek_head (mb->q_waiters)) && mem_budget_fits (mb, waiter->size)) {
+        g_queue_pop_head (mb->q_waiters);
+        mem_budget_charge (mb, waiter->size);
+        waiter->on_reserved_cb (waiter->ctx);
+        g_free (waiter);
+    }
+}
+
+void mem_budget_get_stats (MemBudget *mb, guint64 *used, guint64 *max_size, guint64 *peak,
+    guint32 *waiting_nr, guint64 *deferred_nr)
+{
+    *used = mb->used;
+    *max_size = mb->max_size;
+    *peak = mb->peak;
+    *waiting_nr = g_queue_get_length (mb->q_waiters);
+    *deferred_nr = mb->deferred_nr;
+}
@@ -119,6 +119,41 @@ void range_add (Range *range, guint64 start, guint64 end)
     }
 }
 
+void range_remove (Range *range, guint64 start, guint64 end)
+{
+    GList *l, *l_next;
+
+    for (l = g_list_first (range->l_intervals); l; l = l_next) {
+        Interval *in = (Interval *) l->data;
+
+        l_next = g_list_next (l);
+
+        if (in->end <= start || in->start >= end)
+            continue;
+
+        // split the interval
+        if (in->start < start && in->end > end) {
+            Interval *in1 = g_new0 (Interval, 1);
+
+            in1->start = end;
+            in1->end = in->end;
+            in->end = start;
+            range->l_intervals = g_list_insert_before (range->l_intervals, l_next, in1);
+            break;
+        }
+
+        // cut it or remove it completely
+        if (in->start < start)
+            in->end = start;
+        else if (in->end > end)
+            in->start = end;
+        else {
+            range->l_intervals = g_list_delete_link (range->l_intervals, l);
+            g_free (in);
+        }
+    }
+}
+
 gboolean range_contain (Range *range, guint64 start, guint64 end)
 {
     GList *l;
@@ -133,6 +168,53 @@ gboolean range_contain (Range *range, guint64 start, guint64 end)
     return FALSE;
 }
 
+gboolean range_intersect (Range *range, guint64 start, guint64 end)
+{
+    GList *l;
+
+    for (l = g_list_first (range->l_intervals); l; l = g_list_next (l)) {
+        Interval *in = (Interval *) l->data;
+
+        if (in->start < end && in->end > start)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+void range_foreach_gap (Range *range, guint64 start, guint64 end, RangeFunc func, gpointer ctx)
+{
+    GList *l;
+    guint64 pos = start;
+
+    for (l = g_list_first (range->l_intervals); l && pos < end; l = g_list_next (l)) {
+        Interval *in = (Interval *) l->data;
+
+        if (in->end <= pos)
+            continue;
+        if (in->start >= end)
+            break;
+
+        if (in->start > pos)
+            func (pos, in->start, ctx);
+        pos = in->end;
+    }
+
+    if (pos < end)
+        func (pos, end, ctx);
+}
+
+void range_foreach (Range *range, RangeFunc func, gpointer ctx)
+{
+    GList *l;
+
+    for (l = g_list_first (range->l_intervals); l; l = g_list_next (l)) {
+        Interval *in = (Interval *) l->data;
+
+        func (in->start, in->end, ctx);
+    }
+}
+
 gint range_count (Range *range)
 {
     return g_list_length (range->l_intervals);
@@ -98,6 +98,7 @@ static void rfuse_statfs (fuse_req_t req, fuse_ino_t ino);
 static void rfuse_symlink (fuse_req_t req, const char *link, fuse_ino_t parent_ino, const char *name);
 static void rfuse_readlink (fuse_req_t req, fuse_ino_t ino);
 static void rfuse_flush (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+static void rfuse_fsync (fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi);
 
 static struct fuse_lowlevel_ops rfuse_opers = {
     .init       = rfuse_init,
@@ -124,6 +125,7 @@ static struct fuse_lowlevel_ops rfuse_opers = {
     .symlink    = rfuse_symlink,
     .readlink   = rfuse_readlink,
     .flush      = rfuse_flush,
+    .fsync      = rfuse_fsync,
 };
 /*}}}*/
 
@@ -324,10 +326,19 @@ static void rfuse_on_timer (evutil_socket_t fd, short what, void *arg)
 }
 */
 
-// turn ASYNC read off
+// set connection options: async reads and splice of cached data
 static void rfuse_init (G_GNUC_UNUSED void *userdata, struct fuse_conn_info *conn)
 {
-    conn->async_read = 0;
+    // FileIO handles several outstanding reads, let the kernel send them in parallel
+    conn->async_read = 1;
+
+#ifdef FUSE_CAP_SPLICE_WRITE
+    // send cached data to /dev/fuse with splice()
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE)
+        conn->want |= FUSE_CAP_SPLICE_MOVE;
+#endif
 }
 
 static void rfuse_dest (void *userdata)
@@ -699,8 +710,26 @@ static void rfuse_read_cb (fuse_req_t req, gboolean success, const char *buf, si
     fuse_reply_buf (req, buf, buf_size);
 }
 
+#if FUSE_VERSION >= 29
+// read callback, data is in local cache file
+// let FUSE send it directly from the file descriptor (using splice if kernel supports it)
+static void rfuse_read_fd_cb (fuse_req_t req, int fd, off_t off, size_t size)
+{
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT (size);
+
+    LOG_debug (FUSE_LOG, "[req: %p] <<<<< read_fd_cb  fd: %d IN buf: %zu", (void *)req, fd, size);
+
+    bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    bufv.buf[0].fd = fd;
+    bufv.buf[0].pos = off;
+
+    fuse_reply_data (req, &bufv, FUSE_BUF_SPLICE_MOVE);
+    close (fd);
+}
+#endif
+
 // FUSE lowlevel operation: read
-// Valid replies: fuse_reply_buf() fuse_reply_err()
+// Valid replies: fuse_reply_buf() fuse_reply_data() fuse_reply_err()
 static void rfuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
     RFuse *rfuse = fuse_req_userdata (req);
@@ -708,7 +737,11 @@ static void rfuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     LOG_debug (FUSE_LOG, INO_FI_H">>>> read  inode, size: %zu, off: %"OFF_FMT, INO_T (ino), (void *)fi, size, off);
 
     rfuse->read_ops++;
-    dir_tree_file_read (rfuse->dir_tree, ino, size, off, rfuse_read_cb, req, fi);
+#if FUSE_VERSION >= 29
+    dir_tree_file_read (rfuse->dir_tree, ino, size, off, rfuse_read_cb, rfuse_read_fd_cb, req, fi);
+#else
+    dir_tree_file_read (rfuse->dir_tree, ino, size, off, rfuse_read_cb, NULL, req, fi);
+#endif
 }
 /*}}}*/
 
@@ -1048,3 +1081,29 @@ static void rfuse_flush (fuse_req_t req, fuse_ino_t ino, G_GNUC_UNUSED struct fu
     rfuse_flush_cb (req, TRUE);
 }
 /*}}}*/
+
+/*{{{ fsync */
+// fsync callback
+static void rfuse_fsync_cb (fuse_req_t req, gboolean success)
+{
+    LOG_debug (FUSE_LOG, "[req: %p] fsync_cb  success: %s", (void *)req, success?"YES":"NO");
+
+    if (!success) {
+        fuse_reply_err (req, EIO);
+        return;
+    }
+
+    fuse_reply_err (req, 0);
+}
+
+// FUSE lowlevel operation: fsync
+// Valid replies: fuse_reply_err()
+static void rfuse_fsync (fuse_req_t req, fuse_ino_t ino, G_GNUC_UNUSED int datasync, struct fuse_file_info *fi)
+{
+    RFuse *rfuse = fuse_req_userdata (req);
+
+    LOG_debug (FUSE_LOG, INO_FI_H"fsync inode", INO_T (ino), (void *)fi);
+
+    dir_tree_file_fsync (rfuse->dir_tree, ino, fi, rfuse_fsync_cb, req);
+}
+/*}}}*/
@@ -21,6 +21,8 @@
 #include "dir_tree.h"
 #include "rfuse.h"
 #include "cache_mng.h"
+#include "mem_budget.h"
+#include "uploader.h"
 
 struct _StatSrv {
     Application *app;
@@ -125,6 +127,14 @@ static void stat_srv_on_stats_cb (struct evhttp_request *req, void *ctx)
     guint64 read_ops, write_ops, readdir_ops, lookup_ops;
     guint32 cache_entries;
     guint64 total_cache_size, cache_hits, cache_miss;
+    guint32 mem_blocks;
+    guint64 cache_mem_size, cache_mem_max, mem_hits;
+    guint32 fetch_pending;
+    guint64 fetch_shared;
+    guint64 mem_used, mem_max, mem_peak, mem_deferred;
+    guint32 mem_waiting;
+    guint64 upl_queued_size, upl_uploaded, upl_failed;
+    guint32 upl_queued, upl_in_flight;
     struct tm *cur_p;
     struct tm cur;
     time_t now;
@@ -179,8 +189,31 @@ static void stat_srv_on_stats_cb (struct evhttp_request *req, void *ctx)
     // CacheMng
     cache_mng_get_stats (application_get_cache_mng (stat_srv->app), &cache_entries, &total_cache_size, &cache_hits, &cache_miss);
     g_string_append_printf (str, "<BR>CacheMng: <BR>-Total entries: %"G_GUINT32_FORMAT", Total cache size: %"G_GUINT64_FORMAT
-        " bytes, Cache hits: %"G_GUINT64_FORMAT", Cache misses: %"G_GUINT64_FORMAT" <BR>",
+        " bytes, Disk hits: %"G_GUINT64_FORMAT", Cache misses: %"G_GUINT64_FORMAT" <BR>",
         cache_entries, total_cache_size, cache_hits, cache_miss);
+    cache_mng_get_mem_stats (application_get_cache_mng (stat_srv->app), &mem_blocks, &cache_mem_size, &cache_mem_max,
+        &mem_hits);
+    g_string_append_printf (str, "-Memory tier: Blocks: %"G_GUINT32_FORMAT", Size: %"G_GUINT64_FORMAT" bytes, Max: %"
+        G_GUINT64_FORMAT" bytes, Memory hits: %"G_GUINT64_FORMAT" <BR>",
+        mem_blocks, cache_mem_size, cache_mem_max, mem_hits);
+    cache_mng_get_fetch_stats (application_get_cache_mng (stat_srv->app), &fetch_pending, &fetch_shared);
+    g_string_append_printf (str, "-Pending downloads: %"G_GUINT32_FORMAT", Shared downloads: %"G_GUINT64_FORMAT" <BR>",
+        fetch_pending, fetch_shared);
+
+    // MemBudget
+    mem_budget_get_stats (application_get_mem_budget (stat_srv->app), &mem_used, &mem_max, &mem_peak, &mem_waiting, &mem_deferred);
+    g_string_append_printf (str, "<BR>MemBudget: <BR>-Used: %"G_GUINT64_FORMAT" bytes, Max: %"G_GUINT64_FORMAT
+        " bytes, Peak: %"G_GUINT64_FORMAT" bytes, Waiting ops: %"G_GUINT32_FORMAT", Deferred ops: %"G_GUINT64_FORMAT" <BR>",
+        mem_used, mem_max, mem_peak, mem_waiting, mem_deferred);
+
+    // Uploader
+    if (application_get_uploader (stat_srv->app)) {
+        uploader_get_stats (application_get_uploader (stat_srv->app), &upl_queued, &upl_queued_size, &upl_in_flight,
+            &upl_uploaded, &upl_failed);
+        g_string_append_printf (str, "<BR>Write-behind: <BR>-Queued: %"G_GUINT32_FORMAT" (%"G_GUINT64_FORMAT
+            " bytes), In progress: %"G_GUINT32_FORMAT", Uploaded: %"G_GUINT64_FORMAT", Failed: %"G_GUINT64_FORMAT" <BR>",
+            upl_queued, upl_queued_size, upl_in_flight, upl_uploaded, upl_failed);
+    }
 
     g_string_append_printf (str, "<BR>Read workers (%d): <BR>",
         client_pool_get_client_count (application_get_read_client_pool (stat_srv->app)));
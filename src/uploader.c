@@ -0,0 +1,767 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "uploader.h"
+#include "http_connection.h"
+#include "client_pool.h"
+#include "utils.h"
+
+/*{{{ structs */
+struct _Uploader {
+    Application *app;
+    gchar *dir; // spool directory, keeps the journal and the data of pending uploads
+    int journal_fd;
+    guint64 next_id;
+
+    GQueue *q_items; // uploads waiting for a connection, UploaderItem
+    guint in_flight; // the number of uploads in progress
+    GHashTable *h_inodes; // ino -> the number of pending uploads of the inode
+    GList *l_waiters; // UploaderWaiter
+    struct event *ev_pump; // queue is pumped from the event loop, also used to retry when pool is busy
+
+    // spool files are written by a worker thread, so the event loop doesn't wait for the copy and fsync
+    GThreadPool *copy_pool; // UploaderCopy
+    GAsyncQueue *q_copied; // UploaderCopy, finished by the worker
+    int copy_pipe[2]; // the worker wakes up the event loop
+    struct event *ev_copied;
+    guint copies_in_flight;
+
+    // stats
+    guint64 queued_size;
+    guint64 uploaded_nr;
+    guint64 failed_nr;
+};
+
+typedef struct {
+    Uploader *upl;
+    guint64 id;
+    gchar *fname;
+    fuse_ino_t ino;
+    guint64 size;
+    Uploader_on_uploaded_cb on_uploaded_cb;
+    gpointer ctx;
+} UploaderItem;
+
+// data of the new item is copied into the spool file
+typedef struct {
+    UploaderItem *item;
+    int fd; // data is read from the file, -1 if it's in buf
+    gchar *buf;
+    gboolean success;
+    int err; // errno of the failed operation
+    Uploader_on_queued_cb on_queued_cb;
+    gpointer ctx;
+} UploaderCopy;
+
+typedef struct {
+    fuse_ino_t ino;
+    gboolean failed; // one of the uploads of the inode failed
+    Uploader_on_uploaded_cb on_uploaded_cb;
+    gpointer ctx;
+} UploaderWaiter;
+
+#define UPL_LOG "upl"
+#define UPL_JOURNAL "journal"
+// data is copied into the spool file by blocks of this size
+#define UPL_COPY_BLOCK (256 * 1024)
+// retry interval if there is no free connection
+#define UPL_RETRY_SEC 1
+
+static void uploader_on_pump_cb (evutil_socket_t fd, short flags, void *ctx);
+static void uploader_replay_journal (Uploader *upl);
+static gboolean uploader_copy_start (Uploader *upl);
+static void uploader_copy_stop (Uploader *upl);
+/*}}}*/
+
+/*{{{ create / destroy */
+Uploader *uploader_create (Application *app)
+{
+    Uploader *upl;
+    gchar *path;
+
+    upl = g_new0 (Uploader, 1);
+    upl->app = app;
+    upl->dir = g_strdup (conf_get_string (application_get_conf (app), "filesystem.upload_dir"));
+    upl->journal_fd = -1;
+    upl->next_id = 1;
+    upl->q_items = g_queue_new ();
+    upl->in_flight = 0;
+    upl->h_inodes = g_hash_table_new (g_direct_hash, g_direct_equal);
+    upl->l_waiters = NULL;
+    upl->ev_pump = evtimer_new (application_get_evbase (app), uploader_on_pump_cb, upl);
+    upl->copy_pool = NULL;
+    upl->q_copied = NULL;
+    upl->copy_pipe[0] = upl->copy_pipe[1] = -1;
+    upl->ev_copied = NULL;
+    upl->copies_in_flight = 0;
+    upl->queued_size = 0;
+    upl->uploaded_nr = 0;
+    upl->failed_nr = 0;
+
+    if (g_mkdir_with_parents (upl->dir, 0700) != 0) {
+        LOG_err (UPL_LOG, "Failed to create directory: %s", upl->dir);
+        uploader_destroy (upl);
+        return NULL;
+    }
+
+    // uploads of the previous run
+    uploader_replay_journal (upl);
+
+    path = g_build_filename (upl->dir, UPL_JOURNAL, NULL);
+    upl->journal_fd = open (path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (upl->journal_fd < 0) {
+        LOG_err (UPL_LOG, "Failed to open journal: %s", path);
+        g_free (path);
+        uploader_destroy (upl);
+        return NULL;
+    }
+    g_free (path);
+
+    if (!uploader_copy_start (upl)) {
+        uploader_destroy (upl);
+        return NULL;
+    }
+
+    LOG_debug (UPL_LOG, "Write-behind directory: %s, pending uploads: %u", upl->dir, g_queue_get_length (upl->q_items));
+
+    // start uploads from the event loop
+    if (!g_queue_is_empty (upl->q_items))
+        event_active (upl->ev_pump, 0, 0);
+
+    return upl;
+}
+
+static void uploader_item_destroy (UploaderItem *item)
+{
+    g_free (item->fname);
+    g_free (item);
+}
+
+void uploader_destroy (Uploader *upl)
+{
+    UploaderItem *item;
+
+    // spool files being written are finished first
+    uploader_copy_stop (upl);
+
+    // data and journal records are kept, uploads are resumed on the next start
+    while ((item = g_queue_pop_head (upl->q_items)))
+        uploader_item_destroy (item);
+    g_queue_free (upl->q_items);
+    g_hash_table_destroy (upl->h_inodes);
+    g_list_free_full (upl->l_waiters, g_free);
+    event_free (upl->ev_pump);
+    if (upl->journal_fd >= 0)
+        close (upl->journal_fd);
+    g_free (upl->dir);
+    g_free (upl);
+}
+/*}}}*/
+
+/*{{{ journal */
+static gchar *uploader_item_path (Uploader *upl, guint64 id)
+{
+    gchar name[30];
+
+    g_snprintf (name, sizeof (name), "%"G_GUINT64_FORMAT, id);
+    return g_build_filename (upl->dir, name, NULL);
+}
+
+// append the record to the journal, records are written by a single write () call
+static gboolean uploader_journal_write (Uploader *upl, const gchar *record)
+{
+    size_t len = strlen (record);
+
+    if (write (upl->journal_fd, record, len) != (ssize_t) len) {
+        LOG_err (UPL_LOG, "Failed to write journal: %s", strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint uploader_item_cmp (const UploaderItem *a, const UploaderItem *b)
+{
+    return a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
+}
+
+static void uploader_item_queue (Uploader *upl, UploaderItem *item)
+{
+    guint pending;
+
+    pending = GPOINTER_TO_UINT (g_hash_table_lookup (upl->h_inodes, GUINT_TO_POINTER (item->ino)));
+    g_hash_table_insert (upl->h_inodes, GUINT_TO_POINTER (item->ino), GUINT_TO_POINTER (pending + 1));
+
+    upl->queued_size += item->size;
+    g_queue_push_tail (upl->q_items, item);
+}
+
+// journal contains "A <id> <size> <object path>" when the upload is queued and "D <id>" when it's done
+// pending uploads are queued again, inodes of the previous run are unknown
+static void uploader_replay_journal (Uploader *upl)
+{
+    gchar *path;
+    gchar *tmp_path;
+    gchar *contents = NULL;
+    gchar **lines;
+    gchar **line;
+    GHashTable *h_items;
+    GList *l_items, *l;
+    GString *compacted;
+    GDir *dir;
+    const gchar *name;
+
+    path = g_build_filename (upl->dir, UPL_JOURNAL, NULL);
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        g_free (path);
+        return;
+    }
+
+    h_items = g_hash_table_new (g_int64_hash, g_int64_equal);
+    lines = g_strsplit (contents, "\n", -1);
+    for (line = lines; *line; line++) {
+        guint64 id, size;
+        gchar fname[PATH_MAX];
+        UploaderItem *item;
+
+        id = 0;
+        if (sscanf (*line, "A %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %4095s", &id, &size, fname) == 3) {
+            item = g_new0 (UploaderItem, 1);
+            item->upl = upl;
+            item->id = id;
+            item->fname = g_strdup (fname);
+            item->ino = 0;
+            item->size = size;
+            g_hash_table_insert (h_items, &item->id, item);
+        } else if (sscanf (*line, "D %"G_GUINT64_FORMAT, &id) == 1) {
+            item = g_hash_table_lookup (h_items, &id);
+            if (item) {
+                g_hash_table_remove (h_items, &id);
+                uploader_item_destroy (item);
+            }
+        }
+        if (id >= upl->next_id)
+            upl->next_id = id + 1;
+    }
+    g_strfreev (lines);
+    g_free (contents);
+
+    // queue pending uploads in the original order, the journal is rewritten without finished uploads
+    compacted = g_string_new (NULL);
+    l_items = g_list_sort (g_hash_table_get_values (h_items), (GCompareFunc) uploader_item_cmp);
+    for (l = g_list_first (l_items); l; l = g_list_next (l)) {
+        UploaderItem *item = (UploaderItem *) l->data;
+        gchar *item_path;
+        struct stat st;
+
+        item_path = uploader_item_path (upl, item->id);
+        if (stat (item_path, &st) == 0 && (guint64) st.st_size == item->size) {
+            LOG_msg (UPL_LOG, "Resuming upload of %s, size: %"G_GUINT64_FORMAT, item->fname, item->size);
+            g_string_append_printf (compacted, "A %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %s\n",
+                item->id, item->size, item->fname);
+            uploader_item_queue (upl, item);
+        } else {
+            LOG_err (UPL_LOG, "Data of %s is lost, upload is dropped !", item->fname);
+            uploader_item_destroy (item);
+        }
+        g_free (item_path);
+    }
+    g_list_free (l_items);
+    g_hash_table_destroy (h_items);
+
+    tmp_path = g_strdup_printf ("%s.tmp", path);
+    if (!g_file_set_contents (tmp_path, compacted->str, compacted->len, NULL) || rename (tmp_path, path) != 0)
+        LOG_err (UPL_LOG, "Failed to rewrite journal: %s", path);
+    g_free (tmp_path);
+    g_string_free (compacted, TRUE);
+    g_free (path);
+
+    // remove spool files of finished uploads
+    dir = g_dir_open (upl->dir, 0, NULL);
+    while (dir && (name = g_dir_read_name (dir))) {
+        guint64 id;
+        gchar *end;
+        GList *l_queued;
+        gboolean found = FALSE;
+
+        id = g_ascii_strtoull (name, &end, 10);
+        if (*end != '\0' || end == name)
+            continue;
+
+        for (l_queued = g_queue_peek_head_link (upl->q_items); l_queued && !found; l_queued = g_list_next (l_queued))
+            found = ((UploaderItem *) l_queued->data)->id == id;
+
+        if (!found) {
+            gchar *item_path = uploader_item_path (upl, id);
+            unlink (item_path);
+            g_free (item_path);
+        }
+    }
+    if (dir)
+        g_dir_close (dir);
+}
+/*}}}*/
+
+/*{{{ upload */
+static void uploader_pump (Uploader *upl);
+
+// all uploads of the inode are finished, reply to fsync waiters
+static void uploader_item_done (Uploader *upl, UploaderItem *item, gboolean success)
+{
+    guint pending;
+    GList *l, *l_done = NULL;
+
+    pending = GPOINTER_TO_UINT (g_hash_table_lookup (upl->h_inodes, GUINT_TO_POINTER (item->ino)));
+    if (pending > 1)
+        g_hash_table_insert (upl->h_inodes, GUINT_TO_POINTER (item->ino), GUINT_TO_POINTER (pending - 1));
+    else
+        g_hash_table_remove (upl->h_inodes, GUINT_TO_POINTER (item->ino));
+
+    for (l = g_list_first (upl->l_waiters); l; ) {
+        UploaderWaiter *waiter = (UploaderWaiter *) l->data;
+        GList *next = g_list_next (l);
+
+        if (waiter->ino == item->ino) {
+            if (!success)
+                waiter->failed = TRUE;
+            if (pending <= 1) {
+                upl->l_waiters = g_list_remove_link (upl->l_waiters, l);
+                l_done = g_list_concat (l_done, l);
+            }
+        }
+        l = next;
+    }
+
+    if (item->on_uploaded_cb)
+        item->on_uploaded_cb (item->ctx, success);
+
+    for (l = g_list_first (l_done); l; l = g_list_next (l)) {
+        UploaderWaiter *waiter = (UploaderWaiter *) l->data;
+        waiter->on_uploaded_cb (waiter->ctx, !waiter->failed);
+        g_free (waiter);
+    }
+    g_list_free (l_done);
+
+    uploader_item_destroy (item);
+}
+
+static void uploader_on_sent_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    UploaderItem *item = (UploaderItem *) ctx;
+    Uploader *upl = item->upl;
+
+    http_connection_release (con);
+
+    upl->in_flight--;
+    upl->queued_size -= item->size;
+
+    if (success) {
+        gchar record[64];
+        gchar *path;
+
+        LOG_debug (UPL_LOG, INO_CON_H"File %s is uploaded, size: %"G_GUINT64_FORMAT,
+            INO_T (item->ino), (void *)con, item->fname, item->size);
+
+        g_snprintf (record, sizeof (record), "D %"G_GUINT64_FORMAT"\n", item->id);
+        uploader_journal_write (upl, record);
+        path = uploader_item_path (upl, item->id);
+        unlink (path);
+        g_free (path);
+
+        upl->uploaded_nr++;
+    } else {
+        // journal record and data are kept, upload is retried on the next start
+        LOG_err (UPL_LOG, INO_CON_H"Failed to upload file %s !", INO_T (item->ino), (void *)con, item->fname);
+        upl->failed_nr++;
+    }
+
+    uploader_item_done (upl, item, success);
+
+    uploader_pump (upl);
+}
+
+static void uploader_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    UploaderItem *item = (UploaderItem *) ctx;
+    Uploader *upl = item->upl;
+    gchar *path;
+    gchar *md5str = NULL;
+    gchar *md5b = NULL;
+    gchar *tmp;
+    MD5_CTX md5;
+    guint64 off = 0;
+    int fd;
+    gboolean res;
+
+    path = uploader_item_path (upl, item->id);
+    fd = open (path, O_RDONLY);
+    g_free (path);
+
+    // MD5 is calculated from the spool file, data is sent without copying it to memory
+    res = fd >= 0;
+    MD5_Init (&md5);
+    tmp = g_malloc (UPL_COPY_BLOCK);
+    while (res && off < item->size) {
+        ssize_t bytes = pread (fd, tmp, MIN (item->size - off, UPL_COPY_BLOCK), off);
+        if (bytes <= 0) {
+            res = FALSE;
+            break;
+        }
+        MD5_Update (&md5, tmp, bytes);
+        off += bytes;
+    }
+    g_free (tmp);
+    res = res && get_md5_final (&md5, &md5str, &md5b);
+    if (res && item->size)
+        res = http_connection_set_output_file (con, fd, 0, item->size);
+    if (fd >= 0)
+        close (fd);
+
+    if (!res) {
+        LOG_err (UPL_LOG, INO_CON_H"Failed to read spool file of %s !", INO_T (item->ino), (void *)con, item->fname);
+        http_connection_release (con);
+        g_free (md5str);
+        g_free (md5b);
+        upl->in_flight--;
+        upl->queued_size -= item->size;
+        upl->failed_nr++;
+        uploader_item_done (upl, item, FALSE);
+        uploader_pump (upl);
+        return;
+    }
+
+    http_connection_acquire (con);
+
+    http_connection_add_output_header (con, "Content-MD5", md5b);
+
+#ifdef MAGIC_ENABLED
+    // guess MIME type
+    {
+        gchar head[4096];
+        ssize_t head_len;
+        const gchar *mime_type = NULL;
+
+        path = uploader_item_path (upl, item->id);
+        fd = open (path, O_RDONLY);
+        g_free (path);
+        if (fd >= 0) {
+            head_len = pread (fd, head, MIN (item->size, sizeof (head)), 0);
+            if (head_len >= 0)
+                mime_type = magic_buffer (application_get_magic_ctx (upl->app), head, head_len);
+            close (fd);
+        }
+        if (mime_type)
+            http_connection_add_output_header (con, "Content-Type", mime_type);
+    }
+#endif
+
+    {
+        time_t t;
+        gchar time_str[50];
+
+        t = time (NULL);
+        if (strftime (time_str, sizeof (time_str), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t))) {
+            http_connection_add_output_header (con, "x-amz-meta-date", time_str);
+        }
+
+        http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (upl->app), "s3.storage_type"));
+    }
+
+    g_free (md5str);
+    g_free (md5b);
+
+    LOG_debug (UPL_LOG, INO_CON_H"Uploading %s, size: %"G_GUINT64_FORMAT, INO_T (item->ino), (void *)con, item->fname, item->size);
+
+    res = http_connection_make_request (con,
+        item->fname, "PUT", NULL, TRUE, NULL,
+        uploader_on_sent_cb,
+        item
+    );
+
+    // uploader_on_sent_cb () is already called with failure status
+    if (!res)
+        LOG_err (UPL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+}
+
+// start queued uploads, up to write_behind_max_uploads at once
+static void uploader_pump (Uploader *upl)
+{
+    guint max_in_flight = conf_get_uint (application_get_conf (upl->app), "s3.write_behind_max_uploads");
+    UploaderItem *item;
+
+    if (!max_in_flight)
+        max_in_flight = 1;
+
+    while (upl->in_flight < max_in_flight && (item = g_queue_pop_head (upl->q_items))) {
+        upl->in_flight++;
+        if (!client_pool_get_client (application_get_write_client_pool (upl->app), uploader_on_con_cb, item)) {
+            // pool queue is full, try again later
+            upl->in_flight--;
+            g_queue_push_head (upl->q_items, item);
+            if (!upl->in_flight) {
+                struct timeval tv = { UPL_RETRY_SEC, 0 };
+                evtimer_add (upl->ev_pump, &tv);
+            }
+            return;
+        }
+    }
+}
+
+static void uploader_on_pump_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    Uploader *upl = (Uploader *) ctx;
+
+    uploader_pump (upl);
+}
+
+// copy file data to the spool file, it outlives the cache entry
+static gboolean uploader_copy_data (int out_fd, int fd, const gchar *buf, guint64 size)
+{
+    gchar *tmp;
+    guint64 off = 0;
+
+    if (buf)
+        return write (out_fd, buf, size) == (ssize_t) size;
+
+    tmp = g_malloc (MIN (size, UPL_COPY_BLOCK));
+    while (off < size) {
+        ssize_t bytes = pread (fd, tmp, MIN (size - off, UPL_COPY_BLOCK), off);
+        if (bytes <= 0 || write (out_fd, tmp, bytes) != bytes) {
+            g_free (tmp);
+            return FALSE;
+        }
+        off += bytes;
+    }
+    g_free (tmp);
+
+    return TRUE;
+}
+
+// called by the worker thread: data is on disk before the journal record is written
+static void uploader_copy_worker (gpointer data, gpointer user_data)
+{
+    UploaderCopy *copy = (UploaderCopy *) data;
+    Uploader *upl = (Uploader *) user_data;
+    gchar *path;
+    gchar *record;
+    int out_fd;
+    char c = 0;
+
+    path = uploader_item_path (upl, copy->item->id);
+    out_fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    copy->success = out_fd >= 0 && uploader_copy_data (out_fd, copy->fd, copy->buf, copy->item->size) &&
+        fsync (out_fd) == 0;
+    if (out_fd >= 0)
+        close (out_fd);
+
+    // records are written by a single write () call, they aren't mixed with records written by the event loop
+    record = g_strdup_printf ("A %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %s\n",
+        copy->item->id, copy->item->size, copy->item->fname);
+    copy->success = copy->success && write (upl->journal_fd, record, strlen (record)) == (ssize_t) strlen (record) &&
+        fsync (upl->journal_fd) == 0;
+    g_free (record);
+
+    if (!copy->success) {
+        copy->err = errno;
+        unlink (path);
+    }
+    g_free (path);
+
+    if (copy->fd >= 0)
+        close (copy->fd);
+    copy->fd = -1;
+
+    g_async_queue_push (upl->q_copied, copy);
+    if (write (upl->copy_pipe[1], &c, 1) != 1) {
+        // the pipe is full, the event loop is woken up anyway
+    }
+}
+
+static void uploader_copy_destroy (UploaderCopy *copy)
+{
+    if (copy->fd >= 0)
+        close (copy->fd);
+    g_free (copy->buf);
+    g_free (copy);
+}
+
+// spool file is written, the item is queued for upload
+static void uploader_copy_done (Uploader *upl, UploaderCopy *copy)
+{
+    UploaderItem *item = copy->item;
+
+    if (!--upl->copies_in_flight)
+        event_del (upl->ev_copied);
+
+    if (!copy->success) {
+        LOG_err (UPL_LOG, INO_H"Failed to write spool file of %s: %s", INO_T (item->ino), item->fname, strerror (copy->err));
+        copy->on_queued_cb (copy->ctx, FALSE);
+        uploader_item_destroy (item);
+        uploader_copy_destroy (copy);
+        return;
+    }
+
+    LOG_debug (UPL_LOG, INO_H"Upload of %s is queued, size: %"G_GUINT64_FORMAT, INO_T (item->ino), item->fname, item->size);
+
+    uploader_item_queue (upl, item);
+    copy->on_queued_cb (copy->ctx, TRUE);
+    uploader_copy_destroy (copy);
+
+    uploader_pump (upl);
+}
+
+static void uploader_on_copied_cb (evutil_socket_t fd, G_GNUC_UNUSED short flags, void *ctx)
+{
+    Uploader *upl = (Uploader *) ctx;
+    UploaderCopy *copy;
+    char buf[64];
+
+    // pipe is drained first, copies which are finished after it wake up the event loop again
+    while (read (fd, buf, sizeof (buf)) > 0);
+
+    while ((copy = (UploaderCopy *) g_async_queue_try_pop (upl->q_copied)))
+        uploader_copy_done (upl, copy);
+}
+
+static gboolean uploader_copy_start (Uploader *upl)
+{
+    GError *err = NULL;
+
+#if !GLIB_CHECK_VERSION(2,32,0)
+    if (!g_thread_supported ())
+        g_thread_init (NULL);
+#endif
+
+    if (pipe (upl->copy_pipe) != 0) {
+        LOG_err (UPL_LOG, "Failed to create pipe: %s", strerror (errno));
+        upl->copy_pipe[0] = upl->copy_pipe[1] = -1;
+        return FALSE;
+    }
+    evutil_make_socket_nonblocking (upl->copy_pipe[0]);
+    evutil_make_socket_nonblocking (upl->copy_pipe[1]);
+
+    upl->q_copied = g_async_queue_new ();
+    upl->ev_copied = event_new (application_get_evbase (upl->app), upl->copy_pipe[0], EV_READ | EV_PERSIST,
+        uploader_on_copied_cb, upl);
+
+    // a single thread keeps journal records in order of item ids
+    upl->copy_pool = g_thread_pool_new (uploader_copy_worker, upl, 1, TRUE, &err);
+    if (!upl->copy_pool) {
+        LOG_err (UPL_LOG, "Failed to create thread pool: %s", err ? err->message : "");
+        if (err)
+            g_error_free (err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// wait for the worker, callers of unfinished copies are not notified,
+// items with the journal record written are uploaded on the next start
+static void uploader_copy_stop (Uploader *upl)
+{
+    UploaderCopy *copy;
+    guint i;
+
+    if (upl->copy_pool) {
+        g_thread_pool_free (upl->copy_pool, FALSE, TRUE);
+        upl->copy_pool = NULL;
+    }
+
+    if (upl->q_copied) {
+        while ((copy = (UploaderCopy *) g_async_queue_try_pop (upl->q_copied))) {
+            uploader_item_destroy (copy->item);
+            uploader_copy_destroy (copy);
+        }
+        g_async_queue_unref (upl->q_copied);
+        upl->q_copied = NULL;
+    }
+
+    if (upl->ev_copied) {
+        event_free (upl->ev_copied);
+        upl->ev_copied = NULL;
+    }
+    upl->copies_in_flight = 0;
+
+    for (i = 0; i < 2; i++) {
+        if (upl->copy_pipe[i] >= 0)
+            close (upl->copy_pipe[i]);
+        upl->copy_pipe[i] = -1;
+    }
+}
+
+void uploader_add (Uploader *upl, const gchar *fname, fuse_ino_t ino, int fd, const gchar *buf, guint64 size,
+    Uploader_on_queued_cb on_queued_cb, Uploader_on_uploaded_cb on_uploaded_cb, gpointer ctx)
+{
+    UploaderItem *item;
+    UploaderCopy *copy;
+
+    item = g_new0 (UploaderItem, 1);
+    item->upl = upl;
+    item->id = upl->next_id++;
+    item->fname = g_strdup (fname);
+    item->ino = ino;
+    item->size = size;
+    item->on_uploaded_cb = on_uploaded_cb;
+    item->ctx = ctx;
+
+    copy = g_new0 (UploaderCopy, 1);
+    copy->item = item;
+    copy->fd = fd;
+    if (fd < 0 && buf) {
+        copy->buf = g_malloc (size);
+        memcpy (copy->buf, buf, size);
+    }
+    copy->on_queued_cb = on_queued_cb;
+    copy->ctx = ctx;
+
+    if (!upl->copies_in_flight++)
+        event_add (upl->ev_copied, NULL);
+
+    g_thread_pool_push (upl->copy_pool, copy, NULL);
+}
+
+void uploader_wait (Uploader *upl, fuse_ino_t ino, Uploader_on_uploaded_cb on_uploaded_cb, gpointer ctx)
+{
+    UploaderWaiter *waiter;
+
+    if (!g_hash_table_lookup (upl->h_inodes, GUINT_TO_POINTER (ino))) {
+        on_uploaded_cb (ctx, TRUE);
+        return;
+    }
+
+    waiter = g_new0 (UploaderWaiter, 1);
+    waiter->ino = ino;
+    waiter->failed = FALSE;
+    waiter->on_uploaded_cb = on_uploaded_cb;
+    waiter->ctx = ctx;
+    upl->l_waiters = g_list_append (upl->l_waiters, waiter);
+}
+
+void uploader_get_stats (Uploader *upl, guint32 *queued_nr, guint64 *queued_size, guint32 *in_flight,
+    guint64 *uploaded_nr, guint64 *failed_nr)
+{
+    *queued_nr = g_queue_get_length (upl->q_items);
+    *queued_size = upl->queued_size;
+    *in_flight = upl->in_flight;
+    *uploaded_nr = upl->uploaded_nr;
+    *failed_nr = upl->failed_nr;
+}
+/*}}}*/
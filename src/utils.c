@@ -41,15 +41,25 @@ gchar *get_random_string (size_t len, gboolean readable)
 
 gboolean get_md5_sum (const gchar *buf, size_t len, gchar **md5str, gchar **md5b)
 {
-    unsigned char digest[16];
-    size_t i;
-    gchar *out;
+    MD5_CTX ctx;
 
     if (!md5b && !md5str)
         return TRUE;
 
-    MD5 ((const unsigned char *)buf, len, digest);
+    MD5_Init (&ctx);
+    MD5_Update (&ctx, buf, len);
+
+    return get_md5_final (&ctx, md5str, md5b);
+}
+
+// finish MD5 calculated by parts
+gboolean get_md5_final (MD5_CTX *ctx, gchar **md5str, gchar **md5b)
+{
+    unsigned char digest[16];
+    size_t i;
+    gchar *out;
 
+    MD5_Final (digest, ctx);
 
     if (md5b)
         *md5b = get_base64 ((const gchar *)digest, 16);
@@ -55,6 +55,13 @@ static void retrieve_cb (unsigned char *buf, size_t size, gboolean success, void
     }
 }
 
+static void file_fd_cb (int fd, void *ctx)
+{
+    int *out = (int *) ctx;
+
+    *out = fd;
+}
+
 static void cache_mng_test_store (CacheMng **cmng, gconstpointer test_data)
 {
     struct test_ctx test_ctx = {FALSE, NULL, 0};
@@ -106,6 +113,42 @@ static void cache_mng_test_remove (CacheMng **cmng, gconstpointer test_data)
     g_assert (cache_mng_size (*cmng) == 0);
 }
 
+static void cache_mng_test_rename (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    int i;
+    unsigned char buf[256];
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    cache_mng_store_file_buf (*cmng, 1, sizeof (buf), 0, buf, store_cb, &test_ctx);
+    cache_mng_store_file_buf (*cmng, 2, 10, 0, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    cache_mng_update_etag (*cmng, 1, "\"etag\"");
+
+    // data of the target is replaced
+    g_assert (cache_mng_rename_file (*cmng, 1, 2));
+    g_assert (!cache_mng_file_contains (*cmng, 1, 1, 0));
+    g_assert (cache_mng_file_contains (*cmng, 2, sizeof (buf), 0));
+    g_assert (cache_mng_size (*cmng) == sizeof (buf));
+    g_assert_cmpstr (cache_mng_get_etag (*cmng, 2), ==, "\"etag\"");
+
+    cache_mng_retrieve_file_buf (*cmng, 2, sizeof (buf), 0, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (memcmp (test_ctx.buf, buf, sizeof (buf)) == 0);
+    g_free (test_ctx.buf);
+
+    // staged file stays in place
+    cache_mng_stage_file (*cmng, 2);
+    g_assert (!cache_mng_rename_file (*cmng, 2, 3));
+    cache_mng_unstage_file (*cmng, 2);
+
+    g_assert (!cache_mng_rename_file (*cmng, 4, 5));
+}
+
 static void cache_mng_test_lru (CacheMng **cmng, gconstpointer test_data)
 {
     struct test_ctx test_ctx = {FALSE, NULL, 0};
@@ -154,6 +197,510 @@ static void cache_mng_test_zero_size (CacheMng **cmng, gconstpointer test_data)
     g_assert (test_ctx.buf == NULL);
 }
 
+static void cache_mng_test_contains (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    int i;
+    unsigned char buf[256];
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    g_assert (!cache_mng_file_contains (*cmng, 1, 10, 0));
+
+    cache_mng_store_file_buf (*cmng, 1, 100, 0, buf, store_cb, &test_ctx);
+    cache_mng_store_file_buf (*cmng, 1, 50, 150, buf + 150, store_cb, &test_ctx);
+    app_dispatch (app);
+
+    g_assert (test_ctx.success);
+    g_assert (cache_mng_file_contains (*cmng, 1, 100, 0));
+    g_assert (cache_mng_file_contains (*cmng, 1, 10, 160));
+    g_assert (!cache_mng_file_contains (*cmng, 1, 100, 50));
+    g_assert (!cache_mng_file_contains (*cmng, 2, 10, 0));
+
+    cache_mng_remove_file (*cmng, 1);
+    g_assert (!cache_mng_file_contains (*cmng, 1, 10, 0));
+}
+
+static void fetched_cb (gboolean success, void *ctx)
+{
+    gint *calls = (gint *) ctx;
+
+    if (success)
+        (*calls)++;
+}
+
+static void cache_mng_test_fetch (CacheMng **cmng, gconstpointer test_data)
+{
+    gint calls = 0;
+    guint32 pending;
+    guint64 shared;
+    guint64 bs = cache_mng_get_block_size (*cmng);
+
+    // the first request downloads the block, the rest are waiting for it
+    g_assert (cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, 0, 100, NULL, NULL));
+
+    // different blocks and inodes are independent
+    g_assert (cache_mng_fetch_start (*cmng, 1, bs * 2, 100, fetched_cb, &calls));
+    g_assert (cache_mng_fetch_start (*cmng, 2, 0, 100, fetched_cb, &calls));
+
+    cache_mng_get_fetch_stats (*cmng, &pending, &shared);
+    g_assert (pending == 3);
+    g_assert (shared == 2);
+
+    cache_mng_fetch_done (*cmng, 1, 0, TRUE);
+    g_assert (calls == 2);
+
+    cache_mng_get_fetch_stats (*cmng, &pending, &shared);
+    g_assert (pending == 2);
+
+    // the block can be requested again
+    g_assert (cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+
+    cache_mng_fetch_done (*cmng, 1, 0, TRUE);
+    cache_mng_fetch_done (*cmng, 1, bs * 2, TRUE);
+    cache_mng_fetch_done (*cmng, 2, 0, TRUE);
+    g_assert (calls == 2);
+}
+
+static void cache_mng_test_fetch_overlap (CacheMng **cmng, gconstpointer test_data)
+{
+    gint calls = 0;
+    guint32 pending;
+    guint64 shared;
+    guint64 bs = cache_mng_get_block_size (*cmng);
+
+    // a part-sized download covers the blocks of the reads at other offsets
+    g_assert (cache_mng_fetch_start (*cmng, 1, 0, bs * 4, NULL, NULL));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, bs * 2 + 100, 4096, fetched_cb, &calls));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, bs * 3, bs * 2, fetched_cb, &calls));
+    g_assert (cache_mng_fetch_start (*cmng, 1, bs * 4, 4096, fetched_cb, &calls));
+
+    cache_mng_get_fetch_stats (*cmng, &pending, &shared);
+    g_assert (pending == 2);
+    g_assert (shared == 2);
+
+    // the download is referred by its start only
+    cache_mng_fetch_done (*cmng, 1, bs * 2, TRUE);
+    g_assert (calls == 0);
+    cache_mng_fetch_done (*cmng, 1, 0, TRUE);
+    g_assert (calls == 2);
+
+    // all blocks are released
+    g_assert (cache_mng_fetch_start (*cmng, 1, bs * 3, 100, NULL, NULL));
+    cache_mng_fetch_done (*cmng, 1, bs * 3, TRUE);
+    cache_mng_fetch_done (*cmng, 1, bs * 4, TRUE);
+
+    cache_mng_get_fetch_stats (*cmng, &pending, &shared);
+    g_assert (pending == 0);
+}
+
+static void cache_mng_test_fetch_progress (CacheMng **cmng, gconstpointer test_data)
+{
+    gint calls = 0;
+    guint32 pending;
+    guint64 shared;
+
+    g_assert (cache_mng_fetch_start (*cmng, 1, 0, 100, NULL, NULL));
+    g_assert (!cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+
+    // waiters are called on progress, but the block is still being downloaded
+    cache_mng_fetch_progress (*cmng, 1, 0);
+    g_assert (calls == 1);
+    cache_mng_fetch_progress (*cmng, 1, 0);
+    g_assert (calls == 1);
+
+    cache_mng_get_fetch_stats (*cmng, &pending, &shared);
+    g_assert (pending == 1);
+
+    // waiter attaches again
+    g_assert (!cache_mng_fetch_start (*cmng, 1, 0, 100, fetched_cb, &calls));
+    cache_mng_fetch_done (*cmng, 1, 0, TRUE);
+    g_assert (calls == 2);
+
+    // unknown block is ignored
+    cache_mng_fetch_progress (*cmng, 1, 0);
+    g_assert (calls == 2);
+}
+
+static void cache_mng_test_fd (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    unsigned char buf[100];
+    unsigned char out[50];
+    int i;
+    int fd;
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    cache_mng_store_file_buf (*cmng, 1, 100, 0, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+
+    fd = cache_mng_get_file_fd (*cmng, 1, 50, 200);
+    g_assert (fd < 0);
+    fd = cache_mng_get_file_fd (*cmng, 2, 10, 0);
+    g_assert (fd < 0);
+
+    fd = cache_mng_get_file_fd (*cmng, 1, 50, 30);
+    g_assert (fd >= 0);
+    g_assert (pread (fd, out, 50, 30) == 50);
+    g_assert (memcmp (out, buf + 30, 50) == 0);
+    close (fd);
+}
+
+static void cache_mng_test_stage (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    unsigned char remote[100];
+    unsigned char local[20];
+    int i;
+
+    for (i = 0; i < (int) sizeof (remote); i++)
+        remote[i] = i % 256;
+    memset (local, 0xff, sizeof (local));
+
+    cache_mng_stage_file (*cmng, 1);
+
+    // the client writes into the middle of the file
+    cache_mng_write_file_buf (*cmng, 1, 20, 40, local, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (cache_mng_is_dirty (*cmng, 1, 10, 35));
+    g_assert (!cache_mng_is_dirty (*cmng, 1, 40, 0));
+    g_assert (!cache_mng_is_dirty (*cmng, 1, 40, 60));
+
+    // downloaded data doesn't overwrite written data
+    test_ctx.success = FALSE;
+    cache_mng_store_file_buf (*cmng, 1, 100, 0, remote, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (cache_mng_size (*cmng) == 100);
+
+    cache_mng_retrieve_file_buf (*cmng, 1, 100, 0, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (memcmp (test_ctx.buf, remote, 40) == 0);
+    g_assert (memcmp (test_ctx.buf + 40, local, 20) == 0);
+    g_assert (memcmp (test_ctx.buf + 60, remote + 60, 40) == 0);
+    g_free (test_ctx.buf);
+
+    cache_mng_unstage_file (*cmng, 1);
+    g_assert (!cache_mng_is_dirty (*cmng, 1, 20, 40));
+    g_assert (cache_mng_file_contains (*cmng, 1, 100, 0));
+}
+
+static void missing_block_cb (guint64 off, guint64 size, void *ctx)
+{
+    GArray *a_runs = (GArray *) ctx;
+
+    g_array_append_val (a_runs, off);
+    g_array_append_val (a_runs, size);
+}
+
+static void cache_mng_test_blocks (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    CacheMng *bcmng;
+    GArray *a_runs;
+    unsigned char buf[512];
+    int i;
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 64);
+    bcmng = cache_mng_create (app);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 0);
+    g_assert (cache_mng_get_block_size (bcmng) == 64);
+
+    cache_mng_store_file_buf (bcmng, 1, 100, 0, buf, store_cb, &test_ctx);
+    cache_mng_store_file_buf (bcmng, 1, 100, 200, buf + 200, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (cache_mng_size (bcmng) == 200);
+
+    // [64, 128) and [192, 256) are cached partially
+    a_runs = g_array_new (FALSE, FALSE, sizeof (guint64));
+    cache_mng_foreach_missing_block (bcmng, 1, 300, 0, missing_block_cb, a_runs);
+    g_assert (a_runs->len == 2);
+    g_assert (g_array_index (a_runs, guint64, 0) == 64);
+    g_assert (g_array_index (a_runs, guint64, 1) == 192);
+
+    // the part of the block which is outside the range doesn't matter
+    g_array_set_size (a_runs, 0);
+    cache_mng_foreach_missing_block (bcmng, 1, 100, 200, missing_block_cb, a_runs);
+    g_assert (a_runs->len == 0);
+
+    cache_mng_foreach_missing_block (bcmng, 2, 10, 130, missing_block_cb, a_runs);
+    g_assert (a_runs->len == 2);
+    g_assert (g_array_index (a_runs, guint64, 0) == 128);
+    g_assert (g_array_index (a_runs, guint64, 1) == 64);
+    g_array_free (a_runs, TRUE);
+
+    // filling the gap updates the accounting of the blocks it touches
+    cache_mng_store_file_buf (bcmng, 1, 100, 100, buf + 100, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (cache_mng_size (bcmng) == 300);
+    g_assert (cache_mng_file_contains (bcmng, 1, 300, 0));
+
+    cache_mng_remove_file (bcmng, 1);
+    g_assert (cache_mng_size (bcmng) == 0);
+
+    cache_mng_destroy (bcmng);
+}
+
+static void cache_mng_test_mem (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    CacheMng *mcmng;
+    unsigned char buf[256];
+    unsigned char out[256];
+    guint32 blocks_num;
+    guint64 size, max_size, mem_hits;
+    int i;
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    // memory tier holds two blocks
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 64);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_memory_max_size", 128);
+    mcmng = cache_mng_create (app);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 0);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_memory_max_size", 0);
+
+    cache_mng_store_file_buf (mcmng, 1, sizeof (buf), 0, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+
+    // blocks are copied to memory when they are read from the disk twice
+    for (i = 0; i < 2; i++) {
+        g_assert (!cache_mng_read_mem (mcmng, 1, 128, 0, out));
+        cache_mng_retrieve_file_buf (mcmng, 1, 128, 0, retrieve_cb, &test_ctx);
+        app_dispatch (app);
+        g_assert (test_ctx.success);
+        g_free (test_ctx.buf);
+    }
+    g_assert (cache_mng_read_mem (mcmng, 1, 128, 0, out));
+    g_assert (memcmp (out, buf, 128) == 0);
+    cache_mng_get_mem_stats (mcmng, &blocks_num, &size, &max_size, &mem_hits);
+    g_assert (blocks_num == 2);
+    g_assert (size == 128);
+    g_assert (mem_hits == 1);
+
+    // the block which is read less often doesn't replace them at once
+    for (i = 0; i < 2; i++) {
+        cache_mng_retrieve_file_buf (mcmng, 1, 64, 128, retrieve_cb, &test_ctx);
+        app_dispatch (app);
+        g_assert (test_ctx.success);
+        g_free (test_ctx.buf);
+    }
+    g_assert (!cache_mng_read_mem (mcmng, 1, 64, 128, out));
+
+    cache_mng_retrieve_file_buf (mcmng, 1, 64, 128, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_free (test_ctx.buf);
+    g_assert (cache_mng_read_mem (mcmng, 1, 64, 128, out));
+    g_assert (memcmp (out, buf + 128, 64) == 0);
+    g_assert (!cache_mng_read_mem (mcmng, 1, 64, 0, out));
+
+    // stored data replaces the memory copy
+    cache_mng_store_file_buf (mcmng, 1, 10, 128, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (!cache_mng_read_mem (mcmng, 1, 64, 128, out));
+
+    cache_mng_remove_file (mcmng, 1);
+    cache_mng_get_mem_stats (mcmng, &blocks_num, &size, &max_size, &mem_hits);
+    g_assert (blocks_num == 0);
+    g_assert (size == 0);
+
+    cache_mng_destroy (mcmng);
+}
+
+static void cache_mng_test_persistent (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    CacheMng *pcmng;
+    unsigned char buf[256];
+    int i;
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    conf_set_boolean (application_get_conf (app), "filesystem.cache_persistent", TRUE);
+    conf_set_string (application_get_conf (app), "s3.bucket_name", "test");
+    conf_set_uint (application_get_conf (app), "filesystem.cache_dir_max_size", 1024 * 1024);
+
+    pcmng = cache_mng_create (app);
+    g_assert (pcmng);
+    cache_mng_store_file_buf (pcmng, 1, sizeof (buf), 0, buf, store_cb, &test_ctx);
+    cache_mng_store_file_buf (pcmng, 2, 10, 0, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    cache_mng_update_etag (pcmng, 1, "\"etag\"");
+    cache_mng_attach_file (pcmng, 1, "/file", "\"etag\"");
+    cache_mng_destroy (pcmng);
+
+    // inodes of the new mount differ, the object is identified by path and ETag
+    pcmng = cache_mng_create (app);
+    g_assert (pcmng);
+    g_assert (cache_mng_size (pcmng) == sizeof (buf));
+
+    cache_mng_attach_file (pcmng, 3, "/file", "\"etag2\"");
+    g_assert (!cache_mng_file_contains (pcmng, 3, 1, 0));
+    cache_mng_attach_file (pcmng, 4, "/file", "\"etag\"");
+    g_assert (cache_mng_file_contains (pcmng, 4, sizeof (buf), 0));
+    g_assert_cmpstr (cache_mng_get_etag (pcmng, 4), ==, "\"etag\"");
+    g_assert (cache_mng_size (pcmng) == sizeof (buf));
+
+    cache_mng_retrieve_file_buf (pcmng, 4, sizeof (buf), 0, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (memcmp (test_ctx.buf, buf, sizeof (buf)) == 0);
+    g_free (test_ctx.buf);
+
+    // removed data isn't attached by the next mount
+    cache_mng_remove_file (pcmng, 4);
+    cache_mng_destroy (pcmng);
+
+    pcmng = cache_mng_create (app);
+    g_assert (cache_mng_size (pcmng) == 0);
+    cache_mng_attach_file (pcmng, 5, "/file", "\"etag\"");
+    g_assert (!cache_mng_file_contains (pcmng, 5, 1, 0));
+    cache_mng_destroy (pcmng);
+
+    conf_set_boolean (application_get_conf (app), "filesystem.cache_persistent", FALSE);
+    conf_set_string (application_get_conf (app), "filesystem.cache_dir_max_size", "1Gb");
+}
+
+static void cache_mng_test_async (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx store_ctx = {FALSE, NULL, 0};
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    CacheMng *acmng;
+    unsigned char buf[256];
+    unsigned char out[256];
+    int i;
+    int fd;
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    conf_set_uint (application_get_conf (app), "filesystem.cache_io_threads", 2);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 64);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_memory_max_size", 128);
+    acmng = cache_mng_create (app);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_io_threads", 0);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_block_size", 0);
+    conf_set_uint (application_get_conf (app), "filesystem.cache_memory_max_size", 0);
+    g_assert (cache_mng_is_async (acmng));
+
+    cache_mng_store_file_buf (acmng, 1, sizeof (buf), 0, buf, store_cb, &store_ctx);
+    app_dispatch (app);
+    g_assert (store_ctx.success);
+
+    cache_mng_retrieve_file_buf (acmng, 1, 100, 10, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (test_ctx.buflen == 100);
+    g_assert (memcmp (test_ctx.buf, buf + 10, 100) == 0);
+    g_free (test_ctx.buf);
+
+    // the read is done after the write, which is submitted before it
+    memset (buf, 7, sizeof (buf));
+    store_ctx.success = FALSE;
+    test_ctx.success = FALSE;
+    cache_mng_store_file_buf (acmng, 1, 50, 20, buf, store_cb, &store_ctx);
+    cache_mng_retrieve_file_buf (acmng, 1, 50, 20, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (store_ctx.success);
+    g_assert (test_ctx.success);
+    g_assert (memcmp (test_ctx.buf, buf, 50) == 0);
+    g_free (test_ctx.buf);
+
+    // the block is copied to memory, though the reads don't contain all of its data
+    g_assert (cache_mng_read_mem (acmng, 1, 64, 0, out));
+    g_assert (memcmp (out + 20, buf, 44) == 0);
+
+    // descriptor is returned when the stored data is written
+    store_ctx.success = FALSE;
+    cache_mng_store_file_buf (acmng, 1, 10, 200, buf, store_cb, &store_ctx);
+    g_assert (cache_mng_get_file_fd (acmng, 1, 10, 200) < 0);
+    fd = -1;
+    cache_mng_get_file_fd_async (acmng, 1, 10, 200, file_fd_cb, &fd);
+    app_dispatch (app);
+    g_assert (store_ctx.success);
+    g_assert (fd >= 0);
+    g_assert (pread (fd, out, 10, 200) == 10);
+    g_assert (memcmp (out, buf, 10) == 0);
+    close (fd);
+
+    // the block is read by a worker before it's copied to memory
+    fd = cache_mng_get_file_fd (acmng, 1, 10, 200);
+    g_assert (fd >= 0);
+    close (fd);
+    g_assert (!cache_mng_read_mem (acmng, 1, 64, 192, out));
+    app_dispatch (app);
+    g_assert (cache_mng_read_mem (acmng, 1, 64, 192, out));
+    g_assert (memcmp (out + 8, buf, 10) == 0);
+
+    // the range isn't cached
+    fd = 0;
+    cache_mng_get_file_fd_async (acmng, 1, 10, 300, file_fd_cb, &fd);
+    app_dispatch (app);
+    g_assert (fd < 0);
+
+    cache_mng_destroy (acmng);
+}
+
+static void cache_mng_test_fds (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    unsigned char buf[10];
+    int i;
+    int fd;
+
+    // more files than descriptors are kept open
+    for (i = 1; i <= 1100; i++) {
+        memset (buf, i % 256, sizeof (buf));
+        cache_mng_store_file_buf (*cmng, i, sizeof (buf), 0, buf, store_cb, &test_ctx);
+        app_dispatch (app);
+        g_assert (test_ctx.success);
+    }
+
+    for (i = 1; i <= 1100; i++) {
+        memset (buf, i % 256, sizeof (buf));
+        cache_mng_retrieve_file_buf (*cmng, i, sizeof (buf), 0, retrieve_cb, &test_ctx);
+        app_dispatch (app);
+        g_assert (test_ctx.success);
+        g_assert (memcmp (test_ctx.buf, buf, sizeof (buf)) == 0);
+        g_free (test_ctx.buf);
+    }
+
+    // descriptor of the removed file is closed
+    fd = cache_mng_get_file_fd (*cmng, 1100, sizeof (buf), 0);
+    g_assert (fd >= 0);
+    close (fd);
+    cache_mng_remove_file (*cmng, 1100);
+    g_assert (cache_mng_get_file_fd (*cmng, 1100, sizeof (buf), 0) < 0);
+
+    memset (buf, 1, sizeof (buf));
+    cache_mng_store_file_buf (*cmng, 1100, 5, 0, buf, store_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    cache_mng_retrieve_file_buf (*cmng, 1100, 5, 0, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+    g_assert (test_ctx.success);
+    g_assert (memcmp (test_ctx.buf, buf, 5) == 0);
+    g_free (test_ctx.buf);
+    g_assert (!cache_mng_file_contains (*cmng, 1100, 10, 0));
+}
+
 int main (int argc, char *argv[])
 {
     app = app_create ();
@@ -161,8 +708,20 @@ int main (int argc, char *argv[])
 
     g_test_add ("/cache_mng/cache_mng_test_store", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_store, cache_mng_test_destroy);
     g_test_add ("/cache_mng/cache_mng_test_remove", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_remove, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_rename", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_rename, cache_mng_test_destroy);
     g_test_add ("/cache_mng/cache_mng_test_lru", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_lru, cache_mng_test_destroy);
     g_test_add ("/cache_mng/cache_mng_test_zero_size", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_zero_size, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_contains", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_contains, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_fetch", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_fetch, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_fetch_overlap", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_fetch_overlap, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_fetch_progress", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_fetch_progress, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_fd", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_fd, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_blocks", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_blocks, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_stage", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_stage, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_mem", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_mem, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_persistent", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_persistent, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_async", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_async, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_fds", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_fds, cache_mng_test_destroy);
 
     return g_test_run ();
 }
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "mem_budget.h"
+#include "test_application.h"
+
+static Application *app;
+
+static void mem_budget_test_setup (MemBudget **mb, gconstpointer test_data)
+{
+    conf_set_uint (application_get_conf (app), "filesystem.memory_max_size", 100);
+    *mb = mem_budget_create (app);
+}
+
+static void mem_budget_test_destroy (MemBudget **mb, gconstpointer test_data)
+{
+    mem_budget_destroy (*mb);
+}
+
+static void reserved_cb (gpointer ctx)
+{
+    gint *calls = (gint *) ctx;
+
+    (*calls)++;
+}
+
+static void mem_budget_test_reserve (MemBudget **mb, gconstpointer test_data)
+{
+    gint calls = 0;
+    guint64 used, max_size, peak, deferred;
+    guint32 waiting;
+
+    g_assert (mem_budget_reserve (*mb, 60, reserved_cb, &calls));
+    g_assert (!mem_budget_reserve (*mb, 60, reserved_cb, &calls));
+    // waiters are served in order, even if the budget has room
+    g_assert (!mem_budget_reserve (*mb, 10, reserved_cb, &calls));
+
+    mem_budget_get_stats (*mb, &used, &max_size, &peak, &waiting, &deferred);
+    g_assert_cmpuint (used, ==, 60);
+    g_assert_cmpuint (max_size, ==, 100);
+    g_assert_cmpuint (waiting, ==, 2);
+    g_assert_cmpuint (deferred, ==, 2);
+
+    // waiters are resumed from the event loop
+    mem_budget_release (*mb, 60);
+    g_assert_cmpint (calls, ==, 0);
+    app_dispatch (app);
+    g_assert_cmpint (calls, ==, 2);
+
+    mem_budget_get_stats (*mb, &used, &max_size, &peak, &waiting, &deferred);
+    g_assert_cmpuint (used, ==, 70);
+    g_assert_cmpuint (peak, ==, 70);
+    g_assert_cmpuint (waiting, ==, 0);
+}
+
+static void mem_budget_test_add (MemBudget **mb, gconstpointer test_data)
+{
+    gint calls = 0;
+    guint64 used, max_size, peak, deferred;
+    guint32 waiting;
+
+    // allocated memory is accounted even if it exceeds the budget
+    mem_budget_add (*mb, 150);
+    g_assert (!mem_budget_reserve (*mb, 0, reserved_cb, &calls));
+
+    mem_budget_release (*mb, 40);
+    app_dispatch (app);
+    g_assert_cmpint (calls, ==, 0);
+
+    mem_budget_release (*mb, 10);
+    app_dispatch (app);
+    g_assert_cmpint (calls, ==, 1);
+
+    // request larger than the budget is granted when nothing else is used
+    mem_budget_release (*mb, 100);
+    g_assert (mem_budget_reserve (*mb, 200, reserved_cb, &calls));
+
+    mem_budget_get_stats (*mb, &used, &max_size, &peak, &waiting, &deferred);
+    g_assert_cmpuint (used, ==, 200);
+    g_assert_cmpuint (peak, ==, 200);
+    g_assert_cmpuint (deferred, ==, 1);
+}
+
+int main (int argc, char *argv[])
+{
+    app = app_create ();
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/mem_budget/mem_budget_test_reserve", MemBudget *, 0, mem_budget_test_setup, mem_budget_test_reserve, mem_budget_test_destroy);
+    g_test_add ("/mem_budget/mem_budget_test_add", MemBudget *, 0, mem_budget_test_setup, mem_budget_test_add, mem_budget_test_destroy);
+
+    return g_test_run ();
+}
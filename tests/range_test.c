@@ -103,6 +103,91 @@ static void range_test_remove_3 (Range **range, gconstpointer test_data)
     g_assert (range_count (*range) == 3);
 }
 
+static void range_test_remove_4 (Range **range, gconstpointer test_data)
+{
+    range_add (*range, 0, 100);
+    range_add (*range, 200, 300);
+
+    // split
+    range_remove (*range, 10, 20);
+    g_assert (range_count (*range) == 3);
+    g_assert (range_contain (*range, 0, 10) == TRUE);
+    g_assert (range_intersect (*range, 10, 20) == FALSE);
+    g_assert (range_contain (*range, 20, 100) == TRUE);
+
+    // cut both intervals, remove the one in the middle
+    range_remove (*range, 50, 250);
+    g_assert (range_count (*range) == 3);
+    g_assert (range_intersect (*range, 50, 250) == FALSE);
+    g_assert (range_contain (*range, 250, 300) == TRUE);
+    g_assert (range_length (*range) == 10 + 30 + 50);
+
+    range_remove (*range, 0, 300);
+    g_assert (range_count (*range) == 0);
+}
+
+static void range_test_intersect (Range **range, gconstpointer test_data)
+{
+    range_add (*range, 10, 20);
+    range_add (*range, 30, 40);
+
+    g_assert (range_intersect (*range, 0, 10) == FALSE);
+    g_assert (range_intersect (*range, 0, 11) == TRUE);
+    g_assert (range_intersect (*range, 20, 30) == FALSE);
+    g_assert (range_intersect (*range, 15, 35) == TRUE);
+    g_assert (range_intersect (*range, 39, 100) == TRUE);
+    g_assert (range_intersect (*range, 40, 100) == FALSE);
+}
+
+static void gap_cb (guint64 start, guint64 end, gpointer ctx)
+{
+    GString *str = (GString *) ctx;
+
+    g_string_append_printf (str, "[%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]", start, end);
+}
+
+static void range_test_foreach_gap (Range **range, gconstpointer test_data)
+{
+    GString *str;
+
+    str = g_string_new (NULL);
+    range_foreach_gap (*range, 0, 10, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "[0 10]");
+
+    range_add (*range, 10, 20);
+    range_add (*range, 30, 40);
+
+    g_string_truncate (str, 0);
+    range_foreach_gap (*range, 0, 50, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "[0 10][20 30][40 50]");
+
+    g_string_truncate (str, 0);
+    range_foreach_gap (*range, 15, 35, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "[20 30]");
+
+    g_string_truncate (str, 0);
+    range_foreach_gap (*range, 12, 18, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "");
+
+    g_string_free (str, TRUE);
+}
+
+static void range_test_foreach (Range **range, gconstpointer test_data)
+{
+    GString *str;
+
+    str = g_string_new (NULL);
+    range_foreach (*range, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "");
+
+    range_add (*range, 30, 40);
+    range_add (*range, 10, 20);
+
+    range_foreach (*range, gap_cb, str);
+    g_assert_cmpstr (str->str, ==, "[10 20][30 40]");
+
+    g_string_free (str, TRUE);
+}
 
 int main (int argc, char *argv[])
 {
@@ -114,6 +199,10 @@ int main (int argc, char *argv[])
     g_test_add ("/range/range_test_add", Range *, 0, range_test_setup, range_test_remove_1, range_test_destroy);
     g_test_add ("/range/range_test_add", Range *, 0, range_test_setup, range_test_remove_2, range_test_destroy);
     g_test_add ("/range/range_test_add", Range *, 0, range_test_setup, range_test_remove_3, range_test_destroy);
+    g_test_add ("/range/range_test_remove", Range *, 0, range_test_setup, range_test_remove_4, range_test_destroy);
+    g_test_add ("/range/range_test_intersect", Range *, 0, range_test_setup, range_test_intersect, range_test_destroy);
+    g_test_add ("/range/range_test_foreach_gap", Range *, 0, range_test_setup, range_test_foreach_gap, range_test_destroy);
+    g_test_add ("/range/range_test_foreach", Range *, 0, range_test_setup, range_test_foreach, range_test_destroy);
 
     return g_test_run ();
 }
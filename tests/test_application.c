@@ -16,6 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #include "test_application.h"
+#include "mem_budget.h"
 
 struct event_base *application_get_evbase (Application *app)
 {
@@ -42,6 +43,11 @@ StatSrv *application_get_stat_srv (Application *app)
     return NULL;
 }
 
+MemBudget *application_get_mem_budget (Application *app)
+{
+    return app->mem_budget;
+}
+
 void stats_srv_add_op_history (StatSrv *stat_srv, const gchar *str)
 {
 }
@@ -63,6 +69,11 @@ Application *app_create ()
     conf_set_boolean (app->conf, "filesystem.cache_enabled", TRUE);
     conf_set_string (app->conf, "filesystem.cache_dir", "/tmp/s3ffs");
     conf_set_string (app->conf, "filesystem.cache_dir_max_size", "1Gb");
+    conf_set_boolean (app->conf, "filesystem.cache_persistent", FALSE);
+    conf_set_uint (app->conf, "filesystem.cache_memory_max_size", 0);
+    conf_set_uint (app->conf, "filesystem.cache_io_threads", 0);
+    conf_set_uint (app->conf, "filesystem.memory_max_size", 0);
+    app->mem_budget = mem_budget_create (app);
 
     return app;
 }
@@ -79,5 +90,6 @@ void app_dispatch(Application *app)
 
 void app_destroy (Application *app)
 {
+    mem_budget_destroy (app->mem_budget);
     g_free (app);
 }